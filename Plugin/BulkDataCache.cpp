@@ -0,0 +1,293 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#include "BulkDataCache.h"
+
+#include <cassert>
+
+
+static const size_t DEFAULT_MAX_INDEX_SIZE = 16 * 1024 * 1024;
+
+
+static size_t EstimateLocationSize(const std::string& path,
+                                   const OrthancPlugins::DicomHeaderScanner::ElementLocation& location)
+{
+  return (path.size() + sizeof(OrthancPlugins::DicomHeaderScanner::ElementLocation) +
+          location.fragments_.size() * sizeof(OrthancPlugins::DicomHeaderScanner::ElementLocation::Fragments::value_type));
+}
+
+
+namespace OrthancPlugins
+{
+  BulkDataCache::BulkDataCache() :
+    currentSize_(0),
+    maxSize_(0),
+    indexSize_(0),
+    maxIndexSize_(DEFAULT_MAX_INDEX_SIZE),
+    hits_(0),
+    misses_(0)
+  {
+  }
+
+
+  BulkDataCache& BulkDataCache::GetInstance()
+  {
+    static BulkDataCache singleton;
+    return singleton;
+  }
+
+
+  void BulkDataCache::RemoveEntry(Content::iterator entry)
+  {
+    assert(entry != content_.end());
+    assert(entry->second.file_.get() != NULL);
+    assert(currentSize_ >= entry->second.file_->size());
+
+    currentSize_ -= entry->second.file_->size();
+    recency_.erase(entry->second.recency_);
+    content_.erase(entry);
+  }
+
+
+  void BulkDataCache::MakeRoom()
+  {
+    while (!recency_.empty() &&
+           currentSize_ > maxSize_)
+    {
+      RemoveEntry(content_.find(recency_.back()));
+    }
+  }
+
+
+  void BulkDataCache::RemoveIndexEntry(Index::iterator entry)
+  {
+    assert(entry != index_.end());
+    assert(indexSize_ >= entry->second.size_);
+
+    indexSize_ -= entry->second.size_;
+    indexRecency_.erase(entry->second.recency_);
+    index_.erase(entry);
+  }
+
+
+  void BulkDataCache::MakeIndexRoom()
+  {
+    while (!indexRecency_.empty() &&
+           indexSize_ > maxIndexSize_)
+    {
+      RemoveIndexEntry(index_.find(indexRecency_.back()));
+    }
+  }
+
+
+  void BulkDataCache::SetMaxSize(size_t maxSize)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    maxSize_ = maxSize;
+    MakeRoom();
+  }
+
+
+  void BulkDataCache::SetMaxIndexSize(size_t maxSize)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    maxIndexSize_ = maxSize;
+    MakeIndexRoom();
+  }
+
+
+  BulkDataCache::FilePtr BulkDataCache::LookupFile(const std::string& instanceId)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    Content::iterator found = content_.find(instanceId);
+
+    if (found == content_.end())
+    {
+      misses_++;
+      return FilePtr();
+    }
+    else
+    {
+      hits_++;
+      recency_.splice(recency_.begin(), recency_, found->second.recency_);
+      return found->second.file_;
+    }
+  }
+
+
+  void BulkDataCache::StoreFile(const std::string& instanceId,
+                                const FilePtr& file)
+  {
+    if (file.get() == NULL)
+    {
+      return;
+    }
+
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (file->size() <= maxSize_)
+    {
+      Content::iterator found = content_.find(instanceId);
+      if (found != content_.end())
+      {
+        RemoveEntry(found);
+      }
+
+      Entry& entry = content_[instanceId];
+      entry.file_ = file;
+      entry.recency_ = recency_.insert(recency_.begin(), instanceId);
+      currentSize_ += file->size();
+
+      MakeRoom();
+    }
+  }
+
+
+  bool BulkDataCache::LookupLocation(DicomHeaderScanner::ElementLocation& location,
+                                     const std::string& instanceId,
+                                     const std::string& path)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    Index::iterator found = index_.find(instanceId);
+    if (found != index_.end())
+    {
+      Locations::const_iterator it = found->second.locations_.find(path);
+      if (it != found->second.locations_.end())
+      {
+        indexRecency_.splice(indexRecency_.begin(), indexRecency_, found->second.recency_);
+        location = it->second;
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+
+  void BulkDataCache::StoreLocation(const std::string& instanceId,
+                                    const std::string& path,
+                                    const DicomHeaderScanner::ElementLocation& location)
+  {
+    const size_t size = EstimateLocationSize(path, location);
+
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (size > maxIndexSize_)
+    {
+      return;
+    }
+
+    Index::iterator found = index_.find(instanceId);
+
+    if (found == index_.end())
+    {
+      IndexEntry& entry = index_[instanceId];
+      entry.size_ = 0;
+      entry.recency_ = indexRecency_.insert(indexRecency_.begin(), instanceId);
+      found = index_.find(instanceId);
+    }
+    else
+    {
+      indexRecency_.splice(indexRecency_.begin(), indexRecency_, found->second.recency_);
+
+      Locations::iterator previous = found->second.locations_.find(path);
+      if (previous != found->second.locations_.end())
+      {
+        const size_t previousSize = EstimateLocationSize(path, previous->second);
+        assert(found->second.size_ >= previousSize &&
+               indexSize_ >= previousSize);
+        found->second.size_ -= previousSize;
+        indexSize_ -= previousSize;
+      }
+    }
+
+    found->second.locations_[path] = location;
+    found->second.size_ += size;
+    indexSize_ += size;
+
+    MakeIndexRoom();
+  }
+
+
+  void BulkDataCache::Invalidate(const std::string& instanceId)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    Content::iterator found = content_.find(instanceId);
+    if (found != content_.end())
+    {
+      RemoveEntry(found);
+    }
+
+    Index::iterator indexed = index_.find(instanceId);
+    if (indexed != index_.end())
+    {
+      RemoveIndexEntry(indexed);
+    }
+  }
+
+
+  void BulkDataCache::Clear()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    content_.clear();
+    recency_.clear();
+    currentSize_ = 0;
+    index_.clear();
+    indexRecency_.clear();
+    indexSize_ = 0;
+  }
+
+
+  size_t BulkDataCache::GetSize()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return content_.size();
+  }
+
+
+  size_t BulkDataCache::GetMemoryUsage()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return currentSize_;
+  }
+
+
+  size_t BulkDataCache::GetIndexMemoryUsage()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return indexSize_;
+  }
+
+
+  void BulkDataCache::GetStatistics(uint64_t& hits,
+                                    uint64_t& misses)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    hits = hits_;
+    misses = misses_;
+  }
+}
@@ -0,0 +1,137 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#pragma once
+
+#include "DicomHeaderScanner.h"
+
+#include <list>
+#include <map>
+#include <string>
+#include <stdint.h>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+
+namespace OrthancPlugins
+{
+  // Memory-bounded LRU cache of the DICOM files that are accessed by
+  // WADO-RS RetrieveBulkData, together with the index of the location
+  // of the bulk data elements that have already been requested in
+  // each file.  Viewers request the bulk data of the same instance
+  // over and over (e.g. slices of a large array through "Range"
+  // requests): once cached, such a request is answered by copying a
+  // slice of the stored file, without any call to the Orthanc core.
+  // The index has its own LRU and budget, so that the files that are
+  // too large for the cache need not be scanned again.
+  class BulkDataCache : public boost::noncopyable
+  {
+  public:
+    typedef boost::shared_ptr<const std::string>  FilePtr;
+
+  private:
+    typedef std::list<std::string>  Recency;  // Most recently used first
+
+    // Indexed by the path to the element, as found in the bulk data URI
+    typedef std::map<std::string, DicomHeaderScanner::ElementLocation>  Locations;
+
+    struct Entry
+    {
+      FilePtr            file_;
+      Recency::iterator  recency_;
+    };
+
+    struct IndexEntry
+    {
+      Locations          locations_;
+      size_t             size_;  // Estimated memory usage of "locations_"
+      Recency::iterator  recency_;
+    };
+
+    typedef std::map<std::string, Entry>       Content;
+    typedef std::map<std::string, IndexEntry>  Index;
+
+    boost::mutex  mutex_;
+    Content       content_;
+    Recency       recency_;
+    size_t        currentSize_;
+    size_t        maxSize_;  // In bytes, 0 means the cache is disabled
+    Index         index_;
+    Recency       indexRecency_;
+    size_t        indexSize_;
+    size_t        maxIndexSize_;  // In bytes, 0 means the index is disabled
+    uint64_t      hits_;
+    uint64_t      misses_;
+
+    // The mutex must be locked
+    void RemoveEntry(Content::iterator entry);
+
+    // The mutex must be locked
+    void MakeRoom();
+
+    // The mutex must be locked
+    void RemoveIndexEntry(Index::iterator entry);
+
+    // The mutex must be locked
+    void MakeIndexRoom();
+
+  public:
+    BulkDataCache();
+
+    static BulkDataCache& GetInstance();
+
+    void SetMaxSize(size_t maxSize);
+
+    void SetMaxIndexSize(size_t maxSize);
+
+    // Returns NULL if the file of the instance is not in the cache
+    FilePtr LookupFile(const std::string& instanceId);
+
+    // The file is not stored if it is larger than the cache
+    void StoreFile(const std::string& instanceId,
+                   const FilePtr& file);
+
+    bool LookupLocation(DicomHeaderScanner::ElementLocation& location,
+                        const std::string& instanceId,
+                        const std::string& path);
+
+    // Independent of the presence of the file in the cache
+    void StoreLocation(const std::string& instanceId,
+                       const std::string& path,
+                       const DicomHeaderScanner::ElementLocation& location);
+
+    void Invalidate(const std::string& instanceId);
+
+    void Clear();
+
+    size_t GetSize();
+
+    size_t GetMemoryUsage();
+
+    size_t GetIndexMemoryUsage();
+
+    void GetStatistics(uint64_t& hits,
+                       uint64_t& misses);
+  };
+}
@@ -0,0 +1,274 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#include "CacheWarmer.h"
+
+#include "WorkersPool.h"
+#include "../Resources/Orthanc/Plugins/OrthancPluginCppWrapper.h"
+
+#include <Logging.h>
+#include <OrthancException.h>
+
+#include <boost/lexical_cast.hpp>
+
+
+namespace OrthancPlugins
+{
+  void CacheWarmer::Worker(CacheWarmer* that,
+                           std::string name)
+  {
+    Orthanc::Logging::ScopedThreadNameSetter setter(name);
+
+    std::string studyOrthancId;
+
+    while (that->WaitForIdleWorkers() &&
+           that->DequeueStudy(studyOrthancId))
+    {
+      that->Execute(studyOrthancId);
+    }
+  }
+
+
+  bool CacheWarmer::WaitForIdleWorkers()
+  {
+    for (;;)
+    {
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+        if (stopping_)
+        {
+          return false;
+        }
+      }
+
+      size_t queued, active;
+      WorkersPool::GetInstance().GetStatistics(queued, active);
+
+      if (queued == 0)
+      {
+        return true;
+      }
+
+      boost::this_thread::sleep(boost::posix_time::milliseconds(100));
+    }
+  }
+
+
+  bool CacheWarmer::DequeueStudy(std::string& studyOrthancId)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    while (queue_.empty() &&
+           !stopping_)
+    {
+      studyAvailable_.wait(lock);
+    }
+
+    if (stopping_)
+    {
+      return false;
+    }
+
+    studyOrthancId = queue_.front();
+    queue_.pop_front();
+    queued_.erase(studyOrthancId);
+    running_++;
+
+    return true;
+  }
+
+
+  void CacheWarmer::Execute(const std::string& studyOrthancId)
+  {
+    bool success = false;
+
+    try
+    {
+      function_(studyOrthancId);
+      success = true;
+    }
+    catch (Orthanc::OrthancException& e)
+    {
+      LOG(WARNING) << "DicomWEB: cannot warm up the caches of study " << studyOrthancId << ": " << e.What();
+    }
+    catch (...)
+    {
+      LOG(WARNING) << "DicomWEB: native exception while warming up the caches of study " << studyOrthancId;
+    }
+
+    boost::mutex::scoped_lock lock(mutex_);
+    running_--;
+
+    if (success)
+    {
+      warmed_++;
+    }
+    else
+    {
+      failed_++;
+    }
+  }
+
+
+  CacheWarmer::CacheWarmer() :
+    maxQueueSize_(1000),
+    running_(0),
+    stopping_(false),
+    warmed_(0),
+    dropped_(0),
+    failed_(0),
+    function_(NULL)
+  {
+  }
+
+
+  CacheWarmer::~CacheWarmer()
+  {
+    Stop();
+  }
+
+
+  CacheWarmer& CacheWarmer::GetInstance()
+  {
+    static CacheWarmer singleton;
+    return singleton;
+  }
+
+
+  void CacheWarmer::SetMaxQueueSize(size_t size)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    maxQueueSize_ = size;
+  }
+
+
+  void CacheWarmer::Start(unsigned int threadsCount,
+                          WarmFunction function)
+  {
+    if (function == NULL)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_NullPointer);
+    }
+
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (!threads_.empty())
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+    }
+
+    stopping_ = false;
+    function_ = function;
+
+    for (unsigned int i = 0; i < threadsCount; i++)
+    {
+      threads_.push_back(boost::shared_ptr<boost::thread>(
+                           new boost::thread(Worker, this, "DW-WARMUP-" + boost::lexical_cast<std::string>(i))));
+    }
+  }
+
+
+  void CacheWarmer::Stop()
+  {
+    std::vector<boost::shared_ptr<boost::thread> > threads;
+
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      stopping_ = true;
+      threads.swap(threads_);
+      studyAvailable_.notify_all();
+    }
+
+    for (size_t i = 0; i < threads.size(); i++)
+    {
+      if (threads[i]->joinable())
+      {
+        threads[i]->join();
+      }
+    }
+
+    boost::mutex::scoped_lock lock(mutex_);
+    queue_.clear();
+    queued_.clear();
+  }
+
+
+  bool CacheWarmer::IsStarted()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return !threads_.empty();
+  }
+
+
+  bool CacheWarmer::Enqueue(const std::string& studyOrthancId)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (queued_.find(studyOrthancId) != queued_.end())
+    {
+      return true;
+    }
+    else if (queue_.size() >= maxQueueSize_)
+    {
+      dropped_++;
+      return false;
+    }
+    else
+    {
+      queue_.push_back(studyOrthancId);
+      queued_.insert(studyOrthancId);
+      studyAvailable_.notify_one();
+      return true;
+    }
+  }
+
+
+  void CacheWarmer::GetStatistics(size_t& queued,
+                                  size_t& running,
+                                  uint64_t& warmed,
+                                  uint64_t& dropped,
+                                  uint64_t& failed)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    queued = queue_.size();
+    running = running_;
+    warmed = warmed_;
+    dropped = dropped_;
+    failed = failed_;
+  }
+
+
+  void CacheWarmer::RefreshMetrics()
+  {
+    size_t queued, running;
+    uint64_t warmed, dropped, failed;
+    GetStatistics(queued, running, warmed, dropped, failed);
+
+    OrthancPlugins::SetMetricsValue("orthanc_dicomweb_warmup_queue_depth", static_cast<int64_t>(queued));
+    OrthancPlugins::SetMetricsValue("orthanc_dicomweb_warmup_running", static_cast<int64_t>(running));
+    OrthancPlugins::SetMetricsValue("orthanc_dicomweb_warmup_warmed_studies", static_cast<int64_t>(warmed));
+    OrthancPlugins::SetMetricsValue("orthanc_dicomweb_warmup_dropped_studies", static_cast<int64_t>(dropped));
+    OrthancPlugins::SetMetricsValue("orthanc_dicomweb_warmup_failed_studies", static_cast<int64_t>(failed));
+  }
+}
@@ -0,0 +1,104 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#pragma once
+
+#include <deque>
+#include <set>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+
+namespace OrthancPlugins
+{
+  // Background warm-up of the caches of the studies (series metadata
+  // and thumbnails), e.g. after a bulk import.  The studies
+  // are queued in a bounded queue, and are processed by dedicated
+  // threads that give way to the live requests: A study is only
+  // started if no task is waiting for the shared pool of workers.
+  class CacheWarmer : public boost::noncopyable
+  {
+  public:
+    typedef void (*WarmFunction) (const std::string& studyOrthancId);
+
+  private:
+    boost::mutex                                     mutex_;
+    boost::condition_variable                        studyAvailable_;
+    std::deque<std::string>                          queue_;
+    std::set<std::string>                            queued_;   // Same content as "queue_", to skip duplicates
+    size_t                                           maxQueueSize_;
+    size_t                                           running_;
+    bool                                             stopping_;
+    uint64_t                                         warmed_;
+    uint64_t                                         dropped_;
+    uint64_t                                         failed_;
+    WarmFunction                                     function_;
+    std::vector<boost::shared_ptr<boost::thread> >   threads_;
+
+    static void Worker(CacheWarmer* that,
+                       std::string name);
+
+    // Waits while the live requests have tasks waiting for the
+    // workers.  Returns "false" if the warmer is stopping.
+    bool WaitForIdleWorkers();
+
+    bool DequeueStudy(std::string& studyOrthancId);
+
+    void Execute(const std::string& studyOrthancId);
+
+  public:
+    CacheWarmer();
+
+    ~CacheWarmer();
+
+    static CacheWarmer& GetInstance();
+
+    void SetMaxQueueSize(size_t size);
+
+    void Start(unsigned int threadsCount,
+               WarmFunction function);
+
+    // The studies that are still queued are discarded
+    void Stop();
+
+    bool IsStarted();
+
+    // Returns "false" if the study is dropped because the queue is
+    // full.  A study that is already queued is not queued twice.
+    bool Enqueue(const std::string& studyOrthancId);
+
+    void GetStatistics(size_t& queued,
+                       size_t& running,
+                       uint64_t& warmed,
+                       uint64_t& dropped,
+                       uint64_t& failed);
+
+    void RefreshMetrics();
+  };
+}
@@ -33,6 +33,7 @@
 
 #include <fstream>
 #include <boost/regex.hpp>
+#include <boost/thread.hpp>
 #include <boost/lexical_cast.hpp>
 #include <boost/algorithm/string/predicate.hpp>
 
@@ -677,6 +678,13 @@ namespace OrthancPlugins
       }
     }
 
+    size_t GetMetadataBinaryThreshold()
+    {
+      // The option is expressed in KB
+      return static_cast<size_t>(GetUnsignedIntegerValue("MetadataBinaryThreshold", 0)) * 1024;
+    }
+
+
     unsigned int GetMetadataWorkerThreadsCount()
     {
       return GetUnsignedIntegerValue("MetadataWorkerThreadsCount", 4);
@@ -697,11 +705,176 @@ namespace OrthancPlugins
       return GetUnsignedIntegerValue("WadoRsLoaderThreadsCount", 0);
     }
 
+    unsigned int GetWadoRsReadAheadMaxInstances()
+    {
+      return GetUnsignedIntegerValue("WadoRsReadAheadMaxInstances", 0);
+    }
+
+    unsigned int GetWadoRsReadAheadMaxSize()
+    {
+      return GetUnsignedIntegerValue("WadoRsReadAheadMaxSize", 256);
+    }
+
+    bool IsWadoRsZipCompression()
+    {
+      return GetBooleanValue("WadoRsZipCompression", false);
+    }
+
+    unsigned int GetWadoRsZipSpillThreshold()
+    {
+      return GetUnsignedIntegerValue("WadoRsZipSpillThreshold", 64);
+    }
+
+    unsigned int GetWorkerThreadsCount()
+    {
+      unsigned int count = GetUnsignedIntegerValue("WorkerThreadsCount", 0);
+
+      if (count == 0)
+      {
+        // By default, one worker per CPU core, but enough workers to
+        // serve one request with the configured parallelism
+        count = std::max(boost::thread::hardware_concurrency(),
+                         std::max(GetMetadataWorkerThreadsCount(),
+                                  std::max(GetWadoRsLoaderThreadsCount(),
+                                           std::max(GetStowRsThreadsCount(), GetRetrieveStoreThreadsCount()))));
+      }
+
+      return count;
+    }
+
+    unsigned int GetStowRsThreadsCount()
+    {
+      return GetUnsignedIntegerValue("StowRsThreadsCount", 1);
+    }
+
+    unsigned int GetStowRsMaxInFlightSize()
+    {
+      return GetUnsignedIntegerValue("StowRsMaxInFlightSize", 256);
+    }
+
+    unsigned int GetStowRsSpillThreshold()
+    {
+      return GetUnsignedIntegerValue("StowRsSpillThreshold", 0);
+    }
+
+    unsigned int GetRetrieveStoreThreadsCount()
+    {
+      return GetUnsignedIntegerValue("RetrieveStoreThreadsCount", 1);
+    }
+
+    unsigned int GetRetrieveMaxInFlightSize()
+    {
+      return GetUnsignedIntegerValue("RetrieveMaxInFlightSize", 256);
+    }
+
     bool IsPerformanceLogsEnabled()
     {
       return GetBooleanValue("EnablePerformanceLogs", false);
     }
 
+    unsigned int GetRetrieveFramesCacheSize()
+    {
+      // Disabled by default, not to increase the resident memory of
+      // Orthanc after an upgrade
+      return GetUnsignedIntegerValue("RetrieveFramesCacheSize", 0);
+    }
+
+    unsigned int GetRetrieveFramesCacheMaxInstances()
+    {
+      return GetUnsignedIntegerValue("RetrieveFramesCacheMaxInstances", 32);
+    }
+
+    unsigned int GetRetrieveFramesCoalescingWindow()
+    {
+      return GetUnsignedIntegerValue("RetrieveFramesCoalescingWindow", 1000);
+    }
+
+    unsigned int GetRenderedCacheSize()
+    {
+      // Disabled by default, not to increase the resident memory of
+      // Orthanc after an upgrade
+      return GetUnsignedIntegerValue("RenderedCacheSize", 0);
+    }
+
+    bool IsRenderedCachePersistent()
+    {
+      return GetBooleanValue("RenderedCachePersistent", false);
+    }
+
+    bool IsRenderedCachePregenerate()
+    {
+      return GetBooleanValue("RenderedCachePregenerate", false);
+    }
+
+    bool IsWadoUriStudyAndSeriesRequired()
+    {
+      return GetBooleanValue("WadoUriRequireStudyAndSeries", false);
+    }
+
+    unsigned int GetBulkDataCacheSize()
+    {
+      // Disabled by default, as this cache keeps whole DICOM files (the
+      // offsets of the elements have their own, smaller index)
+      return GetUnsignedIntegerValue("BulkDataCacheSize", 0);
+    }
+
+    bool IsBulkDataRangeAvailable()
+    {
+      // The partial content is sent by "OrthancPluginSendHttpStatus()",
+      // whose body is dropped by the Orthanc core if "HttpDescribeErrors"
+      // is disabled (same limitation as the STOW-RS answers with 202)
+      return globalConfiguration_->GetBooleanValue("HttpDescribeErrors", true);
+    }
+
+    unsigned int GetResourceLookupCacheTTL()
+    {
+      // Disabled by default, as the cached lookups are not submitted
+      // again to the authorization plugin until they expire.  The
+      // cache is forced off if the authorization plugin is loaded.
+      return GetUnsignedIntegerValue("ResourceLookupCacheTTL", 0);
+    }
+
+    unsigned int GetResourceLookupCacheSize()
+    {
+      return GetUnsignedIntegerValue("ResourceLookupCacheSize", 10000);
+    }
+
+    unsigned int GetQidoPageSize()
+    {
+      return GetUnsignedIntegerValue("QidoPageSize", 1000);
+    }
+
+    unsigned int GetQidoCacheSize()
+    {
+      return GetUnsignedIntegerValue("QidoCacheSize", 0);
+    }
+
+    unsigned int GetQidoCacheMaxStaleness()
+    {
+      return GetUnsignedIntegerValue("QidoCacheMaxStaleness", 10);
+    }
+
+    unsigned int GetCacheWarmingThreadsCount()
+    {
+      return GetUnsignedIntegerValue("CacheWarmingThreadsCount", 0);
+    }
+
+    unsigned int GetCacheWarmingQueueSize()
+    {
+      return GetUnsignedIntegerValue("CacheWarmingQueueSize", 1000);
+    }
+
+    unsigned int GetCacheWarmingStartupDays()
+    {
+      return GetUnsignedIntegerValue("CacheWarmingStartupDays", 0);
+    }
+
+    unsigned int GetLimitFindResults()
+    {
+      // This is an option of the Orthanc core, not of the DICOMweb plugin
+      return globalConfiguration_->GetUnsignedIntegerValue("LimitFindResults", 0);
+    }
+
     MetadataMode GetMetadataMode(Orthanc::ResourceType level)
     {
       static const std::string FULL = "Full";
@@ -141,12 +141,71 @@ namespace OrthancPlugins
 
     unsigned int GetMetadataWorkerThreadsCount();
 
+    size_t GetMetadataBinaryThreshold();  // In bytes, 0 if disabled
+
     unsigned int GetWadoRsLoaderThreadsCount();
 
+    unsigned int GetWadoRsReadAheadMaxInstances();
+
+    unsigned int GetWadoRsReadAheadMaxSize();  // In MB
+
+    bool IsWadoRsZipCompression();
+
+    unsigned int GetWadoRsZipSpillThreshold();  // In MB
+
+    unsigned int GetWorkerThreadsCount();
+
+    unsigned int GetStowRsThreadsCount();
+
+    unsigned int GetStowRsMaxInFlightSize();  // In MB
+
+    unsigned int GetStowRsSpillThreshold();  // In MB
+
+    unsigned int GetRetrieveStoreThreadsCount();
+
+    unsigned int GetRetrieveMaxInFlightSize();  // In MB
+
     bool IsMetadataCacheEnabled();
 
     bool IsReadOnly();
 
     bool IsPerformanceLogsEnabled();
+
+    unsigned int GetRetrieveFramesCacheSize();  // In MB
+
+    unsigned int GetRetrieveFramesCacheMaxInstances();
+
+    unsigned int GetRetrieveFramesCoalescingWindow();  // In milliseconds
+
+    unsigned int GetRenderedCacheSize();  // In MB
+
+    bool IsRenderedCachePersistent();
+
+    bool IsRenderedCachePregenerate();
+
+    bool IsWadoUriStudyAndSeriesRequired();
+
+    unsigned int GetBulkDataCacheSize();  // In MB
+
+    // Whether "206 Partial Content" can be answered to "Range" requests
+    bool IsBulkDataRangeAvailable();
+
+    unsigned int GetResourceLookupCacheTTL();  // In seconds
+
+    unsigned int GetResourceLookupCacheSize();
+
+    unsigned int GetQidoPageSize();
+
+    unsigned int GetQidoCacheSize();  // In MB
+
+    unsigned int GetQidoCacheMaxStaleness();  // In seconds
+
+    unsigned int GetLimitFindResults();
+
+    unsigned int GetCacheWarmingThreadsCount();  // 0 if disabled
+
+    unsigned int GetCacheWarmingQueueSize();
+
+    unsigned int GetCacheWarmingStartupDays();  // 0 if no crawl at startup
   }
 }
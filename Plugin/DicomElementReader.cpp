@@ -0,0 +1,325 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "DicomElementReader.h"
+
+#include <cassert>
+#include <string.h>
+
+
+namespace OrthancPlugins
+{
+  const uint32_t DicomElementReader::UNDEFINED_LENGTH = 0xffffffffu;
+
+  const size_t DicomElementReader::MAX_DEPTH = 16;
+
+
+  static bool IsValidVR(const uint8_t* vr)
+  {
+    return (vr[0] >= 'A' && vr[0] <= 'Z' &&
+            vr[1] >= 'A' && vr[1] <= 'Z');
+  }
+
+
+  // In explicit VR, these VRs have a reserved field followed by a
+  // 32-bit length, instead of a 16-bit length
+  static bool HasLongLength(const uint8_t* vr)
+  {
+    static const char* const LONG_VRS[] = {
+      "OB", "OD", "OF", "OL", "OV", "OW", "SQ", "SV", "UC", "UN", "UR", "UT", "UV", NULL
+    };
+
+    for (size_t i = 0; LONG_VRS[i] != NULL; i++)
+    {
+      if (vr[0] == LONG_VRS[i][0] &&
+          vr[1] == LONG_VRS[i][1])
+      {
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+
+  DicomElementReader::DicomElementReader(const void* data,
+                                         size_t size) :
+    data_(reinterpret_cast<const uint8_t*>(data)),
+    size_(size)
+  {
+  }
+
+
+  bool DicomElementReader::ReadTag(uint16_t& group,
+                                   uint16_t& element,
+                                   size_t position,
+                                   size_t limit) const
+  {
+    assert(limit <= size_);
+
+    if (position > limit ||
+        limit - position < 8)
+    {
+      return false;
+    }
+
+    group = ReadUInt16(data_ + position);
+    element = ReadUInt16(data_ + position + 2);
+    return true;
+  }
+
+
+  bool DicomElementReader::ReadElement(Element& element,
+                                       size_t position,
+                                       size_t limit,
+                                       bool implicit) const
+  {
+    if (!ReadTag(element.group_, element.element_, position, limit))
+    {
+      return false;
+    }
+
+    const uint8_t* p = data_ + position;
+
+    element.headerOffset_ = position;
+    element.implicitItems_ = implicit;
+
+    if (element.IsItemTag() ||
+        implicit)
+    {
+      element.vr_[0] = '\0';
+      element.vr_[1] = '\0';
+      element.length_ = ReadUInt32(p + 4);
+      element.valueOffset_ = position + 8;
+
+      if (element.IsItemTag() &&
+          element.element_ != 0xe000)
+      {
+        return true;  // The length of the delimitations is meaningless
+      }
+    }
+    else if (!IsValidVR(p + 4))
+    {
+      return false;
+    }
+    else
+    {
+      element.vr_[0] = static_cast<char>(p[4]);
+      element.vr_[1] = static_cast<char>(p[5]);
+
+      if (HasLongLength(p + 4))
+      {
+        if (limit - position < 12)
+        {
+          return false;
+        }
+
+        // The items of a sequence whose VR is "UN" are encoded in implicit VR
+        element.implicitItems_ = element.IsVR("UN");
+        element.length_ = ReadUInt32(p + 8);
+        element.valueOffset_ = position + 12;
+      }
+      else
+      {
+        element.length_ = ReadUInt16(p + 6);
+        element.valueOffset_ = position + 8;
+      }
+    }
+
+    return (element.HasUndefinedLength() ||
+            element.length_ <= limit - element.valueOffset_);
+  }
+
+
+  bool DicomElementReader::SkipValue(size_t& position,
+                                     const Element& element,
+                                     size_t limit,
+                                     size_t depth) const
+  {
+    assert(!element.IsItemTag());
+
+    position = element.valueOffset_;
+
+    if (element.HasUndefinedLength())
+    {
+      return SkipItems(position, limit, element.implicitItems_, depth);
+    }
+    else
+    {
+      position += element.length_;
+      return true;
+    }
+  }
+
+
+  bool DicomElementReader::SkipItems(size_t& position,
+                                     size_t limit,
+                                     bool implicit,
+                                     size_t depth) const
+  {
+    if (depth >= MAX_DEPTH)
+    {
+      return false;
+    }
+
+    for (;;)
+    {
+      Element item;
+      if (!ReadElement(item, position, limit, implicit) ||
+          !item.IsItemTag())
+      {
+        return false;
+      }
+
+      position = item.valueOffset_;
+
+      if (item.element_ == 0xe0dd)
+      {
+        return true;  // Sequence delimitation item
+      }
+      else if (item.element_ != 0xe000)
+      {
+        return false;
+      }
+      else if (item.HasUndefinedLength())
+      {
+        if (!SkipItemElements(position, limit, implicit, depth + 1))
+        {
+          return false;
+        }
+      }
+      else
+      {
+        position += item.length_;
+      }
+    }
+  }
+
+
+  bool DicomElementReader::SkipItemElements(size_t& position,
+                                            size_t limit,
+                                            bool implicit,
+                                            size_t depth) const
+  {
+    for (;;)
+    {
+      Element element;
+      if (!ReadElement(element, position, limit, implicit))
+      {
+        return false;
+      }
+
+      if (element.IsItemTag())
+      {
+        position = element.valueOffset_;
+        return (element.element_ == 0xe00d);  // Item delimitation item
+      }
+      else if (!SkipValue(position, element, limit, depth))
+      {
+        return false;
+      }
+    }
+  }
+
+
+  bool DicomElementReader::ReadMetaHeader(size_t& position,
+                                          std::string& transferSyntax) const
+  {
+    transferSyntax.clear();
+
+    // Preamble of 128 bytes, followed by the "DICM" magic number
+    if (data_ == NULL ||
+        size_ < 132 ||
+        memcmp(data_ + 128, "DICM", 4) != 0)
+    {
+      return false;
+    }
+
+    position = 132;
+
+    uint16_t group, element;
+    while (ReadTag(group, element, position, size_) &&
+           group == 0x0002)
+    {
+      Element header;
+      if (!ReadElement(header, position, size_, false /* explicit */) ||
+          header.HasUndefinedLength())
+      {
+        return false;
+      }
+
+      if (header.element_ == 0x0010)
+      {
+        transferSyntax = StripPadding(GetValue(header), header.length_);
+      }
+
+      position = header.valueOffset_ + header.length_;
+    }
+
+    return true;
+  }
+
+
+  bool DicomElementReader::IsLittleEndian(bool& implicit,
+                                          const std::string& transferSyntax)
+  {
+    if (transferSyntax == "1.2.840.10008.1.2")
+    {
+      implicit = true;
+      return true;
+    }
+    else if (transferSyntax.empty() ||
+             transferSyntax == "1.2.840.10008.1.2.2" ||      // Explicit VR big endian
+             transferSyntax == "1.2.840.10008.1.2.1.99")     // Deflated explicit VR little endian
+    {
+      return false;
+    }
+    else
+    {
+      // All the other transfer syntaxes encode the dataset in explicit VR little endian
+      implicit = false;
+      return true;
+    }
+  }
+
+
+  std::string DicomElementReader::StripPadding(const uint8_t* value,
+                                               size_t length)
+  {
+    size_t start = 0;
+    while (start < length &&
+           value[start] == ' ')
+    {
+      start++;
+    }
+
+    while (length > start &&
+           (value[length - 1] == ' ' ||
+            value[length - 1] == '\0'))
+    {
+      length--;
+    }
+
+    return std::string(reinterpret_cast<const char*>(value) + start, length - start);
+  }
+}
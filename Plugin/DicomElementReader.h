@@ -0,0 +1,176 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+namespace OrthancPlugins
+{
+  // Decoding of the headers of the DICOM data elements encoded in
+  // little endian (implicit or explicit VR), without DCMTK.  It is
+  // shared by the lightweight parsers of the plugin, namely
+  // "DicomHeaderScanner" and "UncompressedFramesIndex".  The positions
+  // are offsets from the beginning of the buffer, and all the methods
+  // return "false" if the encoding is corrupted or not supported.
+  class DicomElementReader
+  {
+  public:
+    static const uint32_t UNDEFINED_LENGTH;
+
+    // Maximum nesting of the sequences, which bounds the recursion on
+    // malicious files
+    static const size_t MAX_DEPTH;
+
+    struct Element
+    {
+      uint16_t  group_;
+      uint16_t  element_;
+      char      vr_[2];          // Set to zeros if the VR is not encoded
+      uint32_t  length_;         // Can be "UNDEFINED_LENGTH"
+      size_t    headerOffset_;
+      size_t    valueOffset_;
+      bool      implicitItems_;  // Encoding of the nested items, if any
+
+      bool HasVR() const
+      {
+        return vr_[0] != '\0';
+      }
+
+      bool IsVR(const char* vr) const
+      {
+        return (vr_[0] == vr[0] &&
+                vr_[1] == vr[1]);
+      }
+
+      // Items, item delimitations and sequence delimitations
+      bool IsItemTag() const
+      {
+        return group_ == 0xfffe;
+      }
+
+      bool HasUndefinedLength() const
+      {
+        return length_ == UNDEFINED_LENGTH;
+      }
+
+      size_t GetHeaderSize() const
+      {
+        return valueOffset_ - headerOffset_;
+      }
+    };
+
+  private:
+    const uint8_t*  data_;
+    size_t          size_;
+
+  public:
+    DicomElementReader(const void* data,
+                       size_t size);
+
+    const uint8_t* GetData() const
+    {
+      return data_;
+    }
+
+    size_t GetSize() const
+    {
+      return size_;
+    }
+
+    const uint8_t* GetValue(const Element& element) const
+    {
+      return data_ + element.valueOffset_;
+    }
+
+    // Reads the tag of the element at "position", without decoding the
+    // rest of its header
+    bool ReadTag(uint16_t& group,
+                 uint16_t& element,
+                 size_t position,
+                 size_t limit) const;
+
+    // Reads the header of the element at "position". Its value must end
+    // before "limit", except if its length is undefined.  In explicit
+    // VR, the items and the delimitations have no VR, and the items of
+    // a sequence whose VR is "UN" are encoded in implicit VR.
+    bool ReadElement(Element& element,
+                     size_t position,
+                     size_t limit,
+                     bool implicit) const;
+
+    // Moves "position" after the value of an element that is found in
+    // a dataset nested in "depth" sequences.  Must not be used on items.
+    bool SkipValue(size_t& position,
+                   const Element& element,
+                   size_t limit,
+                   size_t depth) const;
+
+    // Skips the items of an element with undefined length (sequence, or
+    // encapsulated pixel data), "position" being at the beginning of its
+    // value.  "position" is left after the sequence delimitation.
+    bool SkipItems(size_t& position,
+                   size_t limit,
+                   bool implicit,
+                   size_t depth) const;
+
+    // Skips the elements of an item with undefined length, "position"
+    // being at the beginning of its value.  "position" is left after
+    // the item delimitation.
+    bool SkipItemElements(size_t& position,
+                          size_t limit,
+                          bool implicit,
+                          size_t depth) const;
+
+    // Reads the file meta information of a DICOM Part 10 file, which is
+    // always encoded in explicit VR little endian.  "position" is left
+    // at the beginning of the dataset.
+    bool ReadMetaHeader(size_t& position,
+                        std::string& transferSyntax) const;
+
+    // Returns "false" if the dataset is not encoded in little endian,
+    // or if it is deflated
+    static bool IsLittleEndian(bool& implicit,
+                               const std::string& transferSyntax);
+
+    static uint16_t ReadUInt16(const uint8_t* p)
+    {
+      return (static_cast<uint16_t>(p[0]) |
+              static_cast<uint16_t>(p[1]) << 8);
+    }
+
+    static uint32_t ReadUInt32(const uint8_t* p)
+    {
+      return (static_cast<uint32_t>(p[0]) |
+              static_cast<uint32_t>(p[1]) << 8 |
+              static_cast<uint32_t>(p[2]) << 16 |
+              static_cast<uint32_t>(p[3]) << 24);
+    }
+
+    // Removes the leading spaces, and the trailing spaces and nulls
+    static std::string StripPadding(const uint8_t* value,
+                                    size_t length);
+  };
+}
@@ -0,0 +1,574 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include "DicomHeaderScanner.h"
+
+#include "DicomElementReader.h"
+
+#include <boost/noncopyable.hpp>
+#include <cassert>
+
+
+namespace OrthancPlugins
+{
+  // Reads the file meta information, and leaves "position" at the
+  // beginning of the dataset
+  static bool ReadMetaHeader(size_t& position,
+                             bool& implicit,
+                             const DicomElementReader& reader)
+  {
+    std::string transferSyntax;
+    return (reader.ReadMetaHeader(position, transferSyntax) &&
+            DicomElementReader::IsLittleEndian(implicit, transferSyntax));
+  }
+
+
+  bool DicomHeaderScanner::Scan(Values& target,
+                                const std::set<Orthanc::DicomTag>& tags,
+                                const void* dicom,
+                                size_t size)
+  {
+    target.clear();
+
+    DicomElementReader reader(dicom, size);
+
+    size_t position;
+    bool implicit;
+    if (!ReadMetaHeader(position, implicit, reader))
+    {
+      return false;
+    }
+
+    uint32_t maxTag = 0;
+    for (std::set<Orthanc::DicomTag>::const_iterator it = tags.begin(); it != tags.end(); ++it)
+    {
+      const uint32_t tag = (static_cast<uint32_t>(it->GetGroup()) << 16) | it->GetElement();
+      if (tag > maxTag)
+      {
+        maxTag = tag;
+      }
+    }
+
+    while (position < size)
+    {
+      uint16_t group, element;
+      if (!reader.ReadTag(group, element, position, size) ||
+          group == 0xfffe)
+      {
+        target.clear();
+        return false;
+      }
+
+      // The scan stops after the largest tag of interest, without
+      // decoding the next element (the nested elements are skipped)
+      if (((static_cast<uint32_t>(group) << 16) | element) > maxTag)
+      {
+        return true;
+      }
+
+      DicomElementReader::Element header;
+      if (!reader.ReadElement(header, position, size, implicit))
+      {
+        target.clear();
+        return false;
+      }
+
+      if (!header.HasUndefinedLength())
+      {
+        const Orthanc::DicomTag tag(group, element);
+        if (tags.find(tag) != tags.end())
+        {
+          target[tag] = DicomElementReader::StripPadding(reader.GetValue(header), header.length_);
+        }
+      }
+
+      if (!reader.SkipValue(position, header, size, 0))
+      {
+        target.clear();
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+
+  static bool IsBinaryVR(const DicomElementReader::Element& element)
+  {
+    return (element.IsVR("OB") ||
+            element.IsVR("OD") ||
+            element.IsVR("OF") ||
+            element.IsVR("OL") ||
+            element.IsVR("OV") ||
+            element.IsVR("OW") ||
+            element.IsVR("UN"));
+  }
+
+
+  namespace
+  {
+    // Copies a dataset in explicit VR little endian, leaving out the
+    // large binary elements, and recomputing the lengths of the
+    // sequences and of the items
+    class DatasetReducer : public boost::noncopyable
+    {
+    private:
+      const DicomElementReader&           reader_;
+      std::string&                        target_;
+      DicomHeaderScanner::LargeElements&  removed_;
+      size_t                              threshold_;
+      DicomHeaderScanner::Parents         parents_;
+
+      void PatchLength(size_t offset,
+                       size_t length)
+      {
+        assert(offset + 4 <= target_.size());
+        target_[offset] = static_cast<char>(length & 0xff);
+        target_[offset + 1] = static_cast<char>((length >> 8) & 0xff);
+        target_[offset + 2] = static_cast<char>((length >> 16) & 0xff);
+        target_[offset + 3] = static_cast<char>((length >> 24) & 0xff);
+      }
+
+      void Append(size_t position,
+                  size_t size)
+      {
+        target_.append(reinterpret_cast<const char*>(reader_.GetData()) + position, size);
+      }
+
+      bool ReduceItems(size_t& position,
+                       size_t limit,
+                       bool undefinedLength,
+                       const Orthanc::DicomTag& sequence)
+      {
+        if (parents_.size() >= DicomElementReader::MAX_DEPTH)
+        {
+          return false;
+        }
+
+        for (size_t index = 0; ; index++)
+        {
+          if (!undefinedLength &&
+              position == limit)
+          {
+            return true;
+          }
+
+          DicomElementReader::Element item;
+          if (!reader_.ReadElement(item, position, limit, false) ||
+              !item.IsItemTag())
+          {
+            return false;
+          }
+
+          if (item.element_ == 0xe0dd &&
+              undefinedLength)
+          {
+            Append(position, 8);  // Sequence delimitation item
+            position = item.valueOffset_;
+            return true;
+          }
+          else if (item.element_ != 0xe000)
+          {
+            return false;
+          }
+
+          const size_t lengthOffset = target_.size() + 4;
+          Append(position, 8);
+          position = item.valueOffset_;
+
+          parents_.push_back(std::make_pair(sequence, index));
+
+          bool success;
+
+          if (item.HasUndefinedLength())
+          {
+            success = ReduceElements(position, limit, true, false);
+          }
+          else
+          {
+            const size_t start = target_.size();
+            success = ReduceElements(position, position + item.length_, false, false);
+            PatchLength(lengthOffset, target_.size() - start);
+          }
+
+          parents_.pop_back();
+
+          if (!success)
+          {
+            return false;
+          }
+        }
+      }
+
+    public:
+      DatasetReducer(std::string& target,
+                     DicomHeaderScanner::LargeElements& removed,
+                     const DicomElementReader& reader,
+                     size_t threshold) :
+        reader_(reader),
+        target_(target),
+        removed_(removed),
+        threshold_(threshold)
+      {
+      }
+
+      // The elements are read until "limit" if the dataset has a
+      // defined length, or until the item delimitation otherwise
+      bool ReduceElements(size_t& position,
+                          size_t limit,
+                          bool undefinedLength,
+                          bool topLevel)
+      {
+        while (position < limit)
+        {
+          DicomElementReader::Element element;
+          if (!reader_.ReadElement(element, position, limit, false))
+          {
+            return false;
+          }
+
+          if (element.IsItemTag())
+          {
+            if (undefinedLength &&
+                element.element_ == 0xe00d)
+            {
+              Append(position, 8);  // Item delimitation item
+              position = element.valueOffset_;
+              return true;
+            }
+            else
+            {
+              return false;
+            }
+          }
+
+          const size_t header = position;
+          const size_t headerSize = element.GetHeaderSize();
+          const Orthanc::DicomTag tag(element.group_, element.element_);
+          const bool isPixelData = (topLevel && element.group_ == 0x7fe0 && element.element_ == 0x0010);
+
+          position = element.valueOffset_;
+
+          if (element.IsVR("SQ"))
+          {
+            const size_t lengthOffset = target_.size() + 8;
+            Append(header, headerSize);
+
+            if (element.HasUndefinedLength())
+            {
+              if (!ReduceItems(position, limit, true, tag))
+              {
+                return false;
+              }
+            }
+            else
+            {
+              const size_t start = target_.size();
+              if (!ReduceItems(position, position + element.length_, false, tag))
+              {
+                return false;
+              }
+
+              PatchLength(lengthOffset, target_.size() - start);
+            }
+          }
+          else if (element.HasUndefinedLength())
+          {
+            // Encapsulated pixel data, or sequence whose VR is "UN"
+            if (!reader_.SkipItems(position, limit, element.implicitItems_, parents_.size()))
+            {
+              return false;
+            }
+
+            if (isPixelData)
+            {
+              Append(header, headerSize - 4);
+              target_.append(4, '\0');
+            }
+            else
+            {
+              Append(header, position - header);
+            }
+          }
+          else
+          {
+            if (isPixelData)
+            {
+              // Same as "OrthancPluginLoadDicomInstanceMode_EmptyPixelData"
+              Append(header, headerSize - (headerSize == 12 ? 4 : 2));
+              target_.append(headerSize == 12 ? 4 : 2, '\0');
+            }
+            else if (IsBinaryVR(element) &&
+                     element.length_ > threshold_)
+            {
+              removed_.push_back(DicomHeaderScanner::LargeElement(
+                                   parents_, tag, std::string(element.vr_, 2)));
+            }
+            else
+            {
+              Append(header, headerSize + element.length_);
+            }
+
+            position += element.length_;
+          }
+        }
+
+        // A nested item with undefined length must end with a delimitation
+        return !undefinedLength;
+      }
+    };
+  }
+
+
+  bool DicomHeaderScanner::RemoveLargeBinaryElements(std::string& target,
+                                                     LargeElements& removed,
+                                                     const void* dicom,
+                                                     size_t size,
+                                                     size_t threshold)
+  {
+    target.clear();
+    removed.clear();
+
+    DicomElementReader reader(dicom, size);
+
+    size_t position;
+    bool implicit;
+    if (!ReadMetaHeader(position, implicit, reader) ||
+        implicit /* the VR of the elements is unknown */)
+    {
+      return false;
+    }
+
+    // The file meta information is copied as such
+    target.reserve(position);
+    target.assign(reinterpret_cast<const char*>(dicom), position);
+
+    DatasetReducer reducer(target, removed, reader, threshold);
+    if (reducer.ReduceElements(position, size, false, true))
+    {
+      return true;
+    }
+    else
+    {
+      target.clear();
+      removed.clear();
+      return false;
+    }
+  }
+
+
+  namespace
+  {
+    class ElementLocator : public boost::noncopyable
+    {
+    private:
+      const DicomElementReader&              reader_;
+      const DicomHeaderScanner::Parents&     parents_;
+      const Orthanc::DicomTag&               tag_;
+      DicomHeaderScanner::ElementLocation&   target_;
+
+      // "position" is at the value of an element with undefined length
+      bool ReadFragments(size_t position,
+                         size_t limit)
+      {
+        target_.isEncapsulated_ = true;
+        target_.fragments_.clear();
+
+        for (bool isOffsetTable = true; ; isOffsetTable = false)
+        {
+          DicomElementReader::Element item;
+          if (!reader_.ReadElement(item, position, limit, false) ||
+              !item.IsItemTag())
+          {
+            return false;
+          }
+
+          if (item.element_ == 0xe0dd)
+          {
+            return true;  // Sequence delimitation item
+          }
+          else if (item.element_ != 0xe000 ||
+                   item.HasUndefinedLength())
+          {
+            return false;
+          }
+
+          if (!isOffsetTable)
+          {
+            target_.fragments_.push_back(std::make_pair(item.valueOffset_, static_cast<size_t>(item.length_)));
+          }
+
+          position = item.valueOffset_ + item.length_;
+        }
+      }
+
+      // "position" is at the value of the sequence "parents_[depth]"
+      bool LocateInItems(size_t position,
+                         size_t limit,
+                         bool implicit,
+                         size_t depth)
+      {
+        assert(depth < parents_.size());
+
+        for (size_t index = 0; ; index++)
+        {
+          DicomElementReader::Element item;
+          if (!reader_.ReadElement(item, position, limit, implicit) ||
+              !item.IsItemTag() ||
+              item.element_ != 0xe000)
+          {
+            return false;  // Also reached after the last item of the sequence
+          }
+
+          position = item.valueOffset_;
+
+          if (index == parents_[depth].second)
+          {
+            return LocateInDataset(position, (item.HasUndefinedLength() ? limit : position + item.length_),
+                                   implicit, depth + 1);
+          }
+          else if (item.HasUndefinedLength())
+          {
+            if (!reader_.SkipItemElements(position, limit, implicit, depth + 1))
+            {
+              return false;
+            }
+          }
+          else
+          {
+            position += item.length_;
+          }
+        }
+      }
+
+    public:
+      ElementLocator(DicomHeaderScanner::ElementLocation& target,
+                     const DicomHeaderScanner::Parents& parents,
+                     const Orthanc::DicomTag& tag,
+                     const DicomElementReader& reader) :
+        reader_(reader),
+        parents_(parents),
+        tag_(tag),
+        target_(target)
+      {
+      }
+
+      // The elements of a dataset are sorted by increasing tags, which
+      // allows to stop as soon as the expected tag has been passed
+      bool LocateInDataset(size_t position,
+                           size_t limit,
+                           bool implicit,
+                           size_t depth)
+      {
+        const Orthanc::DicomTag& expected = (depth < parents_.size() ? parents_[depth].first : tag_);
+
+        while (position < limit)
+        {
+          DicomElementReader::Element element;
+          if (!reader_.ReadElement(element, position, limit, implicit))
+          {
+            return false;
+          }
+
+          const Orthanc::DicomTag tag(element.group_, element.element_);
+
+          if (element.IsItemTag() ||  // End of an item with undefined length
+              expected < tag)
+          {
+            return false;
+          }
+
+          if (tag == expected)
+          {
+            const size_t end = (element.HasUndefinedLength() ? limit : element.valueOffset_ + element.length_);
+
+            if (depth < parents_.size())
+            {
+              if (element.HasVR() &&
+                  !element.IsVR("SQ") &&
+                  !element.IsVR("UN"))
+              {
+                return false;
+              }
+
+              return LocateInItems(element.valueOffset_, end, element.implicitItems_, depth);
+            }
+            else if (element.HasUndefinedLength())
+            {
+              // Only the pixel data in explicit VR can be encapsulated
+              if (!element.IsVR("OB") &&
+                  !element.IsVR("OW"))
+              {
+                return false;
+              }
+
+              return ReadFragments(element.valueOffset_, limit);
+            }
+            else if (element.IsVR("SQ"))
+            {
+              return false;
+            }
+            else
+            {
+              target_.isEncapsulated_ = false;
+              target_.offset_ = element.valueOffset_;
+              target_.length_ = element.length_;
+              target_.fragments_.clear();
+              return true;
+            }
+          }
+          else if (!reader_.SkipValue(position, element, limit, depth))
+          {
+            return false;
+          }
+        }
+
+        return false;
+      }
+    };
+  }
+
+
+  bool DicomHeaderScanner::LocateElement(ElementLocation& target,
+                                         const Parents& parents,
+                                         const Orthanc::DicomTag& tag,
+                                         const void* dicom,
+                                         size_t size)
+  {
+    if (parents.size() > DicomElementReader::MAX_DEPTH)
+    {
+      return false;
+    }
+
+    DicomElementReader reader(dicom, size);
+
+    size_t position;
+    bool implicit;
+    if (!ReadMetaHeader(position, implicit, reader))
+    {
+      return false;
+    }
+
+    ElementLocator locator(target, parents, tag, reader);
+    return locator.LocateInDataset(position, size, implicit, 0);
+  }
+}
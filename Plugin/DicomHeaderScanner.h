@@ -0,0 +1,123 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include <DicomFormat/DicomTag.h>
+
+#include <list>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace OrthancPlugins
+{
+  // Lightweight lookup of some top-level string tags of a DICOM file,
+  // by scanning its binary encoding instead of parsing the full
+  // dataset.  The scan stops after the largest tag of interest, which
+  // makes it suited to read the identifiers of big instances.
+  //
+  // Only a subset of the DICOM encodings is supported (Part 10 files
+  // in little endian, not deflated).  "Scan()" returns "false" in all
+  // the other cases, or if the file looks corrupted, in which case the
+  // caller must revert to a full parsing by the Orthanc core.
+  class DicomHeaderScanner
+  {
+  public:
+    typedef std::map<Orthanc::DicomTag, std::string>  Values;
+
+    // Path to a nested element: The tag of each parent sequence,
+    // together with the index of the item in this sequence
+    typedef std::vector<std::pair<Orthanc::DicomTag, size_t> >  Parents;
+
+    struct LargeElement
+    {
+      Parents            parents_;
+      Orthanc::DicomTag  tag_;
+      std::string        vr_;
+
+      LargeElement(const Parents& parents,
+                   const Orthanc::DicomTag& tag,
+                   const std::string& vr) :
+        parents_(parents),
+        tag_(tag),
+        vr_(vr)
+      {
+      }
+    };
+
+    typedef std::list<LargeElement>  LargeElements;
+
+    // Location of the value of a data element in a DICOM file. The value
+    // of an encapsulated element (i.e. compressed pixel data) is given
+    // as the list of its fragments, without the basic offset table.
+    struct ElementLocation
+    {
+      typedef std::vector<std::pair<size_t, size_t> >  Fragments;  // Offsets and lengths
+
+      bool       isEncapsulated_;
+      size_t     offset_;     // Only if not encapsulated
+      size_t     length_;     // Only if not encapsulated
+      Fragments  fragments_;  // Only if encapsulated
+
+      ElementLocation() :
+        isEncapsulated_(false),
+        offset_(0),
+        length_(0)
+      {
+      }
+    };
+
+    // The values have their padding removed. The tags that are absent
+    // from the file are absent from "target".
+    static bool Scan(Values& target,
+                     const std::set<Orthanc::DicomTag>& tags,
+                     const void* dicom,
+                     size_t size);
+
+    // Copies a DICOM file, leaving out the binary elements (OB, OD, OF,
+    // OL, OV, OW and UN) whose value is larger than "threshold" bytes,
+    // which are listed in "removed".  The pixel data is replaced by an
+    // empty element, as in "OrthancPluginLoadDicomInstanceMode_EmptyPixelData".
+    // This allows the Orthanc core to parse the metadata of instances
+    // containing huge arrays (e.g. deformable registrations) without
+    // loading these arrays.  Only explicit VR little endian is supported.
+    static bool RemoveLargeBinaryElements(std::string& target,
+                                          LargeElements& removed,
+                                          const void* dicom,
+                                          size_t size,
+                                          size_t threshold);
+
+    // Locates the value of the element "tag" nested in "parents" (the
+    // indexes of the items are 0-based), by skipping over the other
+    // elements. Returns "false" if the element is absent, or if the
+    // encoding is not supported: The caller must then revert to the
+    // Orthanc core, which can tell these two cases apart.
+    static bool LocateElement(ElementLocation& target,
+                              const Parents& parents,
+                              const Orthanc::DicomTag& tag,
+                              const void* dicom,
+                              size_t size);
+  };
+}
@@ -25,6 +25,9 @@
 
 #include "../Resources/Orthanc/Plugins/OrthancPluginCppWrapper.h"
 #include "DicomWebServers.h"
+#include "SingleFunctionJob.h"
+#include "SlidingWindowMetrics.h"
+#include "WorkersPool.h"
 
 #include <ChunkedBuffer.h>
 #include <Compatibility.h>
@@ -32,6 +35,8 @@
 #include <Logging.h>
 #include <Toolbox.h>
 
+#include <deque>
+#include <limits>
 #include <list>
 #include <set>
 #include <boost/lexical_cast.hpp>
@@ -42,295 +47,29 @@
 
 
 static const std::string HAS_WADO_RS_UNIVERSAL_TRANSFER_SYNTAX = "HasWadoRsUniversalTransferSyntax";
+static const std::string STOW_CONNECTIONS = "StowConnections";
+static const std::string STOW_MAX_INSTANCES_PER_REQUEST = "StowMaxInstancesPerRequest";
+static const std::string RETRIEVE_CONNECTIONS = "RetrieveConnections";
+static const std::string RETRIEVE_MAX_RETRIES = "RetrieveMaxRetries";
+static const std::string RETRIEVE_RETRY_DELAY = "RetrieveRetryDelay";
         
 
-class SingleFunctionJob : public OrthancPlugins::OrthancJob
-{
-public:
-  class JobContext : public boost::noncopyable
-  {
-  private:
-    SingleFunctionJob&  that_;
-
-  public:
-    explicit JobContext(SingleFunctionJob& that) :
-      that_(that)
-    {
-    }
-
-    void SetContent(const std::string& key,
-                    const Json::Value& value)
-    {
-      that_.SetContent(key, value);
-    }
-
-    void SetProgress(unsigned int position,
-                     unsigned int maxPosition)
-    {
-      boost::mutex::scoped_lock lock(that_.mutex_);
-
-      if (maxPosition == 0 || 
-          position > maxPosition)
-      {
-        that_.UpdateProgress(1);
-      }
-      else
-      {
-        that_.UpdateProgress(static_cast<float>(position) / static_cast<float>(maxPosition));
-      }
-    }
-  };
-
-
-  class IFunction : public boost::noncopyable
-  {
-  public:
-    virtual ~IFunction()
-    {
-    }
-
-    virtual void Execute(JobContext& context) = 0;
-  };
-
-
-  class IFunctionFactory : public boost::noncopyable
-  {
-  public:
-    virtual ~IFunctionFactory()
-    {
-    }
-
-    // Called when the job is paused or canceled. WARNING:
-    // "CancelFunction()" will be invoked while "Execute()" is
-    // running. Mutex is probably necessary.
-    virtual void CancelFunction() = 0;
-
-    virtual void PauseFunction() = 0;
-
-    virtual IFunction* CreateFunction() = 0;
-  };
-
-
-protected:
-  void SetFactory(IFunctionFactory& factory)
-  {
-    boost::mutex::scoped_lock lock(mutex_);
-
-    if (factory_ != NULL)
-    {
-      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
-    }
-    else
-    {
-      factory_ = &factory;
-    }
-  }
-  
-
-private:
-  enum FunctionResult
-  {
-    FunctionResult_Running,
-    FunctionResult_Done,
-    FunctionResult_Failure
-  };
-
-  boost::mutex                  mutex_;
-  FunctionResult                functionResult_;  // Can only be modified by the "Worker()" function
-  std::unique_ptr<boost::thread>  worker_;
-  Json::Value                   content_;
-  IFunctionFactory*             factory_;
-  bool                          stopping_;
-
-  void JoinWorker()
-  {
-    assert(factory_ != NULL);
-
-    if (worker_.get() != NULL)
-    {
-      if (worker_->joinable())
-      {
-        worker_->join();
-      }
-
-      worker_.reset();
-    }
-  }
-
-  void StartWorker()
-  {
-    assert(factory_ != NULL);
-
-    if (worker_.get() == NULL)
-    {
-      stopping_ = false;
-      worker_.reset(new boost::thread(Worker, this, factory_));
-    }
-  }
-
-protected:
-  void SetContent(const std::string& key,
-                  const Json::Value& value)
-  {
-    boost::mutex::scoped_lock lock(mutex_);
-    content_[key] = value;
-    UpdateContent(content_);
-  }
-
-private:
-  static void Worker(SingleFunctionJob* job,
-                     IFunctionFactory* factory)
-  {
-    assert(job != NULL && factory != NULL);
-
-    try
-    {
-      JobContext context(*job);
-
-      std::unique_ptr<IFunction> function(factory->CreateFunction());
-      function->Execute(context);
-
-      {
-        boost::mutex::scoped_lock lock(job->mutex_);
-        job->functionResult_ = FunctionResult_Done;
-      }
-    }
-    catch (Orthanc::OrthancException& e)
-    {
-      LOG(ERROR) << "Error in a job: " << e.What();
-
-      {
-        boost::mutex::scoped_lock lock(job->mutex_);
-
-        job->functionResult_ = FunctionResult_Failure;
-
-        if (!job->stopping_)
-        {
-          // Don't report exceptions that are a consequence of stopping the function
-          job->content_["FunctionErrorCode"] = e.GetErrorCode();
-          job->content_["FunctionErrorDescription"] = e.What();
-          if (e.HasDetails())
-          {
-            job->content_["FunctionErrorDetails"] = e.GetDetails();
-          }
-          job->UpdateContent(job->content_);
-        }
-      }
-    }
-  }  
-
-  void StopInternal(OrthancPluginJobStopReason reason)
-  {
-    if (factory_ == NULL)
-    {
-      return;
-    }
-    else if (reason == OrthancPluginJobStopReason_Paused ||
-             reason == OrthancPluginJobStopReason_Canceled)
-    {
-      stopping_ = true;
-
-      if (reason == OrthancPluginJobStopReason_Paused)
-      {
-        factory_->PauseFunction();
-      }
-      else
-      {
-        factory_->CancelFunction();
-      }
-
-      JoinWorker();
-
-      // Be ready for the next possible call to "Step()" that will resume the function
-      functionResult_ = FunctionResult_Running;
-    }
-  }
-
-public:
-  explicit SingleFunctionJob(const std::string& jobName) :
-    OrthancJob(jobName),
-    functionResult_(FunctionResult_Running),
-    content_(Json::objectValue),
-    factory_(NULL),
-    stopping_(false)
-  {
-  }
-
-  virtual ~SingleFunctionJob() ORTHANC_OVERRIDE
-  {
-    if (worker_.get() != NULL)
-    {
-      LOG(ERROR) << "Classes deriving from SingleFunctionJob must "
-                 << "explicitly call Finalize() in their destructor";
-      Finalize();
-    }
-  }
-
-  void Finalize()
-  {
-    try
-    {
-      StopInternal(OrthancPluginJobStopReason_Canceled);
-    }
-    catch (Orthanc::OrthancException&)
-    {
-    }
-  }
-
-  virtual OrthancPluginJobStepStatus Step() ORTHANC_OVERRIDE ORTHANC_FINAL
-  {
-    if (factory_ == NULL)
-    {
-      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
-    }
-
-    FunctionResult result;
-
-    {
-      boost::mutex::scoped_lock lock(mutex_);
-      result = functionResult_;
-    }
-
-    switch (result)
-    {
-      case FunctionResult_Running:
-        StartWorker();
-        boost::this_thread::sleep(boost::posix_time::milliseconds(500));
-        return OrthancPluginJobStepStatus_Continue;
-
-      case FunctionResult_Done:
-        JoinWorker();
-        return OrthancPluginJobStepStatus_Success;
-
-      case FunctionResult_Failure:
-        JoinWorker();
-        return OrthancPluginJobStepStatus_Failure;
-
-      default:
-        throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
-    }
-  }
-
-  virtual void Stop(OrthancPluginJobStopReason reason) ORTHANC_OVERRIDE ORTHANC_FINAL
-  {
-    StopInternal(reason);
-  }
-
-  virtual void Reset() ORTHANC_OVERRIDE ORTHANC_FINAL
-  {
-    boost::mutex::scoped_lock lock(mutex_);
-
-    assert(worker_.get() == NULL);
-    functionResult_ = FunctionResult_Running;
-    content_ = Json::objectValue;
-    ClearContent();
-  }
-};
 
+static const std::string MULTIPART_RELATED = "multipart/related";
 
+// Bandwidth of the STOW-RS transactions sent by the client
+static OrthancPlugins::SlidingWindowMetrics stowClientAverageBandwidth(300);
 
 
-static const std::string MULTIPART_RELATED = "multipart/related";
+void RefreshDicomWebClientMetrics()
+{
+  OrthancPlugins::SlidingWindowMetrics::Statistics statistics;
+  stowClientAverageBandwidth.GetStatistics(statistics);
+  OrthancPlugins::SetMetricsValue("orthanc_dicomweb_client_stowrs_average_bandwidth_per_call_mbytes_per_second_5m",
+                                  static_cast<float>(statistics.GetWeightedAverage()));
+  OrthancPlugins::SetMetricsValue("orthanc_dicomweb_client_stowrs_mbytes_per_second_5m",
+                                  static_cast<float>(statistics.GetSumRate()));
+}
 
 
 
@@ -573,8 +312,8 @@ static void ParseStowRequest(std::list<std::string>& instances /* out */,
 
 
 class StowClientJob :
-  public SingleFunctionJob,
-  private SingleFunctionJob::IFunctionFactory
+  public OrthancPlugins::SingleFunctionJob,
+  private OrthancPlugins::SingleFunctionJob::IFunctionFactory
 {
 private:
   enum Action
@@ -583,52 +322,116 @@ private:
     Action_Pause,
     Action_Cancel
   };
-  
+
+  // Number of instances that are read from the disk ahead of the
+  // instance that is being sent by one connection
+  static const size_t PREFETCH_DEPTH = 2;
+
+  // Range of instances that are sent by one STOW-RS transaction
+  typedef std::pair<size_t, size_t>  Chunk;
+
   boost::mutex                 mutex_;
   std::string                  serverName_;
   std::vector<std::string>     instances_;
   OrthancPlugins::HttpHeaders  headers_;
   std::string                  boundary_;
-  size_t                       position_;
+  std::deque<Chunk>            pendingChunks_;  // Chunks that are still to be sent
+  bool                         hasChunks_;      // Whether "pendingChunks_" has been initialized
+  size_t                       processedCount_;
   Action                       action_;
   size_t                       networkSize_;
   bool                         debug_;
+  bool                         hasError_;
+  Orthanc::ErrorCode           errorCode_;
+  std::string                  errorDetails_;
 
-  bool ReadNextInstance(std::string& dicom,
-                        JobContext& context)
+  // Reads one instance from the disk, possibly in a worker thread
+  class InstanceLoader : public OrthancPlugins::WorkersPool::ITask
   {
-    boost::mutex::scoped_lock lock(mutex_);
+  private:
+    std::string  instanceId_;
+    bool         debug_;
+    bool         success_;
+    std::string  dicom_;
 
-    if (action_ != Action_None)
+  public:
+    InstanceLoader(const std::string& instanceId,
+                   bool debug) :
+      instanceId_(instanceId),
+      debug_(debug),
+      success_(false)
     {
-      return false;
     }
 
-    while (position_ < instances_.size())
+    virtual void Execute() ORTHANC_OVERRIDE
     {
-      context.SetProgress(position_, instances_.size());
-      
-      size_t i = position_++;
-
       if (debug_)
       {
         boost::this_thread::sleep(boost::posix_time::milliseconds(100));
       }
 
-      if (OrthancPlugins::RestApiGetString(dicom, "/instances/" + instances_[i] + "/file", false))
-      {
-        networkSize_ += dicom.size();
-        context.SetContent("NetworkSizeMB", boost::lexical_cast<std::string>
-                           (networkSize_ / static_cast<uint64_t>(1024 * 1024)));
+      success_ = OrthancPlugins::RestApiGetString(dicom_, "/instances/" + instanceId_ + "/file", false);
+    }
 
-        return true;
-      }
+    bool IsSuccess() const
+    {
+      return success_;
     }
 
-    return false;
+    std::string& GetDicom()
+    {
+      return dicom_;
+    }
+  };
+
+
+  bool IsStopping()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return (action_ != Action_None || hasError_);
+  }
+
+
+  void AddProcessedInstance(JobContext& context,
+                            size_t dicomSize,
+                            bool loaded)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    processedCount_++;
+    context.SetProgress(processedCount_, instances_.size());
+
+    if (loaded)
+    {
+      networkSize_ += dicomSize;
+      context.SetContent("NetworkSizeMB", boost::lexical_cast<std::string>
+                         (networkSize_ / static_cast<uint64_t>(1024 * 1024)));
+    }
+  }
+
+
+  // Forgets about the instances of a chunk that has failed, as they
+  // will be counted again when the full chunk is sent again
+  void RemoveProcessedInstances(JobContext& context,
+                                size_t count,
+                                size_t dicomSize)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    assert(processedCount_ >= count &&
+           networkSize_ >= dicomSize);
+    processedCount_ -= count;
+    networkSize_ -= dicomSize;
+
+    context.SetProgress(processedCount_, instances_.size());
+    context.SetContent("NetworkSizeMB", boost::lexical_cast<std::string>
+                       (networkSize_ / static_cast<uint64_t>(1024 * 1024)));
   }
 
 
+  // Body of one STOW-RS transaction, that sends the instances of one
+  // chunk. The next instances are loaded by the workers pool while
+  // the current instance is sent over the network.
   class RequestBody : public OrthancPlugins::HttpClient::IRequestBody
   {
   private:
@@ -637,15 +440,77 @@ private:
     std::string     boundary_;
     bool            done_;
     size_t          processedSize_;
+    size_t          loadedSize_;  // Size of the DICOM files that were loaded
+    size_t          position_;    // Next instance to be sent
+    size_t          end_;
+    size_t          prefetched_;  // Next instance to be submitted to the pool
+
+    // The loaders must outlive the group
+    std::deque<boost::shared_ptr<InstanceLoader> >  loaders_;
+    std::deque<size_t>                              loaderIndexes_;
+    OrthancPlugins::WorkersPool::TasksGroup         group_;
+
+    void Prefetch()
+    {
+      while (prefetched_ < end_ &&
+             prefetched_ < position_ + PREFETCH_DEPTH)
+      {
+        boost::shared_ptr<InstanceLoader> loader(new InstanceLoader(that_.instances_[prefetched_], that_.debug_));
+        loaders_.push_back(loader);
+        loaderIndexes_.push_back(group_.Submit(*loader));
+        prefetched_++;
+      }
+    }
+
+    bool ReadNextInstance(std::string& dicom)
+    {
+      while (position_ < end_)
+      {
+        if (that_.IsStopping())
+        {
+          return false;
+        }
+
+        Prefetch();
+
+        assert(!loaders_.empty());
+        group_.Wait(loaderIndexes_.front());
+
+        boost::shared_ptr<InstanceLoader> loader = loaders_.front();
+        loaders_.pop_front();
+        loaderIndexes_.pop_front();
+        position_++;
+
+        if (loader->IsSuccess())
+        {
+          dicom.swap(loader->GetDicom());
+          loadedSize_ += dicom.size();
+          that_.AddProcessedInstance(context_, dicom.size(), true);
+          return true;
+        }
+        else
+        {
+          that_.AddProcessedInstance(context_, 0, false);
+        }
+      }
+
+      return false;
+    }
 
   public:
     RequestBody(StowClientJob& that,
-                JobContext& context) :
+                JobContext& context,
+                const Chunk& chunk) :
       that_(that),
       context_(context),
       boundary_(that.boundary_),
       done_(false),
-      processedSize_(0)
+      processedSize_(0),
+      loadedSize_(0),
+      position_(chunk.first),
+      end_(chunk.second),
+      prefetched_(chunk.first),
+      group_(OrthancPlugins::WorkersPool::GetInstance(), 1)
     {
     }
 
@@ -653,14 +518,13 @@ private:
     {
       if (done_)
       {
-        context_.SetProgress(1, 1);
         return false;
       }
       else
       {
         std::string dicom;
 
-        if (that_.ReadNextInstance(dicom, context_))
+        if (ReadNextInstance(dicom))
         {
           chunk = ("--" + boundary_ + "\r\n" +
                    "Content-Type: application/dicom\r\n" +
@@ -685,96 +549,270 @@ private:
     {
       return processedSize_;
     }
+
+    size_t GetLoadedSize() const
+    {
+      return loadedSize_;
+    }
+
+    // Index of the first instance that has not been sent
+    size_t GetPosition() const
+    {
+      return position_;
+    }
   };
 
 
-  class F : public IFunction
+  // Sends one chunk of instances in one STOW-RS transaction. Returns
+  // the index of the first instance that has not been sent, which is
+  // smaller than the end of the chunk if the job was paused.
+  size_t SendChunk(JobContext& context,
+                   const std::string& serverName,
+                   const Chunk& chunk)
   {
-  private:
-    StowClientJob& that_;
+    // The lifetime of "body" should be larger than "client"
+    std::unique_ptr<RequestBody> body;
+    std::unique_ptr<OrthancPlugins::HttpClient> client;
 
-  public:
-    explicit F(StowClientJob& that) :
-      that_(that)
     {
+      boost::mutex::scoped_lock lock(mutex_);
+      body.reset(new RequestBody(*this, context, chunk));
+
+      client.reset(new OrthancPlugins::HttpClient);
+      std::map<std::string, std::string> userProperties;
+      OrthancPlugins::DicomWebServers::GetInstance().ConfigureHttpClient(*client, userProperties, serverName, "/studies");
+      client->SetMethod(OrthancPluginHttpMethod_Post);
+      client->AddHeaders(headers_);
     }
 
-    virtual void Execute(JobContext& context) ORTHANC_OVERRIDE
+    Json::Value answerBody;
+
+    assert(client.get() != NULL);
+    client->SetBody(*body);
+
+    try
     {
-      std::string serverName;
-      size_t startPosition;
+      const boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
 
-      // The lifetime of "body" should be larger than "client"
-      std::unique_ptr<RequestBody> body;
-      std::unique_ptr<OrthancPlugins::HttpClient> client;
+      OrthancPlugins::ServerRequestTimer timer(serverName);
+      OrthancPlugins::HttpHeaders answerHeaders;
+      client->Execute(answerHeaders, answerBody);
+      timer.SetSuccess();
 
+      const int64_t elapsed = (boost::posix_time::microsec_clock::universal_time() - start).total_microseconds();
+      if (elapsed > 0)
       {
-        boost::mutex::scoped_lock lock(that_.mutex_);
-        context.SetContent("InstancesCount", boost::lexical_cast<std::string>(that_.instances_.size()));
-        serverName = that_.serverName_;
-        
-        startPosition = that_.position_;        
-        body.reset(new RequestBody(that_, context));
-
-        client.reset(new OrthancPlugins::HttpClient);
-        std::map<std::string, std::string> userProperties;
-        OrthancPlugins::DicomWebServers::GetInstance().ConfigureHttpClient(*client, userProperties, serverName, "/studies");
-        client->SetMethod(OrthancPluginHttpMethod_Post);
-        client->AddHeaders(that_.headers_);
+        // Bytes per microsecond, which gives a bandwidth in MB/s
+        const double size = static_cast<double>(body->GetProcessedSize());
+        stowClientAverageBandwidth.AddValue(size / static_cast<double>(elapsed), size);
       }
 
-      Json::Value answerBody;
-
-      assert(client.get() != NULL);
-      client->SetBody(*body);
+      CheckStowAnswer(answerBody, serverName, body->GetPosition() - chunk.first);
+    }
+    catch (Orthanc::OrthancException&)
+    {
+      // The full chunk will be sent again by "SendChunks()" if the
+      // job is resubmitted, so its instances must not be counted twice
+      RemoveProcessedInstances(context, body->GetPosition() - chunk.first, body->GetLoadedSize());
 
-      try
+      if (client->GetHttpStatus() == 411)
       {
-        OrthancPlugins::HttpHeaders answerHeaders;
-        client->Execute(answerHeaders, answerBody);
-      }
-      catch (Orthanc::OrthancException&)
+        /**
+         * "Length required" error. This might indicate an older
+         * version of Orthanc (<= 1.5.6) that does not support
+         * chunked transfers, or a version of Orthanc <= 1.7.2 that
+         * supports chunk transfers, but cannot receive multipart
+         * messages larger than 2GB. The latter problem is fixed by:
+         * https://orthanc.uclouvain.be/hg/orthanc/rev/36257d6f348f
+         **/
+        if (client->IsChunkedTransfersAllowed())
+        {
+          LOG(ERROR) << "The remote DICOMweb server \"" << serverName << "\" does not support chunked transfers "
+                     << "(this might indicate Orthanc <= 1.5.6), set configuration option \"ChunkedTransfers\" "
+                     << "to \"false\" in the configuration (or upgrade remote Orthanc if applicable)";
+        }
+        else if (body->GetProcessedSize() >= 2 * static_cast<uint64_t>(1024 * 1024 * 1024))
+        {
+          LOG(ERROR) << "Cannot send a study larger than 2GB (chunked transfer is disabled) using STOW-RS, "
+                     << "this might indicate that the remote DICOMweb server is Orthanc <= 1.7.2 "
+                     << "(if so, please upgrade the remote Orthanc)";
+        }
+        else
+        {
+          LOG(ERROR) << "Cannot send a study of " << (body->GetProcessedSize() / (1024 * 1024))
+                     << "MB with STOW-RS (chunked transfer is disabled), check out the logs of the remote modality";
+        }
+      }
+
+      throw;
+    }
+
+    return body->GetPosition();
+  }
+
+
+  // Loop run by each connection, until there is no more chunk to be
+  // sent, or until the job is stopped
+  void SendChunks(JobContext& context,
+                  const std::string& serverName)
+  {
+    for (;;)
+    {
+      Chunk chunk;
+
       {
-        if (client->GetHttpStatus() == 411)
+        boost::mutex::scoped_lock lock(mutex_);
+
+        if (action_ != Action_None ||
+            hasError_ ||
+            pendingChunks_.empty())
         {
-          /**
-           * "Length required" error. This might indicate an older
-           * version of Orthanc (<= 1.5.6) that does not support
-           * chunked transfers, or a version of Orthanc <= 1.7.2 that
-           * supports chunk transfers, but cannot receive multipart
-           * messages larger than 2GB. The latter problem is fixed by:
-           * https://orthanc.uclouvain.be/hg/orthanc/rev/36257d6f348f
-           **/
-          if (client->IsChunkedTransfersAllowed())
-          {
-            LOG(ERROR) << "The remote DICOMweb server \"" << serverName << "\" does not support chunked transfers "
-                       << "(this might indicate Orthanc <= 1.5.6), set configuration option \"ChunkedTransfers\" "
-                       << "to \"false\" in the configuration (or upgrade remote Orthanc if applicable)";
-          }
-          else if (body->GetProcessedSize() >= 2 * static_cast<uint64_t>(1024 * 1024 * 1024))
-          {
-            LOG(ERROR) << "Cannot send a study larger than 2GB (chunked transfer is disabled) using STOW-RS, "
-                       << "this might indicate that the remote DICOMweb server is Orthanc <= 1.7.2 "
-                       << "(if so, please upgrade the remote Orthanc)";
-          }
-          else
+          return;
+        }
+
+        chunk = pendingChunks_.front();
+        pendingChunks_.pop_front();
+      }
+
+      try
+      {
+        size_t position = SendChunk(context, serverName, chunk);
+
+        if (position < chunk.second)
+        {
+          // The job was paused or canceled: The remaining instances
+          // of the chunk will be sent once the job is resumed
+          boost::mutex::scoped_lock lock(mutex_);
+          pendingChunks_.push_front(Chunk(position, chunk.second));
+        }
+      }
+      catch (Orthanc::OrthancException& e)
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+
+        // The full chunk will be sent again if the job is resubmitted
+        pendingChunks_.push_front(chunk);
+
+        if (!hasError_)
+        {
+          hasError_ = true;
+          errorCode_ = e.GetErrorCode();
+          errorDetails_ = (e.HasDetails() ? e.GetDetails() : "");
+        }
+
+        return;
+      }
+    }
+  }
+
+
+  static void ConnectionWorker(StowClientJob* that,
+                               JobContext* context,
+                               std::string serverName)
+  {
+    assert(that != NULL && context != NULL);
+    that->SendChunks(*context, serverName);
+  }
+
+
+  // The mutex must be locked
+  void CreateChunks(const Orthanc::WebServiceParameters& server)
+  {
+    const size_t chunkSize = OrthancPlugins::DicomWebServers::GetUnsignedIntegerUserProperty(
+      server, STOW_MAX_INSTANCES_PER_REQUEST, 0 /* all the instances in one request */);
+
+    pendingChunks_.clear();
+
+    if (chunkSize == 0 ||
+        instances_.empty())
+    {
+      pendingChunks_.push_back(Chunk(0, instances_.size()));
+    }
+    else
+    {
+      for (size_t i = 0; i < instances_.size(); i += chunkSize)
+      {
+        pendingChunks_.push_back(Chunk(i, std::min(i + chunkSize, instances_.size())));
+      }
+    }
+
+    processedCount_ = 0;
+    hasChunks_ = true;
+  }
+
+
+  class F : public IFunction
+  {
+  private:
+    StowClientJob& that_;
+
+  public:
+    explicit F(StowClientJob& that) :
+      that_(that)
+    {
+    }
+
+    virtual void Execute(JobContext& context) ORTHANC_OVERRIDE
+    {
+      std::string serverName;
+      unsigned int connectionsCount;
+
+      {
+        boost::mutex::scoped_lock lock(that_.mutex_);
+        context.SetContent("InstancesCount", boost::lexical_cast<std::string>(that_.instances_.size()));
+        serverName = that_.serverName_;
+
+        const Orthanc::WebServiceParameters server = OrthancPlugins::DicomWebServers::GetInstance().GetServer(serverName);
+
+        connectionsCount = OrthancPlugins::DicomWebServers::GetUnsignedIntegerUserProperty(
+          server, STOW_CONNECTIONS, 1);
+
+        if (!that_.hasChunks_)
+        {
+          that_.CreateChunks(server);
+        }
+
+        connectionsCount = std::max(1u, std::min(connectionsCount, static_cast<unsigned int>(that_.pendingChunks_.size())));
+        that_.hasError_ = false;
+      }
+
+      if (connectionsCount == 1)
+      {
+        that_.SendChunks(context, serverName);
+      }
+      else
+      {
+        std::vector<boost::shared_ptr<boost::thread> > connections(connectionsCount);
+
+        for (size_t i = 0; i < connections.size(); i++)
+        {
+          connections[i].reset(new boost::thread(ConnectionWorker, &that_, &context, serverName));
+        }
+
+        for (size_t i = 0; i < connections.size(); i++)
+        {
+          if (connections[i]->joinable())
           {
-            LOG(ERROR) << "Cannot send a study of " << (body->GetProcessedSize() / (1024 * 1024))
-                       << "MB with STOW-RS (chunked transfer is disabled), check out the logs of the remote modality";
+            connections[i]->join();
           }
         }
-
-        throw;
       }
 
       {
         boost::mutex::scoped_lock lock(that_.mutex_);
-        size_t endPosition = that_.position_;
-        CheckStowAnswer(answerBody, serverName, endPosition - startPosition);
 
-        if (that_.action_ == Action_Cancel)
+        if (that_.hasError_)
+        {
+          throw Orthanc::OrthancException(that_.errorCode_, that_.errorDetails_);
+        }
+        else if (that_.action_ == Action_Cancel)
         {
-          that_.position_ = 0;
+          that_.hasChunks_ = false;
+        }
+        else if (that_.action_ == Action_None)
+        {
+          assert(that_.pendingChunks_.empty());
+          context.SetProgress(1, 1);
         }
       }
     }
@@ -797,6 +835,7 @@ private:
   
   virtual IFunction* CreateFunction() ORTHANC_OVERRIDE
   {
+    boost::mutex::scoped_lock lock(mutex_);
     action_ = Action_None;
     return new F(*this);
   }
@@ -807,13 +846,16 @@ public:
                 const std::list<std::string>& instances,
                 const OrthancPlugins::HttpHeaders& headers,
                 const Json::Value& resourcesForJobContent) :
-    SingleFunctionJob("DicomWebStowClient"),
+    OrthancPlugins::SingleFunctionJob("DicomWebStowClient"),
     serverName_(serverName),
     headers_(headers),
-    position_(0),
+    hasChunks_(false),
+    processedCount_(0),
     action_(Action_None),
     networkSize_(0),
-    debug_(false)
+    debug_(false),
+    hasError_(false),
+    errorCode_(Orthanc::ErrorCode_Success)
   {
     SetContent("Resources", resourcesForJobContent);
     SetContent("Server", serverName_);
@@ -966,7 +1008,12 @@ void GetFromServer(OrthancPluginRestOutput* output,
   
   std::map<std::string, std::string> answerHeaders;
   std::string answer;
-  client.Execute(answerHeaders, answer);
+
+  {
+    OrthancPlugins::ServerRequestTimer timer(request->groups[0]);
+    client.Execute(answerHeaders, answer);
+    timer.SetSuccess();
+  }
 
   std::string contentType = "application/octet-stream";
 
@@ -1004,7 +1051,10 @@ void GetFromServer(Json::Value& result,
   ConfigureGetFromServer(client, request);
 
   std::map<std::string, std::string> answerHeaders;
+
+  OrthancPlugins::ServerRequestTimer timer(request->groups[0]);
   client.Execute(answerHeaders, result);
+  timer.SetSuccess();
 }
 
 
@@ -1023,12 +1073,112 @@ private:
     State_Canceled
   };
 
+  // Stores one received part into Orthanc, possibly in a worker thread
+  class StoreTask : public OrthancPlugins::WorkersPool::ITask
+  {
+  private:
+    std::string         copy_;
+    const void*         data_;
+    size_t              size_;
+    bool                debug_;
+    bool                success_;
+    std::string         instanceId_;
+    Orthanc::ErrorCode  errorCode_;
+    std::string         errorDetails_;
+
+  public:
+    // If "copy" is true, the part is stored by a worker thread, which
+    // requires a copy, as the buffer of the multipart parser is transient
+    StoreTask(const void* data,
+              size_t size,
+              bool copy,
+              bool debug) :
+      data_(data),
+      size_(size),
+      debug_(debug),
+      success_(false),
+      errorCode_(Orthanc::ErrorCode_InternalError)
+    {
+      if (copy)
+      {
+        copy_.assign(reinterpret_cast<const char*>(data), size);
+        data_ = copy_.empty() ? NULL : copy_.c_str();
+      }
+    }
+
+    virtual void Execute() ORTHANC_OVERRIDE
+    {
+      try
+      {
+        OrthancPlugins::MemoryBuffer tmp;
+        tmp.RestApiPost("/instances", data_, size_, false);
+
+        Json::Value result;
+        tmp.ToJson(result);
+
+        if (OrthancPlugins::LookupStringValue(instanceId_, result, "ID"))
+        {
+          success_ = true;
+        }
+
+        if (debug_)
+        {
+          boost::this_thread::sleep(boost::posix_time::milliseconds(50));
+        }
+      }
+      catch (Orthanc::OrthancException& e)
+      {
+        errorCode_ = e.GetErrorCode();
+        errorDetails_ = (e.HasDetails() ? e.GetDetails() : "");
+      }
+
+      // Release the memory as soon as possible
+      std::string empty;
+      copy_.swap(empty);
+      data_ = NULL;
+    }
+
+    const std::string& GetInstanceId() const
+    {
+      if (success_)
+      {
+        return instanceId_;
+      }
+      else
+      {
+        throw Orthanc::OrthancException(errorCode_, errorDetails_);
+      }
+    }
+  };
+
   bool                                           debug_;
   boost::mutex                                   mutex_;
   State                                          state_;
   std::list<std::string>                         instances_;
   std::unique_ptr<Orthanc::MultipartStreamReader>  reader_;
   uint64_t                                       networkSize_;
+  size_t                                         maxInFlightSize_;
+  size_t                                         inFlightSize_;
+
+  // The parts that are stored by the workers, in the order of the answer
+  std::vector<boost::shared_ptr<StoreTask> >               tasks_;
+  std::deque<size_t>                                       inFlight_;       // Oldest first
+  std::deque<size_t>                                       inFlightSizes_;
+  std::unique_ptr<OrthancPlugins::WorkersPool::TasksGroup>  group_;  // Must be declared after "tasks_"
+
+  void WaitOldestInFlight()
+  {
+    assert(group_.get() != NULL &&
+           !inFlight_.empty());
+
+    // If no worker has started storing this part yet, it is stored by this thread
+    group_->Wait(inFlight_.front());
+
+    assert(inFlightSize_ >= inFlightSizes_.front());
+    inFlightSize_ -= inFlightSizes_.front();
+    inFlight_.pop_front();
+    inFlightSizes_.pop_front();
+  }
 
   virtual void HandlePart(const Orthanc::MultipartStreamReader::HttpHeaders& headers,
                           const void* part,
@@ -1055,34 +1205,47 @@ private:
         "Parts of a WADO-RS retrieve should have \"application/dicom\" type, but received: " + contentType);
     }
 
-    OrthancPlugins::MemoryBuffer tmp;
-    tmp.RestApiPost("/instances", part, size, false);
-
-    Json::Value result;
-    tmp.ToJson(result);
-
-    std::string id;
-    if (OrthancPlugins::LookupStringValue(id, result, "ID"))
+    if (group_.get() == NULL)
     {
-      instances_.push_back(id);
+      // Sequential mode: Store the part in the thread that receives the answer
+      StoreTask task(part, size, false, debug_);
+      task.Execute();
+      instances_.push_back(task.GetInstanceId());
     }
     else
     {
-      throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);      
-    }
+      // Bound the memory that is used by the copies of the parts
+      // that are waiting to be stored
+      while (!inFlight_.empty() &&
+             inFlightSize_ + size > maxInFlightSize_)
+      {
+        WaitOldestInFlight();
+      }
 
-    if (debug_)
-    {
-      boost::this_thread::sleep(boost::posix_time::milliseconds(50));
+      boost::shared_ptr<StoreTask> task(new StoreTask(part, size, true, debug_));
+      tasks_.push_back(task);
+      inFlight_.push_back(group_->Submit(*task));
+      inFlightSizes_.push_back(size);
+      inFlightSize_ += size;
     }
   }
 
 public:
-  WadoRetrieveAnswer() :
+  // If "storeThreadsCount" is greater than 1, the received parts are
+  // stored by the workers pool while the answer is still received
+  WadoRetrieveAnswer(unsigned int storeThreadsCount,
+                     size_t maxInFlightSize) :
     debug_(false),
     state_(State_Headers),
-    networkSize_(0)
+    networkSize_(0),
+    maxInFlightSize_(maxInFlightSize == 0 ? std::numeric_limits<size_t>::max() : maxInFlightSize),
+    inFlightSize_(0)
   {
+    if (storeThreadsCount > 1)
+    {
+      group_.reset(new OrthancPlugins::WorkersPool::TasksGroup(
+                     OrthancPlugins::WorkersPool::GetInstance(), storeThreadsCount));
+    }
   }
 
   virtual ~WadoRetrieveAnswer() ORTHANC_OVERRIDE
@@ -1103,6 +1266,22 @@ public:
     {
       reader_->CloseStream();
     }
+
+    if (group_.get() != NULL)
+    {
+      group_->WaitAll();
+      inFlight_.clear();
+      inFlightSizes_.clear();
+      inFlightSize_ = 0;
+
+      if (state_ != State_Canceled)
+      {
+        for (size_t i = 0; i < tasks_.size(); i++)
+        {
+          instances_.push_back(tasks_[i]->GetInstanceId());
+        }
+      }
+    }
   }
 
   virtual void AddHeader(const std::string& key,
@@ -1203,26 +1382,39 @@ public:
 
 
 class WadoRetrieveJob : 
-  public SingleFunctionJob,
-  private SingleFunctionJob::IFunctionFactory
+  public OrthancPlugins::SingleFunctionJob,
+  private OrthancPlugins::SingleFunctionJob::IFunctionFactory
 {
+public:
+  // Unit of the download of a study whose series or instances are
+  // listed by a QIDO-RS query against the remote server
+  enum Granularity
+  {
+    Granularity_Study,
+    Granularity_Series,
+    Granularity_Instance
+  };
+
 private:
   class Resource : public boost::noncopyable
   {
   private:
     std::string                        uri_;
     std::map<std::string, std::string> additionalHeaders_;
+    bool                               done_;
 
   public:
     explicit Resource(const std::string& uri) :
-      uri_(uri)
+      uri_(uri),
+      done_(false)
     {
     }
 
     Resource(const std::string& uri,
              const std::map<std::string, std::string>& additionalHeaders) :
       uri_(uri),
-      additionalHeaders_(additionalHeaders)
+      additionalHeaders_(additionalHeaders),
+      done_(false)
     {
     }
 
@@ -1235,6 +1427,28 @@ private:
     {
       return additionalHeaders_;
     }
+
+    bool IsDone() const
+    {
+      return done_;
+    }
+
+    void SetDone(bool done)
+    {
+      done_ = done;
+    }
+  };
+
+
+  // Study (or series) that must be split into smaller resources
+  // before being retrieved
+  struct ResourceToExpand
+  {
+    std::string                         study_;
+    std::string                         series_;  // Empty if the full study
+    Granularity                         granularity_;
+    std::map<std::string, std::string>  getArguments_;
+    std::map<std::string, std::string>  additionalHeaders_;
   };
 
 
@@ -1251,18 +1465,80 @@ private:
 
     virtual void Execute(JobContext& context) ORTHANC_OVERRIDE
     {
-      for (;;)
+      unsigned int connectionsCount;
+
+      {
+        boost::mutex::scoped_lock lock(that_.mutex_);
+
+        const Orthanc::WebServiceParameters server =
+          OrthancPlugins::DicomWebServers::GetInstance().GetServer(that_.serverName_);
+
+        connectionsCount = OrthancPlugins::DicomWebServers::GetUnsignedIntegerUserProperty(
+          server, RETRIEVE_CONNECTIONS, 1);
+
+        that_.maxRetries_ = OrthancPlugins::DicomWebServers::GetUnsignedIntegerUserProperty(
+          server, RETRIEVE_MAX_RETRIES, 0);
+
+        that_.retryDelay_ = OrthancPlugins::DicomWebServers::GetUnsignedIntegerUserProperty(
+          server, RETRIEVE_RETRY_DELAY, 1);
+
+        that_.storeThreadsCount_ = OrthancPlugins::Configuration::GetRetrieveStoreThreadsCount();
+        that_.hasError_ = false;
+      }
+
+      that_.ExpandResources(context);
+
       {
-        OrthancPlugins::HttpClient client;
+        boost::mutex::scoped_lock lock(that_.mutex_);
+
+        // Only retrieve the resources that were not retrieved by a
+        // previous execution of the job, if the job was paused or has failed
+        that_.pending_.clear();
 
-        if (that_.SetupNextResource(client, context))
+        for (size_t i = 0; i < that_.resources_.size(); i++)
         {
-          client.Execute(*that_.answer_);
-          that_.CloseResource(context);
+          assert(that_.resources_[i] != NULL);
+          if (!that_.resources_[i]->IsDone())
+          {
+            that_.pending_.push_back(i);
+          }
         }
-        else
+
+        connectionsCount = std::max(1u, std::min(connectionsCount, static_cast<unsigned int>(that_.pending_.size())));
+
+        // The budget of memory is shared by the connections
+        that_.maxInFlightSize_ = (static_cast<size_t>(OrthancPlugins::Configuration::GetRetrieveMaxInFlightSize()) *
+                                  1024 * 1024 / connectionsCount);
+      }
+
+      if (connectionsCount == 1)
+      {
+        that_.RetrieveResources(context);
+      }
+      else
+      {
+        std::vector<boost::shared_ptr<boost::thread> > connections(connectionsCount);
+
+        for (size_t i = 0; i < connections.size(); i++)
         {
-          return;   // We're done
+          connections[i].reset(new boost::thread(ConnectionWorker, &that_, &context));
+        }
+
+        for (size_t i = 0; i < connections.size(); i++)
+        {
+          if (connections[i]->joinable())
+          {
+            connections[i]->join();
+          }
+        }
+      }
+
+      {
+        boost::mutex::scoped_lock lock(that_.mutex_);
+
+        if (that_.hasError_)
+        {
+          throw Orthanc::OrthancException(that_.errorCode_, that_.errorDetails_);
         }
       }
     }
@@ -1271,32 +1547,433 @@ private:
 
   boost::mutex            mutex_;
   std::string             serverName_;
-  size_t                  position_;
+  std::deque<size_t>      pending_;    // Resources that are still to be retrieved
+  size_t                  completed_;  // Number of resources that have been retrieved
   std::vector<Resource*>  resources_;
+  std::list<ResourceToExpand>  toExpand_;
   bool                    stopped_;
+  bool                    canceled_;
   std::list<std::string>  retrievedInstances_;
-  std::unique_ptr<WadoRetrieveAnswer>  answer_;
+  size_t                  skippedInstances_;
+  std::set<WadoRetrieveAnswer*>  answers_;  // Answers being received by the connections
   uint64_t                networkSize_;
   bool                    debug_;
+  unsigned int            storeThreadsCount_;
+  size_t                  maxInFlightSize_;  // For each connection
+  unsigned int            maxRetries_;
+  unsigned int            retryDelay_;       // In seconds, doubled after each failure
+  bool                    hasError_;
+  Orthanc::ErrorCode      errorCode_;
+  std::string             errorDetails_;
+
 
-  bool SetupNextResource(OrthancPlugins::HttpClient& client,
-                         JobContext& context)
+  // DICOMweb JSON answer of a QIDO-RS request against the remote server
+  void QueryRemoteServer(Json::Value& answer,
+                         const std::string& uri,
+                         const std::map<std::string, std::string>& additionalHeaders)
+  {
+    OrthancPlugins::HttpClient client;
+
+    std::map<std::string, std::string> userProperties;
+    OrthancPlugins::DicomWebServers::GetInstance().ConfigureHttpClient(client, userProperties, serverName_, uri);
+    client.AddHeaders(additionalHeaders);
+    client.AddHeader("Accept", "application/dicom+json");
+
+    {
+      OrthancPlugins::ServerRequestTimer timer(serverName_);
+      OrthancPlugins::HttpHeaders answerHeaders;
+      client.Execute(answerHeaders, answer);
+      timer.SetSuccess();
+    }
+
+    if (answer.type() != Json::arrayValue)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_NetworkProtocol,
+                                      "The QIDO-RS answer of DICOMweb server \"" + serverName_ +
+                                      "\" is not a JSON array: " + uri);
+    }
+  }
+
+
+  static bool LookupDicomWebValue(std::string& target,
+                                  const Json::Value& item,
+                                  const std::string& tag)
+  {
+    if (item.type() == Json::objectValue &&
+        item.isMember(tag) &&
+        item[tag].type() == Json::objectValue &&
+        item[tag].isMember("Value") &&
+        item[tag]["Value"].type() == Json::arrayValue &&
+        item[tag]["Value"].size() == 1)
+    {
+      const Json::Value& value = item[tag]["Value"][0];
+
+      if (value.type() == Json::stringValue)
+      {
+        target = value.asString();
+        return true;
+      }
+      else if (value.isUInt())
+      {
+        target = boost::lexical_cast<std::string>(value.asUInt());
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+
+  // Returns the number of instances of the series that are stored by
+  // this Orthanc, indexed by their SeriesInstanceUID, together with
+  // the Orthanc identifier of the series
+  static void ListLocalSeries(std::map<std::string, std::pair<std::string, size_t> >& target,
+                              const std::string& studyInstanceUid)
+  {
+    Json::Value request;
+    request["Level"] = "Series";
+    request["Expand"] = true;
+    request["Query"]["StudyInstanceUID"] = studyInstanceUid;
+
+    Json::Value answer;
+    if (OrthancPlugins::RestApiPost(answer, "/tools/find", request, false) &&
+        answer.type() == Json::arrayValue)
+    {
+      for (Json::Value::ArrayIndex i = 0; i < answer.size(); i++)
+      {
+        std::string uid;
+        if (answer[i].isMember("MainDicomTags") &&
+            answer[i]["Instances"].type() == Json::arrayValue &&
+            OrthancPlugins::LookupStringValue(uid, answer[i]["MainDicomTags"], "SeriesInstanceUID"))
+        {
+          target[uid] = std::make_pair(answer[i]["ID"].asString(), static_cast<size_t>(answer[i]["Instances"].size()));
+        }
+      }
+    }
+  }
+
+
+  static void ListLocalInstances(std::set<std::string>& target,
+                                 const std::string& seriesId)
+  {
+    Json::Value answer;
+    if (OrthancPlugins::RestApiGet(answer, "/series/" + seriesId + "/instances", false) &&
+        answer.type() == Json::arrayValue)
+    {
+      for (Json::Value::ArrayIndex i = 0; i < answer.size(); i++)
+      {
+        std::string uid;
+        if (answer[i].isMember("MainDicomTags") &&
+            OrthancPlugins::LookupStringValue(uid, answer[i]["MainDicomTags"], "SOPInstanceUID"))
+        {
+          target.insert(uid);
+        }
+      }
+    }
+  }
+
+
+  // Lists the URIs of the series (or of the instances) of a study
+  // that must be retrieved, skipping the ones that are already
+  // stored by this Orthanc
+  void ExpandResource(std::list<std::string>& uris,
+                      size_t& skipped,
+                      const ResourceToExpand& resource)
+  {
+    static const std::string SERIES_INSTANCE_UID = "0020000E";
+    static const std::string SOP_INSTANCE_UID = "00080018";
+    static const std::string NUMBER_OF_SERIES_RELATED_INSTANCES = "00201209";
+
+    const std::string studyUri = "/studies/" + resource.study_;
+
+    std::map<std::string, std::pair<std::string, size_t> > localSeries;
+    ListLocalSeries(localSeries, resource.study_);
+
+    Json::Value remoteSeries;
+    QueryRemoteServer(remoteSeries, studyUri + "/series", resource.additionalHeaders_);
+
+    for (Json::Value::ArrayIndex i = 0; i < remoteSeries.size(); i++)
+    {
+      std::string seriesUid;
+      if (!LookupDicomWebValue(seriesUid, remoteSeries[i], SERIES_INSTANCE_UID) ||
+          (!resource.series_.empty() &&
+           seriesUid != resource.series_))
+      {
+        continue;
+      }
+
+      const std::string seriesUri = studyUri + "/series/" + seriesUid;
+
+      // The number of instances is optional in the QIDO-RS answer
+      bool hasCount = false;
+      size_t count = 0;
+
+      std::string s;
+      if (LookupDicomWebValue(s, remoteSeries[i], NUMBER_OF_SERIES_RELATED_INSTANCES))
+      {
+        try
+        {
+          count = boost::lexical_cast<size_t>(Orthanc::Toolbox::StripSpaces(s));
+          hasCount = true;
+        }
+        catch (boost::bad_lexical_cast&)
+        {
+        }
+      }
+
+      std::map<std::string, std::pair<std::string, size_t> >::const_iterator local = localSeries.find(seriesUid);
+
+      if (hasCount &&
+          local != localSeries.end() &&
+          local->second.second >= count)
+      {
+        skipped += count;   // The series is already fully stored
+      }
+      else if (resource.granularity_ == Granularity_Series ||
+               !hasCount)
+      {
+        uris.push_back(seriesUri);
+      }
+      else
+      {
+        Json::Value remoteInstances;
+        QueryRemoteServer(remoteInstances, seriesUri + "/instances", resource.additionalHeaders_);
+
+        if (remoteInstances.size() < count)
+        {
+          // The QIDO-RS answer has been truncated by the remote server
+          uris.push_back(seriesUri);
+        }
+        else
+        {
+          std::set<std::string> localInstances;
+          if (local != localSeries.end())
+          {
+            ListLocalInstances(localInstances, local->second.first);
+          }
+
+          for (Json::Value::ArrayIndex j = 0; j < remoteInstances.size(); j++)
+          {
+            std::string sopUid;
+            if (!LookupDicomWebValue(sopUid, remoteInstances[j], SOP_INSTANCE_UID))
+            {
+              throw Orthanc::OrthancException(Orthanc::ErrorCode_NetworkProtocol,
+                                              "Missing SOPInstanceUID in the QIDO-RS answer of DICOMweb server: " +
+                                              serverName_);
+            }
+            else if (localInstances.find(sopUid) != localInstances.end())
+            {
+              skipped++;
+            }
+            else
+            {
+              uris.push_back(seriesUri + "/instances/" + sopUid);
+            }
+          }
+        }
+      }
+    }
+
+    if (remoteSeries.size() == 0)
+    {
+      // Fallback if the remote server does not list the series
+      uris.push_back(resource.series_.empty() ? studyUri : studyUri + "/series/" + resource.series_);
+    }
+  }
+
+
+  void ExpandResources(JobContext& context)
+  {
+    for (;;)
+    {
+      ResourceToExpand resource;
+
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+
+        if (stopped_ ||
+            toExpand_.empty())
+        {
+          return;
+        }
+
+        resource = toExpand_.front();
+      }
+
+      std::list<std::string> uris;
+      size_t skipped = 0;
+      ExpandResource(uris, skipped, resource);
+
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+
+        for (std::list<std::string>::const_iterator it = uris.begin(); it != uris.end(); ++it)
+        {
+          std::string uri;
+          OrthancPlugins::DicomWebServers::UriEncode(uri, *it, resource.getArguments_);
+          resources_.push_back(new Resource(uri, resource.additionalHeaders_));
+        }
+
+        // The resource is only removed once expanded, so that the
+        // expansion is resumed if the job is paused or fails
+        toExpand_.pop_front();
+
+        skippedInstances_ += skipped;
+        context.SetContent("SkippedInstancesCount", boost::lexical_cast<std::string>(skippedInstances_));
+      }
+    }
+  }
+
+
+  bool TakeNextResource(size_t& index,
+                        JobContext& context)
   {
     boost::mutex::scoped_lock lock(mutex_);
 
     if (stopped_ ||
-        position_ == resources_.size())
+        pending_.empty())
     {
       return false;
     }
     else
     {
-      context.SetProgress(position_, resources_.size());
+      context.SetProgress(completed_, resources_.size());
+      index = pending_.front();
+      pending_.pop_front();
+      return true;
+    }
+  }
+
+
+  // Waits before retrying a resource, unless the job is stopped
+  // meanwhile. Returns "false" if the job is stopped.
+  bool WaitBeforeRetry(unsigned int attempt)
+  {
+    // Exponential backoff
+    const unsigned int delay = retryDelay_ * (1u << std::min(attempt, 6u));
+    const boost::posix_time::ptime end = (boost::posix_time::microsec_clock::universal_time() +
+                                          boost::posix_time::seconds(delay));
+
+    for (;;)
+    {
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+        if (stopped_)
+        {
+          return false;
+        }
+      }
+
+      if (boost::posix_time::microsec_clock::universal_time() >= end)
+      {
+        return true;
+      }
+
+      boost::this_thread::sleep(boost::posix_time::milliseconds(100));
+    }
+  }
 
-      answer_.reset(new WadoRetrieveAnswer);
-      answer_->SetDebug(debug_);
 
-      const Resource* resource = resources_[position_++];
+  // Loop run by each connection, until there is no more resource to
+  // be retrieved, or until the job is stopped
+  void RetrieveResources(JobContext& context)
+  {
+    size_t index;
+
+    while (TakeNextResource(index, context))
+    {
+      for (unsigned int attempt = 0; ; attempt++)
+      {
+        try
+        {
+          RetrieveResource(context, index);
+          break;
+        }
+        catch (Orthanc::OrthancException& e)
+        {
+          if (attempt < maxRetries_ &&
+              e.GetErrorCode() != Orthanc::ErrorCode_CanceledJob)
+          {
+            LOG(WARNING) << "Error while retrieving " << resources_[index]->GetUri() << " from DICOMweb server \""
+                         << serverName_ << "\", retrying (" << (attempt + 1) << "/" << maxRetries_ << "): " << e.What();
+
+            if (WaitBeforeRetry(attempt))
+            {
+              continue;
+            }
+          }
+
+          boost::mutex::scoped_lock lock(mutex_);
+
+          // The resource will be retrieved again if the job is resubmitted
+          pending_.push_front(index);
+
+          if (!hasError_)
+          {
+            hasError_ = true;
+            errorCode_ = e.GetErrorCode();
+            errorDetails_ = (e.HasDetails() ? e.GetDetails() : "");
+          }
+
+          // Don't start new downloads in the other connections
+          stopped_ = true;
+          return;
+        }
+      }
+    }
+  }
+
+
+  static void ConnectionWorker(WadoRetrieveJob* that,
+                               JobContext* context)
+  {
+    assert(that != NULL && context != NULL);
+    that->RetrieveResources(*context);
+  }
+
+
+  void RetrieveResource(JobContext& context,
+                        size_t index)
+  {
+    OrthancPlugins::HttpClient client;
+    std::unique_ptr<WadoRetrieveAnswer> answer;
+    SetupResource(client, answer, index);
+
+    try
+    {
+      OrthancPlugins::ServerRequestTimer timer(serverName_);
+      client.Execute(*answer);
+      answer->Close();
+      timer.SetSuccess();
+    }
+    catch (Orthanc::OrthancException&)
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      answers_.erase(answer.get());
+      throw;
+    }
+
+    CloseResource(context, *answer, index);
+  }
+
+
+  void SetupResource(OrthancPlugins::HttpClient& client,
+                     std::unique_ptr<WadoRetrieveAnswer>& answer,
+                     size_t index)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (stopped_)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_CanceledJob);
+    }
+    else
+    {
+      answer.reset(new WadoRetrieveAnswer(storeThreadsCount_, maxInFlightSize_));
+      answer->SetDebug(debug_);
+      answers_.insert(answer.get());
+
+      const Resource* resource = resources_[index];
       if (resource == NULL)
       {
         throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
@@ -1365,76 +2042,106 @@ private:
           client.AddHeader("Accept", "multipart/related; type=\"application/dicom\"; transfer-syntax=*");
         }
       }
-
-      return true;
     }
   }
 
 
-  void CloseResource(JobContext& context)
+  // The answer must have been closed
+  void CloseResource(JobContext& context,
+                     WadoRetrieveAnswer& answer,
+                     size_t index)
   {
     boost::mutex::scoped_lock lock(mutex_);
-    answer_->Close();
 
     std::list<std::string> instances;
-    answer_->GetReceivedInstances(instances);
-    networkSize_ += answer_->GetNetworkSize();
+    answer.GetReceivedInstances(instances);
+    networkSize_ += answer.GetNetworkSize();
 
-    answer_.reset();
+    answers_.erase(&answer);
 
     retrievedInstances_.splice(retrievedInstances_.end(), instances);
 
-    context.SetProgress(position_, resources_.size());
+    resources_[index]->SetDone(true);
+    completed_++;
+    context.SetProgress(completed_, resources_.size());
     context.SetContent("NetworkUsageMB", boost::lexical_cast<std::string>
                        (networkSize_ / static_cast<uint64_t>(1024 * 1024)));
     context.SetContent("ReceivedInstancesCount", boost::lexical_cast<std::string>(retrievedInstances_.size()));
   }
 
 
-  virtual void CancelFunction() ORTHANC_OVERRIDE
+  // The mutex must be locked
+  void StopConnections()
   {
-    boost::mutex::scoped_lock lock(mutex_);
-
     stopped_ = true;
-    if (answer_.get() != NULL)
-    {      
-      answer_->Cancel();
+
+    for (std::set<WadoRetrieveAnswer*>::iterator it = answers_.begin(); it != answers_.end(); ++it)
+    {
+      assert(*it != NULL);
+      (*it)->Cancel();
     }
   }
 
+  virtual void CancelFunction() ORTHANC_OVERRIDE
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    canceled_ = true;
+    StopConnections();
+  }
+
   virtual void PauseFunction() ORTHANC_OVERRIDE
   {
-    // This type of job cannot be paused
-    CancelFunction();
+    // The resources that are being downloaded are interrupted, and
+    // will be retrieved again once the job is resumed
+    boost::mutex::scoped_lock lock(mutex_);
+    StopConnections();
   }
 
   virtual IFunction* CreateFunction() ORTHANC_OVERRIDE
   {
-    // This type of job cannot be paused: If restarting, always go
-    // back to the beginning
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (canceled_)
+    {
+      // If restarting after a cancellation, go back to the beginning
+      for (size_t i = 0; i < resources_.size(); i++)
+      {
+        resources_[i]->SetDone(false);
+      }
+
+      completed_ = 0;
+      retrievedInstances_.clear();
+      canceled_ = false;
+    }
 
     stopped_ = false;
-    position_ = 0;
-    retrievedInstances_.clear();
 
     return new F(*this);
   }
 
 public:
   explicit WadoRetrieveJob(const std::string& serverName) :
-    SingleFunctionJob("DicomWebWadoRetrieveClient"),
+    OrthancPlugins::SingleFunctionJob("DicomWebWadoRetrieveClient"),
     serverName_(serverName),
-    position_(0),
+    completed_(0),
     stopped_(false),
+    canceled_(false),
+    skippedInstances_(0),
     networkSize_(0),
-    debug_(false)
+    debug_(false),
+    storeThreadsCount_(1),
+    maxInFlightSize_(0),
+    maxRetries_(0),
+    retryDelay_(1),
+    hasError_(false),
+    errorCode_(Orthanc::ErrorCode_Success)
   {
     SetFactory(*this);
   }
 
   virtual ~WadoRetrieveJob() ORTHANC_OVERRIDE
   {
-    SingleFunctionJob::Finalize();
+    OrthancPlugins::SingleFunctionJob::Finalize();
 
     for (size_t i = 0; i < resources_.size(); i++)
     {
@@ -1459,6 +2166,23 @@ public:
     resources_.push_back(new Resource(uri, additionalHeaders));
   }
 
+  // The study (or the series, if "series" is not empty) is split
+  // into resources of the given granularity, once the job is started
+  void AddResourceToExpand(const std::string& study,
+                           const std::string& series,
+                           Granularity granularity,
+                           const std::map<std::string, std::string>& getArguments,
+                           const std::map<std::string, std::string>& additionalHeaders)
+  {
+    ResourceToExpand resource;
+    resource.study_ = study;
+    resource.series_ = series;
+    resource.granularity_ = granularity;
+    resource.getArguments_ = getArguments;
+    resource.additionalHeaders_ = additionalHeaders;
+    toExpand_.push_back(resource);
+  }
+
   void AddResourceFromRequest(const Json::Value& resource)
   {
     std::string uri;
@@ -1513,6 +2237,7 @@ void RetrieveFromServer(OrthancPluginRestOutput* output,
   static const char* const STUDY = "Study";
   static const char* const SERIES = "Series";
   static const char* const INSTANCE = "Instance";
+  static const char* const GRANULARITY = "Granularity";
 
   if (request->method != OrthancPluginHttpMethod_Post)
   {
@@ -1535,6 +2260,31 @@ void RetrieveFromServer(OrthancPluginRestOutput* output,
   std::map<std::string, std::string> additionalHeaders;
   OrthancPlugins::ParseAssociativeArray(additionalHeaders, body, HTTP_HEADERS);
 
+  WadoRetrieveJob::Granularity granularity = WadoRetrieveJob::Granularity_Study;
+
+  std::string s;
+  if (OrthancPlugins::LookupStringValue(s, body, GRANULARITY))
+  {
+    if (s == "Study")
+    {
+      granularity = WadoRetrieveJob::Granularity_Study;
+    }
+    else if (s == "Series")
+    {
+      granularity = WadoRetrieveJob::Granularity_Series;
+    }
+    else if (s == "Instance")
+    {
+      granularity = WadoRetrieveJob::Granularity_Instance;
+    }
+    else
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                      "The \"" + std::string(GRANULARITY) + "\" field must be "
+                                      "\"Study\", \"Series\" or \"Instance\", found: " + s);
+    }
+  }
+
   std::unique_ptr<WadoRetrieveJob> job(new WadoRetrieveJob(serverName));
 
   if (body.type() != Json::objectValue ||
@@ -1576,6 +2326,13 @@ void RetrieveFromServer(OrthancPluginRestOutput* output,
                                       "Missing \"Series\" field in the body, as \"Instance\" is present");
     }
 
+    if (granularity != WadoRetrieveJob::Granularity_Study &&
+        instance.empty())
+    {
+      job->AddResourceToExpand(study, series, granularity, getArguments, additionalHeaders);
+      continue;
+    }
+
     std::string tmp = "/studies/" + study;
 
     if (!series.empty())
@@ -45,3 +45,5 @@ void RetrieveFromServer(OrthancPluginRestOutput* output,
 void WadoRetrieveClient(OrthancPluginRestOutput* output,
                         const char* url,
                         const OrthancPluginHttpRequest* request);
+
+void RefreshDicomWebClientMetrics();
@@ -25,9 +25,13 @@
 
 #include "../Resources/Orthanc/Plugins/OrthancPluginCppWrapper.h"
 
-#if !defined(NDEBUG)  // In debug mode, check that the value is actually a JSON string
-#  include <Toolbox.h>
-#endif
+#include <Toolbox.h>
+
+#include <boost/lexical_cast.hpp>
+#include <boost/math/special_functions/round.hpp>
+#include <algorithm>
+#include <cmath>
+#include <limits>
 
 
 namespace OrthancPlugins
@@ -41,6 +45,15 @@ namespace OrthancPlugins
   }
 
 
+  // Keys of the DICOMweb JSON
+  static std::string FormatKey(const Orthanc::DicomTag& tag)
+  {
+    char buf[16];
+    sprintf(buf, "%04X%04X", tag.GetGroup(), tag.GetElement());
+    return std::string(buf);
+  }
+
+
   void DicomWebFormatter::Callback(OrthancPluginDicomWebNode *node,
                                    OrthancPluginDicomWebSetBinaryNode setter,
                                    uint32_t levelDepth,
@@ -250,34 +263,484 @@ namespace OrthancPlugins
     }
   }
                   
-  void DicomWebFormatter::HttpWriter::AddOrthancMap(const Orthanc::DicomMap& value)
+  static void ToShortDicomAsJson(Json::Value& target,
+                                 const Orthanc::DicomMap& source)
   {
-    Json::Value json = Json::objectValue;
+    target = Json::objectValue;
 
     std::set<Orthanc::DicomTag> tags;
-    value.GetTags(tags);
+    source.GetTags(tags);
     
     // construct a "short" DicomAsJson that can be used in CreateDicom
     for (std::set<Orthanc::DicomTag>::const_iterator
            it = tags.begin(); it != tags.end(); ++it)
     {
-      const Orthanc::DicomValue& v = value.GetValue(*it);
+      const Orthanc::DicomValue& v = source.GetValue(*it);
       if (v.IsSequence())
       {
-        json[it->Format()] = Json::arrayValue;
-        ToShortDicomAsJson(json[it->Format()], v.GetSequenceContent());
+        target[it->Format()] = Json::arrayValue;
+        ToShortDicomAsJson(target[it->Format()], v.GetSequenceContent());
       }
       else
       {
         std::string s;
-        if (value.LookupStringValue(s, *it, false))
+        if (source.LookupStringValue(s, *it, false))
+        {
+          target[it->Format()] = s;
+        }
+      }
+    }
+  }
+
+
+  namespace
+  {
+    struct KnownTag
+    {
+      uint16_t     group_;
+      uint16_t     element_;
+      const char*  vr_;
+    };
+
+    // VR of the tags that are found in the QIDO-RS answers and in the
+    // "MainDicomTags" metadata, sorted by tag
+    const KnownTag KNOWN_TAGS[] = {
+      { 0x0008, 0x0005, "CS" },  // SpecificCharacterSet
+      { 0x0008, 0x0012, "DA" },  // InstanceCreationDate
+      { 0x0008, 0x0013, "TM" },  // InstanceCreationTime
+      { 0x0008, 0x0016, "UI" },  // SOPClassUID
+      { 0x0008, 0x0018, "UI" },  // SOPInstanceUID
+      { 0x0008, 0x0020, "DA" },  // StudyDate
+      { 0x0008, 0x0021, "DA" },  // SeriesDate
+      { 0x0008, 0x0022, "DA" },  // AcquisitionDate
+      { 0x0008, 0x0023, "DA" },  // ContentDate
+      { 0x0008, 0x0030, "TM" },  // StudyTime
+      { 0x0008, 0x0031, "TM" },  // SeriesTime
+      { 0x0008, 0x0032, "TM" },  // AcquisitionTime
+      { 0x0008, 0x0033, "TM" },  // ContentTime
+      { 0x0008, 0x0050, "SH" },  // AccessionNumber
+      { 0x0008, 0x0056, "CS" },  // InstanceAvailability
+      { 0x0008, 0x0060, "CS" },  // Modality
+      { 0x0008, 0x0061, "CS" },  // ModalitiesInStudy
+      { 0x0008, 0x0062, "UI" },  // SOPClassesInStudy
+      { 0x0008, 0x0070, "LO" },  // Manufacturer
+      { 0x0008, 0x0080, "LO" },  // InstitutionName
+      { 0x0008, 0x0090, "PN" },  // ReferringPhysicianName
+      { 0x0008, 0x0201, "SH" },  // TimezoneOffsetFromUTC
+      { 0x0008, 0x1010, "SH" },  // StationName
+      { 0x0008, 0x1030, "LO" },  // StudyDescription
+      { 0x0008, 0x103e, "LO" },  // SeriesDescription
+      { 0x0008, 0x1070, "PN" },  // OperatorsName
+      { 0x0008, 0x1190, "UR" },  // RetrieveURL
+      { 0x0010, 0x0010, "PN" },  // PatientName
+      { 0x0010, 0x0020, "LO" },  // PatientID
+      { 0x0010, 0x0021, "LO" },  // IssuerOfPatientID
+      { 0x0010, 0x0030, "DA" },  // PatientBirthDate
+      { 0x0010, 0x0040, "CS" },  // PatientSex
+      { 0x0010, 0x1000, "LO" },  // OtherPatientIDs
+      { 0x0010, 0x1010, "AS" },  // PatientAge
+      { 0x0010, 0x1020, "DS" },  // PatientSize
+      { 0x0010, 0x1030, "DS" },  // PatientWeight
+      { 0x0018, 0x0010, "LO" },  // ContrastBolusAgent
+      { 0x0018, 0x0015, "CS" },  // BodyPartExamined
+      { 0x0018, 0x0024, "SH" },  // SequenceName
+      { 0x0018, 0x0050, "DS" },  // SliceThickness
+      { 0x0018, 0x1030, "LO" },  // ProtocolName
+      { 0x0018, 0x1090, "IS" },  // CardiacNumberOfImages
+      { 0x0018, 0x1400, "LO" },  // AcquisitionDeviceProcessingDescription
+      { 0x0020, 0x000d, "UI" },  // StudyInstanceUID
+      { 0x0020, 0x000e, "UI" },  // SeriesInstanceUID
+      { 0x0020, 0x0010, "SH" },  // StudyID
+      { 0x0020, 0x0011, "IS" },  // SeriesNumber
+      { 0x0020, 0x0012, "IS" },  // AcquisitionNumber
+      { 0x0020, 0x0013, "IS" },  // InstanceNumber
+      { 0x0020, 0x0032, "DS" },  // ImagePositionPatient
+      { 0x0020, 0x0037, "DS" },  // ImageOrientationPatient
+      { 0x0020, 0x0100, "IS" },  // TemporalPositionIdentifier
+      { 0x0020, 0x0105, "IS" },  // NumberOfTemporalPositions
+      { 0x0020, 0x1002, "IS" },  // ImagesInAcquisition
+      { 0x0020, 0x1200, "IS" },  // NumberOfPatientRelatedStudies
+      { 0x0020, 0x1202, "IS" },  // NumberOfPatientRelatedSeries
+      { 0x0020, 0x1204, "IS" },  // NumberOfPatientRelatedInstances
+      { 0x0020, 0x1206, "IS" },  // NumberOfStudyRelatedSeries
+      { 0x0020, 0x1208, "IS" },  // NumberOfStudyRelatedInstances
+      { 0x0020, 0x1209, "IS" },  // NumberOfSeriesRelatedInstances
+      { 0x0020, 0x4000, "LT" },  // ImageComments
+      { 0x0028, 0x0008, "IS" },  // NumberOfFrames
+      { 0x0028, 0x0010, "US" },  // Rows
+      { 0x0028, 0x0011, "US" },  // Columns
+      { 0x0028, 0x0030, "DS" },  // PixelSpacing
+      { 0x0028, 0x0100, "US" },  // BitsAllocated
+      { 0x0032, 0x1032, "PN" },  // RequestingPhysician
+      { 0x0032, 0x1060, "LO" },  // RequestedProcedureDescription
+      { 0x0040, 0x0244, "DA" },  // PerformedProcedureStepStartDate
+      { 0x0040, 0x0245, "TM" },  // PerformedProcedureStepStartTime
+      { 0x0040, 0x0254, "LO" },  // PerformedProcedureStepDescription
+      { 0x0054, 0x0081, "US" },  // NumberOfSlices
+      { 0x0054, 0x0101, "US" },  // NumberOfTimeSlices
+      { 0x0054, 0x1000, "CS" },  // SeriesType
+      { 0x0054, 0x1330, "US" }   // ImageIndex
+    };
+
+    bool IsLowerTag(const KnownTag& a,
+                    const Orthanc::DicomTag& b)
+    {
+      return (a.group_ < b.GetGroup() ||
+              (a.group_ == b.GetGroup() && a.element_ < b.GetElement()));
+    }
+  }
+
+
+  static const char* LookupKnownTag(const Orthanc::DicomTag& tag)
+  {
+    const KnownTag* end = KNOWN_TAGS + sizeof(KNOWN_TAGS) / sizeof(KnownTag);
+    const KnownTag* found = std::lower_bound(KNOWN_TAGS, end, tag, IsLowerTag);
+
+    if (found != end &&
+        found->group_ == tag.GetGroup() &&
+        found->element_ == tag.GetElement())
+    {
+      return found->vr_;
+    }
+    else
+    {
+      return NULL;
+    }
+  }
+
+
+  // Same conversions as in "DicomWebJsonVisitor" of the Orthanc framework
+  static Json::Value FormatInteger(int64_t value)
+  {
+    if (value < 0)
+    {
+      return Json::Value(static_cast<int32_t>(value));
+    }
+    else
+    {
+      return Json::Value(static_cast<uint32_t>(value));
+    }
+  }
+
+
+  static Json::Value FormatDouble(double value)
+  {
+    try
+    {
+      long long a = boost::math::llround<double>(value);
+
+      double d = fabs(value - static_cast<double>(a));
+
+      if (d <= std::numeric_limits<double>::epsilon() * 100.0)
+      {
+        return FormatInteger(a);
+      }
+      else
+      {
+        return Json::Value(value);
+      }
+    }
+    catch (boost::math::rounding_error&)
+    {
+      // Can occur if "long long" is too small to receive this value
+      // (e.g. infinity)
+      return Json::Value(value);
+    }
+  }
+
+
+  static bool HasPadding(const std::string& value)
+  {
+    // Padding is removed by DCMTK in the CreateDicom round-trip
+    return (!value.empty() &&
+            (value[0] == ' ' ||
+             value[value.size() - 1] == ' ' ||
+             value[value.size() - 1] == '\0'));
+  }
+
+
+  static bool FormatValue(Json::Value& target,
+                          const std::string& vr,
+                          const std::string& value)
+  {
+    std::vector<std::string> tokens;
+    Orthanc::Toolbox::TokenizeString(tokens, value, '\\');
+
+    if (tokens.size() > 1 &&
+        (vr == "LT" || vr == "UR"))
+    {
+      return false;  // Backslashes are not delimiters for these VRs
+    }
+
+    target = Json::arrayValue;
+
+    for (size_t i = 0; i < tokens.size(); i++)
+    {
+      const std::string& token = tokens[i];
+
+      if (vr == "PN")
+      {
+        if (HasPadding(token))
+        {
+          return false;
+        }
+
+        Json::Value name = Json::objectValue;
+        if (!token.empty())
+        {
+          std::vector<std::string> components;
+          Orthanc::Toolbox::TokenizeString(components, token, '=');
+
+          if (components.size() >= 1)
+          {
+            name["Alphabetic"] = components[0];
+          }
+
+          if (components.size() >= 2)
+          {
+            name["Ideographic"] = components[1];
+          }
+
+          if (components.size() >= 3)
+          {
+            name["Phonetic"] = components[2];
+          }
+        }
+
+        target.append(name);
+      }
+      else if (vr == "IS" ||
+               vr == "DS" ||
+               vr == "US")
+      {
+        const std::string t = Orthanc::Toolbox::StripSpaces(token);
+
+        if (t.empty())
+        {
+          if (vr == "US")
+          {
+            return false;
+          }
+
+          target.append(Json::nullValue);
+        }
+        else
+        {
+          try
+          {
+            if (vr == "DS")
+            {
+              target.append(FormatDouble(boost::lexical_cast<double>(t)));
+            }
+            else
+            {
+              const int64_t v = boost::lexical_cast<int64_t>(t);
+              if (vr == "US" &&
+                  (v < 0 || v > 65535))
+              {
+                return false;
+              }
+
+              target.append(FormatInteger(v));
+            }
+          }
+          catch (boost::bad_lexical_cast&)
+          {
+            return false;  // The Orthanc core would log a warning
+          }
+        }
+      }
+      else
+      {
+        if (HasPadding(token))
+        {
+          return false;
+        }
+        else if (token.empty())
+        {
+          target.append(Json::nullValue);
+        }
+        else
+        {
+          target.append(token);
+        }
+      }
+    }
+
+    return true;
+  }
+
+
+  void DicomWebFormatter::AddBulkDataElements(Json::Value& target,
+                                              const DicomHeaderScanner::LargeElements& elements,
+                                              const std::string& bulkRoot)
+  {
+    for (DicomHeaderScanner::LargeElements::const_iterator
+           it = elements.begin(); it != elements.end(); ++it)
+    {
+      // Same URI as in "Callback()"
+      std::string uri = bulkRoot;
+      Json::Value* node = &target;
+
+      for (size_t i = 0; i < it->parents_.size() && node != NULL; i++)
+      {
+        const Orthanc::DicomTag& sequence = it->parents_[i].first;
+        const size_t index = it->parents_[i].second;
+
+        uri += ("/" + FormatTag(sequence.GetGroup(), sequence.GetElement()) + "/" +
+                boost::lexical_cast<std::string>(index + 1));
+
+        const std::string key = FormatKey(sequence);
+
+        if (node->type() == Json::objectValue &&
+            node->isMember(key) &&
+            (*node) [key].isMember("Value") &&
+            (*node) [key]["Value"].type() == Json::arrayValue &&
+            index < (*node) [key]["Value"].size())
+        {
+          node = &(*node) [key]["Value"][static_cast<Json::Value::ArrayIndex>(index)];
+        }
+        else
+        {
+          node = NULL;
+        }
+      }
+
+      if (node != NULL &&
+          node->type() == Json::objectValue)
+      {
+        uri += "/" + FormatTag(it->tag_.GetGroup(), it->tag_.GetElement());
+
+        Json::Value& element = (*node) [FormatKey(it->tag_)];
+        element = Json::objectValue;
+        element["vr"] = it->vr_;
+        element["BulkDataURI"] = uri;
+      }
+      else
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError,
+                                        "Cannot locate the parent of tag " + FormatKey(it->tag_) +
+                                        " in the DICOMweb JSON");
+      }
+    }
+  }
+
+
+  bool DicomWebFormatter::ConvertToDicomWebJson(Json::Value& target,
+                                                const Orthanc::DicomMap& source)
+  {
+    // The strings must be in UTF-8, otherwise the Orthanc core would
+    // convert them from the default encoding
+    std::string encoding;
+    if (!source.LookupStringValue(encoding, Orthanc::DICOM_TAG_SPECIFIC_CHARACTER_SET, false) ||
+        encoding != "ISO_IR 192")
+    {
+      return false;
+    }
+
+    target = Json::objectValue;
+
+    std::set<Orthanc::DicomTag> tags;
+    source.GetTags(tags);
+
+    for (std::set<Orthanc::DicomTag>::const_iterator
+           it = tags.begin(); it != tags.end(); ++it)
+    {
+      const Orthanc::DicomValue& value = source.GetValue(*it);
+
+      std::string s;
+      if (value.IsSequence())
+      {
+        return false;
+      }
+      else if (source.LookupStringValue(s, *it, false))
+      {
+        const char* vr = LookupKnownTag(*it);
+        if (vr == NULL)
         {
-          json[it->Format()] = s;
+          return false;
         }
+
+        char key[16];
+        sprintf(key, "%04X%04X", it->GetGroup(), it->GetElement());
+
+        Json::Value& node = target[key];
+        node["vr"] = vr;
+
+        if (!s.empty() &&
+            !FormatValue(node["Value"], vr, s))
+        {
+          return false;
+        }
+      }
+    }
+
+    return true;
+  }
+
+
+  bool DicomWebFormatter::SerializeToDicomWebJson(std::string& target,
+                                                  const Orthanc::DicomMap& source)
+  {
+    Json::Value dicomweb;
+
+    if (ConvertToDicomWebJson(dicomweb, source))
+    {
+      // Same serialization as in "DicomWebBinaryFormatter::Apply()" of
+      // the Orthanc core, which must be built against the same JsonCpp
+      target = dicomweb.toStyledString();
+      return true;
+    }
+    else
+    {
+      return false;
+    }
+  }
+
+
+  void DicomWebFormatter::HttpWriter::AddOrthancMap(const Orthanc::DicomMap& value)
+  {
+    // The XML answers are out of the scope of the direct conversion
+    std::string item;
+
+    if (isXml_ ||
+        !SerializeToDicomWebJson(item, value))
+    {
+      Json::Value json;
+      ToShortDicomAsJson(json, value);
+      AddOrthancJson(json);
+      return;
+    }
+
+#if !defined(NDEBUG)
+    {
+      // In debug mode, check that the result is the same as building a
+      // DICOM file and converting it by the Orthanc core
+      Json::Value json;
+      ToShortDicomAsJson(json, value);
+
+      std::string expected;
+      DicomWebFormatter::Apply(expected, context_, json, false, OrthancPluginDicomWebBinaryMode_Ignore, "");
+
+      if (expected != item)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError,
+                                        "Mismatch in the direct DICOMweb conversion, expected: " +
+                                        expected + " - found: " + item);
       }
     }
+#endif
     
-    AddOrthancJson(json);
+    if (first_)
+    {
+      first_ = false;
+    }
+    else
+    {
+      jsonBuffer_.AddChunk(",");
+    }
+
+    jsonBuffer_.AddChunk(item);
   }
 
 
@@ -27,6 +27,7 @@
 #include <DicomFormat/DicomMap.h>
 
 #include "../Resources/Orthanc/Plugins/OrthancPluginCppWrapper.h"
+#include "DicomHeaderScanner.h"
 
 #include <json/value.h>
 
@@ -82,6 +83,24 @@ namespace OrthancPlugins
                       OrthancPluginDicomWebBinaryMode mode,
                       const std::string& bulkRoot);
 
+    // Direct conversion of the main DICOM tags to DICOMweb JSON,
+    // without the CreateDicom round-trip through the Orthanc core.
+    // Returns "false" if some tag cannot be safely converted.
+    static bool ConvertToDicomWebJson(Json::Value& target,
+                                      const Orthanc::DicomMap& source);
+
+    // Same as "ConvertToDicomWebJson()", serialized byte by byte as
+    // the Orthanc core serializes the DICOMweb JSON of a DICOM file
+    static bool SerializeToDicomWebJson(std::string& target,
+                                        const Orthanc::DicomMap& source);
+
+    // Adds a "BulkDataURI" to the DICOMweb JSON of an instance for each
+    // of the elements that were left out by
+    // "DicomHeaderScanner::RemoveLargeBinaryElements()"
+    static void AddBulkDataElements(Json::Value& target,
+                                    const DicomHeaderScanner::LargeElements& elements,
+                                    const std::string& bulkRoot);
+
     class HttpWriter : public boost::noncopyable
     {
     private:
@@ -29,7 +29,10 @@
 #include <Toolbox.h>
 #include <Logging.h>
 
+#include <cctype>
+#include <set>
 #include <boost/algorithm/string/predicate.hpp>
+#include <boost/lexical_cast.hpp>
 
 namespace OrthancPlugins
 {
@@ -95,6 +98,34 @@ namespace OrthancPlugins
   }
 
 
+  unsigned int DicomWebServers::GetUnsignedIntegerUserProperty(const Orthanc::WebServiceParameters& parameters,
+                                                               const std::string& key,
+                                                               unsigned int defaultValue)
+  {
+    std::string value;
+    if (!parameters.LookupUserProperty(value, key))
+    {
+      return defaultValue;
+    }
+
+    try
+    {
+      int tmp = boost::lexical_cast<int>(Orthanc::Toolbox::StripSpaces(value));
+      if (tmp >= 0)
+      {
+        return static_cast<unsigned int>(tmp);
+      }
+    }
+    catch (boost::bad_lexical_cast&)
+    {
+    }
+
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                    "The property \"" + key + "\" of a DICOMweb server "
+                                    "must be a non-negative integer, found: " + value);
+  }
+
+
   Orthanc::WebServiceParameters DicomWebServers::GetServer(const std::string& name)
   {
     boost::mutex::scoped_lock lock(mutex_);
@@ -219,6 +250,86 @@ namespace OrthancPlugins
 
 
 
+  void DicomWebServers::RecordRequest(const std::string& name,
+                                      uint64_t latencyMicroseconds,
+                                      bool success)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    Statistics& statistics = statistics_[name];
+    statistics.requests_++;
+    statistics.recentRequests_++;
+    statistics.recentLatencyMicroseconds_ += latencyMicroseconds;
+
+    if (!success)
+    {
+      statistics.failures_++;
+    }
+  }
+
+
+  void DicomWebServers::RefreshMetrics()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    std::set<std::string> usedNames;
+
+    for (std::map<std::string, Statistics>::iterator it = statistics_.begin(); it != statistics_.end(); ++it)
+    {
+      // The names of the metrics can only contain alphanumeric characters and underscores
+      std::string name;
+      Orthanc::Toolbox::ToLowerCase(name, it->first);
+
+      for (size_t i = 0; i < name.size(); i++)
+      {
+        if (!isalnum(static_cast<unsigned char>(name[i])))
+        {
+          name[i] = '_';
+        }
+      }
+
+      // Servers whose names only differ by non-alphanumeric characters
+      // (e.g. "a-b" and "a_b") would share the same metrics: Add a
+      // suffix to keep them apart. As "statistics_" is sorted, the
+      // suffixes are stable from one refresh to the next.
+      if (usedNames.find(name) != usedNames.end())
+      {
+        unsigned int suffix = 2;
+        while (usedNames.find(name + "_" + boost::lexical_cast<std::string>(suffix)) != usedNames.end())
+        {
+          suffix++;
+        }
+
+        name += "_" + boost::lexical_cast<std::string>(suffix);
+      }
+
+      usedNames.insert(name);
+
+      const std::string prefix = "orthanc_dicomweb_client_" + name;
+      Statistics& statistics = it->second;
+
+      SetMetricsValue((prefix + "_requests").c_str(), static_cast<int64_t>(statistics.requests_));
+      SetMetricsValue((prefix + "_failures").c_str(), static_cast<int64_t>(statistics.failures_));
+
+      // Average latency of the requests since the previous refresh
+      SetMetricsValue((prefix + "_latency_ms").c_str(),
+                      statistics.recentRequests_ == 0 ? 0.0f :
+                      static_cast<float>(statistics.recentLatencyMicroseconds_) /
+                      (1000.0f * static_cast<float>(statistics.recentRequests_)));
+
+      statistics.recentRequests_ = 0;
+      statistics.recentLatencyMicroseconds_ = 0;
+    }
+  }
+
+
+  ServerRequestTimer::~ServerRequestTimer()
+  {
+    const boost::posix_time::time_duration elapsed = boost::posix_time::microsec_clock::universal_time() - start_;
+    DicomWebServers::GetInstance().RecordRequest(name_, elapsed.total_microseconds(), success_);
+  }
+
+
   void CallServer(MemoryBuffer& answerBody /* out */,
                   std::map<std::string, std::string>& answerHeaders /* out */,
                   const Orthanc::WebServiceParameters& server,
@@ -28,6 +28,7 @@
 
 #include <list>
 #include <string>
+#include <boost/date_time/posix_time/posix_time.hpp>
 #include <boost/thread/mutex.hpp>
 #include <json/value.h>
 
@@ -38,8 +39,25 @@ namespace OrthancPlugins
   private:
     typedef std::map<std::string, Orthanc::WebServiceParameters*>  Servers;
 
-    boost::mutex  mutex_;
-    Servers       servers_;
+    struct Statistics
+    {
+      uint64_t  requests_;
+      uint64_t  failures_;
+      uint64_t  recentRequests_;               // Since the last refresh of the metrics
+      uint64_t  recentLatencyMicroseconds_;
+
+      Statistics() :
+        requests_(0),
+        failures_(0),
+        recentRequests_(0),
+        recentLatencyMicroseconds_(0)
+      {
+      }
+    };
+
+    boost::mutex                        mutex_;
+    Servers                             servers_;
+    std::map<std::string, Statistics>   statistics_;
 
     DicomWebServers()  // Forbidden (singleton pattern)
     {
@@ -61,6 +79,11 @@ namespace OrthancPlugins
 
     static DicomWebServers& GetInstance();
 
+    // The user properties of the remote servers are strings
+    static unsigned int GetUnsignedIntegerUserProperty(const Orthanc::WebServiceParameters& parameters,
+                                                       const std::string& key,
+                                                       unsigned int defaultValue);
+
     Orthanc::WebServiceParameters GetServer(const std::string& name);
 
     void ListServers(std::list<std::string>& servers);
@@ -78,6 +101,39 @@ namespace OrthancPlugins
     void SerializeGlobalProperty(std::string& target);
 
     void UnserializeGlobalProperty(const std::string& source);
+
+    void RecordRequest(const std::string& name,
+                       uint64_t latencyMicroseconds,
+                       bool success);
+
+    void RefreshMetrics();
+  };
+
+
+  // Measures one HTTP request to a remote DICOMweb server, for the
+  // metrics. The request is reported as failed, unless "SetSuccess()"
+  // is called before the destruction of the timer.
+  class ServerRequestTimer : public boost::noncopyable
+  {
+  private:
+    std::string               name_;
+    boost::posix_time::ptime  start_;
+    bool                      success_;
+
+  public:
+    explicit ServerRequestTimer(const std::string& name) :
+      name_(name),
+      start_(boost::posix_time::microsec_clock::universal_time()),
+      success_(false)
+    {
+    }
+
+    ~ServerRequestTimer();
+
+    void SetSuccess()
+    {
+      success_ = true;
+    }
   };
 
 
@@ -0,0 +1,316 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#include "FramesRequestParser.h"
+
+#include <OrthancException.h>
+#include <Toolbox.h>
+
+#include <boost/algorithm/string/replace.hpp>
+#include <boost/lexical_cast.hpp>
+
+
+namespace OrthancPlugins
+{
+  static void TokenizeAndNormalize(std::vector<std::string>& tokens,
+                                   const std::string& source,
+                                   char separator)
+  {
+    Orthanc::Toolbox::TokenizeString(tokens, source, separator);
+
+    for (size_t i = 0; i < tokens.size(); i++)
+    {
+      tokens[i] = Orthanc::Toolbox::StripSpaces(tokens[i]);
+      Orthanc::Toolbox::ToLowerCase(tokens[i]);
+    }
+  }
+
+
+  static void RemoveSurroundingQuotes(std::string& value)
+  {
+    if (!value.empty() &&
+        value[0] == '\"' &&
+        value[value.size() - 1] == '\"')
+    {
+      value = value.substr(1, value.size() - 2);
+    }  
+  }
+
+
+  void FramesRequestParser::ParseTransferSyntax(Orthanc::DicomTransferSyntax& syntax,
+                                                const OrthancPluginHttpRequest* request)
+  {
+    for (uint32_t i = 0; i < request->headersCount; i++)
+    {
+      std::string key(request->headersKeys[i]);
+      Orthanc::Toolbox::ToLowerCase(key);
+
+      if (key == "accept")
+      {
+        std::vector<std::string> tokens;
+        TokenizeAndNormalize(tokens, request->headersValues[i], ';');
+
+        if (tokens.size() == 0 ||
+            tokens[0] == "*/*")
+        {
+          syntax = Orthanc::DicomTransferSyntax_LittleEndianExplicit;
+          return;
+        }
+
+        if (tokens[0] != "multipart/related")
+        {
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange, "expecting 'Accept: multipart/related' HTTP header");
+        }
+
+        std::string type("application/octet-stream");
+        std::string transferSyntax;
+
+        for (size_t j = 1; j < tokens.size(); j++)
+        {
+          std::vector<std::string> parsed;
+          TokenizeAndNormalize(parsed, tokens[j], '=');
+
+          if (parsed.size() != 2)
+          {
+            throw Orthanc::OrthancException(Orthanc::ErrorCode_BadRequest);
+          }
+
+          if (parsed[0] == "type")
+          {
+            type = parsed[1];
+            RemoveSurroundingQuotes(type);
+          }
+
+          if (parsed[0] == "transfer-syntax")
+          {
+            transferSyntax = parsed[1];
+            RemoveSurroundingQuotes(transferSyntax);
+          }
+        }
+
+        if (type == "application/octet-stream")
+        {
+          if (transferSyntax.empty())
+          {
+            syntax = Orthanc::DicomTransferSyntax_LittleEndianExplicit;
+            return;
+          }
+          else if (transferSyntax == "*")
+          {
+            // don't change transferSyntax, it must have been set to the 'current' value before calling this method
+            return;
+          }
+          else
+          {
+            if (!Orthanc::LookupTransferSyntax(syntax, transferSyntax))
+            {
+              throw Orthanc::OrthancException(Orthanc::ErrorCode_NotImplemented,
+                                              "Unknown transfer syntax in 'Accept' header: " + transferSyntax);
+            }
+            return;         
+          }
+        }
+        else
+        {
+          /**
+           * DICOM 2017c
+           * http://dicom.nema.org/medical/dicom/current/output/html/part18.html#table_6.1.1.8-3b
+           **/
+          if (type == "image/jpeg" && (transferSyntax.empty() ||  // Default
+                                       transferSyntax == "1.2.840.10008.1.2.4.70"))
+          {
+            syntax = Orthanc::DicomTransferSyntax_JPEGProcess14SV1;
+            return;
+          }
+          else if (type == "image/jpeg" && transferSyntax == "1.2.840.10008.1.2.4.50")
+          {
+            syntax = Orthanc::DicomTransferSyntax_JPEGProcess1;
+            return;
+          }
+          else if (type == "image/jpeg" && transferSyntax == "1.2.840.10008.1.2.4.51")
+          {
+            syntax = Orthanc::DicomTransferSyntax_JPEGProcess2_4;
+            return;
+          }
+          else if (type == "image/jpeg" && transferSyntax == "1.2.840.10008.1.2.4.57")
+          {
+            syntax = Orthanc::DicomTransferSyntax_JPEGProcess14;
+            return;
+          }
+          else if ((type == "image/x-dicom-rle" ||   // Table 6.1.1.8-3b of DICOM 2017c (backward compatibility)
+                    type == "image/dicom-rle") &&    // Table 8.7.3-5 of DICOM 2021a
+                   (transferSyntax.empty() ||        // Default
+                    transferSyntax == "1.2.840.10008.1.2.5"))
+          {
+            syntax = Orthanc::DicomTransferSyntax_RLELossless;
+            return;
+          }
+          else if ((type == "image/x-jls" ||   // Table 6.1.1.8-3b of DICOM 2017c (backward compatibility)
+                    type == "image/jls") &&    // Table 8.7.3-5 of DICOM 2021a
+                   (transferSyntax.empty() ||  // Default
+                    transferSyntax == "1.2.840.10008.1.2.4.80"))
+          {
+            syntax = Orthanc::DicomTransferSyntax_JPEGLSLossless;
+            return;
+          }
+          else if ((type == "image/x-jls" ||   // Table 6.1.1.8-3b of DICOM 2017c (backward compatibility)
+                    type == "image/jls") &&    // Table 8.7.3-5 of DICOM 2021a
+                   transferSyntax == "1.2.840.10008.1.2.4.81")
+          {
+            syntax = Orthanc::DicomTransferSyntax_JPEGLSLossy;
+            return;
+          }
+          else if (type == "image/jp2" && (transferSyntax.empty() ||  // Default
+                                           transferSyntax == "1.2.840.10008.1.2.4.90"))
+          {
+            syntax = Orthanc::DicomTransferSyntax_JPEG2000LosslessOnly;
+            return;
+          }
+          else if (type == "image/jp2" && transferSyntax == "1.2.840.10008.1.2.4.91")
+          {
+            syntax = Orthanc::DicomTransferSyntax_JPEG2000;
+            return;
+          }
+          else if (type == "image/jpx" && (transferSyntax.empty() ||  // Default
+                                           transferSyntax == "1.2.840.10008.1.2.4.92"))
+          {
+            syntax = Orthanc::DicomTransferSyntax_JPEG2000MulticomponentLosslessOnly;
+            return;
+          }
+          else if (type == "image/jpx" && transferSyntax == "1.2.840.10008.1.2.4.93")
+          {
+            syntax = Orthanc::DicomTransferSyntax_JPEG2000Multicomponent;
+            return;
+          }
+
+
+          /**
+           * Backward compatibility with DICOM 2014a
+           * http://dicom.nema.org/medical/dicom/2014a/output/html/part18.html#table_6.5-1
+           **/
+          if (type == "image/dicom+jpeg" && transferSyntax == "1.2.840.10008.1.2.4.50")
+          {
+            syntax = Orthanc::DicomTransferSyntax_JPEGProcess1;
+            return;
+          }
+          else if (type == "image/dicom+jpeg" && transferSyntax == "1.2.840.10008.1.2.4.51")
+          {
+            syntax = Orthanc::DicomTransferSyntax_JPEGProcess2_4;
+            return;
+          }
+          else if (type == "image/dicom+jpeg" && transferSyntax == "1.2.840.10008.1.2.4.57")
+          {
+            syntax = Orthanc::DicomTransferSyntax_JPEGProcess14;
+            return;
+          }
+          else if (type == "image/dicom+jpeg" && (transferSyntax.empty() ||
+                                                  transferSyntax == "1.2.840.10008.1.2.4.70"))
+          {
+            syntax = Orthanc::DicomTransferSyntax_JPEGProcess14SV1;
+            return;
+          }
+          else if (type == "image/dicom+rle" && (transferSyntax.empty() ||
+                                                 transferSyntax == "1.2.840.10008.1.2.5"))
+          {
+            syntax = Orthanc::DicomTransferSyntax_RLELossless;
+            return;
+          }
+          else if (type == "image/dicom+jpeg-ls" && (transferSyntax.empty() ||
+                                                     transferSyntax == "1.2.840.10008.1.2.4.80"))
+          {
+            syntax = Orthanc::DicomTransferSyntax_JPEGLSLossless;
+            return;
+          }
+          else if (type == "image/dicom+jpeg-ls" && transferSyntax == "1.2.840.10008.1.2.4.81")
+          {
+            syntax = Orthanc::DicomTransferSyntax_JPEGLSLossy;
+            return;
+          }
+          else if (type == "image/dicom+jp2" && (transferSyntax.empty() ||
+                                                 transferSyntax == "1.2.840.10008.1.2.4.90"))
+          {
+            syntax = Orthanc::DicomTransferSyntax_JPEG2000LosslessOnly;
+            return;
+          }
+          else if (type == "image/dicom+jp2" && transferSyntax == "1.2.840.10008.1.2.4.91")
+          {
+            syntax = Orthanc::DicomTransferSyntax_JPEG2000;
+            return;
+          }
+          else if (type == "image/dicom+jpx" && (transferSyntax.empty() ||
+                                                 transferSyntax == "1.2.840.10008.1.2.4.92"))
+          {
+            syntax = Orthanc::DicomTransferSyntax_JPEG2000MulticomponentLosslessOnly;
+            return;
+          }
+          else if (type == "image/dicom+jpx" && transferSyntax == "1.2.840.10008.1.2.4.93")
+          {
+            syntax = Orthanc::DicomTransferSyntax_JPEG2000Multicomponent;
+            return;
+          }
+
+          throw Orthanc::OrthancException(
+            Orthanc::ErrorCode_BadRequest,
+            "DICOMweb RetrieveFrames: Transfer syntax \"" + 
+            transferSyntax + "\" is incompatible with media type \"" + type + "\"");
+        }
+      }
+    }
+
+    // By default, DICOMweb expects Little Endian uncompressed pixel data
+    syntax = Orthanc::DicomTransferSyntax_LittleEndianExplicit;
+  }
+
+
+  void FramesRequestParser::ParseFrameList(std::list<unsigned int>& frames,
+                                           const OrthancPluginHttpRequest* request)
+  {
+    frames.clear();
+
+    if (request->groupsCount <= 3 ||
+        request->groups[3] == NULL)
+    {
+      return;
+    }
+
+    std::string source(request->groups[3]);
+    Orthanc::Toolbox::ToLowerCase(source);
+    boost::replace_all(source, "%2c", ",");
+
+    std::vector<std::string> tokens;
+    Orthanc::Toolbox::TokenizeString(tokens, source, ',');
+
+    for (size_t i = 0; i < tokens.size(); i++)
+    {
+      int frame = boost::lexical_cast<int>(tokens[i]);
+      if (frame <= 0)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                        "Invalid frame number (must be > 0): " + tokens[i]);
+      }
+
+      frames.push_back(static_cast<unsigned int>(frame - 1));
+    }
+  }
+}
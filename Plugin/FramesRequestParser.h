@@ -0,0 +1,50 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#pragma once
+
+#include <Enumerations.h>
+#include <orthanc/OrthancCPlugin.h>
+
+#include <list>
+
+
+namespace OrthancPlugins
+{
+  // Parsing of the parameters of the WADO-RS RetrieveFrames requests
+  class FramesRequestParser
+  {
+  public:
+    // Reads the transfer syntax from the "Accept" HTTP header. If the
+    // header requests "transfer-syntax=*", "syntax" is left unchanged,
+    // so it must be initialized with the current transfer syntax.
+    static void ParseTransferSyntax(Orthanc::DicomTransferSyntax& syntax,
+                                    const OrthancPluginHttpRequest* request);
+
+    // Reads the 1-based list of frames from the 4th group of the URI
+    // (e.g. "1,2,3" or "1%2C2"). The frames in "frames" are 0-based.
+    static void ParseFrameList(std::list<unsigned int>& frames,
+                               const OrthancPluginHttpRequest* request);
+  };
+}
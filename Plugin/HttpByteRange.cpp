@@ -0,0 +1,149 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#include "HttpByteRange.h"
+
+#include <Toolbox.h>
+
+#include <boost/lexical_cast.hpp>
+
+
+static bool ParsePosition(uint64_t& target,
+                          const std::string& s)
+{
+  if (s.empty() ||
+      s.size() > 19 /* avoid overflows */)
+  {
+    return false;
+  }
+
+  for (size_t i = 0; i < s.size(); i++)
+  {
+    if (s[i] < '0' ||
+        s[i] > '9')
+    {
+      return false;
+    }
+  }
+
+  target = boost::lexical_cast<uint64_t>(s);
+  return true;
+}
+
+
+namespace OrthancPlugins
+{
+  HttpByteRange::Result HttpByteRange::Parse(uint64_t& first,
+                                             uint64_t& last,
+                                             const std::string& header,
+                                             uint64_t size)
+  {
+    const size_t equal = header.find('=');
+    if (equal == std::string::npos)
+    {
+      return Result_Ignored;
+    }
+
+    std::string unit = Orthanc::Toolbox::StripSpaces(header.substr(0, equal));
+    Orthanc::Toolbox::ToLowerCase(unit);
+
+    if (unit != "bytes")
+    {
+      return Result_Ignored;
+    }
+
+    const std::string s = Orthanc::Toolbox::StripSpaces(header.substr(equal + 1));
+
+    const size_t dash = s.find('-');
+    if (dash == std::string::npos ||
+        s.find(',') != std::string::npos)
+    {
+      return Result_Ignored;
+    }
+
+    const std::string start = Orthanc::Toolbox::StripSpaces(s.substr(0, dash));
+    const std::string end = Orthanc::Toolbox::StripSpaces(s.substr(dash + 1));
+
+    if (start.empty())
+    {
+      // Suffix range: The last bytes of the content
+      uint64_t suffix;
+      if (!ParsePosition(suffix, end))
+      {
+        return Result_Ignored;
+      }
+      else if (suffix == 0 ||
+               size == 0)
+      {
+        return Result_Unsatisfiable;
+      }
+      else
+      {
+        first = (suffix >= size ? 0 : size - suffix);
+        last = size - 1;
+        return Result_Satisfiable;
+      }
+    }
+
+    uint64_t a;
+    if (!ParsePosition(a, start))
+    {
+      return Result_Ignored;
+    }
+
+    uint64_t b = 0;
+    const bool hasEnd = !end.empty();
+
+    if (hasEnd &&
+        (!ParsePosition(b, end) || b < a))
+    {
+      return Result_Ignored;
+    }
+
+    if (a >= size)
+    {
+      return Result_Unsatisfiable;
+    }
+
+    first = a;
+    last = (hasEnd && b < size ? b : size - 1);
+    return Result_Satisfiable;
+  }
+
+
+  std::string HttpByteRange::FormatContentRange(uint64_t first,
+                                                uint64_t last,
+                                                uint64_t size)
+  {
+    return ("bytes " + boost::lexical_cast<std::string>(first) + "-" +
+            boost::lexical_cast<std::string>(last) + "/" +
+            boost::lexical_cast<std::string>(size));
+  }
+
+
+  std::string HttpByteRange::FormatUnsatisfiedRange(uint64_t size)
+  {
+    return "bytes */" + boost::lexical_cast<std::string>(size);
+  }
+}
@@ -0,0 +1,62 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#pragma once
+
+#include <stdint.h>
+#include <string>
+
+namespace OrthancPlugins
+{
+  // Parser of the "Range" HTTP header (RFC 9110), restricted to one
+  // single range of bytes, which is what the ranged retrievals of
+  // bulk data use.  A header that is malformed, that uses another
+  // unit, or that contains several ranges is ignored, in which case
+  // the full content must be answered with "200 OK" as allowed by the
+  // RFC.
+  class HttpByteRange
+  {
+  public:
+    enum Result
+    {
+      Result_Ignored,
+      Result_Satisfiable,     // Answer "206 Partial Content"
+      Result_Unsatisfiable    // Answer "416 Range Not Satisfiable"
+    };
+
+    // "first" and "last" are inclusive, and only set if satisfiable
+    static Result Parse(uint64_t& first,
+                        uint64_t& last,
+                        const std::string& header,
+                        uint64_t size);
+
+    // Value of the "Content-Range" HTTP header for "206 Partial Content"
+    static std::string FormatContentRange(uint64_t first,
+                                          uint64_t last,
+                                          uint64_t size);
+
+    // Value of the "Content-Range" HTTP header for "416 Range Not Satisfiable"
+    static std::string FormatUnsatisfiedRange(uint64_t size);
+  };
+}
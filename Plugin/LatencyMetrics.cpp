@@ -0,0 +1,389 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#include "LatencyMetrics.h"
+
+#include "../Resources/Orthanc/Plugins/OrthancPluginCppWrapper.h"
+
+#include <OrthancException.h>
+
+#include <limits>
+#include <boost/functional/hash.hpp>
+#include <boost/thread.hpp>
+#include <boost/thread/tss.hpp>
+
+
+namespace OrthancPlugins
+{
+  // Upper bounds of the buckets, in milliseconds
+  static const double BUCKETS_BOUNDS[LatencyHistogram::BUCKETS_COUNT - 1] = {
+    0.1, 0.25, 0.5, 1, 2.5, 5, 10, 25, 50, 100, 250, 500, 1000, 2500, 5000, 10000, 25000, 60000
+  };
+
+
+  void LatencyHistogram::Clear()
+  {
+    for (unsigned int i = 0; i < BUCKETS_COUNT; i++)
+    {
+      counts_[i] = 0;
+    }
+
+    total_ = 0;
+  }
+
+
+  void LatencyHistogram::Add(uint64_t microseconds)
+  {
+    const double milliseconds = static_cast<double>(microseconds) / 1000.0;
+
+    unsigned int bucket = 0;
+    while (bucket < BUCKETS_COUNT - 1 &&
+           milliseconds > BUCKETS_BOUNDS[bucket])
+    {
+      bucket++;
+    }
+
+    counts_[bucket]++;
+    total_++;
+  }
+
+
+  void LatencyHistogram::Merge(const LatencyHistogram& other)
+  {
+    for (unsigned int i = 0; i < BUCKETS_COUNT; i++)
+    {
+      counts_[i] += other.counts_[i];
+    }
+
+    total_ += other.total_;
+  }
+
+
+  uint64_t LatencyHistogram::GetBucketCount(unsigned int bucket) const
+  {
+    if (bucket >= BUCKETS_COUNT)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+    else
+    {
+      return counts_[bucket];
+    }
+  }
+
+
+  double LatencyHistogram::GetBucketUpperBound(unsigned int bucket)
+  {
+    if (bucket >= BUCKETS_COUNT)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+    else if (bucket == BUCKETS_COUNT - 1)
+    {
+      return std::numeric_limits<double>::infinity();
+    }
+    else
+    {
+      return BUCKETS_BOUNDS[bucket];
+    }
+  }
+
+
+  double LatencyHistogram::GetQuantile(double q) const
+  {
+    if (q < 0.0 ||
+        q > 1.0)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+
+    if (total_ == 0)
+    {
+      return 0;
+    }
+
+    const double rank = q * static_cast<double>(total_);
+
+    uint64_t cumulated = 0;
+
+    for (unsigned int i = 0; i < BUCKETS_COUNT; i++)
+    {
+      if (counts_[i] > 0 &&
+          static_cast<double>(cumulated + counts_[i]) >= rank)
+      {
+        const double lower = (i == 0 ? 0.0 : BUCKETS_BOUNDS[i - 1]);
+
+        if (i == BUCKETS_COUNT - 1)
+        {
+          // The last bucket has no upper bound: Report its lower bound, as Prometheus
+          return lower;
+        }
+        else
+        {
+          const double upper = BUCKETS_BOUNDS[i];
+          return lower + (upper - lower) * (rank - static_cast<double>(cumulated)) / static_cast<double>(counts_[i]);
+        }
+      }
+
+      cumulated += counts_[i];
+    }
+
+    return BUCKETS_BOUNDS[BUCKETS_COUNT - 2];  // Only reached because of rounding errors
+  }
+
+
+  LatencyMetrics::LatencyMetrics()
+  {
+    for (unsigned int i = 0; i < LatencyRoute_Count; i++)
+    {
+      for (unsigned int j = 0; j < LatencyStage_Count; j++)
+      {
+        totalCounts_[i][j] = 0;
+      }
+    }
+  }
+
+
+  LatencyMetrics& LatencyMetrics::GetInstance()
+  {
+    static LatencyMetrics instance;
+    return instance;
+  }
+
+
+  const char* LatencyMetrics::GetRouteName(LatencyRoute route)
+  {
+    switch (route)
+    {
+      case LatencyRoute_Qido:
+        return "qido";
+
+      case LatencyRoute_WadoRsDicom:
+        return "wadors_dicom";
+
+      case LatencyRoute_WadoRsMetadata:
+        return "wadors_metadata";
+
+      case LatencyRoute_WadoRsFrames:
+        return "wadors_frames";
+
+      case LatencyRoute_WadoRsRendered:
+        return "wadors_rendered";
+
+      case LatencyRoute_WadoUri:
+        return "wadouri";
+
+      case LatencyRoute_Stow:
+        return "stow";
+
+      default:
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+  }
+
+
+  const char* LatencyMetrics::GetStageName(LatencyStage stage)
+  {
+    switch (stage)
+    {
+      case LatencyStage_Total:
+        return "total";
+
+      case LatencyStage_Locate:
+        return "locate";
+
+      case LatencyStage_Load:
+        return "load";
+
+      case LatencyStage_Transcode:
+        return "transcode";
+
+      case LatencyStage_Format:
+        return "format";
+
+      case LatencyStage_Send:
+        return "send";
+
+      default:
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+  }
+
+
+  void LatencyMetrics::Record(LatencyRoute route,
+                              LatencyStage stage,
+                              uint64_t microseconds)
+  {
+    if (route >= LatencyRoute_Count ||
+        stage >= LatencyStage_Count)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+
+    Shard& shard = shards_[boost::hash<boost::thread::id>()(boost::this_thread::get_id()) % SHARDS_COUNT];
+
+    boost::mutex::scoped_lock lock(shard.mutex_);
+    shard.histograms_[route][stage].Add(microseconds);
+  }
+
+
+  void LatencyMetrics::Collect(LatencyHistogram (&target)[LatencyRoute_Count][LatencyStage_Count])
+  {
+    for (unsigned int i = 0; i < SHARDS_COUNT; i++)
+    {
+      boost::mutex::scoped_lock lock(shards_[i].mutex_);
+
+      for (unsigned int route = 0; route < LatencyRoute_Count; route++)
+      {
+        for (unsigned int stage = 0; stage < LatencyStage_Count; stage++)
+        {
+          LatencyHistogram& histogram = shards_[i].histograms_[route][stage];
+
+          if (histogram.GetCount() > 0)
+          {
+            target[route][stage].Merge(histogram);
+            histogram.Clear();
+          }
+        }
+      }
+    }
+  }
+
+
+  void LatencyMetrics::RefreshMetrics()
+  {
+    boost::mutex::scoped_lock lock(refreshMutex_);
+
+    LatencyHistogram recent[LatencyRoute_Count][LatencyStage_Count];
+    Collect(recent);
+
+    for (unsigned int route = 0; route < LatencyRoute_Count; route++)
+    {
+      for (unsigned int stage = 0; stage < LatencyStage_Count; stage++)
+      {
+        const LatencyHistogram& histogram = recent[route][stage];
+        totalCounts_[route][stage] += histogram.GetCount();
+
+        if (totalCounts_[route][stage] > 0)
+        {
+          const std::string prefix = (std::string("orthanc_dicomweb_latency_") +
+                                      GetRouteName(static_cast<LatencyRoute>(route)) + "_" +
+                                      GetStageName(static_cast<LatencyStage>(stage)));
+
+          OrthancPlugins::SetMetricsValue((prefix + "_count").c_str(), static_cast<int64_t>(totalCounts_[route][stage]));
+          OrthancPlugins::SetMetricsValue((prefix + "_p50_ms").c_str(), static_cast<float>(histogram.GetQuantile(0.50)));
+          OrthancPlugins::SetMetricsValue((prefix + "_p95_ms").c_str(), static_cast<float>(histogram.GetQuantile(0.95)));
+          OrthancPlugins::SetMetricsValue((prefix + "_p99_ms").c_str(), static_cast<float>(histogram.GetQuantile(0.99)));
+        }
+      }
+    }
+  }
+
+
+  static void DontDeleteRouteTimer(LatencyRouteTimer*)
+  {
+    // The timers are allocated on the stack of the threads
+  }
+
+  static boost::thread_specific_ptr<LatencyRouteTimer>  currentRouteTimer_(DontDeleteRouteTimer);
+
+
+  LatencyStageTimer::LatencyStageTimer(LatencyStage stage) :
+    active_(false),
+    route_(LatencyRoute_Count),
+    stage_(stage)
+  {
+    const LatencyRouteTimer* current = LatencyRouteTimer::GetCurrent();
+    if (current != NULL)
+    {
+      active_ = true;
+      route_ = current->GetRoute();
+      start_ = boost::posix_time::microsec_clock::universal_time();
+    }
+  }
+
+
+  LatencyStageTimer::LatencyStageTimer(LatencyRoute route,
+                                       LatencyStage stage) :
+    active_(true),
+    route_(route),
+    stage_(stage),
+    start_(boost::posix_time::microsec_clock::universal_time())
+  {
+  }
+
+
+  LatencyStageTimer::~LatencyStageTimer()
+  {
+    try
+    {
+      Stop();
+    }
+    catch (Orthanc::OrthancException&)
+    {
+    }
+  }
+
+
+  void LatencyStageTimer::Stop()
+  {
+    if (active_)
+    {
+      active_ = false;
+
+      const boost::posix_time::time_duration elapsed = boost::posix_time::microsec_clock::universal_time() - start_;
+      LatencyMetrics::GetInstance().Record(route_, stage_, elapsed.total_microseconds());
+    }
+  }
+
+
+  LatencyRouteTimer::LatencyRouteTimer(LatencyRoute route) :
+    route_(route),
+    previous_(currentRouteTimer_.get()),
+    start_(boost::posix_time::microsec_clock::universal_time())
+  {
+    currentRouteTimer_.reset(this);
+  }
+
+
+  LatencyRouteTimer::~LatencyRouteTimer()
+  {
+    currentRouteTimer_.reset(previous_);
+
+    try
+    {
+      const boost::posix_time::time_duration elapsed = boost::posix_time::microsec_clock::universal_time() - start_;
+      LatencyMetrics::GetInstance().Record(route_, LatencyStage_Total, elapsed.total_microseconds());
+    }
+    catch (Orthanc::OrthancException&)
+    {
+    }
+  }
+
+
+  LatencyRouteTimer* LatencyRouteTimer::GetCurrent()
+  {
+    return currentRouteTimer_.get();
+  }
+}
@@ -0,0 +1,187 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#pragma once
+
+#include <stdint.h>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+
+namespace OrthancPlugins
+{
+  enum LatencyRoute
+  {
+    LatencyRoute_Qido,
+    LatencyRoute_WadoRsDicom,
+    LatencyRoute_WadoRsMetadata,
+    LatencyRoute_WadoRsFrames,
+    LatencyRoute_WadoRsRendered,
+    LatencyRoute_WadoUri,
+    LatencyRoute_Stow,
+    LatencyRoute_Count  // Not a route, must be last
+  };
+
+  enum LatencyStage
+  {
+    LatencyStage_Total,      // Whole request
+    LatencyStage_Locate,     // Lookup of the DICOM UIDs in the database
+    LatencyStage_Load,       // Reading the DICOM instances or their tags (storing them for STOW-RS)
+    LatencyStage_Transcode,  // Transcoding, decoding and rendering of the images
+    LatencyStage_Format,     // Generation of the DICOMweb JSON/XML
+    LatencyStage_Send,       // Sending the answer to the HTTP client
+    LatencyStage_Count       // Not a stage, must be last
+  };
+
+
+  // Histogram of durations with fixed buckets, from which quantiles
+  // can be estimated as in Prometheus ("histogram_quantile()")
+  class LatencyHistogram
+  {
+  public:
+    static const unsigned int BUCKETS_COUNT = 19;  // The last bucket has no upper bound
+
+  private:
+    uint64_t  counts_[BUCKETS_COUNT];
+    uint64_t  total_;
+
+  public:
+    LatencyHistogram()
+    {
+      Clear();
+    }
+
+    void Clear();
+
+    void Add(uint64_t microseconds);
+
+    void Merge(const LatencyHistogram& other);
+
+    uint64_t GetCount() const
+    {
+      return total_;
+    }
+
+    uint64_t GetBucketCount(unsigned int bucket) const;
+
+    // In milliseconds. The bound of the last bucket is infinite.
+    static double GetBucketUpperBound(unsigned int bucket);
+
+    // Estimates the quantile ("q" between 0 and 1) in milliseconds,
+    // by linear interpolation within the bucket.  Returns 0 if the
+    // histogram is empty.
+    double GetQuantile(double q) const;
+  };
+
+
+  // Plugin-wide latency histograms, for each route and each stage of
+  // the routes.  The samples are recorded into shards that are
+  // selected by the ID of the calling thread, so that concurrent
+  // requests do not contend on one shared mutex.
+  class LatencyMetrics : public boost::noncopyable
+  {
+  private:
+    static const unsigned int SHARDS_COUNT = 16;
+
+    struct Shard
+    {
+      boost::mutex      mutex_;
+      LatencyHistogram  histograms_[LatencyRoute_Count][LatencyStage_Count];
+    };
+
+    Shard         shards_[SHARDS_COUNT];
+    boost::mutex  refreshMutex_;
+    uint64_t      totalCounts_[LatencyRoute_Count][LatencyStage_Count];  // Protected by "refreshMutex_"
+
+  public:
+    LatencyMetrics();
+
+    static LatencyMetrics& GetInstance();
+
+    static const char* GetRouteName(LatencyRoute route);
+
+    static const char* GetStageName(LatencyStage stage);
+
+    void Record(LatencyRoute route,
+                LatencyStage stage,
+                uint64_t microseconds);
+
+    // Merges the samples recorded since the previous call into
+    // "target", and clears the shards
+    void Collect(LatencyHistogram (&target)[LatencyRoute_Count][LatencyStage_Count]);
+
+    // Publishes the 50th, 95th and 99th percentiles of the samples
+    // recorded since the previous refresh, and the total count of
+    // samples, for the routes and stages that have been used
+    void RefreshMetrics();
+  };
+
+
+  // Records the duration of one stage of a request.  If no route is
+  // given, the stage is attributed to the route of the enclosing
+  // "LatencyRouteTimer" of the calling thread, if any.
+  class LatencyStageTimer : public boost::noncopyable
+  {
+  private:
+    bool                      active_;
+    LatencyRoute              route_;
+    LatencyStage              stage_;
+    boost::posix_time::ptime  start_;
+
+  public:
+    explicit LatencyStageTimer(LatencyStage stage);
+
+    LatencyStageTimer(LatencyRoute route,
+                      LatencyStage stage);
+
+    ~LatencyStageTimer();
+
+    // Records the duration now, instead of at the destruction
+    void Stop();
+  };
+
+
+  // Records the total duration of a request, and sets the route to
+  // which the "LatencyStageTimer" of the calling thread are attributed
+  class LatencyRouteTimer : public boost::noncopyable
+  {
+  private:
+    LatencyRoute              route_;
+    LatencyRouteTimer*        previous_;
+    boost::posix_time::ptime  start_;
+
+  public:
+    explicit LatencyRouteTimer(LatencyRoute route);
+
+    ~LatencyRouteTimer();
+
+    LatencyRoute GetRoute() const
+    {
+      return route_;
+    }
+
+    // Returns NULL if the calling thread is not serving a route
+    static LatencyRouteTimer* GetCurrent();
+  };
+}
@@ -21,12 +21,20 @@
  **/
 
 #include "../Resources/Orthanc/Plugins/OrthancPluginCppWrapper.h"
+#include "BulkDataCache.h"
+#include "CacheWarmer.h"
 #include "DicomWebClient.h"
 #include "DicomWebServers.h"
+#include "LatencyMetrics.h"
+#include "QidoResultsCache.h"
 #include "QidoRs.h"
+#include "RenderedFramesCache.h"
+#include "ResourceLookupCache.h"
 #include "StowRs.h"
+#include "TranscodedInstancesCache.h"
 #include "WadoRs.h"
 #include "WadoUri.h"
+#include "WorkersPool.h"
 
 #include <Logging.h>
 #include <SystemToolbox.h>
@@ -397,7 +405,12 @@ void DeleteClient(OrthancPluginRestOutput* output,
     std::map<std::string, std::string> userProperties;
     OrthancPlugins::DicomWebServers::GetInstance().ConfigureHttpClient(client, userProperties, serverName, uri);
     client.SetMethod(OrthancPluginHttpMethod_Delete);
-    client.Execute();
+
+    {
+      OrthancPlugins::ServerRequestTimer timer(serverName);
+      client.Execute();
+      timer.SetSuccess();
+    }
 
     std::string tmp = "{}";
     OrthancPluginAnswerBuffer(context, output, tmp.c_str(), tmp.size(), "application/json");
@@ -469,8 +482,34 @@ void ServeDicomWebClient(OrthancPluginRestOutput* output,
 static void RefreshMetricsCallback()
 {
   RefreshWadoRsMetrics();
+  RefreshQidoRsMetrics();
+  OrthancPlugins::StowServer::RefreshMetrics();
+  RefreshDicomWebClientMetrics();
+  OrthancPlugins::DicomWebServers::GetInstance().RefreshMetrics();
+  OrthancPlugins::CacheWarmer::GetInstance().RefreshMetrics();
+  OrthancPlugins::LatencyMetrics::GetInstance().RefreshMetrics();
+}
+
+static bool IsAuthorizationPluginLoaded()
+{
+  Json::Value plugins;
+  if (OrthancPlugins::RestApiGet(plugins, "/plugins", false) &&
+      plugins.type() == Json::arrayValue)
+  {
+    for (Json::Value::ArrayIndex i = 0; i < plugins.size(); i++)
+    {
+      if (plugins[i].type() == Json::stringValue &&
+          plugins[i].asString() == "authorization")
+      {
+        return true;
+      }
+    }
+  }
+
+  return false;
 }
 
+
 static OrthancPluginErrorCode OnChangeCallback(OrthancPluginChangeType changeType, 
                                                OrthancPluginResourceType resourceType, 
                                                const char *resourceId)
@@ -508,13 +547,76 @@ static OrthancPluginErrorCode OnChangeCallback(OrthancPluginChangeType changeTyp
           }
         }
 
+        if (OrthancPlugins::CacheWarmer::GetInstance().IsStarted() &&
+            OrthancPlugins::Configuration::GetCacheWarmingStartupDays() > 0)
+        {
+          EnqueueRecentStudiesWarmUp(OrthancPlugins::Configuration::GetCacheWarmingStartupDays());
+        }
+
+        if (OrthancPlugins::ResourceLookupCache::GetInstance().IsEnabled() &&
+            IsAuthorizationPluginLoaded())
+        {
+          // A hit of the cache skips "/tools/find", which is the only
+          // call of the UID lookups that the authorization plugin filters
+          LOG(WARNING) << "DicomWEB: \"ResourceLookupCacheTTL\" is ignored, as the cache of the "
+                       << "UID lookups cannot be used together with the authorization plugin";
+          OrthancPlugins::ResourceLookupCache::GetInstance().SetParameters(
+            0, OrthancPlugins::Configuration::GetResourceLookupCacheSize());
+        }
+
       }; break;
 
       case OrthancPluginChangeType_StableSeries:
+        if (OrthancPlugins::CacheWarmer::GetInstance().IsStarted())
+        {
+          break;  // The series are processed by the cache warmer on "StableStudy"
+        }
+
         if (!OrthancPlugins::Configuration::IsReadOnly())
         {
           CacheSeriesMetadata(resourceId);
         }
+
+        if (OrthancPlugins::Configuration::IsRenderedCachePregenerate())
+        {
+          PregenerateSeriesThumbnail(resourceId);
+        }
+        break;
+
+      case OrthancPluginChangeType_StableStudy:
+        if (OrthancPlugins::CacheWarmer::GetInstance().IsStarted() &&
+            !OrthancPlugins::CacheWarmer::GetInstance().Enqueue(resourceId))
+        {
+          LOG(WARNING) << "DicomWEB: the queue of the cache warmer is full, dropping study " << resourceId;
+        }
+        break;
+
+      case OrthancPluginChangeType_NewInstance:
+        // The instance might have been overwritten, its parsed/transcoded
+        // version and its metadata must not be served anymore
+        OrthancPlugins::TranscodedInstancesCache::GetInstance().Invalidate(resourceId);
+        OrthancPlugins::RenderedFramesCache::GetInstance().Invalidate(resourceId);
+        OrthancPlugins::BulkDataCache::GetInstance().Invalidate(resourceId);
+        OrthancPlugins::ResourceLookupCache::GetInstance().Invalidate(resourceId);
+        OrthancPlugins::QidoResultsCache::GetInstance().Invalidate();
+        break;
+
+      case OrthancPluginChangeType_UpdatedMetadata:
+        OrthancPlugins::ResourceLookupCache::GetInstance().Invalidate(resourceId);
+        break;
+
+      case OrthancPluginChangeType_Deleted:
+        if (resourceType == OrthancPluginResourceType_Instance)
+        {
+          OrthancPlugins::TranscodedInstancesCache::GetInstance().Invalidate(resourceId);
+          OrthancPlugins::RenderedFramesCache::GetInstance().Invalidate(resourceId);
+          OrthancPlugins::BulkDataCache::GetInstance().Invalidate(resourceId);
+        }
+
+        // The children of the deleted resource are not notified and
+        // cannot be identified from their Orthanc IDs: flush the lookups
+        OrthancPlugins::ResourceLookupCache::GetInstance().Clear();
+        OrthancPlugins::QidoResultsCache::GetInstance().Invalidate();
         break;
 
       default:
@@ -712,10 +814,14 @@ extern "C"
         if (!OrthancPlugins::Configuration::IsReadOnly())
         {
           OrthancPlugins::RegisterRestCallback<UpdateSeriesMetadataCache>("/studies/([^/]*)/update-dicomweb-cache", true);
+          OrthancPlugins::RegisterRestCallback<UpdatePatientMetadataCache>("/patients/([^/]*)/update-dicomweb-cache", true);
+          OrthancPlugins::RegisterRestCallback<UpdateArchiveMetadataCache>("/tools/update-dicomweb-cache", true);
         }
 
         OrthancPluginRegisterOnChangeCallback(context, OnChangeCallback);
 
+        OrthancPluginRegisterJobsUnserializer(context, UnserializeUpdateMetadataCacheJob);
+
         OrthancPluginRegisterRefreshMetricsCallback(context, RefreshMetricsCallback);
 
         // Extend the default Orthanc Explorer with custom JavaScript for STOW client
@@ -755,7 +861,41 @@ extern "C"
         LOG(WARNING) << "The DICOMweb plugin will use "
                      << (OrthancPlugins::Configuration::GetWadoRsLoaderThreadsCount() == 0 ? 1 :
                          OrthancPlugins::Configuration::GetWadoRsLoaderThreadsCount())
-                     << " threads to load DICOM files for WADO-RS queries";
+                     << " threads per WADO-RS query to load DICOM files";
+
+        OrthancPlugins::TranscodedInstancesCache::GetInstance().SetLimits(
+          static_cast<size_t>(OrthancPlugins::Configuration::GetRetrieveFramesCacheSize()) * 1024 * 1024,
+          OrthancPlugins::Configuration::GetRetrieveFramesCacheMaxInstances());
+        OrthancPlugins::RenderedFramesCache::GetInstance().SetMaxSize(
+          static_cast<size_t>(OrthancPlugins::Configuration::GetRenderedCacheSize()) * 1024 * 1024);
+        OrthancPlugins::BulkDataCache::GetInstance().SetMaxSize(
+          static_cast<size_t>(OrthancPlugins::Configuration::GetBulkDataCacheSize()) * 1024 * 1024);
+        OrthancPlugins::TranscodedInstancesCache::GetInstance().SetCoalescingWindow(
+          OrthancPlugins::Configuration::GetRetrieveFramesCoalescingWindow());
+
+        OrthancPlugins::ResourceLookupCache::GetInstance().SetParameters(
+          OrthancPlugins::Configuration::GetResourceLookupCacheTTL(),
+          OrthancPlugins::Configuration::GetResourceLookupCacheSize());
+
+        OrthancPlugins::QidoResultsCache::GetInstance().SetParameters(
+          static_cast<size_t>(OrthancPlugins::Configuration::GetQidoCacheSize()) * 1024 * 1024,
+          OrthancPlugins::Configuration::GetQidoCacheMaxStaleness());
+
+        // The workers are shared by the WADO-RS loaders and the metadata workers of all the requests
+        const unsigned int workersCount = OrthancPlugins::Configuration::GetWorkerThreadsCount();
+        LOG(WARNING) << "The DICOMweb plugin will use a pool of " << workersCount << " worker threads";
+        OrthancPlugins::WorkersPool::GetInstance().Start(workersCount, "DW-WORKER-");
+
+        const unsigned int warmingThreadsCount = OrthancPlugins::Configuration::GetCacheWarmingThreadsCount();
+        if (warmingThreadsCount > 0)
+        {
+          LOG(WARNING) << "The DICOMweb plugin will warm up the caches of the stable studies using "
+                       << warmingThreadsCount << " threads";
+          OrthancPlugins::CacheWarmer::GetInstance().SetMaxQueueSize(OrthancPlugins::Configuration::GetCacheWarmingQueueSize());
+          OrthancPlugins::CacheWarmer::GetInstance().Start(warmingThreadsCount, WarmStudyCaches);
+        }
+
+        OrthancPlugins::RegisterRestCallback<WarmUpStudies>(root + "warm-up", true);
       }
       else
       {
@@ -792,6 +932,8 @@ extern "C"
 
   ORTHANC_PLUGINS_API void OrthancPluginFinalize()
   {
+    OrthancPlugins::CacheWarmer::GetInstance().Stop();
+    OrthancPlugins::WorkersPool::GetInstance().Stop();
   }
 
 
@@ -0,0 +1,222 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "QidoResultsCache.h"
+
+#include "ResourceLookupCache.h"
+
+#include <cassert>
+
+
+namespace OrthancPlugins
+{
+  QidoResultsCache::QidoResultsCache() :
+    currentSize_(0),
+    maxSize_(0),
+    maxStaleness_(0),
+    generation_(0),
+    hits_(0),
+    misses_(0),
+    savedTime_(0)
+  {
+  }
+
+
+  QidoResultsCache& QidoResultsCache::GetInstance()
+  {
+    static QidoResultsCache singleton;
+    return singleton;
+  }
+
+
+  void QidoResultsCache::RemoveEntry(Content::iterator entry)
+  {
+    assert(entry != content_.end());
+    assert(currentSize_ >= entry->second.answer_.size());
+
+    currentSize_ -= entry->second.answer_.size();
+    recency_.erase(entry->second.recency_);
+    content_.erase(entry);
+  }
+
+
+  void QidoResultsCache::MakeRoom()
+  {
+    while (!recency_.empty() &&
+           currentSize_ > maxSize_)
+    {
+      RemoveEntry(content_.find(recency_.back()));
+    }
+  }
+
+
+  void QidoResultsCache::SetParameters(size_t maxSize,
+                                       unsigned int maxStaleness)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    maxSize_ = maxSize;
+    maxStaleness_ = maxStaleness;
+
+    if (maxStaleness_ == 0)
+    {
+      content_.clear();
+      recency_.clear();
+      currentSize_ = 0;
+    }
+    else
+    {
+      MakeRoom();
+    }
+  }
+
+
+  bool QidoResultsCache::IsEnabled()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return (maxSize_ != 0 && maxStaleness_ != 0);
+  }
+
+
+  std::string QidoResultsCache::ComputeKey(const std::string& query,
+                                           const std::string& wadoBasePublicUrl,
+                                           const std::map<std::string, std::string>& httpHeaders)
+  {
+    // The public URL is part of the answer (RetrieveURL), and the
+    // authorization plugin might filter "/tools/find" according to
+    // the HTTP headers
+    return (ResourceLookupCache::ComputeHeadersFingerprint(httpHeaders) + "|" +
+            wadoBasePublicUrl + "|" + query);
+  }
+
+
+  uint64_t QidoResultsCache::GetGeneration()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return generation_;
+  }
+
+
+  bool QidoResultsCache::Lookup(std::string& answer,
+                                const std::string& key)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    Content::iterator found = content_.find(key);
+
+    if (found == content_.end())
+    {
+      misses_++;
+      return false;
+    }
+    else if (boost::posix_time::microsec_clock::universal_time() >= found->second.expiration_)
+    {
+      RemoveEntry(found);
+      misses_++;
+      return false;
+    }
+    else
+    {
+      hits_++;
+      savedTime_ += found->second.computation_;
+      recency_.splice(recency_.begin(), recency_, found->second.recency_);
+      answer = found->second.answer_;
+      return true;
+    }
+  }
+
+
+  void QidoResultsCache::Store(const std::string& key,
+                               const std::string& answer,
+                               uint64_t generation,
+                               const boost::posix_time::time_duration& computation)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (maxStaleness_ == 0 ||
+        answer.size() > maxSize_ ||
+        generation != generation_)
+    {
+      return;  // Disabled, too large, or possibly outdated
+    }
+
+    Content::iterator found = content_.find(key);
+    if (found != content_.end())
+    {
+      RemoveEntry(found);
+    }
+
+    Entry& entry = content_[key];
+    entry.answer_ = answer;
+    entry.expiration_ = (boost::posix_time::microsec_clock::universal_time() +
+                         boost::posix_time::seconds(maxStaleness_));
+    entry.computation_ = (computation.is_negative() ? 0 : computation.total_microseconds());
+    entry.recency_ = recency_.insert(recency_.begin(), key);
+    currentSize_ += answer.size();
+
+    MakeRoom();
+  }
+
+
+  void QidoResultsCache::Invalidate()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    generation_++;
+    content_.clear();
+    recency_.clear();
+    currentSize_ = 0;
+  }
+
+
+  void QidoResultsCache::Clear()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    content_.clear();
+    recency_.clear();
+    currentSize_ = 0;
+  }
+
+
+  size_t QidoResultsCache::GetSize()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return content_.size();
+  }
+
+
+  size_t QidoResultsCache::GetMemoryUsage()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return currentSize_;
+  }
+
+
+  void QidoResultsCache::GetStatistics(uint64_t& hits,
+                                       uint64_t& misses,
+                                       uint64_t& savedTime)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    hits = hits_;
+    misses = misses_;
+    savedTime = savedTime_;
+  }
+}
@@ -0,0 +1,117 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include <list>
+#include <map>
+#include <string>
+#include <stdint.h>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+
+namespace OrthancPlugins
+{
+  // Memory-bounded LRU cache of the JSON answers to the QIDO-RS
+  // requests, for the clients that poll the same queries over and over
+  // (e.g. the worklists of a RIS).
+  //
+  // Any new or deleted resource increments a generation counter that
+  // empties the cache.  An answer is only stored if no change has
+  // occurred since its "/tools/find" was started, which prevents a slow
+  // request from storing an outdated answer.  The entries also expire
+  // after a maximum staleness, as other Orthanc servers might share the
+  // same database.
+  class QidoResultsCache : public boost::noncopyable
+  {
+  private:
+    typedef std::list<std::string>  Recency;  // Most recently used first
+
+    struct Entry
+    {
+      std::string               answer_;
+      boost::posix_time::ptime  expiration_;
+      uint64_t                  computation_;  // Time spent to compute the answer, in microseconds
+      Recency::iterator         recency_;
+    };
+
+    typedef std::map<std::string, Entry>  Content;
+
+    boost::mutex  mutex_;
+    Content       content_;
+    Recency       recency_;
+    size_t        currentSize_;
+    size_t        maxSize_;       // In bytes, 0 means the cache is disabled
+    unsigned int  maxStaleness_;  // In seconds, 0 means the cache is disabled
+    uint64_t      generation_;
+    uint64_t      hits_;
+    uint64_t      misses_;
+    uint64_t      savedTime_;     // In microseconds
+
+    // The mutex must be locked
+    void RemoveEntry(Content::iterator entry);
+
+    // The mutex must be locked
+    void MakeRoom();
+
+  public:
+    QidoResultsCache();
+
+    static QidoResultsCache& GetInstance();
+
+    void SetParameters(size_t maxSize,
+                       unsigned int maxStaleness);
+
+    bool IsEnabled();
+
+    // "query" is the normalized body of the call to "/tools/find"
+    static std::string ComputeKey(const std::string& query,
+                                  const std::string& wadoBasePublicUrl,
+                                  const std::map<std::string, std::string>& httpHeaders);
+
+    // To be read before starting the "/tools/find", then given to "Store()"
+    uint64_t GetGeneration();
+
+    bool Lookup(std::string& answer,
+                const std::string& key);
+
+    void Store(const std::string& key,
+               const std::string& answer,
+               uint64_t generation,
+               const boost::posix_time::time_duration& computation);
+
+    // To be called whenever a resource is added or deleted
+    void Invalidate();
+
+    void Clear();
+
+    size_t GetSize();
+
+    size_t GetMemoryUsage();
+
+    void GetStatistics(uint64_t& hits,
+                       uint64_t& misses,
+                       uint64_t& savedTime /* in microseconds */);
+  };
+}
@@ -26,12 +26,16 @@
 #include "../Resources/Orthanc/Plugins/OrthancPluginCppWrapper.h"
 #include "Configuration.h"
 #include "DicomWebFormatter.h"
+#include "LatencyMetrics.h"
+#include "QidoResultsCache.h"
+#include "WadoRs.h"
 
 #include <DicomFormat/DicomMap.h>
 #include <DicomFormat/DicomTag.h>
 #include <Logging.h>
 #include <Toolbox.h>
 
+#include <algorithm>
 #include <list>
 #include <boost/lexical_cast.hpp>
 #include <boost/regex.hpp>
@@ -396,11 +400,116 @@ namespace
 
 
 
+static void ExecuteFind(OrthancPlugins::DicomWebFormatter::HttpWriter& writer,
+                        Json::Value& find,
+                        const std::map<std::string, std::string>& httpHeaders,
+                        const std::string& wadoBasePublicUrl,
+                        const ModuleMatcher& matcher,
+                        Orthanc::ResourceType level)
+{
+  /**
+   * If ExtendedFind is available, "Since" and "Limit" are applied by
+   * the database, so the "/tools/find" answer is split into pages in
+   * order to bound the size of the JSON kept in memory. Each page is
+   * converted to DICOMweb (and sent if XML) before the next one is
+   * requested.
+   **/
+  unsigned int pageSize = 0;
+  if (CanUseExtendedFind())
+  {
+    pageSize = OrthancPlugins::Configuration::GetQidoPageSize();
+  }
+
+  unsigned int remaining = matcher.GetLimit();  // 0 means no limit
+
+  if (pageSize != 0 &&
+      remaining == 0)
+  {
+    // Don't bypass the limit that is set in the Orthanc core
+    remaining = OrthancPlugins::Configuration::GetLimitFindResults();
+  }
+
+  unsigned int since = matcher.GetOffset();
+
+  for (;;)
+  {
+    unsigned int count;
+    if (pageSize == 0)
+    {
+      count = remaining;
+    }
+    else if (remaining == 0)
+    {
+      count = pageSize;
+    }
+    else
+    {
+      count = std::min(remaining, pageSize);
+    }
+
+    find["Since"] = since;
+    find["Limit"] = count;
+
+    Json::Value resources;
+
+    {
+      OrthancPlugins::LatencyStageTimer timer(OrthancPlugins::LatencyRoute_Qido, OrthancPlugins::LatencyStage_Locate);
+
+      if (!OrthancPlugins::RestApiPost(resources, "/tools/find", find, httpHeaders, true) ||
+          resources.type() != Json::arrayValue)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+      }
+    }
+
+    OrthancPlugins::LatencyStageTimer timer(OrthancPlugins::LatencyRoute_Qido, OrthancPlugins::LatencyStage_Format);
+
+    for (Json::Value::ArrayIndex i = 0; i < resources.size(); i++)
+    {
+      const Json::Value& resource = resources[i];
+
+      Orthanc::DicomMap source;
+      if (resource["RequestedTags"].isObject())
+      {
+        source.FromDicomAsJson(resource["RequestedTags"], false, true);
+      }
+
+      Orthanc::DicomMap target;
+
+      // since we are populating the target with values from JSON, all string are actually UTF-8
+      target.SetValue(Orthanc::DICOM_TAG_SPECIFIC_CHARACTER_SET, "ISO_IR 192", false);
+
+      matcher.ExtractFields(target, source, wadoBasePublicUrl, level);
+      writer.AddOrthancMap(target);
+    }
+
+    if (pageSize == 0 ||
+        resources.size() < count)
+    {
+      break;  // This was the last page
+    }
+
+    since += count;
+
+    if (remaining != 0)
+    {
+      remaining -= count;
+      if (remaining == 0)
+      {
+        break;
+      }
+    }
+  }
+}
+
+
 static void ApplyMatcher(OrthancPluginRestOutput* output,
                          const OrthancPluginHttpRequest* request,
                          const ModuleMatcher& matcher,
                          Orthanc::ResourceType level)
 {
+  OrthancPlugins::LatencyRouteTimer routeTimer(OrthancPlugins::LatencyRoute_Qido);
+
   Json::Value find;
   matcher.ConvertToOrthanc(find, level);
 
@@ -409,37 +518,63 @@ static void ApplyMatcher(OrthancPluginRestOutput* output,
   std::map<std::string, std::string> httpHeaders;
   OrthancPlugins::GetHttpHeaders(httpHeaders, request);
 
-  Json::Value resources;
-  if (!OrthancPlugins::RestApiPost(resources, "/tools/find", find, httpHeaders, true) ||
-      resources.type() != Json::arrayValue)
-  {
-    throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
-  }
-
   std::string wadoBasePublicUrl = OrthancPlugins::Configuration::GetBasePublicUrl(request);
 
-  OrthancPlugins::DicomWebFormatter::HttpWriter writer(
-    output, OrthancPlugins::Configuration::IsXmlExpected(request));
+  const bool isXml = OrthancPlugins::Configuration::IsXmlExpected(request);
+
+  OrthancPlugins::QidoResultsCache& cache = OrthancPlugins::QidoResultsCache::GetInstance();
+
+  if (isXml ||
+      !cache.IsEnabled())
+  {
+    OrthancPlugins::DicomWebFormatter::HttpWriter writer(output, isXml);
+    ExecuteFind(writer, find, httpHeaders, wadoBasePublicUrl, matcher, level);
 
-  for (Json::Value::ArrayIndex i = 0; i < resources.size(); i++)
+    OrthancPlugins::LatencyStageTimer timer(OrthancPlugins::LatencyRoute_Qido, OrthancPlugins::LatencyStage_Send);
+    writer.Send();
+  }
+  else
   {
-    const Json::Value& resource = resources[i];
+    std::string query;
+    OrthancPlugins::WriteFastJson(query, find);
+
+    const std::string key = OrthancPlugins::QidoResultsCache::ComputeKey(query, wadoBasePublicUrl, httpHeaders);
 
-    Orthanc::DicomMap source;
-    if (resource["RequestedTags"].isObject())
+    std::string answer;
+    if (!cache.Lookup(answer, key))
     {
-      source.FromDicomAsJson(resource["RequestedTags"], false, true);
-    }
+      // Read the generation before "/tools/find", so that the answer
+      // is not stored if a resource was added or deleted meanwhile
+      const uint64_t generation = cache.GetGeneration();
+      const boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
 
-    Orthanc::DicomMap target;
+      OrthancPlugins::DicomWebFormatter::HttpWriter writer(output, false);
+      ExecuteFind(writer, find, httpHeaders, wadoBasePublicUrl, matcher, level);
+      writer.CloseAndGetJsonOutput(answer);
 
-    // since we are populating the target with values from JSON, all string are actually UTF-8
-    target.SetValue(Orthanc::DICOM_TAG_SPECIFIC_CHARACTER_SET, "ISO_IR 192", false);
+      cache.Store(key, answer, generation, boost::posix_time::microsec_clock::universal_time() - start);
+    }
 
-    matcher.ExtractFields(target, source, wadoBasePublicUrl, level);
-    writer.AddOrthancMap(target);
+    OrthancPlugins::LatencyStageTimer timer(OrthancPlugins::LatencyRoute_Qido, OrthancPlugins::LatencyStage_Send);
+    OrthancPluginAnswerBuffer(OrthancPlugins::GetGlobalContext(), output,
+                              answer.c_str(), answer.size(), "application/dicom+json");
   }
-  writer.Send();
+}
+
+
+void RefreshQidoRsMetrics()
+{
+  OrthancPlugins::QidoResultsCache& cache = OrthancPlugins::QidoResultsCache::GetInstance();
+
+  uint64_t hits, misses, savedTime;
+  cache.GetStatistics(hits, misses, savedTime);
+
+  OrthancPlugins::SetMetricsValue("orthanc_dicomweb_qido_cache_hits", static_cast<int64_t>(hits));
+  OrthancPlugins::SetMetricsValue("orthanc_dicomweb_qido_cache_misses", static_cast<int64_t>(misses));
+  OrthancPlugins::SetMetricsValue("orthanc_dicomweb_qido_cache_saved_ms", static_cast<int64_t>(savedTime / 1000));
+  OrthancPlugins::SetMetricsValue("orthanc_dicomweb_qido_cache_count", static_cast<int64_t>(cache.GetSize()));
+  OrthancPlugins::SetMetricsValue("orthanc_dicomweb_qido_cache_size_mbytes",
+                                  static_cast<float>(cache.GetMemoryUsage()) / (1024.0f * 1024.0f));
 }
 
 
@@ -37,3 +37,5 @@ void SearchForSeries(OrthancPluginRestOutput* output,
 void SearchForInstances(OrthancPluginRestOutput* output,
                         const char* url,
                         const OrthancPluginHttpRequest* request);
+
+void RefreshQidoRsMetrics();
@@ -0,0 +1,239 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#include "RenderedFramesCache.h"
+
+#include <Toolbox.h>
+
+#include <boost/lexical_cast.hpp>
+#include <cassert>
+#include <vector>
+
+
+namespace OrthancPlugins
+{
+  RenderedFramesCache::RenderedFramesCache() :
+    currentSize_(0),
+    maxSize_(0),
+    hits_(0),
+    misses_(0),
+    notModified_(0)
+  {
+  }
+
+
+  RenderedFramesCache& RenderedFramesCache::GetInstance()
+  {
+    static RenderedFramesCache singleton;
+    return singleton;
+  }
+
+
+  void RenderedFramesCache::RemoveEntry(Content::iterator entry)
+  {
+    assert(entry != content_.end());
+    assert(currentSize_ >= entry->second.content_.size());
+
+    currentSize_ -= entry->second.content_.size();
+    recency_.erase(entry->second.recency_);
+    content_.erase(entry);
+  }
+
+
+  void RenderedFramesCache::MakeRoom()
+  {
+    while (!recency_.empty() &&
+           currentSize_ > maxSize_)
+    {
+      RemoveEntry(content_.find(recency_.back()));
+    }
+  }
+
+
+  void RenderedFramesCache::SetMaxSize(size_t maxSize)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    maxSize_ = maxSize;
+    MakeRoom();
+  }
+
+
+  bool RenderedFramesCache::IsEnabled()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return maxSize_ != 0;
+  }
+
+
+  std::string RenderedFramesCache::ComputeKey(const std::string& instanceId,
+                                              unsigned int frame,
+                                              const std::string& mime,
+                                              const std::string& parameters)
+  {
+    return instanceId + "|" + boost::lexical_cast<std::string>(frame) + "|" + mime + "|" + parameters;
+  }
+
+
+  std::string RenderedFramesCache::ComputeETag(const std::string& content)
+  {
+    std::string md5;
+    Orthanc::Toolbox::ComputeMD5(md5, content);
+    return "\"" + md5 + "\"";
+  }
+
+
+  bool RenderedFramesCache::MatchesETag(const std::string& ifNoneMatch,
+                                        const std::string& etag)
+  {
+    std::vector<std::string> tokens;
+    Orthanc::Toolbox::TokenizeString(tokens, ifNoneMatch, ',');
+
+    for (size_t i = 0; i < tokens.size(); i++)
+    {
+      std::string token = Orthanc::Toolbox::StripSpaces(tokens[i]);
+
+      if (token.compare(0, 2, "W/") == 0)
+      {
+        // Weak comparison, as mandated by RFC 9110 for "If-None-Match"
+        token = token.substr(2);
+      }
+
+      if (token == "*" ||
+          token == etag)
+      {
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+
+  bool RenderedFramesCache::Lookup(std::string& content,
+                                   std::string& etag,
+                                   const std::string& key)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    Content::iterator found = content_.find(key);
+
+    if (found == content_.end())
+    {
+      misses_++;
+      return false;
+    }
+    else
+    {
+      hits_++;
+      recency_.splice(recency_.begin(), recency_, found->second.recency_);
+      content = found->second.content_;
+      etag = found->second.etag_;
+      return true;
+    }
+  }
+
+
+  std::string RenderedFramesCache::Store(const std::string& key,
+                                         const std::string& content)
+  {
+    const std::string etag = ComputeETag(content);
+
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (content.size() <= maxSize_)
+    {
+      Content::iterator found = content_.find(key);
+      if (found != content_.end())
+      {
+        RemoveEntry(found);
+      }
+
+      Entry& entry = content_[key];
+      entry.content_ = content;
+      entry.etag_ = etag;
+      entry.recency_ = recency_.insert(recency_.begin(), key);
+      currentSize_ += content.size();
+
+      MakeRoom();
+    }
+
+    return etag;
+  }
+
+
+  void RenderedFramesCache::Invalidate(const std::string& instanceId)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    const std::string prefix = instanceId + "|";
+
+    Content::iterator it = content_.lower_bound(prefix);
+    while (it != content_.end() &&
+           it->first.compare(0, prefix.size(), prefix) == 0)
+    {
+      RemoveEntry(it++);
+    }
+  }
+
+
+  void RenderedFramesCache::Clear()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    content_.clear();
+    recency_.clear();
+    currentSize_ = 0;
+  }
+
+
+  size_t RenderedFramesCache::GetSize()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return content_.size();
+  }
+
+
+  size_t RenderedFramesCache::GetMemoryUsage()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return currentSize_;
+  }
+
+
+  void RenderedFramesCache::CountNotModified()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    notModified_++;
+  }
+
+
+  void RenderedFramesCache::GetStatistics(uint64_t& hits,
+                                          uint64_t& misses,
+                                          uint64_t& notModified)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    hits = hits_;
+    misses = misses_;
+    notModified = notModified_;
+  }
+}
@@ -0,0 +1,122 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#pragma once
+
+#include <list>
+#include <map>
+#include <string>
+#include <stdint.h>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+
+namespace OrthancPlugins
+{
+  // Memory-bounded LRU cache of the encoded (JPEG/PNG) answers to the
+  // WADO-RS RetrieveRendered and thumbnail requests.  Study browsers
+  // request the same thumbnails over and over, whose computation
+  // requires to load, decode, window and re-encode the instance.
+  //
+  // The keys are built by "ComputeKey()" and start with the Orthanc ID
+  // of the instance, which allows to invalidate all the renderings of
+  // an instance at once.  Each entry is associated with a strong ETag
+  // derived from its content.
+  class RenderedFramesCache : public boost::noncopyable
+  {
+  private:
+    typedef std::list<std::string>  Recency;  // Most recently used first
+
+    struct Entry
+    {
+      std::string        content_;
+      std::string        etag_;
+      Recency::iterator  recency_;
+    };
+
+    typedef std::map<std::string, Entry>  Content;
+
+    boost::mutex  mutex_;
+    Content       content_;
+    Recency       recency_;
+    size_t        currentSize_;
+    size_t        maxSize_;  // In bytes, 0 means the cache is disabled
+    uint64_t      hits_;
+    uint64_t      misses_;
+    uint64_t      notModified_;
+
+    // The mutex must be locked
+    void RemoveEntry(Content::iterator entry);
+
+    // The mutex must be locked
+    void MakeRoom();
+
+  public:
+    RenderedFramesCache();
+
+    static RenderedFramesCache& GetInstance();
+
+    void SetMaxSize(size_t maxSize);
+
+    bool IsEnabled();
+
+    // "frame" is the 1-based frame number, "parameters" is the
+    // normalized representation of the rendering parameters
+    static std::string ComputeKey(const std::string& instanceId,
+                                  unsigned int frame,
+                                  const std::string& mime,
+                                  const std::string& parameters);
+
+    static std::string ComputeETag(const std::string& content);
+
+    // Evaluates the value of a "If-None-Match" HTTP header, which is
+    // either "*" or a comma-separated list of (possibly weak) ETags
+    static bool MatchesETag(const std::string& ifNoneMatch,
+                            const std::string& etag);
+
+    bool Lookup(std::string& content,
+                std::string& etag,
+                const std::string& key);
+
+    // Returns the ETag of the content, even if the cache is disabled or
+    // if the content is larger than the cache
+    std::string Store(const std::string& key,
+                      const std::string& content);
+
+    // Removes all the renderings of the given instance
+    void Invalidate(const std::string& instanceId);
+
+    void Clear();
+
+    size_t GetSize();
+
+    size_t GetMemoryUsage();
+
+    // To be called when a "304 Not Modified" is answered
+    void CountNotModified();
+
+    void GetStatistics(uint64_t& hits,
+                       uint64_t& misses,
+                       uint64_t& notModified);
+  };
+}
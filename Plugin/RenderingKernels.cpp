@@ -0,0 +1,383 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#include "RenderingKernels.h"
+
+#include <Images/Image.h>
+#include <Images/ImageTraits.h>
+#include <OrthancException.h>
+
+#include <cassert>
+#include <cmath>
+#include <limits>
+
+
+namespace OrthancPlugins
+{
+  namespace RenderingKernels
+  {
+    namespace
+    {
+      // Maps one (non-rescaled) source value to the output range [0, 255]
+      class WindowingFunction
+      {
+      private:
+        WindowingMode  mode_;
+        float          c_;
+        float          w_;
+        float          rescaleSlope_;
+        float          rescaleIntercept_;
+        float          linearXMin_;
+        float          linearXMax_;
+        float          linearYScaling_;
+        float          linearYOffset_;
+        float          exactXMin_;
+        float          exactXMax_;
+        float          exactYScaling_;
+        float          exactYOffset_;
+        float          minValue_;
+        float          wholeDynamicsScale_;
+
+        static const float  YMIN;
+        static const float  YMAX;
+
+      public:
+        WindowingFunction(float c,
+                          float w,
+                          WindowingMode mode,
+                          float rescaleSlope,
+                          float rescaleIntercept) :
+          mode_(mode),
+          c_(c),
+          w_(w),
+          rescaleSlope_(rescaleSlope),
+          rescaleIntercept_(rescaleIntercept),
+          minValue_(0),
+          wholeDynamicsScale_(1)
+        {
+          /**
+
+             LINEAR:
+             http://dicom.nema.org/MEDICAL/dicom/2019a/output/chtml/part03/sect_C.11.2.html#sect_C.11.2.1.2.1
+
+             Python
+             ------
+
+             import sympy as sym
+             x, c, w, ymin, ymax = sym.symbols('x c w ymin ymax')
+
+             e = ((x - (c - 0.5)) / (w-1) + 0.5) * (ymax- ymin) + ymin
+             print(sym.simplify(sym.collect(sym.expand(e), [ x, ymin, ymax ])))
+
+             Result
+             ------
+
+             (x*(ymax - ymin) + ymax*(-c + 0.5*w) + ymin*(c + 0.5*w - 1.0))/(w - 1)
+
+          **/
+
+          linearXMin_ = (c - 0.5f - (w - 1.0f) / 2.0f);
+          linearXMax_ = (c - 0.5f + (w - 1.0f) / 2.0f);
+          linearYScaling_ = (YMAX - YMIN) / (w - 1.0f);
+          linearYOffset_ = (YMAX * (-c + 0.5f * w) + YMIN * (c + 0.5f * w - 1.0f)) / (w - 1.0f);
+
+
+          /**
+
+             LINEAR-EXACT:
+             http://dicom.nema.org/MEDICAL/dicom/2019a/output/chtml/part03/sect_C.11.2.html#sect_C.11.2.1.3.2
+
+             Python
+             ------
+
+             import sympy as sym
+             x, c, w, ymin, ymax = sym.symbols('x c w ymin ymax')
+
+             e = (x - c) / w * (ymax- ymin) + ymin
+             print(sym.simplify(sym.collect(sym.expand(e), [ x, ymin, ymax ])))
+
+             Result
+             ------
+
+             (-c*ymax + x*(ymax - ymin) + ymin*(c + w))/w
+
+          **/
+
+          exactXMin_ = (c - w / 2.0f);
+          exactXMax_ = (c + w / 2.0f);
+          exactYScaling_ = (YMAX - YMIN) / w;
+          exactYOffset_ = (-c * YMAX + YMIN * (c + w)) / w;
+        }
+
+        bool IsWholeDynamics() const
+        {
+          return mode_ == WindowingMode_WholeDynamics;
+        }
+
+        // Only used in the "whole dynamics" mode, with the non-rescaled
+        // extreme values of the source image
+        void SetDynamics(float minValue,
+                         float maxValue)
+        {
+          minValue_ = rescaleSlope_ * minValue + rescaleIntercept_;
+          maxValue = rescaleSlope_ * maxValue + rescaleIntercept_;
+          wholeDynamicsScale_ = 255.0f / (maxValue - minValue_);
+        }
+
+        float Apply(float a) const
+        {
+          a = rescaleSlope_ * a + rescaleIntercept_;
+
+          switch (mode_)
+          {
+            case WindowingMode_WholeDynamics:
+              return (a - minValue_) * wholeDynamicsScale_;
+
+            case WindowingMode_Linear:
+              if (a <= linearXMin_)
+              {
+                return YMIN;
+              }
+              else if (a > linearXMax_)
+              {
+                return YMAX;
+              }
+              else
+              {
+                return a * linearYScaling_ + linearYOffset_;
+              }
+
+            case WindowingMode_LinearExact:
+              if (a <= exactXMin_)
+              {
+                return YMIN;
+              }
+              else if (a > exactXMax_)
+              {
+                return YMAX;
+              }
+              else
+              {
+                return a * exactYScaling_ + exactYOffset_;
+              }
+
+            case WindowingMode_Sigmoid:
+              // http://dicom.nema.org/MEDICAL/dicom/2019a/output/chtml/part03/sect_C.11.2.html#sect_C.11.2.1.3.1
+              return YMAX / (1.0f + expf(-4.0f * (a - c_) / w_));
+
+            default:
+              throw Orthanc::OrthancException(Orthanc::ErrorCode_NotImplemented);
+          }
+        }
+      };
+
+      const float WindowingFunction::YMIN = 0;
+      const float WindowingFunction::YMAX = 255;
+
+
+      template <Orthanc::PixelFormat SourceFormat>
+      void GetFloatRange(float& minValue,
+                         float& maxValue,
+                         const Orthanc::ImageAccessor& source)
+      {
+        minValue = std::numeric_limits<float>::infinity();
+        maxValue = -std::numeric_limits<float>::infinity();
+
+        for (unsigned int y = 0; y < source.GetHeight(); y++)
+        {
+          for (unsigned int x = 0; x < source.GetWidth(); x++)
+          {
+            float a = Orthanc::ImageTraits<SourceFormat>::GetFloatPixel(source, x, y);
+            minValue = std::min(minValue, a);
+            maxValue = std::max(maxValue, a);
+          }
+        }
+      }
+
+
+      // Reference implementation, evaluates the function for each pixel
+      template <Orthanc::PixelFormat SourceFormat>
+      void ApplyPerPixel(Orthanc::ImageAccessor& target,
+                         const Orthanc::ImageAccessor& source,
+                         const WindowingFunction& f)
+      {
+        for (unsigned int y = 0; y < source.GetHeight(); y++)
+        {
+          for (unsigned int x = 0; x < source.GetWidth(); x++)
+          {
+            float a = Orthanc::ImageTraits<SourceFormat>::GetFloatPixel(source, x, y);
+            Orthanc::ImageTraits<Orthanc::PixelFormat_Grayscale8>::SetFloatPixel(target, f.Apply(a), x, y);
+          }
+        }
+      }
+
+
+      template <typename PixelType>
+      void GetIntegerRange(PixelType& minValue,
+                           PixelType& maxValue,
+                           const Orthanc::ImageAccessor& source)
+      {
+        assert(source.GetWidth() > 0 && source.GetHeight() > 0);
+
+        minValue = *reinterpret_cast<const PixelType*>(source.GetConstRow(0));
+        maxValue = minValue;
+
+        for (unsigned int y = 0; y < source.GetHeight(); y++)
+        {
+          const PixelType* p = reinterpret_cast<const PixelType*>(source.GetConstRow(y));
+
+          for (unsigned int x = 0; x < source.GetWidth(); x++)
+          {
+            if (p[x] < minValue)
+            {
+              minValue = p[x];
+            }
+            else if (p[x] > maxValue)
+            {
+              maxValue = p[x];
+            }
+          }
+        }
+      }
+
+
+      template <Orthanc::PixelFormat SourceFormat,
+                typename PixelType>
+      void ApplyInteger(Orthanc::ImageAccessor& target,
+                        const Orthanc::ImageAccessor& source,
+                        WindowingFunction& f,
+                        bool allowLookupTable)
+      {
+        if (source.GetWidth() == 0 ||
+            source.GetHeight() == 0)
+        {
+          return;
+        }
+
+        PixelType minValue, maxValue;
+        GetIntegerRange<PixelType>(minValue, maxValue, source);
+
+        if (f.IsWholeDynamics())
+        {
+          f.SetDynamics(static_cast<float>(minValue), static_cast<float>(maxValue));
+        }
+
+        const unsigned int tableSize = static_cast<unsigned int>(static_cast<int>(maxValue) -
+                                                                 static_cast<int>(minValue)) + 1u;
+
+        if (!allowLookupTable ||
+            tableSize > source.GetWidth() * source.GetHeight())
+        {
+          // Small image with a large dynamics
+          ApplyPerPixel<SourceFormat>(target, source, f);
+          return;
+        }
+
+        // The lookup table is filled through "SetFloatPixel()" to get the
+        // exact same rounding as in the per-pixel evaluation
+        Orthanc::Image table(Orthanc::PixelFormat_Grayscale8, tableSize, 1, false);
+
+        for (unsigned int i = 0; i < tableSize; i++)
+        {
+          const float a = static_cast<float>(static_cast<int>(minValue) + static_cast<int>(i));
+          Orthanc::ImageTraits<Orthanc::PixelFormat_Grayscale8>::SetFloatPixel(table, f.Apply(a), i, 0);
+        }
+
+        const uint8_t* lookup = reinterpret_cast<const uint8_t*>(table.GetConstRow(0));
+
+        for (unsigned int y = 0; y < source.GetHeight(); y++)
+        {
+          const PixelType* p = reinterpret_cast<const PixelType*>(source.GetConstRow(y));
+          uint8_t* q = reinterpret_cast<uint8_t*>(target.GetRow(y));
+
+          for (unsigned int x = 0; x < source.GetWidth(); x++)
+          {
+            q[x] = lookup[static_cast<int>(p[x]) - static_cast<int>(minValue)];
+          }
+        }
+      }
+
+
+      void ApplyFloat(Orthanc::ImageAccessor& target,
+                      const Orthanc::ImageAccessor& source,
+                      WindowingFunction& f)
+      {
+        if (f.IsWholeDynamics())
+        {
+          float minValue, maxValue;
+          GetFloatRange<Orthanc::PixelFormat_Float32>(minValue, maxValue, source);
+          f.SetDynamics(minValue, maxValue);
+        }
+
+        ApplyPerPixel<Orthanc::PixelFormat_Float32>(target, source, f);
+      }
+    }
+
+
+    void ApplyWindowing(Orthanc::ImageAccessor& target,
+                        const Orthanc::ImageAccessor& source,
+                        float center,
+                        float width,
+                        WindowingMode mode,
+                        float rescaleSlope,
+                        float rescaleIntercept,
+                        bool allowLookupTable)
+    {
+      if (target.GetFormat() != Orthanc::PixelFormat_Grayscale8)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_IncompatibleImageFormat);
+      }
+
+      if (source.GetWidth() != target.GetWidth() ||
+          source.GetHeight() != target.GetHeight())
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_IncompatibleImageSize);
+      }
+
+      WindowingFunction f(center, width, mode, rescaleSlope, rescaleIntercept);
+
+      switch (source.GetFormat())
+      {
+        case Orthanc::PixelFormat_Grayscale8:
+          ApplyInteger<Orthanc::PixelFormat_Grayscale8, uint8_t>(target, source, f, allowLookupTable);
+          break;
+
+        case Orthanc::PixelFormat_Grayscale16:
+          ApplyInteger<Orthanc::PixelFormat_Grayscale16, uint16_t>(target, source, f, allowLookupTable);
+          break;
+
+        case Orthanc::PixelFormat_SignedGrayscale16:
+          ApplyInteger<Orthanc::PixelFormat_SignedGrayscale16, int16_t>(target, source, f, allowLookupTable);
+          break;
+
+        case Orthanc::PixelFormat_Float32:
+          ApplyFloat(target, source, f);
+          break;
+
+        default:
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_NotImplemented);
+      }
+    }
+  }
+}
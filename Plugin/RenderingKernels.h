@@ -0,0 +1,59 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#pragma once
+
+#include <Images/ImageAccessor.h>
+
+namespace OrthancPlugins
+{
+  enum WindowingMode
+  {
+    WindowingMode_WholeDynamics,
+    WindowingMode_Linear,
+    WindowingMode_LinearExact,
+    WindowingMode_Sigmoid
+  };
+
+  namespace RenderingKernels
+  {
+    // Applies the rescale slope/intercept, then the windowing, to a
+    // grayscale image (Grayscale8, Grayscale16, SignedGrayscale16 or
+    // Float32), producing a Grayscale8 image of the same size.
+    //
+    // For integer inputs, the windowing function is evaluated once
+    // for each value in the range of the image and stored in a lookup
+    // table, if this is cheaper than evaluating it for each pixel.
+    // The result is identical to the per-pixel evaluation, which can
+    // be forced by setting "allowLookupTable" to "false".
+    void ApplyWindowing(Orthanc::ImageAccessor& target,
+                        const Orthanc::ImageAccessor& source,
+                        float center,
+                        float width,
+                        WindowingMode mode,
+                        float rescaleSlope,
+                        float rescaleIntercept,
+                        bool allowLookupTable = true);
+  }
+}
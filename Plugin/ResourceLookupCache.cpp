@@ -0,0 +1,278 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "ResourceLookupCache.h"
+
+#include <Toolbox.h>
+
+#include <cassert>
+
+
+namespace OrthancPlugins
+{
+  static bool IsIgnoredHeader(const std::string& header)
+  {
+    // These HTTP headers describe the transport or the requested
+    // representation, they have no influence on authorization
+    static const char* const IGNORED[] = {
+      "accept",
+      "accept-encoding",
+      "accept-language",
+      "cache-control",
+      "connection",
+      "content-length",
+      "content-type",
+      "dnt",
+      "expect",
+      "host",
+      "if-match",
+      "if-modified-since",
+      "if-none-match",
+      "keep-alive",
+      "origin",
+      "pragma",
+      "priority",
+      "range",
+      "referer",
+      "te",
+      "transfer-encoding",
+      "upgrade-insecure-requests",
+      "user-agent",
+      NULL
+    };
+
+    for (size_t i = 0; IGNORED[i] != NULL; i++)
+    {
+      if (header == IGNORED[i])
+      {
+        return true;
+      }
+    }
+
+    return header.compare(0, 4, "sec-") == 0;
+  }
+
+
+  ResourceLookupCache::ResourceLookupCache() :
+    ttl_(0),
+    maxSize_(0),
+    hits_(0),
+    misses_(0)
+  {
+  }
+
+
+  ResourceLookupCache& ResourceLookupCache::GetInstance()
+  {
+    static ResourceLookupCache singleton;
+    return singleton;
+  }
+
+
+  void ResourceLookupCache::RemoveEntry(Content::iterator entry)
+  {
+    assert(entry != content_.end());
+
+    ReverseIndex::iterator keys = reverseIndex_.find(entry->second.orthancId_);
+    assert(keys != reverseIndex_.end());
+    keys->second.erase(entry->first);
+    if (keys->second.empty())
+    {
+      reverseIndex_.erase(keys);
+    }
+
+    queue_.erase(entry->second.position_);
+    content_.erase(entry);
+  }
+
+
+  void ResourceLookupCache::SetParameters(unsigned int ttl,
+                                          size_t maxSize)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    ttl_ = ttl;
+    maxSize_ = maxSize;
+
+    if (ttl_ == 0 || maxSize_ == 0)
+    {
+      content_.clear();
+      queue_.clear();
+      reverseIndex_.clear();
+    }
+
+    while (queue_.size() > maxSize_)
+    {
+      RemoveEntry(content_.find(queue_.back()));
+    }
+  }
+
+
+  bool ResourceLookupCache::IsEnabled()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return (ttl_ != 0 && maxSize_ != 0);
+  }
+
+
+  std::string ResourceLookupCache::ComputeHeadersFingerprint(const std::map<std::string, std::string>& httpHeaders)
+  {
+    std::string headers;
+
+    for (std::map<std::string, std::string>::const_iterator
+           it = httpHeaders.begin(); it != httpHeaders.end(); ++it)
+    {
+      std::string key;
+      Orthanc::Toolbox::ToLowerCase(key, it->first);
+
+      if (!IsIgnoredHeader(key))
+      {
+        headers += key + ":" + it->second + "\n";
+      }
+    }
+
+    std::string fingerprint;
+    Orthanc::Toolbox::ComputeMD5(fingerprint, headers);
+    return fingerprint;
+  }
+
+
+  std::string ResourceLookupCache::ComputeKey(const std::string& level,
+                                              const std::string& studyInstanceUid,
+                                              const std::string& seriesInstanceUid,
+                                              const std::string& sopInstanceUid,
+                                              bool firstResourceOnly,
+                                              const std::map<std::string, std::string>& httpHeaders)
+  {
+    return (level + (firstResourceOnly ? "|first|" : "|") + studyInstanceUid + "|" +
+            seriesInstanceUid + "|" + sopInstanceUid + "|" + ComputeHeadersFingerprint(httpHeaders));
+  }
+
+
+  bool ResourceLookupCache::Lookup(std::string& orthancId,
+                                   Metadata& metadata,
+                                   const std::string& key)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    Content::iterator found = content_.find(key);
+
+    if (found == content_.end())
+    {
+      misses_++;
+      return false;
+    }
+    else if (boost::posix_time::microsec_clock::universal_time() >= found->second.expiration_)
+    {
+      // This entry might be outdated if another Orthanc has modified a shared database
+      RemoveEntry(found);
+      misses_++;
+      return false;
+    }
+    else
+    {
+      orthancId = found->second.orthancId_;
+      metadata = found->second.metadata_;
+      hits_++;
+      return true;
+    }
+  }
+
+
+  void ResourceLookupCache::Store(const std::string& key,
+                                  const std::string& orthancId,
+                                  const Metadata& metadata)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (ttl_ == 0 || maxSize_ == 0)
+    {
+      return;
+    }
+
+    Content::iterator found = content_.find(key);
+    if (found != content_.end())
+    {
+      RemoveEntry(found);
+    }
+
+    while (queue_.size() >= maxSize_)
+    {
+      RemoveEntry(content_.find(queue_.back()));
+    }
+
+    Entry& entry = content_[key];
+    entry.orthancId_ = orthancId;
+    entry.metadata_ = metadata;
+    entry.expiration_ = (boost::posix_time::microsec_clock::universal_time() +
+                         boost::posix_time::seconds(ttl_));
+    entry.position_ = queue_.insert(queue_.begin(), key);
+
+    reverseIndex_[orthancId].insert(key);
+  }
+
+
+  void ResourceLookupCache::Invalidate(const std::string& orthancId)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    ReverseIndex::iterator keys = reverseIndex_.find(orthancId);
+    if (keys != reverseIndex_.end())
+    {
+      // Copy the keys, as "RemoveEntry()" modifies the reverse index
+      std::set<std::string> toRemove = keys->second;
+
+      for (std::set<std::string>::const_iterator
+             it = toRemove.begin(); it != toRemove.end(); ++it)
+      {
+        Content::iterator found = content_.find(*it);
+        assert(found != content_.end());
+        RemoveEntry(found);
+      }
+    }
+  }
+
+
+  void ResourceLookupCache::Clear()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    content_.clear();
+    queue_.clear();
+    reverseIndex_.clear();
+  }
+
+
+  size_t ResourceLookupCache::GetSize()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return content_.size();
+  }
+
+
+  void ResourceLookupCache::GetStatistics(uint64_t& hits,
+                                          uint64_t& misses)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    hits = hits_;
+    misses = misses_;
+  }
+}
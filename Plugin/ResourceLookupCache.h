@@ -0,0 +1,120 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include <list>
+#include <map>
+#include <set>
+#include <string>
+#include <stdint.h>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+
+namespace OrthancPlugins
+{
+  // Cache of the results of the "/tools/find" calls that map DICOM
+  // UIDs (StudyInstanceUID / SeriesInstanceUID / SOPInstanceUID) to
+  // Orthanc identifiers in WADO-RS routes.
+  //
+  // The authorization plugin filters "/tools/find" according to the HTTP
+  // headers of the request.  Therefore, each entry is scoped by a
+  // fingerprint of the headers that are forwarded to "/tools/find": a
+  // request can only reuse a lookup that has previously been granted to
+  // a request with the same credentials.  However, a hit does not
+  // consult the authorization plugin again, so that revoked
+  // credentials or changed permissions are ignored until the entry
+  // expires: The plugin disables the cache if the authorization
+  // plugin is loaded.
+  class ResourceLookupCache : public boost::noncopyable
+  {
+  public:
+    typedef std::map<std::string, std::string>  Metadata;
+
+  private:
+    typedef std::list<std::string>  Queue;  // Most recently stored first
+
+    struct Entry
+    {
+      std::string               orthancId_;
+      Metadata                  metadata_;
+      boost::posix_time::ptime  expiration_;
+      Queue::iterator           position_;
+    };
+
+    typedef std::map<std::string, Entry>                   Content;
+    typedef std::map<std::string, std::set<std::string> >  ReverseIndex;  // Orthanc ID -> keys
+
+    boost::mutex  mutex_;
+    Content       content_;
+    Queue         queue_;
+    ReverseIndex  reverseIndex_;
+    unsigned int  ttl_;      // In seconds, 0 means the cache is disabled
+    size_t        maxSize_;  // Maximum number of entries
+    uint64_t      hits_;
+    uint64_t      misses_;
+
+    // The mutex must be locked
+    void RemoveEntry(Content::iterator entry);
+
+  public:
+    ResourceLookupCache();
+
+    static ResourceLookupCache& GetInstance();
+
+    void SetParameters(unsigned int ttl,
+                       size_t maxSize);
+
+    bool IsEnabled();
+
+    // MD5 of the HTTP headers that might be used by the authorization
+    // plugin, ignoring the headers that only describe the transport
+    static std::string ComputeHeadersFingerprint(const std::map<std::string, std::string>& httpHeaders);
+
+    static std::string ComputeKey(const std::string& level,
+                                  const std::string& studyInstanceUid,
+                                  const std::string& seriesInstanceUid,
+                                  const std::string& sopInstanceUid,
+                                  bool firstResourceOnly,
+                                  const std::map<std::string, std::string>& httpHeaders);
+
+    bool Lookup(std::string& orthancId,
+                Metadata& metadata,
+                const std::string& key);
+
+    void Store(const std::string& key,
+               const std::string& orthancId,
+               const Metadata& metadata);
+
+    // Removes all the entries that point to the given Orthanc resource
+    void Invalidate(const std::string& orthancId);
+
+    void Clear();
+
+    size_t GetSize();
+
+    void GetStatistics(uint64_t& hits,
+                       uint64_t& misses);
+  };
+}
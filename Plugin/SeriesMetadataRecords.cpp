@@ -0,0 +1,289 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "SeriesMetadataRecords.h"
+
+#include <OrthancException.h>
+
+#include <boost/lexical_cast.hpp>
+#include <string.h>
+
+
+namespace OrthancPlugins
+{
+  static const char* const VERSION_PREFIX = "4;";
+
+
+  void SeriesMetadataRecords::SetLastUpdate(const std::string& lastUpdate)
+  {
+    if (lastUpdate.find(';') != std::string::npos)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+
+    lastUpdate_ = lastUpdate;
+  }
+
+
+  void SeriesMetadataRecords::SetInstance(const std::string& orthancId,
+                                          const std::string& json)
+  {
+    if (orthancId.empty() ||
+        orthancId.find(';') != std::string::npos)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+
+    records_[orthancId] = json;
+  }
+
+
+  bool SeriesMetadataRecords::HasSameInstances(const std::set<std::string>& instances) const
+  {
+    if (instances.size() != records_.size())
+    {
+      return false;
+    }
+
+    std::set<std::string>::const_iterator it = instances.begin();
+    for (Records::const_iterator record = records_.begin(); record != records_.end(); ++record, ++it)
+    {
+      if (record->first != *it)
+      {
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+
+  void SeriesMetadataRecords::Clear()
+  {
+    lastUpdate_.clear();
+    records_.clear();
+    stamps_.clear();
+  }
+
+
+  void SeriesMetadataRecords::Synchronize(std::set<std::string>& missing,
+                                          const Stamps& instances)
+  {
+    missing.clear();
+
+    for (Stamps::const_iterator it = instances.begin(); it != instances.end(); ++it)
+    {
+      if (it->second.find(';') != std::string::npos)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+      }
+    }
+
+    Records::iterator it = records_.begin();
+    while (it != records_.end())
+    {
+      Stamps::const_iterator found = instances.find(it->first);
+      Stamps::const_iterator stamp = stamps_.find(it->first);
+
+      if (found == instances.end() ||
+          found->second != (stamp == stamps_.end() ? std::string() : stamp->second))
+      {
+        records_.erase(it++);
+      }
+      else
+      {
+        ++it;
+      }
+    }
+
+    stamps_ = instances;
+
+    for (Stamps::const_iterator it = instances.begin(); it != instances.end(); ++it)
+    {
+      if (records_.find(it->first) == records_.end())
+      {
+        missing.insert(it->first);
+      }
+    }
+  }
+
+
+  void SeriesMetadataRecords::FormatHeader(std::string& target) const
+  {
+    target = (std::string(VERSION_PREFIX) + lastUpdate_ + ";" +
+              boost::lexical_cast<std::string>(records_.size()) + ";");
+  }
+
+
+  bool SeriesMetadataRecords::ParseHeader(std::string& lastUpdate,
+                                          size_t& count,
+                                          size_t& recordsOffset,
+                                          const std::string& content)
+  {
+    const size_t prefixSize = strlen(VERSION_PREFIX);
+
+    if (content.compare(0, prefixSize, VERSION_PREFIX) != 0)
+    {
+      return false;
+    }
+
+    const size_t first = content.find(';', prefixSize);
+    if (first == std::string::npos)
+    {
+      return false;
+    }
+
+    const size_t second = content.find(';', first + 1);
+    if (second == std::string::npos)
+    {
+      return false;
+    }
+
+    try
+    {
+      count = boost::lexical_cast<size_t>(content.substr(first + 1, second - first - 1));
+    }
+    catch (boost::bad_lexical_cast&)
+    {
+      return false;
+    }
+
+    lastUpdate = content.substr(prefixSize, first - prefixSize);
+    recordsOffset = second + 1;
+    return true;
+  }
+
+
+  void SeriesMetadataRecords::SerializeRecords(std::string& target) const
+  {
+    size_t size = 0;
+    for (Records::const_iterator it = records_.begin(); it != records_.end(); ++it)
+    {
+      size += it->first.size() + it->second.size() + 48;
+    }
+
+    target.clear();
+    target.reserve(size);
+
+    for (Records::const_iterator it = records_.begin(); it != records_.end(); ++it)
+    {
+      Stamps::const_iterator stamp = stamps_.find(it->first);
+
+      target += it->first;
+      target += ';';
+      if (stamp != stamps_.end())
+      {
+        target += stamp->second;
+      }
+      target += ';';
+      target += boost::lexical_cast<std::string>(it->second.size());
+      target += ';';
+      target += it->second;
+    }
+  }
+
+
+  bool SeriesMetadataRecords::UnserializeRecords(const std::string& source)
+  {
+    records_.clear();
+    stamps_.clear();
+
+    size_t position = 0;
+
+    while (position < source.size())
+    {
+      const size_t first = source.find(';', position);
+      if (first == std::string::npos)
+      {
+        Clear();
+        return false;
+      }
+
+      const size_t second = source.find(';', first + 1);
+      if (second == std::string::npos)
+      {
+        Clear();
+        return false;
+      }
+
+      const size_t third = source.find(';', second + 1);
+      if (third == std::string::npos)
+      {
+        Clear();
+        return false;
+      }
+
+      size_t size;
+
+      try
+      {
+        size = boost::lexical_cast<size_t>(source.substr(second + 1, third - second - 1));
+      }
+      catch (boost::bad_lexical_cast&)
+      {
+        Clear();
+        return false;
+      }
+
+      if (first == position ||
+          size > source.size() - third - 1)
+      {
+        Clear();
+        return false;
+      }
+
+      const std::string orthancId = source.substr(position, first - position);
+      stamps_[orthancId] = source.substr(first + 1, second - first - 1);
+      records_[orthancId] = source.substr(third + 1, size);
+      position = third + 1 + size;
+    }
+
+    return true;
+  }
+
+
+  void SeriesMetadataRecords::FormatSeries(std::string& target) const
+  {
+    size_t size = 2;
+    for (Records::const_iterator it = records_.begin(); it != records_.end(); ++it)
+    {
+      size += it->second.size() + 1;
+    }
+
+    target.clear();
+    target.reserve(size);
+    target += '[';
+
+    for (Records::const_iterator it = records_.begin(); it != records_.end(); ++it)
+    {
+      if (it != records_.begin())
+      {
+        target += ',';
+      }
+
+      target += it->second;
+    }
+
+    target += ']';
+  }
+}
@@ -0,0 +1,109 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include <map>
+#include <set>
+#include <string>
+#include <boost/noncopyable.hpp>
+
+namespace OrthancPlugins
+{
+  // Content of the series metadata cache (attachment 4301), version 4.
+  // The DICOMweb JSON of each instance is stored as a separate record,
+  // which allows to only compute the metadata of the instances that
+  // have been added to the series since the cache was written.
+  //
+  // The attachment is formatted as "4;<last-update>;<count>;<records>",
+  // where "<last-update>" is the "LastUpdate" of the series when the
+  // cache was written, "<count>" is the number of records, and
+  // "<records>" is the gzip-compressed sequence of the records.  The
+  // uncompressed header can be validated without uncompressing the
+  // records.  Each record is formatted as
+  // "<orthanc-id>;<stamp>;<size>;<json>", where "<stamp>" identifies
+  // the version of the instance the JSON was computed from (its
+  // "ReceptionDate"): An instance that is overwritten keeps its
+  // Orthanc ID, but not its stamp.
+  class SeriesMetadataRecords : public boost::noncopyable
+  {
+  public:
+    typedef std::map<std::string, std::string>  Stamps;  // Orthanc ID of the instance -> stamp
+
+  private:
+    typedef std::map<std::string, std::string>  Records;  // Orthanc ID of the instance -> DICOMweb JSON
+
+    std::string  lastUpdate_;
+    Records      records_;
+    Stamps       stamps_;
+
+  public:
+    const std::string& GetLastUpdate() const
+    {
+      return lastUpdate_;
+    }
+
+    void SetLastUpdate(const std::string& lastUpdate);
+
+    size_t GetSize() const
+    {
+      return records_.size();
+    }
+
+    bool HasInstance(const std::string& orthancId) const
+    {
+      return records_.find(orthancId) != records_.end();
+    }
+
+    void SetInstance(const std::string& orthancId,
+                     const std::string& json);
+
+    // Tells whether the records are those of exactly "instances"
+    bool HasSameInstances(const std::set<std::string>& instances) const;
+
+    void Clear();
+
+    // Removes the records of the instances that are not part of
+    // "instances" anymore or whose stamp has changed, and lists the
+    // instances that have no record.  The stamps of "instances" are
+    // those of the records that are set afterwards.
+    void Synchronize(std::set<std::string>& missing,
+                     const Stamps& instances);
+
+    void FormatHeader(std::string& target) const;
+
+    static bool ParseHeader(std::string& lastUpdate,
+                            size_t& count,
+                            size_t& recordsOffset,
+                            const std::string& content);
+
+    void SerializeRecords(std::string& target) const;
+
+    // Returns "false" if the records are corrupted, in which case the
+    // object is cleared
+    bool UnserializeRecords(const std::string& source);
+
+    // Formats the records as a DICOMweb JSON array
+    void FormatSeries(std::string& target) const;
+  };
+}
@@ -0,0 +1,327 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include "../Resources/Orthanc/Plugins/OrthancPluginCppWrapper.h"
+
+#include <Compatibility.h>
+#include <Logging.h>
+#include <OrthancException.h>
+
+#include <cassert>
+#include <boost/thread.hpp>
+
+namespace OrthancPlugins
+{
+  class SingleFunctionJob : public OrthancJob
+  {
+  public:
+    class JobContext : public boost::noncopyable
+    {
+    private:
+      SingleFunctionJob&  that_;
+
+    public:
+      explicit JobContext(SingleFunctionJob& that) :
+        that_(that)
+      {
+      }
+
+      void SetContent(const std::string& key,
+                      const Json::Value& value)
+      {
+        that_.SetContent(key, value);
+      }
+
+      void SetProgress(unsigned int position,
+                       unsigned int maxPosition)
+      {
+        boost::mutex::scoped_lock lock(that_.mutex_);
+
+        if (maxPosition == 0 || 
+            position > maxPosition)
+        {
+          that_.UpdateProgress(1);
+        }
+        else
+        {
+          that_.UpdateProgress(static_cast<float>(position) / static_cast<float>(maxPosition));
+        }
+      }
+    };
+
+
+    class IFunction : public boost::noncopyable
+    {
+    public:
+      virtual ~IFunction()
+      {
+      }
+
+      virtual void Execute(JobContext& context) = 0;
+    };
+
+
+    class IFunctionFactory : public boost::noncopyable
+    {
+    public:
+      virtual ~IFunctionFactory()
+      {
+      }
+
+      // Called when the job is paused or canceled. WARNING:
+      // "CancelFunction()" will be invoked while "Execute()" is
+      // running. Mutex is probably necessary.
+      virtual void CancelFunction() = 0;
+
+      virtual void PauseFunction() = 0;
+
+      virtual IFunction* CreateFunction() = 0;
+    };
+
+
+  protected:
+    void SetFactory(IFunctionFactory& factory)
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      if (factory_ != NULL)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+      }
+      else
+      {
+        factory_ = &factory;
+      }
+    }
+
+
+  private:
+    enum FunctionResult
+    {
+      FunctionResult_Running,
+      FunctionResult_Done,
+      FunctionResult_Failure
+    };
+
+    boost::mutex                  mutex_;
+    FunctionResult                functionResult_;  // Can only be modified by the "Worker()" function
+    std::unique_ptr<boost::thread>  worker_;
+    Json::Value                   content_;
+    IFunctionFactory*             factory_;
+    bool                          stopping_;
+
+    void JoinWorker()
+    {
+      assert(factory_ != NULL);
+
+      if (worker_.get() != NULL)
+      {
+        if (worker_->joinable())
+        {
+          worker_->join();
+        }
+
+        worker_.reset();
+      }
+    }
+
+    void StartWorker()
+    {
+      assert(factory_ != NULL);
+
+      if (worker_.get() == NULL)
+      {
+        stopping_ = false;
+        worker_.reset(new boost::thread(Worker, this, factory_));
+      }
+    }
+
+  protected:
+    void SetContent(const std::string& key,
+                    const Json::Value& value)
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      content_[key] = value;
+      UpdateContent(content_);
+    }
+
+    // Stores the state from which the job can be unserialized after
+    // a restart of Orthanc
+    void SetSerialized(const Json::Value& serialized)
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      UpdateSerialized(serialized);
+    }
+
+  private:
+    static void Worker(SingleFunctionJob* job,
+                       IFunctionFactory* factory)
+    {
+      assert(job != NULL && factory != NULL);
+
+      try
+      {
+        JobContext context(*job);
+
+        std::unique_ptr<IFunction> function(factory->CreateFunction());
+        function->Execute(context);
+
+        {
+          boost::mutex::scoped_lock lock(job->mutex_);
+          job->functionResult_ = FunctionResult_Done;
+        }
+      }
+      catch (Orthanc::OrthancException& e)
+      {
+        LOG(ERROR) << "Error in a job: " << e.What();
+
+        {
+          boost::mutex::scoped_lock lock(job->mutex_);
+
+          job->functionResult_ = FunctionResult_Failure;
+
+          if (!job->stopping_)
+          {
+            // Don't report exceptions that are a consequence of stopping the function
+            job->content_["FunctionErrorCode"] = e.GetErrorCode();
+            job->content_["FunctionErrorDescription"] = e.What();
+            if (e.HasDetails())
+            {
+              job->content_["FunctionErrorDetails"] = e.GetDetails();
+            }
+            job->UpdateContent(job->content_);
+          }
+        }
+      }
+    }  
+
+    void StopInternal(OrthancPluginJobStopReason reason)
+    {
+      if (factory_ == NULL)
+      {
+        return;
+      }
+      else if (reason == OrthancPluginJobStopReason_Paused ||
+               reason == OrthancPluginJobStopReason_Canceled)
+      {
+        stopping_ = true;
+
+        if (reason == OrthancPluginJobStopReason_Paused)
+        {
+          factory_->PauseFunction();
+        }
+        else
+        {
+          factory_->CancelFunction();
+        }
+
+        JoinWorker();
+
+        // Be ready for the next possible call to "Step()" that will resume the function
+        functionResult_ = FunctionResult_Running;
+      }
+    }
+
+  public:
+    explicit SingleFunctionJob(const std::string& jobName) :
+      OrthancJob(jobName),
+      functionResult_(FunctionResult_Running),
+      content_(Json::objectValue),
+      factory_(NULL),
+      stopping_(false)
+    {
+    }
+
+    virtual ~SingleFunctionJob() ORTHANC_OVERRIDE
+    {
+      if (worker_.get() != NULL)
+      {
+        LOG(ERROR) << "Classes deriving from SingleFunctionJob must "
+                   << "explicitly call Finalize() in their destructor";
+        Finalize();
+      }
+    }
+
+    void Finalize()
+    {
+      try
+      {
+        StopInternal(OrthancPluginJobStopReason_Canceled);
+      }
+      catch (Orthanc::OrthancException&)
+      {
+      }
+    }
+
+    virtual OrthancPluginJobStepStatus Step() ORTHANC_OVERRIDE ORTHANC_FINAL
+    {
+      if (factory_ == NULL)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+      }
+
+      FunctionResult result;
+
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+        result = functionResult_;
+      }
+
+      switch (result)
+      {
+        case FunctionResult_Running:
+          StartWorker();
+          boost::this_thread::sleep(boost::posix_time::milliseconds(500));
+          return OrthancPluginJobStepStatus_Continue;
+
+        case FunctionResult_Done:
+          JoinWorker();
+          return OrthancPluginJobStepStatus_Success;
+
+        case FunctionResult_Failure:
+          JoinWorker();
+          return OrthancPluginJobStepStatus_Failure;
+
+        default:
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+      }
+    }
+
+    virtual void Stop(OrthancPluginJobStopReason reason) ORTHANC_OVERRIDE ORTHANC_FINAL
+    {
+      StopInternal(reason);
+    }
+
+    virtual void Reset() ORTHANC_OVERRIDE ORTHANC_FINAL
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      assert(worker_.get() == NULL);
+      functionResult_ = FunctionResult_Running;
+      content_ = Json::objectValue;
+      ClearContent();
+    }
+  };
+}
@@ -0,0 +1,169 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#include "SlidingWindowMetrics.h"
+
+#include <OrthancException.h>
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/functional/hash.hpp>
+#include <boost/thread.hpp>
+
+
+namespace OrthancPlugins
+{
+  SlidingWindowMetrics::Shard& SlidingWindowMetrics::GetShard()
+  {
+    return shards_[boost::hash<boost::thread::id>()(boost::this_thread::get_id()) % SHARDS_COUNT];
+  }
+
+
+  size_t SlidingWindowMetrics::GetBucket(Shard& shard,
+                                         int64_t second)
+  {
+    if (second < 0)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+
+    const size_t index = static_cast<size_t>(second % windowSeconds_);
+    Bucket& bucket = shard.buckets_[index];
+
+    if (bucket.second_ != second)
+    {
+      // The bucket contains the samples of a previous turn of the ring
+      bucket = Bucket();
+      bucket.second_ = second;
+
+      if (hasHistograms_)
+      {
+        shard.histograms_[index].Clear();
+      }
+    }
+
+    return index;
+  }
+
+
+  SlidingWindowMetrics::SlidingWindowMetrics(unsigned int windowSeconds,
+                                             bool hasHistograms) :
+    windowSeconds_(windowSeconds),
+    hasHistograms_(hasHistograms)
+  {
+    if (windowSeconds == 0)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+
+    for (unsigned int i = 0; i < SHARDS_COUNT; i++)
+    {
+      shards_[i].buckets_.resize(windowSeconds);
+
+      if (hasHistograms)
+      {
+        shards_[i].histograms_.resize(windowSeconds);
+      }
+    }
+  }
+
+
+  int64_t SlidingWindowMetrics::GetCurrentSecond()
+  {
+    static const boost::posix_time::ptime EPOCH(boost::gregorian::date(1970, 1, 1));
+    return (boost::posix_time::microsec_clock::universal_time() - EPOCH).total_seconds();
+  }
+
+
+  void SlidingWindowMetrics::AddValue(double value,
+                                      double weight,
+                                      int64_t second)
+  {
+    Shard& shard = GetShard();
+
+    boost::mutex::scoped_lock lock(shard.mutex_);
+
+    Bucket& bucket = shard.buckets_[GetBucket(shard, second)];
+    bucket.count_++;
+    bucket.sum_ += value;
+    bucket.weightedSum_ += value * weight;
+    bucket.totalWeight_ += weight;
+  }
+
+
+  void SlidingWindowMetrics::AddDuration(uint64_t microseconds,
+                                         int64_t second)
+  {
+    const double milliseconds = static_cast<double>(microseconds) / 1000.0;
+
+    Shard& shard = GetShard();
+
+    boost::mutex::scoped_lock lock(shard.mutex_);
+
+    const size_t index = GetBucket(shard, second);
+
+    Bucket& bucket = shard.buckets_[index];
+    bucket.count_++;
+    bucket.sum_ += milliseconds;
+    bucket.weightedSum_ += milliseconds;
+    bucket.totalWeight_ += 1;
+
+    if (hasHistograms_)
+    {
+      shard.histograms_[index].Add(microseconds);
+    }
+  }
+
+
+  void SlidingWindowMetrics::GetStatistics(Statistics& target,
+                                           int64_t second)
+  {
+    target = Statistics();
+    target.windowSeconds_ = windowSeconds_;
+
+    for (unsigned int i = 0; i < SHARDS_COUNT; i++)
+    {
+      boost::mutex::scoped_lock lock(shards_[i].mutex_);
+
+      for (size_t j = 0; j < windowSeconds_; j++)
+      {
+        const Bucket& bucket = shards_[i].buckets_[j];
+
+        if (bucket.second_ >= 0 &&
+            bucket.second_ <= second &&
+            second - bucket.second_ < static_cast<int64_t>(windowSeconds_))
+        {
+          target.count_ += bucket.count_;
+          target.sum_ += bucket.sum_;
+          target.weightedSum_ += bucket.weightedSum_;
+          target.totalWeight_ += bucket.totalWeight_;
+
+          if (hasHistograms_)
+          {
+            target.histogram_.Merge(shards_[i].histograms_[j]);
+          }
+        }
+      }
+    }
+  }
+}
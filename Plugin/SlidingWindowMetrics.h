@@ -0,0 +1,186 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#pragma once
+
+#include "LatencyMetrics.h"
+
+#include <vector>
+#include <stdint.h>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+
+namespace OrthancPlugins
+{
+  // Aggregates samples over a sliding window of a given number of
+  // seconds, with a fixed memory usage: Each shard is a ring of
+  // one-second buckets, and a bucket is reset when the ring wraps
+  // around.  This gives weighted averages, rates and (optionally)
+  // histograms of durations over the window.  As in "LatencyMetrics",
+  // the shard is selected by the ID of the calling thread, and its
+  // mutex is only held to update one bucket.
+  class SlidingWindowMetrics : public boost::noncopyable
+  {
+  public:
+    class Statistics
+    {
+    private:
+      unsigned int      windowSeconds_;
+      uint64_t          count_;
+      double            sum_;
+      double            weightedSum_;
+      double            totalWeight_;
+      LatencyHistogram  histogram_;
+
+      friend class SlidingWindowMetrics;
+
+    public:
+      Statistics() :
+        windowSeconds_(0),
+        count_(0),
+        sum_(0),
+        weightedSum_(0),
+        totalWeight_(0)
+      {
+      }
+
+      uint64_t GetCount() const
+      {
+        return count_;
+      }
+
+      double GetSum() const
+      {
+        return sum_;
+      }
+
+      double GetAverage() const
+      {
+        return (count_ == 0 ? 0 : sum_ / static_cast<double>(count_));
+      }
+
+      // Average of the values, weighted by their weight
+      double GetWeightedAverage() const
+      {
+        return (totalWeight_ > 0 ? weightedSum_ / totalWeight_ : 0);
+      }
+
+      // Number of samples per second
+      double GetRate() const
+      {
+        return (windowSeconds_ == 0 ? 0 : static_cast<double>(count_) / static_cast<double>(windowSeconds_));
+      }
+
+      // Sum of the values per second (e.g. bytes per second)
+      double GetSumRate() const
+      {
+        return (windowSeconds_ == 0 ? 0 : sum_ / static_cast<double>(windowSeconds_));
+      }
+
+      // Only filled by "AddDuration()", if the histograms are enabled
+      const LatencyHistogram& GetHistogram() const
+      {
+        return histogram_;
+      }
+    };
+
+  private:
+    static const unsigned int SHARDS_COUNT = 8;
+
+    struct Bucket
+    {
+      int64_t   second_;
+      uint64_t  count_;
+      double    sum_;
+      double    weightedSum_;
+      double    totalWeight_;
+
+      Bucket() :
+        second_(-1),
+        count_(0),
+        sum_(0),
+        weightedSum_(0),
+        totalWeight_(0)
+      {
+      }
+    };
+
+    struct Shard
+    {
+      boost::mutex                   mutex_;
+      std::vector<Bucket>            buckets_;
+      std::vector<LatencyHistogram>  histograms_;  // Empty if the histograms are disabled
+    };
+
+    unsigned int  windowSeconds_;
+    bool          hasHistograms_;
+    Shard         shards_[SHARDS_COUNT];
+
+    Shard& GetShard();
+
+    // The mutex of the shard must be locked
+    size_t GetBucket(Shard& shard,
+                     int64_t second);
+
+  public:
+    explicit SlidingWindowMetrics(unsigned int windowSeconds,
+                                  bool hasHistograms = false);
+
+    unsigned int GetWindowSeconds() const
+    {
+      return windowSeconds_;
+    }
+
+    static int64_t GetCurrentSecond();
+
+    void AddValue(double value,
+                  double weight,
+                  int64_t second);
+
+    void AddValue(double value,
+                  double weight)
+    {
+      AddValue(value, weight, GetCurrentSecond());
+    }
+
+    // The value of the sample is the duration in milliseconds
+    void AddDuration(uint64_t microseconds,
+                     int64_t second);
+
+    void AddDuration(uint64_t microseconds)
+    {
+      AddDuration(microseconds, GetCurrentSecond());
+    }
+
+    // The samples are those of the last "windowSeconds" seconds,
+    // including the current second
+    void GetStatistics(Statistics& target,
+                       int64_t second);
+
+    void GetStatistics(Statistics& target)
+    {
+      GetStatistics(target, GetCurrentSecond());
+    }
+  };
+}
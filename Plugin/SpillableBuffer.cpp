@@ -0,0 +1,225 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "SpillableBuffer.h"
+
+#include <OrthancException.h>
+
+#if defined(_WIN32)
+#  include <windows.h>
+#else
+#  include <fcntl.h>
+#  include <sys/mman.h>
+#  include <unistd.h>
+#endif
+
+
+namespace OrthancPlugins
+{
+  void SpillableBuffer::Spill()
+  {
+    file_.reset(new Orthanc::TemporaryFile);
+
+    stream_ = fopen(file_->GetPath().c_str(), "wb");
+    if (stream_ == NULL)
+    {
+      file_.reset();
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_CannotWriteFile,
+                                      "Cannot create a temporary file to receive a large part");
+    }
+
+    if (!memory_.empty())
+    {
+      const size_t size = memory_.size();
+      size_ = 0;
+      Append(memory_.c_str(), size);
+
+      std::string empty;
+      memory_.swap(empty);
+    }
+  }
+
+
+  void SpillableBuffer::CloseStream()
+  {
+    if (stream_ != NULL)
+    {
+      const bool ok = (fclose(stream_) == 0);
+      stream_ = NULL;
+
+      if (!ok)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_CannotWriteFile);
+      }
+    }
+  }
+
+
+  void SpillableBuffer::Unmap()
+  {
+    if (mapping_ != NULL)
+    {
+#if defined(_WIN32)
+      UnmapViewOfFile(mapping_);
+      CloseHandle(reinterpret_cast<HANDLE>(mappingHandle_));
+      CloseHandle(reinterpret_cast<HANDLE>(fileHandle_));
+#else
+      munmap(const_cast<void*>(mapping_), size_);
+#endif
+
+      mapping_ = NULL;
+    }
+  }
+
+
+  SpillableBuffer::SpillableBuffer(size_t threshold) :
+    threshold_(threshold),
+    size_(0),
+    stream_(NULL),
+    mapping_(NULL)
+  {
+#if defined(_WIN32)
+    fileHandle_ = NULL;
+    mappingHandle_ = NULL;
+#endif
+  }
+
+
+  SpillableBuffer::~SpillableBuffer()
+  {
+    // The mapping must be released before the temporary file is removed
+    Unmap();
+
+    if (stream_ != NULL)
+    {
+      fclose(stream_);
+    }
+  }
+
+
+  void SpillableBuffer::Append(const void* data,
+                               size_t size)
+  {
+    if (mapping_ != NULL ||
+        (IsSpilled() && stream_ == NULL))
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+    }
+
+    if (size == 0)
+    {
+      return;
+    }
+
+    if (!IsSpilled() &&
+        threshold_ != 0 &&
+        memory_.size() + size > threshold_)
+    {
+      Spill();
+    }
+
+    if (IsSpilled())
+    {
+      if (fwrite(data, 1, size, stream_) != size)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_CannotWriteFile,
+                                        "Cannot write to a temporary file (is the disk full?)");
+      }
+    }
+    else
+    {
+      memory_.append(reinterpret_cast<const char*>(data), size);
+    }
+
+    size_ += size;
+  }
+
+
+  const void* SpillableBuffer::GetData()
+  {
+    if (!IsSpilled())
+    {
+      return memory_.empty() ? NULL : memory_.c_str();
+    }
+    else if (mapping_ != NULL)
+    {
+      return mapping_;
+    }
+
+    CloseStream();
+
+    if (size_ == 0)
+    {
+      return NULL;
+    }
+
+#if defined(_WIN32)
+    HANDLE file = CreateFileA(file_->GetPath().c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+                              OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_CannotWriteFile);
+    }
+
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mapping == NULL)
+    {
+      CloseHandle(file);
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_NotEnoughMemory,
+                                      "Cannot map a temporary file in memory");
+    }
+
+    const void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (view == NULL)
+    {
+      CloseHandle(mapping);
+      CloseHandle(file);
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_NotEnoughMemory,
+                                      "Cannot map a temporary file in memory");
+    }
+
+    fileHandle_ = file;
+    mappingHandle_ = mapping;
+    mapping_ = view;
+#else
+    int fd = open(file_->GetPath().c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_CannotWriteFile);
+    }
+
+    void* view = mmap(NULL, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);  // The mapping remains valid after closing the file descriptor
+
+    if (view == MAP_FAILED)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_NotEnoughMemory,
+                                      "Cannot map a temporary file in memory");
+    }
+
+    mapping_ = view;
+#endif
+
+    return mapping_;
+  }
+}
@@ -0,0 +1,83 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include <TemporaryFile.h>
+
+#include <stdio.h>
+#include <memory>
+#include <string>
+#include <boost/noncopyable.hpp>
+
+namespace OrthancPlugins
+{
+  // Buffer that is kept in memory as long as it is smaller than a
+  // threshold, and that is written to a temporary file beyond this
+  // threshold. Once complete, the content of a spilled buffer is
+  // memory-mapped, so that it is paged from the disk by the operating
+  // system instead of being copied in the heap of the process.
+  class SpillableBuffer : public boost::noncopyable
+  {
+  private:
+    size_t                                  threshold_;
+    size_t                                  size_;
+    std::string                             memory_;
+    std::unique_ptr<Orthanc::TemporaryFile> file_;
+    FILE*                                   stream_;    // Opened as long as data is appended to the file
+    const void*                             mapping_;
+
+#if defined(_WIN32)
+    void*                                   fileHandle_;
+    void*                                   mappingHandle_;
+#endif
+
+    void Spill();
+
+    void CloseStream();
+
+    void Unmap();
+
+  public:
+    // If "threshold" is zero, the buffer is always kept in memory
+    explicit SpillableBuffer(size_t threshold);
+
+    ~SpillableBuffer();
+
+    void Append(const void* data,
+                size_t size);
+
+    size_t GetSize() const
+    {
+      return size_;
+    }
+
+    bool IsSpilled() const
+    {
+      return file_.get() != NULL;
+    }
+
+    // No data can be appended after the first call to this method
+    const void* GetData();
+  };
+}
@@ -24,14 +24,183 @@
 #include "StowRs.h"
 
 #include "Configuration.h"
+#include "DicomHeaderScanner.h"
 #include "DicomWebFormatter.h"
 #include "Logging.h"
+#include "SlidingWindowMetrics.h"
+
+#include <limits>
 
 namespace OrthancPlugins
 {
+  static SlidingWindowMetrics stowAverageBandwidth_(300);
+  static SlidingWindowMetrics stowInstances_(300);  // One sample per request, whose value is the number of stored instances
+
+
+  class StowServer::Part : public WorkersPool::ITask
+  {
+  private:
+    const StowServer&  server_;
+    std::string        copy_;
+    boost::shared_ptr<SpillableBuffer>  spilled_;
+    const void*        data_;
+    size_t             size_;
+    std::string        retrieveUrl_;
+    Json::Value        item_;
+    bool               success_;
+    size_t             taskIndex_;
+
+  public:
+    // Part that is rejected without being stored
+    Part(const StowServer& server,
+         const Json::Value& item,
+         uint16_t failureReason) :
+      server_(server),
+      data_(NULL),
+      size_(0),
+      item_(item),
+      success_(false),
+      taskIndex_(0)
+    {
+      item_[DICOM_TAG_FAILURE_REASON.Format()] = boost::lexical_cast<std::string>(failureReason);
+    }
+
+    // If "copy" is true, the part is stored by a worker thread, which
+    // requires a copy, as the buffer of the multipart parser is
+    // transient. No copy is done if the part has been spilled to the disk.
+    Part(const StowServer& server,
+         const Json::Value& item,
+         const std::string& retrieveUrl,
+         const void* data,
+         size_t size,
+         const boost::shared_ptr<SpillableBuffer>& spilled,
+         bool copy) :
+      server_(server),
+      spilled_(spilled),
+      data_(data),
+      size_(size),
+      retrieveUrl_(retrieveUrl),
+      item_(item),
+      success_(true),
+      taskIndex_(0)
+    {
+      if (copy &&
+          spilled_.get() == NULL)
+      {
+        copy_.assign(reinterpret_cast<const char*>(data), size);
+        data_ = copy_.empty() ? NULL : copy_.c_str();
+      }
+    }
+
+    void SetTaskIndex(size_t index)
+    {
+      taskIndex_ = index;
+    }
+
+    size_t GetTaskIndex() const
+    {
+      return taskIndex_;
+    }
+
+    bool IsSuccess() const
+    {
+      return success_;
+    }
+
+    const Json::Value& GetItem() const
+    {
+      return item_;
+    }
+
+    virtual void Execute() ORTHANC_OVERRIDE
+    {
+      bool ok = false;
+      uint16_t failureReason = 0;
+
+      try
+      {
+        LatencyStageTimer timer(LatencyRoute_Stow, LatencyStage_Load);
+        MemoryBuffer tmp;
+
+        // make sure to forward the auth headers in the request that is sent to Orthanc (to allow usage of the auth plugin)
+        // since we do not know which header is being used, we include all the headers from the STOW-RS request (headers_), replace
+        // the "content-disposition" + "content-type" that are rebuilt from the multi-part message and remove the headers that might
+        // be mi-interpreted by Orthanc core (like "content-length" that is actually the "content-length" from the whole STOW-RS request, not the length of this file)
+        ok = tmp.RestApiPost("/instances", data_, size_, server_.headers_, true);
+        tmp.Clear();
+      }
+      catch (Orthanc::OrthancException& ex)
+      {
+        ok = false;
+        if (ex.GetErrorCode() == Orthanc::ErrorCode_FullStorage)
+        {
+          failureReason = 0xA700;  // out-of-resources
+        }
+        else
+        {
+          failureReason = 0x0110;  // processing error
+        }
+      }
+
+      // Free the copy of the part as soon as possible
+      std::string empty;
+      copy_.swap(empty);
+      spilled_.reset();
+      data_ = NULL;
+
+      if (ok)
+      {
+        item_[DICOM_TAG_RETRIEVE_URL.Format()] = retrieveUrl_;
+      }
+      else
+      {
+        LOG(ERROR) << "Orthanc was unable to store one instance in a STOW-RS request";
+        item_[DICOM_TAG_FAILURE_REASON.Format()] =
+          boost::lexical_cast<std::string>(failureReason);
+        success_ = false;
+      }
+    }
+  };
+
+
+  static bool ScanIdentifiers(Json::Value& dicom,
+                              const void* part,
+                              size_t size)
+  {
+    std::set<Orthanc::DicomTag> tags;
+    tags.insert(Orthanc::DICOM_TAG_SERIES_INSTANCE_UID);
+    tags.insert(Orthanc::DICOM_TAG_SOP_CLASS_UID);
+    tags.insert(Orthanc::DICOM_TAG_SOP_INSTANCE_UID);
+    tags.insert(Orthanc::DICOM_TAG_STUDY_INSTANCE_UID);
+
+    DicomHeaderScanner::Values values;
+    if (!DicomHeaderScanner::Scan(values, tags, part, size))
+    {
+      return false;
+    }
+
+    dicom = Json::objectValue;
+
+    for (std::set<Orthanc::DicomTag>::const_iterator it = tags.begin(); it != tags.end(); ++it)
+    {
+      DicomHeaderScanner::Values::const_iterator found = values.find(*it);
+      if (found == values.end() ||
+          found->second.empty())
+      {
+        return false;  // Let the Orthanc core report the errors
+      }
+
+      dicom[it->Format()] = found->second;
+    }
+
+    return true;
+  }
+
+
   StowServer::StowServer(OrthancPluginContext* context,
                          const std::map<std::string, std::string>& headers,
                          const std::string& expectedStudy) :
+    totalTimer_(LatencyRoute_Stow, LatencyStage_Total),
     context_(context),
     xml_(Configuration::IsXmlExpected(headers)),
     wadoBasePublicUrl_(Configuration::GetBasePublicUrl(headers)),
@@ -42,8 +211,25 @@ namespace OrthancPlugins
     failed_(Json::arrayValue),
     hasBadSyntax_(false),
     hasConflict_(false),
-    headers_(headers)
+    headers_(headers),
+    threadsCount_(Configuration::GetStowRsThreadsCount()),
+    maxInFlightSize_(static_cast<size_t>(Configuration::GetStowRsMaxInFlightSize()) * 1024 * 1024),
+    inFlightSize_(0),
+    receivedBytes_(0),
+    start_(boost::posix_time::microsec_clock::universal_time())
   { 
+    headers_.erase("content-length");
+
+    if (threadsCount_ > 1)
+    {
+      group_.reset(new WorkersPool::TasksGroup(WorkersPool::GetInstance(), threadsCount_));
+    }
+
+    if (maxInFlightSize_ == 0)
+    {
+      maxInFlightSize_ = std::numeric_limits<size_t>::max();
+    }
+
     std::string tmp, contentType, subType, boundary;
     if (!Orthanc::MultipartStreamReader::GetMainContentType(tmp, headers) ||
         !Orthanc::MultipartStreamReader::ParseMultipartContentType(contentType, subType, boundary, tmp))
@@ -74,14 +260,75 @@ namespace OrthancPlugins
       boundary = boundary.substr(1, boundary.size() - 2);
     }
 
-    parser_.reset(new Orthanc::MultipartStreamReader(boundary));
-    parser_->SetHandler(*this);
+    spillThreshold_ = static_cast<size_t>(Configuration::GetStowRsSpillThreshold()) * 1024 * 1024;
+
+    if (spillThreshold_ == 0)
+    {
+      parser_.reset(new Orthanc::MultipartStreamReader(boundary));
+      parser_->SetHandler(*this);
+    }
+    else
+    {
+      streamingParser_.reset(new StreamingMultipartParser(*this, boundary));
+    }
   }
 
 
-  void StowServer::HandlePart(const Orthanc::MultipartStreamReader::HttpHeaders& headers,
-                              const void* part,
-                              size_t size)
+  void StowServer::WaitOldestInFlight()
+  {
+    assert(group_.get() != NULL &&
+           !inFlight_.empty());
+
+    const Part& part = *parts_[inFlight_.front()];
+
+    // If no worker has started storing this part yet, it is stored by this thread
+    group_->Wait(part.GetTaskIndex());
+
+    assert(inFlightSize_ >= inFlightSizes_.front());
+    inFlightSize_ -= inFlightSizes_.front();
+    inFlight_.pop_front();
+    inFlightSizes_.pop_front();
+  }
+
+
+  void StowServer::StartPart(const StreamingMultipartParser::HttpHeaders& headers)
+  {
+    currentHeaders_ = headers;
+    currentPart_.reset(new SpillableBuffer(spillThreshold_));
+  }
+
+
+  void StowServer::AddPartContent(const void* data,
+                                  size_t size)
+  {
+    assert(currentPart_.get() != NULL);
+    currentPart_->Append(data, size);
+  }
+
+
+  void StowServer::EndPart()
+  {
+    assert(currentPart_.get() != NULL);
+
+    boost::shared_ptr<SpillableBuffer> part = currentPart_;
+    currentPart_.reset();
+
+    if (part->IsSpilled())
+    {
+      LOG(INFO) << "STOW-RS: A part of " << part->GetSize() << " bytes has been received in a temporary file";
+      ProcessPart(currentHeaders_, part->GetData(), part->GetSize(), part);
+    }
+    else
+    {
+      ProcessPart(currentHeaders_, part->GetData(), part->GetSize(), boost::shared_ptr<SpillableBuffer>());
+    }
+  }
+
+
+  void StowServer::ProcessPart(const Orthanc::MultipartStreamReader::HttpHeaders& headers,
+                               const void* part,
+                               size_t size,
+                               const boost::shared_ptr<SpillableBuffer>& spilled)
   {
     std::string contentType;
 
@@ -94,25 +341,30 @@ namespace OrthancPlugins
         "\"application/dicom\" (it is: \"" + contentType + "\")");
     }
 
+    // Only the four UIDs are needed: first try to read them from the
+    // beginning of the file, then revert to a full parsing of the part
     Json::Value dicom;
-    bool ok = false;
+    bool ok = ScanIdentifiers(dicom, part, size);
 
-    try
+    if (!ok)
     {
-      OrthancString s;
-      s.Assign(OrthancPluginDicomBufferToJson(context_, part, size,
-                                              OrthancPluginDicomToJsonFormat_Short,
-                                              OrthancPluginDicomToJsonFlags_None, 256));
+      try
+      {
+        OrthancString s;
+        s.Assign(OrthancPluginDicomBufferToJson(context_, part, size,
+                                                OrthancPluginDicomToJsonFormat_Short,
+                                                OrthancPluginDicomToJsonFlags_None, 256));
 
-      if (s.GetContent() != NULL)
+        if (s.GetContent() != NULL)
+        {
+          ok = true;
+          s.ToJson(dicom);
+        }
+      }
+      catch (Orthanc::OrthancException&)
       {
-        ok = true;
-        s.ToJson(dicom);
       }
     }
-    catch (Orthanc::OrthancException&)
-    {
-    }           
 
     if (!ok)
     {
@@ -143,9 +395,7 @@ namespace OrthancPlugins
         Json::Value item = Json::objectValue;
         item[DICOM_TAG_REFERENCED_SOP_CLASS_UID.Format()] = dicom[Orthanc::DICOM_TAG_SOP_CLASS_UID.Format()].asString();
         item[DICOM_TAG_REFERENCED_SOP_INSTANCE_UID.Format()] = dicom[Orthanc::DICOM_TAG_SOP_INSTANCE_UID.Format()].asString();
-        item[DICOM_TAG_FAILURE_REASON.Format()] =
-          boost::lexical_cast<std::string>(0xC000);  // Error: Cannot understand
-        failed_.append(item);
+        parts_.push_back(boost::shared_ptr<Part>(new Part(*this, item, 0xC000)));  // Error: Cannot understand
       }
 
       return;
@@ -168,9 +418,7 @@ namespace OrthancPlugins
 
       hasConflict_ = true;
 
-      item[DICOM_TAG_FAILURE_REASON.Format()] =
-        boost::lexical_cast<std::string>(0x0110);  // Processing failure
-      failed_.append(item);
+      parts_.push_back(boost::shared_ptr<Part>(new Part(*this, item, 0x0110)));  // Processing failure
     }
     else
     {
@@ -181,54 +429,39 @@ namespace OrthancPlugins
         isFirst_ = false;
       }
 
-      uint16_t failureReason = 0;
-      try
-      {
-        MemoryBuffer tmp;
+      std::string url = (wadoBasePublicUrl_ + 
+                         "studies/" + studyInstanceUid +
+                         "/series/" + seriesInstanceUid +
+                         "/instances/" + sopInstanceUid);
 
-        // make sure to forward the auth headers in the request that is sent to Orthanc (to allow usage of the auth plugin)
-        // since we do not know which header is being used, we include all the headers from the STOW-RS request (headers_), replace
-        // the "content-disposition" + "content-type" that are rebuilt from the multi-part message and remove the headers that might
-        // be mi-interpreted by Orthanc core (like "content-length" that is actually the "content-length" from the whole STOW-RS request, not the length of this file)
-        Orthanc::MultipartStreamReader::HttpHeaders mergedHeaders = headers_;
-        Orthanc::MultipartStreamReader::HttpHeaders::iterator foundContentLength = mergedHeaders.find("content-length");
-        if (foundContentLength != mergedHeaders.end())
-        {
-          mergedHeaders.erase(foundContentLength);
-        }
-        
-        ok = tmp.RestApiPost("/instances", part, size, mergedHeaders, true);
-        tmp.Clear();
+      if (group_.get() == NULL)
+      {
+        // Sequential mode: store the part before reading the next one
+        boost::shared_ptr<Part> stored(new Part(*this, item, url, part, size, spilled, false));
+        stored->Execute();
+        parts_.push_back(stored);
       }
-      catch (Orthanc::OrthancException& ex)
+      else
       {
-        ok = false;
-        if (ex.GetErrorCode() == Orthanc::ErrorCode_FullStorage)
+        // Bound the memory that is used by the copies of the parts
+        // that are waiting to be stored. A part that is larger than
+        // the limit is still stored once nothing else is in flight.
+        // The parts that are spilled to the disk are not copied.
+        const size_t buffered = (spilled.get() == NULL ? size : 0);
+
+        while (!inFlight_.empty() &&
+               inFlightSize_ + buffered > maxInFlightSize_)
         {
-          failureReason = 0xA700;  // out-of-resources
+          WaitOldestInFlight();
         }
-        else
-        {
-          failureReason = 0x0110;  // processing error
-        }
-      }
 
-      if (ok)
-      {
-        std::string url = (wadoBasePublicUrl_ + 
-                           "studies/" + studyInstanceUid +
-                           "/series/" + seriesInstanceUid +
-                           "/instances/" + sopInstanceUid);
+        boost::shared_ptr<Part> stored(new Part(*this, item, url, part, size, spilled, true));
+        parts_.push_back(stored);
+        inFlight_.push_back(parts_.size() - 1);
+        inFlightSizes_.push_back(buffered);
+        inFlightSize_ += buffered;
 
-        item[DICOM_TAG_RETRIEVE_URL.Format()] = url;
-        success_.append(item);      
-      }
-      else
-      {
-        LOG(ERROR) << "Orthanc was unable to store one instance in a STOW-RS request";
-        item[DICOM_TAG_FAILURE_REASON.Format()] =
-          boost::lexical_cast<std::string>(failureReason);
-        failed_.append(item);
+        stored->SetTaskIndex(group_->Submit(*stored));
       }
     }
   }
@@ -237,15 +470,51 @@ namespace OrthancPlugins
   void StowServer::AddChunk(const void* data,
                             size_t size)
   {
-    assert(parser_.get() != NULL);
-    parser_->AddChunk(data, size);
+    receivedBytes_ += size;
+
+    if (streamingParser_.get() != NULL)
+    {
+      streamingParser_->AddChunk(data, size);
+    }
+    else
+    {
+      assert(parser_.get() != NULL);
+      parser_->AddChunk(data, size);
+    }
   }
 
 
   void StowServer::Execute(OrthancPluginRestOutput* output)
   {
-    assert(parser_.get() != NULL);
-    parser_->CloseStream();
+    if (streamingParser_.get() != NULL)
+    {
+      streamingParser_->CloseStream();
+    }
+    else
+    {
+      assert(parser_.get() != NULL);
+      parser_->CloseStream();
+    }
+
+    if (group_.get() != NULL)
+    {
+      group_->WaitAll();
+      inFlight_.clear();
+      inFlightSizes_.clear();
+      inFlightSize_ = 0;
+    }
+
+    for (size_t i = 0; i < parts_.size(); i++)
+    {
+      if (parts_[i]->IsSuccess())
+      {
+        success_.append(parts_[i]->GetItem());
+      }
+      else
+      {
+        failed_.append(parts_[i]->GetItem());
+      }
+    }
 
     if (failed_.size() > 0)
     {
@@ -255,10 +524,25 @@ namespace OrthancPlugins
 
     result_[DICOM_TAG_REFERENCED_SOP_SEQUENCE.Format()] = success_;
     
+    {
+      const int64_t elapsed = (boost::posix_time::microsec_clock::universal_time() - start_).total_microseconds();
+      if (elapsed > 0)
+      {
+        // Bytes per microsecond, which gives a bandwidth in MB/s
+        stowAverageBandwidth_.AddValue(static_cast<double>(receivedBytes_) / static_cast<double>(elapsed),
+                                       static_cast<double>(receivedBytes_));
+      }
+
+      stowInstances_.AddValue(static_cast<double>(success_.size()), 1);
+    }
+
     std::string answer;
-    
-    DicomWebFormatter::Apply(answer, context_, result_, xml_,
-                             OrthancPluginDicomWebBinaryMode_Ignore, "");
+
+    {
+      LatencyStageTimer timer(LatencyRoute_Stow, LatencyStage_Format);
+      DicomWebFormatter::Apply(answer, context_, result_, xml_,
+                               OrthancPluginDicomWebBinaryMode_Ignore, "");
+    }
 
     // http://dicom.nema.org/medical/dicom/current/output/html/part18.html#table_10.5.3-1
     uint16_t statusCode = 200;
@@ -279,6 +563,8 @@ namespace OrthancPlugins
       statusCode = 202;
     }
 
+    LatencyStageTimer timer(LatencyRoute_Stow, LatencyStage_Send);
+
     if (statusCode == 200)
     {
       OrthancPluginAnswerBuffer(context_, output, answer.c_str(), answer.size(),
@@ -293,6 +579,21 @@ namespace OrthancPlugins
   };
 
   
+  void StowServer::RefreshMetrics()
+  {
+    SlidingWindowMetrics::Statistics bandwidth;
+    stowAverageBandwidth_.GetStatistics(bandwidth);
+
+    SlidingWindowMetrics::Statistics instances;
+    stowInstances_.GetStatistics(instances);
+
+    SetMetricsValue("orthanc_dicomweb_stowrs_average_bandwidth_per_call_mbytes_per_second_5m",
+                    static_cast<float>(bandwidth.GetWeightedAverage()));
+    SetMetricsValue("orthanc_dicomweb_stowrs_requests_per_second_5m", static_cast<float>(instances.GetRate()));
+    SetMetricsValue("orthanc_dicomweb_stowrs_instances_per_second_5m", static_cast<float>(instances.GetSumRate()));
+  }
+
+
   IChunkedRequestReader* StowServer::PostCallback(const char* url,
                                                   const OrthancPluginHttpRequest* request)
   {
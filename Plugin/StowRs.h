@@ -24,17 +24,28 @@
 #pragma once
 
 #include "../Resources/Orthanc/Plugins/OrthancPluginCppWrapper.h"
+#include "LatencyMetrics.h"
+#include "SpillableBuffer.h"
+#include "StreamingMultipartParser.h"
+#include "WorkersPool.h"
 
 #include <Compatibility.h>
 #include <HttpServer/MultipartStreamReader.h>
 
+#include <deque>
+#include <boost/shared_ptr.hpp>
+
 namespace OrthancPlugins
 {
   class StowServer : 
     public IChunkedRequestReader,
-    private Orthanc::MultipartStreamReader::IHandler
+    private Orthanc::MultipartStreamReader::IHandler,
+    private StreamingMultipartParser::IHandler
   {
   private:
+    class Part;
+
+    LatencyStageTimer      totalTimer_;  // The request spans several callbacks
     OrthancPluginContext*  context_;
     bool                   xml_;
     std::string            wadoBasePublicUrl_;
@@ -45,13 +56,52 @@ namespace OrthancPlugins
     Json::Value            failed_;
     bool                   hasBadSyntax_;
     bool                   hasConflict_;
-    std::map<std::string, std::string> headers_;
+    std::map<std::string, std::string> headers_;  // Without "content-length"
+    unsigned int           threadsCount_;
+    size_t                 maxInFlightSize_;
+    size_t                 inFlightSize_;
+    uint64_t               receivedBytes_;
+    boost::posix_time::ptime  start_;
+
+    // The parts in the order of the multipart body, which is the
+    // order of the items in the answer
+    std::vector<boost::shared_ptr<Part> >  parts_;
+    std::deque<size_t>                     inFlight_;       // Parts being stored by the workers, oldest first
+    std::deque<size_t>                     inFlightSizes_;  // Size of their copy in the heap
+
+    // Must be declared after "parts_", as it must be destroyed first
+    std::unique_ptr<WorkersPool::TasksGroup>  group_;
 
     std::unique_ptr<Orthanc::MultipartStreamReader>  parser_;
 
+    // Used instead of "parser_" if the large parts are spilled to the disk
+    size_t                                      spillThreshold_;
+    std::unique_ptr<StreamingMultipartParser>   streamingParser_;
+    StreamingMultipartParser::HttpHeaders       currentHeaders_;
+    boost::shared_ptr<SpillableBuffer>          currentPart_;
+
+    void WaitOldestInFlight();
+
+    // "spilled" is only set if the part has been spilled to the disk,
+    // in which case "part" points to its memory-mapped content
+    void ProcessPart(const Orthanc::MultipartStreamReader::HttpHeaders& headers,
+                     const void* part,
+                     size_t size,
+                     const boost::shared_ptr<SpillableBuffer>& spilled);
+
     virtual void HandlePart(const Orthanc::MultipartStreamReader::HttpHeaders& headers,
                             const void* part,
-                            size_t size) ORTHANC_OVERRIDE;
+                            size_t size) ORTHANC_OVERRIDE
+    {
+      ProcessPart(headers, part, size, boost::shared_ptr<SpillableBuffer>());
+    }
+
+    virtual void StartPart(const StreamingMultipartParser::HttpHeaders& headers) ORTHANC_OVERRIDE;
+
+    virtual void AddPartContent(const void* data,
+                                size_t size) ORTHANC_OVERRIDE;
+
+    virtual void EndPart() ORTHANC_OVERRIDE;
 
   public:
     StowServer(OrthancPluginContext* context,
@@ -63,6 +113,9 @@ namespace OrthancPlugins
 
     virtual void Execute(OrthancPluginRestOutput* output) ORTHANC_OVERRIDE;
 
+    // Publishes the throughput of the STOW-RS requests over the last 5 minutes
+    static void RefreshMetrics();
+
     static IChunkedRequestReader* PostCallback(const char* url,
                                                const OrthancPluginHttpRequest* request);
   };
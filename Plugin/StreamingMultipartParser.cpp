@@ -0,0 +1,229 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "StreamingMultipartParser.h"
+
+#include <Logging.h>
+#include <OrthancException.h>
+#include <Toolbox.h>
+
+#include <vector>
+
+
+namespace OrthancPlugins
+{
+  static void ParseHeaders(StreamingMultipartParser::HttpHeaders& target,
+                           const std::string& block)
+  {
+    target.clear();
+
+    size_t start = 0;
+    while (start < block.size())
+    {
+      size_t end = block.find("\r\n", start);
+      if (end == std::string::npos)
+      {
+        end = block.size();
+      }
+
+      const std::string line = block.substr(start, end - start);
+
+      const size_t colon = line.find(':');
+      if (colon != std::string::npos)
+      {
+        std::string key;
+        Orthanc::Toolbox::ToLowerCase(key, Orthanc::Toolbox::StripSpaces(line.substr(0, colon)));
+        target[key] = Orthanc::Toolbox::StripSpaces(line.substr(colon + 1));
+      }
+
+      start = end + 2;
+    }
+  }
+
+
+  StreamingMultipartParser::StreamingMultipartParser(IHandler& handler,
+                                                     const std::string& boundary) :
+    handler_(handler),
+    delimiter_("\r\n--" + boundary),
+    state_(State_Preamble),
+    buffer_("\r\n"),  // So that a body that starts with the boundary is handled as the other delimiters
+    maxHeadersSize_(64 * 1024)
+  {
+    if (boundary.empty())
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+  }
+
+
+  void StreamingMultipartParser::FlushContent()
+  {
+    if (buffer_.size() >= delimiter_.size())
+    {
+      const size_t flushed = buffer_.size() - (delimiter_.size() - 1);
+      handler_.AddPartContent(buffer_.c_str(), flushed);
+      buffer_.erase(0, flushed);
+    }
+  }
+
+
+  bool StreamingMultipartParser::Step()
+  {
+    switch (state_)
+    {
+      case State_Preamble:
+      {
+        const size_t pos = buffer_.find(delimiter_);
+        if (pos == std::string::npos)
+        {
+          if (buffer_.size() >= delimiter_.size())
+          {
+            buffer_.erase(0, buffer_.size() - (delimiter_.size() - 1));
+          }
+
+          return false;
+        }
+        else
+        {
+          buffer_.erase(0, pos + delimiter_.size());
+          state_ = State_AfterDelimiter;
+          return true;
+        }
+      }
+
+      case State_AfterDelimiter:
+      {
+        if (buffer_.size() < 2)
+        {
+          return false;
+        }
+        else if (buffer_.compare(0, 2, "--") == 0)
+        {
+          state_ = State_Done;  // Close delimiter, the epilogue is ignored
+          buffer_.clear();
+          return false;
+        }
+        else
+        {
+          // Skip the transport padding up to the end of the line
+          const size_t pos = buffer_.find("\r\n");
+          if (pos == std::string::npos)
+          {
+            return false;
+          }
+
+          buffer_.erase(0, pos + 2);
+          state_ = State_Headers;
+          return true;
+        }
+      }
+
+      case State_Headers:
+      {
+        std::string block;
+
+        if (buffer_.compare(0, 2, "\r\n") == 0)
+        {
+          buffer_.erase(0, 2);  // Part without header
+        }
+        else
+        {
+          const size_t pos = buffer_.find("\r\n\r\n");
+          if (pos == std::string::npos)
+          {
+            if (buffer_.size() > maxHeadersSize_)
+            {
+              throw Orthanc::OrthancException(Orthanc::ErrorCode_NetworkProtocol,
+                                              "Too large headers in a part of a multipart body");
+            }
+
+            return false;
+          }
+
+          block = buffer_.substr(0, pos);
+          buffer_.erase(0, pos + 4);
+        }
+
+        HttpHeaders headers;
+        ParseHeaders(headers, block);
+
+        state_ = State_Content;
+        handler_.StartPart(headers);
+        return true;
+      }
+
+      case State_Content:
+      {
+        const size_t pos = buffer_.find(delimiter_);
+        if (pos == std::string::npos)
+        {
+          FlushContent();
+          return false;
+        }
+        else
+        {
+          if (pos > 0)
+          {
+            handler_.AddPartContent(buffer_.c_str(), pos);
+          }
+
+          buffer_.erase(0, pos + delimiter_.size());
+          state_ = State_AfterDelimiter;
+          handler_.EndPart();
+          return true;
+        }
+      }
+
+      case State_Done:
+        buffer_.clear();
+        return false;
+
+      default:
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+    }
+  }
+
+
+  void StreamingMultipartParser::AddChunk(const void* data,
+                                          size_t size)
+  {
+    if (state_ != State_Done &&
+        size > 0)
+    {
+      buffer_.append(reinterpret_cast<const char*>(data), size);
+
+      while (Step())
+      {
+      }
+    }
+  }
+
+
+  void StreamingMultipartParser::CloseStream()
+  {
+    if (state_ != State_Done)
+    {
+      LOG(WARNING) << "The multipart body has no close delimiter, its last part is ignored";
+    }
+  }
+}
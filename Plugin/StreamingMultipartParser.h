@@ -0,0 +1,94 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include <map>
+#include <string>
+#include <boost/noncopyable.hpp>
+
+namespace OrthancPlugins
+{
+  // Parser of a "multipart/related" body that reports the content of
+  // the parts as it arrives, instead of buffering each part before
+  // reporting it as "Orthanc::MultipartStreamReader" does. This allows
+  // to receive parts that are larger than the available memory.
+  class StreamingMultipartParser : public boost::noncopyable
+  {
+  public:
+    // The keys are in lower case, the values are stripped
+    typedef std::map<std::string, std::string>  HttpHeaders;
+
+    class IHandler : public boost::noncopyable
+    {
+    public:
+      virtual ~IHandler()
+      {
+      }
+
+      virtual void StartPart(const HttpHeaders& headers) = 0;
+
+      virtual void AddPartContent(const void* data,
+                                  size_t size) = 0;
+
+      virtual void EndPart() = 0;
+    };
+
+  private:
+    enum State
+    {
+      State_Preamble,
+      State_AfterDelimiter,
+      State_Headers,
+      State_Content,
+      State_Done
+    };
+
+    IHandler&    handler_;
+    std::string  delimiter_;
+    State        state_;
+    std::string  buffer_;   // Data that has been received, but not processed yet
+    size_t       maxHeadersSize_;
+
+    // Returns "false" if more data is needed
+    bool Step();
+
+    // Reports all the buffered content, except the bytes that might be
+    // the beginning of a delimiter
+    void FlushContent();
+
+  public:
+    StreamingMultipartParser(IHandler& handler,
+                             const std::string& boundary);
+
+    void AddChunk(const void* data,
+                  size_t size);
+
+    void CloseStream();
+
+    bool IsDone() const
+    {
+      return state_ == State_Done;
+    }
+  };
+}
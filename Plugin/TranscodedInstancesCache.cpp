@@ -0,0 +1,527 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "TranscodedInstancesCache.h"
+
+#include <OrthancException.h>
+
+#include <cassert>
+
+
+namespace OrthancPlugins
+{
+  TranscodedInstancesCache::CachedInstance::CachedInstance(DicomInstance* instance) :
+    instance_(instance)
+  {
+    if (instance == NULL)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_NullPointer);
+    }
+
+    size_ = instance_->GetSize();
+  }
+
+
+  TranscodedInstancesCache::CachedInstance::CachedInstance(MemoryBuffer& file,
+                                                           const UncompressedFramesIndex& frames) :
+    frames_(frames)
+  {
+    file_.Swap(file);
+    size_ = file_.GetSize();
+
+    if (frames_.GetFramesCount() > 0 &&
+        frames_.GetFrameOffset(frames_.GetFramesCount() - 1) + frames_.GetFrameSize() > size_)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+  }
+
+
+  unsigned int TranscodedInstancesCache::CachedInstance::GetFramesCount()
+  {
+    if (IsUncompressed())
+    {
+      return frames_.GetFramesCount();
+    }
+    else
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      return instance_->GetFramesCount();
+    }
+  }
+
+
+  void TranscodedInstancesCache::CachedInstance::GetRawFrame(std::string& target,
+                                                             unsigned int frameIndex)
+  {
+    if (IsUncompressed())
+    {
+      const void* data = NULL;
+      size_t size = 0;
+      GetUncompressedFrame(data, size, frameIndex);
+      target.assign(reinterpret_cast<const char*>(data), size);
+    }
+    else
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      instance_->GetRawFrame(target, frameIndex);
+    }
+  }
+
+
+  void TranscodedInstancesCache::CachedInstance::GetUncompressedFrame(const void*& data,
+                                                                      size_t& size,
+                                                                      unsigned int frameIndex) const
+  {
+    if (!IsUncompressed())
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+    }
+
+    data = reinterpret_cast<const uint8_t*>(file_.GetData()) + frames_.GetFrameOffset(frameIndex);
+    size = frames_.GetFrameSize();
+  }
+
+
+  TranscodedInstancesCache::TranscodedInstancesCache() :
+    lingeringSize_(0),
+    currentSize_(0),
+    maxSize_(0),
+    maxCount_(0),
+    coalescingWindow_(0),
+    hits_(0),
+    misses_(0),
+    coalesced_(0),
+    shares_(0),
+    evictions_(0)
+  {
+  }
+
+
+  TranscodedInstancesCache::~TranscodedInstancesCache()
+  {
+    for (Content::iterator it = content_.begin(); it != content_.end(); ++it)
+    {
+      assert(it->second != NULL);
+      delete it->second;
+    }
+  }
+
+
+  TranscodedInstancesCache& TranscodedInstancesCache::GetInstance()
+  {
+    static TranscodedInstancesCache singleton;
+    return singleton;
+  }
+
+
+  std::string TranscodedInstancesCache::GetKey(const std::string& orthancId,
+                                               Orthanc::DicomTransferSyntax syntax)
+  {
+    return orthancId + "|" + Orthanc::GetTransferSyntaxUid(syntax);
+  }
+
+
+  void TranscodedInstancesCache::RemoveReadyEntry(Content::iterator entry)
+  {
+    assert(entry != content_.end() &&
+           entry->second != NULL &&
+           !entry->second->isLoading_);
+
+    assert(currentSize_ >= entry->second->size_);
+    currentSize_ -= entry->second->size_;
+    recency_.erase(entry->second->recency_);
+
+    delete entry->second;
+    content_.erase(entry);
+  }
+
+
+  void TranscodedInstancesCache::MakeRoom()
+  {
+    while (!recency_.empty() &&
+           (currentSize_ > maxSize_ ||
+            (maxCount_ != 0 && recency_.size() > maxCount_)))
+    {
+      Content::iterator oldest = content_.find(recency_.back());
+      assert(oldest != content_.end());
+
+      // The instance is not freed if another thread is still using it,
+      // thanks to the shared pointer
+      RemoveReadyEntry(oldest);
+      evictions_++;
+    }
+  }
+
+
+  void TranscodedInstancesCache::RemoveOldestLingering()
+  {
+    assert(!lingering_.empty() &&
+           lingeringSize_ >= lingering_.front().size_);
+
+    const std::string key = lingering_.front().key_;
+    lingeringSize_ -= lingering_.front().size_;
+    lingering_.pop_front();  // The instance is freed if no request is using it anymore
+
+    Shared::iterator found = shared_.find(key);
+    if (found != shared_.end() &&
+        found->second.expired())
+    {
+      shared_.erase(found);
+    }
+  }
+
+
+  void TranscodedInstancesCache::RemoveExpiredLingering(bool all)
+  {
+    const boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+
+    while (!lingering_.empty() &&
+           (all || lingering_.front().expiration_ <= now))
+    {
+      RemoveOldestLingering();
+    }
+  }
+
+
+  void TranscodedInstancesCache::AddLingering(const std::string& key,
+                                              const InstancePtr& instance)
+  {
+    if (coalescingWindow_ == 0 ||
+        maxSize_ == 0)
+    {
+      // No lingering if the cache is disabled, as the memory usage
+      // would otherwise not be bounded by the configuration
+      return;
+    }
+
+    Lingering lingering;
+    lingering.expiration_ = (boost::posix_time::microsec_clock::universal_time() +
+                             boost::posix_time::milliseconds(coalescingWindow_));
+    lingering.key_ = key;
+    lingering.instance_ = instance;
+    lingering.size_ = instance->GetSize();
+    lingering_.push_back(lingering);
+    lingeringSize_ += lingering.size_;
+
+    // The queue is sorted by expiration, so the oldest instances are
+    // dropped first. The newest instance is always kept, as it is
+    // typically larger than the cache.
+    while (lingering_.size() > 1 &&
+           (lingeringSize_ > maxSize_ ||
+            (maxCount_ != 0 && lingering_.size() > maxCount_)))
+    {
+      RemoveOldestLingering();
+    }
+  }
+
+
+  TranscodedInstancesCache::InstancePtr TranscodedInstancesCache::LookupAvailable(const std::string& key,
+                                                                                  bool countHit)
+  {
+    Content::iterator found = content_.find(key);
+
+    if (found != content_.end() &&
+        !found->second->isLoading_)
+    {
+      if (countHit)
+      {
+        hits_++;
+      }
+
+      recency_.splice(recency_.begin(), recency_, found->second->recency_);
+      return found->second->instance_;
+    }
+
+    Shared::iterator shared = shared_.find(key);
+
+    if (shared != shared_.end())
+    {
+      InstancePtr instance = shared->second.lock();
+
+      if (instance.get() == NULL)
+      {
+        shared_.erase(shared);
+      }
+      else
+      {
+        if (countHit)
+        {
+          shares_++;
+        }
+
+        return instance;
+      }
+    }
+
+    return InstancePtr();
+  }
+
+
+  void TranscodedInstancesCache::SetLimits(size_t maxSize,
+                                           unsigned int maxCount)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    maxSize_ = maxSize;
+    maxCount_ = maxCount;
+    MakeRoom();
+
+    if (maxSize_ == 0)
+    {
+      RemoveExpiredLingering(true);
+    }
+  }
+
+
+  void TranscodedInstancesCache::SetCoalescingWindow(unsigned int milliseconds)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    coalescingWindow_ = milliseconds;
+
+    if (milliseconds == 0)
+    {
+      RemoveExpiredLingering(true);
+    }
+  }
+
+
+  TranscodedInstancesCache::InstancePtr TranscodedInstancesCache::Acquire(const std::string& orthancId,
+                                                                          Orthanc::DicomTransferSyntax syntax,
+                                                                          IInstanceFactory& factory)
+  {
+    const std::string key = GetKey(orthancId, syntax);
+
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      RemoveExpiredLingering(false);
+
+      bool hasWaited = false;
+
+      for (;;)
+      {
+        InstancePtr available = LookupAvailable(key, !hasWaited);
+        if (available.get() != NULL)
+        {
+          return available;
+        }
+
+        Content::iterator found = content_.find(key);
+
+        if (found == content_.end())
+        {
+          // Nobody is loading this instance, this thread will load it
+          break;
+        }
+        else
+        {
+          // Another thread is currently loading this instance, wait for it.
+          // If the loading fails, the entry is removed and this thread will
+          // try to load the instance by itself.
+          assert(found->second->isLoading_);
+
+          if (!hasWaited)
+          {
+            coalesced_++;
+            hasWaited = true;
+          }
+
+          loadingFinished_.wait(lock);
+        }
+      }
+
+      misses_++;
+      content_[key] = new Entry;
+    }
+
+    InstancePtr instance;
+
+    try
+    {
+      instance.reset(factory.Create());
+    }
+    catch (...)
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      Content::iterator found = content_.find(key);
+      assert(found != content_.end() && found->second->isLoading_);
+      delete found->second;
+      content_.erase(found);
+
+      loadingFinished_.notify_all();
+      throw;
+    }
+
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      Content::iterator found = content_.find(key);
+      assert(found != content_.end() && found->second->isLoading_);
+
+      const size_t size = instance->GetSize();
+
+      if (found->second->isInvalidated_)
+      {
+        // Don't share this instance, but still return it to the caller
+        delete found->second;
+        content_.erase(found);
+      }
+      else if (maxSize_ == 0 ||
+               size > maxSize_)
+      {
+        // Don't store this instance in the LRU, but share it with the
+        // threads that are waiting for it and with the next requests
+        delete found->second;
+        content_.erase(found);
+
+        shared_[key] = instance;
+        AddLingering(key, instance);
+      }
+      else
+      {
+        found->second->isLoading_ = false;
+        found->second->instance_ = instance;
+        found->second->size_ = size;
+        found->second->recency_ = recency_.insert(recency_.begin(), key);
+        currentSize_ += size;
+
+        MakeRoom();
+      }
+
+      loadingFinished_.notify_all();
+    }
+
+    return instance;
+  }
+
+
+  void TranscodedInstancesCache::Invalidate(const std::string& orthancId)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    const std::string prefix = orthancId + "|";
+
+    Content::iterator it = content_.lower_bound(prefix);
+    while (it != content_.end() &&
+           it->first.compare(0, prefix.size(), prefix) == 0)
+    {
+      if (it->second->isLoading_)
+      {
+        // The loading thread will discard the instance once loaded
+        it->second->isInvalidated_ = true;
+        ++it;
+      }
+      else
+      {
+        RemoveReadyEntry(it++);
+      }
+    }
+
+    Shared::iterator shared = shared_.lower_bound(prefix);
+    while (shared != shared_.end() &&
+           shared->first.compare(0, prefix.size(), prefix) == 0)
+    {
+      shared_.erase(shared++);
+    }
+
+    LingeringQueue::iterator lingering = lingering_.begin();
+    while (lingering != lingering_.end())
+    {
+      if (lingering->key_.compare(0, prefix.size(), prefix) == 0)
+      {
+        assert(lingeringSize_ >= lingering->size_);
+        lingeringSize_ -= lingering->size_;
+        lingering = lingering_.erase(lingering);
+      }
+      else
+      {
+        ++lingering;
+      }
+    }
+  }
+
+
+  TranscodedInstancesCache::InstancePtr TranscodedInstancesCache::LookupLoaded(const std::string& orthancId,
+                                                                               Orthanc::DicomTransferSyntax syntax)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    RemoveExpiredLingering(false);
+    return LookupAvailable(GetKey(orthancId, syntax), true);
+  }
+
+
+  void TranscodedInstancesCache::Clear()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    Content::iterator it = content_.begin();
+    while (it != content_.end())
+    {
+      if (it->second->isLoading_)
+      {
+        it->second->isInvalidated_ = true;
+        ++it;
+      }
+      else
+      {
+        RemoveReadyEntry(it++);
+      }
+    }
+
+    shared_.clear();
+    lingering_.clear();
+    lingeringSize_ = 0;
+  }
+
+
+  void TranscodedInstancesCache::RefreshMetrics()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    RemoveExpiredLingering(false);
+
+    // Forget about the shared instances that are not used anymore
+    Shared::iterator it = shared_.begin();
+    while (it != shared_.end())
+    {
+      if (it->second.expired())
+      {
+        shared_.erase(it++);
+      }
+      else
+      {
+        ++it;
+      }
+    }
+
+    SetMetricsValue("orthanc_dicomweb_wadors_frames_cache_hits", static_cast<int64_t>(hits_));
+    SetMetricsValue("orthanc_dicomweb_wadors_frames_cache_misses", static_cast<int64_t>(misses_));
+    SetMetricsValue("orthanc_dicomweb_wadors_frames_cache_coalesced", static_cast<int64_t>(coalesced_));
+    SetMetricsValue("orthanc_dicomweb_wadors_frames_cache_shared", static_cast<int64_t>(shares_));
+    SetMetricsValue("orthanc_dicomweb_wadors_frames_cache_evictions", static_cast<int64_t>(evictions_));
+    SetMetricsValue("orthanc_dicomweb_wadors_frames_cache_count", static_cast<int64_t>(recency_.size()));
+    SetMetricsValue("orthanc_dicomweb_wadors_frames_cache_size_mbytes",
+                    static_cast<float>(currentSize_) / (1024.0f * 1024.0f));
+  }
+}
@@ -0,0 +1,224 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include "../Resources/Orthanc/Plugins/OrthancPluginCppWrapper.h"
+#include "UncompressedFramesIndex.h"
+
+#include <Compatibility.h>
+#include <Enumerations.h>
+
+#include <list>
+#include <map>
+#include <string>
+#include <stdint.h>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/weak_ptr.hpp>
+
+namespace OrthancPlugins
+{
+  // Memory-bounded LRU cache of the parsed/transcoded DICOM instances
+  // that are used to answer WADO-RS RetrieveFrames requests.  Viewers
+  // such as OHIF request each frame of a multi-frame instance
+  // separately, often in parallel: without this cache, the full
+  // instance would be downloaded and transcoded for each frame.
+  //
+  // An entry is first inserted in a "being loaded" state: if other
+  // threads request the same entry meanwhile, they wait for the first
+  // thread to complete the loading instead of loading it once more.
+  //
+  // This coalescing also applies to the instances that are not stored
+  // in the LRU (cache disabled, or instance larger than the cache): a
+  // loaded instance remains shared as long as one request is still
+  // using it.  If the cache is enabled, the instances that are too
+  // large for it also remain available during a short "coalescing
+  // window" afterwards.  These lingering instances are bounded by the
+  // same limits as the LRU, except that the last one is always kept.
+  class TranscodedInstancesCache : public boost::noncopyable
+  {
+  public:
+    // The parsed DICOM file in the Orthanc core is not meant to be
+    // accessed by several threads at once, hence the mutex.  If the
+    // pixel data is not compressed, the DICOM file is not parsed by
+    // the core: the frames are read directly from its buffer.
+    class CachedInstance : public boost::noncopyable
+    {
+    private:
+      boost::mutex                    mutex_;
+      std::unique_ptr<DicomInstance>  instance_;  // NULL if uncompressed
+      MemoryBuffer                    file_;
+      UncompressedFramesIndex         frames_;
+      size_t                          size_;
+
+    public:
+      explicit CachedInstance(DicomInstance* instance);  // Takes ownership
+
+      // The content of "file" is swapped into the object
+      CachedInstance(MemoryBuffer& file,
+                     const UncompressedFramesIndex& frames);
+
+      size_t GetSize() const
+      {
+        return size_;
+      }
+
+      bool IsUncompressed() const
+      {
+        return instance_.get() == NULL;
+      }
+
+      unsigned int GetFramesCount();
+
+      void GetRawFrame(std::string& target,
+                       unsigned int frameIndex);
+
+      // Only if "IsUncompressed()".  The frame remains valid as long as
+      // the object is alive, and can be read without locking.
+      void GetUncompressedFrame(const void*& data,
+                                size_t& size,
+                                unsigned int frameIndex) const;
+    };
+
+    typedef boost::shared_ptr<CachedInstance>  InstancePtr;
+
+    class IInstanceFactory : public boost::noncopyable
+    {
+    public:
+      virtual ~IInstanceFactory()
+      {
+      }
+
+      // Must return a newly allocated instance or throw an exception
+      virtual CachedInstance* Create() = 0;
+    };
+
+  private:
+    typedef std::list<std::string>  Recency;  // Most recently used first
+
+    struct Entry
+    {
+      bool               isLoading_;
+      bool               isInvalidated_;  // Only meaningful if "isLoading_"
+      InstancePtr        instance_;
+      size_t             size_;
+      Recency::iterator  recency_;        // Only meaningful if "!isLoading_"
+
+      Entry() :
+        isLoading_(true),
+        isInvalidated_(false),
+        size_(0)
+      {
+      }
+    };
+
+    typedef std::map<std::string, Entry*>  Content;
+
+    // Instances that are not stored in the LRU, but that can still be
+    // shared with the requests that are received while in use
+    typedef std::map<std::string, boost::weak_ptr<CachedInstance> >  Shared;
+
+    struct Lingering
+    {
+      boost::posix_time::ptime  expiration_;
+      std::string               key_;
+      InstancePtr               instance_;
+      size_t                    size_;
+    };
+
+    typedef std::list<Lingering>  LingeringQueue;  // Sorted by expiration
+
+    boost::mutex               mutex_;
+    boost::condition_variable  loadingFinished_;
+    Content                    content_;
+    Recency                    recency_;
+    Shared                     shared_;
+    LingeringQueue             lingering_;
+    size_t                     lingeringSize_;
+    size_t                     currentSize_;
+    size_t                     maxSize_;
+    unsigned int               maxCount_;
+    unsigned int               coalescingWindow_;  // In milliseconds
+    uint64_t                   hits_;
+    uint64_t                   misses_;
+    uint64_t                   coalesced_;
+    uint64_t                   shares_;
+    uint64_t                   evictions_;
+
+    static std::string GetKey(const std::string& orthancId,
+                              Orthanc::DicomTransferSyntax syntax);
+
+    // The mutex must be locked
+    void RemoveReadyEntry(Content::iterator entry);
+
+    // The mutex must be locked
+    void MakeRoom();
+
+    // The mutex must be locked
+    void RemoveOldestLingering();
+
+    // The mutex must be locked
+    void RemoveExpiredLingering(bool all);
+
+    // The mutex must be locked
+    void AddLingering(const std::string& key,
+                      const InstancePtr& instance);
+
+    // The mutex must be locked
+    InstancePtr LookupAvailable(const std::string& key,
+                                bool countHit);
+
+  public:
+    TranscodedInstancesCache();
+
+    ~TranscodedInstancesCache();
+
+    static TranscodedInstancesCache& GetInstance();
+
+    // "maxSize" is expressed in bytes, a value of 0 disables the cache
+    void SetLimits(size_t maxSize,
+                   unsigned int maxCount);
+
+    // Delay during which an instance that is not stored in the LRU
+    // remains available to the subsequent requests
+    void SetCoalescingWindow(unsigned int milliseconds);
+
+    InstancePtr Acquire(const std::string& orthancId,
+                        Orthanc::DicomTransferSyntax syntax,
+                        IInstanceFactory& factory);
+
+    // Returns the instance if it is already loaded (either in the LRU,
+    // or shared), without waiting.  Returns NULL otherwise.
+    InstancePtr LookupLoaded(const std::string& orthancId,
+                             Orthanc::DicomTransferSyntax syntax);
+
+    void Invalidate(const std::string& orthancId);
+
+    void Clear();
+
+    void RefreshMetrics();
+  };
+}
@@ -0,0 +1,189 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "UncompressedFramesIndex.h"
+
+#include "DicomElementReader.h"
+
+#include <OrthancException.h>
+
+#include <boost/lexical_cast.hpp>
+
+
+namespace OrthancPlugins
+{
+  bool UncompressedFramesIndex::Parse(const void* dicom,
+                                      size_t size)
+  {
+    pixelDataOffset_ = 0;
+    frameSize_ = 0;
+    framesCount_ = 0;
+
+    DicomElementReader reader(dicom, size);
+
+    size_t position;
+    std::string transferSyntax;
+    if (!reader.ReadMetaHeader(position, transferSyntax))
+    {
+      return false;
+    }
+
+    bool implicit;
+    if (transferSyntax == "1.2.840.10008.1.2.1")
+    {
+      implicit = false;
+    }
+    else if (transferSyntax == "1.2.840.10008.1.2")
+    {
+      implicit = true;
+    }
+    else
+    {
+      return false;  // Compressed, deflated or big endian
+    }
+
+    unsigned int rows = 0, columns = 0, bitsAllocated = 0, samplesPerPixel = 1, numberOfFrames = 1;
+
+    for (;;)
+    {
+      DicomElementReader::Element element;
+      if (!reader.ReadElement(element, position, size, implicit))
+      {
+        return false;
+      }
+
+      const uint8_t* value = reader.GetValue(element);
+
+      if (element.group_ == 0x7fe0 &&
+          element.element_ == 0x0010)
+      {
+        if (element.HasUndefinedLength() ||  // Encapsulated pixel data
+            rows == 0 ||
+            columns == 0 ||
+            bitsAllocated == 0 ||
+            bitsAllocated % 8 != 0)
+        {
+          return false;
+        }
+
+        const uint64_t frameSize = (static_cast<uint64_t>(rows) * static_cast<uint64_t>(columns) *
+                                    static_cast<uint64_t>(samplesPerPixel) * static_cast<uint64_t>(bitsAllocated / 8));
+
+        if (frameSize == 0 ||
+            frameSize * static_cast<uint64_t>(numberOfFrames) > static_cast<uint64_t>(element.length_))
+        {
+          return false;
+        }
+
+        pixelDataOffset_ = element.valueOffset_;
+        frameSize_ = static_cast<size_t>(frameSize);
+        framesCount_ = numberOfFrames;
+        return true;
+      }
+      else if (element.IsItemTag() ||
+               element.group_ > 0x7fe0)
+      {
+        return false;
+      }
+      else if (element.group_ == 0x0028 &&
+               !element.HasUndefinedLength())
+      {
+        switch (element.element_)
+        {
+          case 0x0002:  // SamplesPerPixel
+          case 0x0010:  // Rows
+          case 0x0011:  // Columns
+          case 0x0100:  // BitsAllocated
+          {
+            if (element.length_ != 2)
+            {
+              return false;
+            }
+
+            const uint16_t v = DicomElementReader::ReadUInt16(value);
+
+            if (element.element_ == 0x0002)
+            {
+              samplesPerPixel = v;
+            }
+            else if (element.element_ == 0x0010)
+            {
+              rows = v;
+            }
+            else if (element.element_ == 0x0011)
+            {
+              columns = v;
+            }
+            else
+            {
+              bitsAllocated = v;
+            }
+
+            break;
+          }
+
+          case 0x0008:  // NumberOfFrames
+          {
+            try
+            {
+              const int frames = boost::lexical_cast<int>(DicomElementReader::StripPadding(value, element.length_));
+              if (frames <= 0)
+              {
+                return false;
+              }
+
+              numberOfFrames = static_cast<unsigned int>(frames);
+            }
+            catch (boost::bad_lexical_cast&)
+            {
+              return false;
+            }
+
+            break;
+          }
+
+          default:
+            break;
+        }
+      }
+
+      // The sequences with undefined length are skipped, including
+      // those whose VR is "UN" (their items are in implicit VR)
+      if (!reader.SkipValue(position, element, size, 0))
+      {
+        return false;
+      }
+    }
+  }
+
+
+  size_t UncompressedFramesIndex::GetFrameOffset(unsigned int frameIndex) const
+  {
+    if (frameIndex >= framesCount_)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+
+    return pixelDataOffset_ + static_cast<size_t>(frameIndex) * frameSize_;
+  }
+}
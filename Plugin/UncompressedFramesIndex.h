@@ -0,0 +1,71 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+namespace OrthancPlugins
+{
+  // Locates the frames of a DICOM file whose pixel data is not
+  // compressed (implicit or explicit VR little endian), by walking its
+  // top-level data elements.  This allows to send the frames as slices
+  // of the buffer containing the DICOM file, without parsing the file
+  // with DCMTK and without copying the frames.
+  class UncompressedFramesIndex
+  {
+  private:
+    size_t        pixelDataOffset_;
+    size_t        frameSize_;
+    unsigned int  framesCount_;
+
+  public:
+    UncompressedFramesIndex() :
+      pixelDataOffset_(0),
+      frameSize_(0),
+      framesCount_(0)
+    {
+    }
+
+    // Returns "false" if the pixel data is compressed, if the frames
+    // are not aligned on bytes (BitsAllocated == 1), or if the file
+    // cannot be parsed
+    bool Parse(const void* dicom,
+               size_t size);
+
+    unsigned int GetFramesCount() const
+    {
+      return framesCount_;
+    }
+
+    size_t GetFrameSize() const
+    {
+      return frameSize_;
+    }
+
+    // Offset of the frame from the beginning of the DICOM file
+    size_t GetFrameOffset(unsigned int frameIndex) const;
+  };
+}
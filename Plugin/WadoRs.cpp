@@ -22,8 +22,22 @@
 
 
 #include "../Resources/Orthanc/Plugins/OrthancPluginCppWrapper.h"
+#include "BulkDataCache.h"
+#include "CacheWarmer.h"
 #include "Configuration.h"
+#include "DicomHeaderScanner.h"
 #include "DicomWebFormatter.h"
+#include "HttpByteRange.h"
+#include "LatencyMetrics.h"
+#include "RenderedFramesCache.h"
+#include "ResourceLookupCache.h"
+#include "SeriesMetadataRecords.h"
+#include "SingleFunctionJob.h"
+#include "SpillableBuffer.h"
+#include "TranscodedInstancesCache.h"
+#include "WadoRs.h"
+#include "WorkersPool.h"
+#include "ZipStreamWriter.h"
 
 #include <ChunkedBuffer.h>
 #include <Compatibility.h>
@@ -31,20 +45,22 @@
 #include <Logging.h>
 #include <Toolbox.h>
 #include <SerializationToolbox.h>
-#include <MultiThreading/SharedMessageQueue.h>
 #include <Compression/GzipCompressor.h>
 
 #if ORTHANC_FRAMEWORK_VERSION_IS_ABOVE(1, 12, 11)
 #  include <ElapsedTimer.h>
-#  include <MultiThreading/BlockingSharedMessageQueue.h>
 #endif
 
+#include <algorithm>
+#include <limits>
 #include <memory>
+#include <boost/thread/condition_variable.hpp>
 #include <boost/thread/mutex.hpp>
 #include <boost/thread.hpp>
 #include <boost/lexical_cast.hpp>
 #include <boost/algorithm/string/predicate.hpp>
-#include "WeightedAverageMetrics.h"
+#include <boost/date_time/gregorian/gregorian.hpp>
+#include "SlidingWindowMetrics.h"
 
 static const std::string SERIES_METADATA_ATTACHMENT_ID = "4301";
 static std::string WADO_BASE_PLACEHOLDER = "$WADO_BASE_PLACEHOLDER$";
@@ -59,23 +75,28 @@ static boost::mutex mainDicomTagsListMutex;
 static bool pluginCanUseExtendedFind_ = false;
 static bool isSystemReadOnly_ = false;
 
-static boost::mutex preloaderThreadsCounterMutex;
-static uint32_t preloaderThreadsCounter = 0;
+static OrthancPlugins::SlidingWindowMetrics wadorsAverageBandwidth(300);
 
-static std::string GetWadoLoaderThreadName()
-{
-  boost::mutex::scoped_lock lock(preloaderThreadsCounterMutex);
-  std::string threadName = std::string("WADO-LOAD-") + boost::lexical_cast<std::string>(preloaderThreadsCounter++);
-  preloaderThreadsCounter %= 1000000;
-
-  return threadName;
-}
+static boost::mutex wadoRsTotalBytesTransferredMutex;
+static int64_t wadoRsTotalBytesTransferred = 0;
 
+static boost::mutex wadoRsReadAheadMutex;
+static int64_t wadoRsReadAheadBufferedBytes = 0;      // Loaded instances waiting to be sent, over all the requests
+static int64_t wadoRsReadAheadPeakBufferedBytes = 0;  // Since the last refresh of the metrics
+static int64_t wadoRsReadAheadWaitMicroseconds = 0;
 
-static WeightedAverageMetrics<float> wadorsAverageBandwidth(300);
+static void UpdateReadAheadBufferedBytes(int64_t delta)
+{
+  boost::mutex::scoped_lock lock(wadoRsReadAheadMutex);
+  wadoRsReadAheadBufferedBytes += delta;
+  wadoRsReadAheadPeakBufferedBytes = std::max(wadoRsReadAheadPeakBufferedBytes, wadoRsReadAheadBufferedBytes);
+}
 
-static boost::mutex wadoRsTotalBytesTransferredMutex;
-static int64_t wadoRsTotalBytesTransferred = 0;
+static void AddReadAheadWaitTime(const boost::posix_time::time_duration& duration)
+{
+  boost::mutex::scoped_lock lock(wadoRsReadAheadMutex);
+  wadoRsReadAheadWaitMicroseconds += duration.total_microseconds();
+}
 
 void SetPluginCanUseExtendedFind(bool enable)
 {
@@ -99,8 +120,52 @@ bool IsSystemReadOnly()
 
 void RefreshWadoRsMetrics()
 {
-  OrthancPlugins::SetMetricsValue("orthanc_dicomweb_wadors_average_bandwidth_per_call_mbytes_per_second_5m", wadorsAverageBandwidth.GetAverage());
+  {
+    OrthancPlugins::SlidingWindowMetrics::Statistics statistics;
+    wadorsAverageBandwidth.GetStatistics(statistics);
+    OrthancPlugins::SetMetricsValue("orthanc_dicomweb_wadors_average_bandwidth_per_call_mbytes_per_second_5m",
+                                    static_cast<float>(statistics.GetWeightedAverage()));
+  }
+
   OrthancPlugins::SetMetricsValue("orthanc_dicomweb_wadors_total_bytes_transferred", wadoRsTotalBytesTransferred);
+
+  {
+    boost::mutex::scoped_lock lock(wadoRsReadAheadMutex);
+    OrthancPlugins::SetMetricsValue("orthanc_dicomweb_wadors_read_ahead_peak_mbytes",
+                                    static_cast<float>(wadoRsReadAheadPeakBufferedBytes) / (1024.0f * 1024.0f));
+    OrthancPlugins::SetMetricsValue("orthanc_dicomweb_wadors_read_ahead_wait_ms",
+                                    static_cast<int64_t>(wadoRsReadAheadWaitMicroseconds / 1000));
+    wadoRsReadAheadPeakBufferedBytes = wadoRsReadAheadBufferedBytes;
+  }
+
+  OrthancPlugins::TranscodedInstancesCache::GetInstance().RefreshMetrics();
+  OrthancPlugins::WorkersPool::GetInstance().RefreshMetrics();
+
+  uint64_t lookupCacheHits, lookupCacheMisses;
+  OrthancPlugins::ResourceLookupCache::GetInstance().GetStatistics(lookupCacheHits, lookupCacheMisses);
+  OrthancPlugins::SetMetricsValue("orthanc_dicomweb_lookup_cache_hits", static_cast<int64_t>(lookupCacheHits));
+  OrthancPlugins::SetMetricsValue("orthanc_dicomweb_lookup_cache_misses", static_cast<int64_t>(lookupCacheMisses));
+  OrthancPlugins::SetMetricsValue("orthanc_dicomweb_lookup_cache_count",
+                                  static_cast<int64_t>(OrthancPlugins::ResourceLookupCache::GetInstance().GetSize()));
+
+  uint64_t renderedCacheHits, renderedCacheMisses, renderedNotModified;
+  OrthancPlugins::RenderedFramesCache::GetInstance().GetStatistics(renderedCacheHits, renderedCacheMisses, renderedNotModified);
+  OrthancPlugins::SetMetricsValue("orthanc_dicomweb_rendered_cache_hits", static_cast<int64_t>(renderedCacheHits));
+  OrthancPlugins::SetMetricsValue("orthanc_dicomweb_rendered_cache_misses", static_cast<int64_t>(renderedCacheMisses));
+  OrthancPlugins::SetMetricsValue("orthanc_dicomweb_rendered_not_modified", static_cast<int64_t>(renderedNotModified));
+  OrthancPlugins::SetMetricsValue("orthanc_dicomweb_rendered_cache_count",
+                                  static_cast<int64_t>(OrthancPlugins::RenderedFramesCache::GetInstance().GetSize()));
+  OrthancPlugins::SetMetricsValue("orthanc_dicomweb_rendered_cache_size_mbytes",
+                                  static_cast<float>(OrthancPlugins::RenderedFramesCache::GetInstance().GetMemoryUsage()) / (1024.0f * 1024.0f));
+
+  uint64_t bulkCacheHits, bulkCacheMisses;
+  OrthancPlugins::BulkDataCache::GetInstance().GetStatistics(bulkCacheHits, bulkCacheMisses);
+  OrthancPlugins::SetMetricsValue("orthanc_dicomweb_bulk_cache_hits", static_cast<int64_t>(bulkCacheHits));
+  OrthancPlugins::SetMetricsValue("orthanc_dicomweb_bulk_cache_misses", static_cast<int64_t>(bulkCacheMisses));
+  OrthancPlugins::SetMetricsValue("orthanc_dicomweb_bulk_cache_count",
+                                  static_cast<int64_t>(OrthancPlugins::BulkDataCache::GetInstance().GetSize()));
+  OrthancPlugins::SetMetricsValue("orthanc_dicomweb_bulk_cache_size_mbytes",
+                                  static_cast<float>(OrthancPlugins::BulkDataCache::GetInstance().GetMemoryUsage()) / (1024.0f * 1024.0f));
 }
 
 static std::string GetResourceUri(Orthanc::ResourceType level,
@@ -126,6 +191,35 @@ static std::string GetResourceUri(Orthanc::ResourceType level,
 
 namespace
 {
+  void ParseTransferSyntaxParameter(bool& transcode,
+                                    Orthanc::DicomTransferSyntax& targetSyntax /* set only if transcoding */,
+                                    const Orthanc::HttpContentNegociation::Dictionary& parameters)
+  {
+    Orthanc::HttpContentNegociation::Dictionary::const_iterator found = parameters.find("transfer-syntax");
+    if (found != parameters.end())
+    {
+      /**
+       * The "*" case below is related to Google Healthcare API:
+       * https://groups.google.com/d/msg/orthanc-users/w1Ekrsc6-U8/T2a_DoQ5CwAJ
+       **/
+      if (found->second == "*")
+      {
+        transcode = false;
+      }
+      else
+      {
+        transcode = true;
+
+        if (!Orthanc::LookupTransferSyntax(targetSyntax, found->second))
+        {
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_BadRequest,
+                                          "Unsupported transfer syntax in WADO-RS: " + found->second);
+        }
+      }
+    }
+  }
+
+
   class MultipartDicomNegotiation : public Orthanc::HttpContentNegociation::IHandler
   {
   private:
@@ -162,36 +256,49 @@ namespace
         }
       }
 
-      found = parameters.find("transfer-syntax");
-      if (found != parameters.end())
-      {
-        /**
-         * The "*" case below is related to Google Healthcare API:
-         * https://groups.google.com/d/msg/orthanc-users/w1Ekrsc6-U8/T2a_DoQ5CwAJ
-         **/
-        if (found->second == "*")
-        {
-          transcode_ = false;
-        }
-        else
-        {
-          transcode_ = true;
+      ParseTransferSyntaxParameter(transcode_, targetSyntax_, parameters);
+    }
+  };
 
-          if (!Orthanc::LookupTransferSyntax(targetSyntax_, found->second))
-          {
-            throw Orthanc::OrthancException(Orthanc::ErrorCode_BadRequest,
-                                            "Unsupported transfer syntax in WADO-RS: " + found->second);
-          }
-        }
-      }
+
+  // "application/zip" is only available in RetrieveStudy (DICOM sup 211)
+  class ZipDicomNegotiation : public Orthanc::HttpContentNegociation::IHandler
+  {
+  private:
+    bool&                         isZip_;
+    bool&                         transcode_;
+    Orthanc::DicomTransferSyntax& targetSyntax_;
+
+  public:
+    ZipDicomNegotiation(
+      bool& isZip,
+      bool& transcode,
+      Orthanc::DicomTransferSyntax& targetSyntax /* set only if transcoding */) :
+      isZip_(isZip),
+      transcode_(transcode),
+      targetSyntax_(targetSyntax)
+    {
+    }
+
+    virtual void Handle(const std::string& type,
+                        const std::string& subtype,
+                        const Orthanc::HttpContentNegociation::Dictionary& parameters) ORTHANC_OVERRIDE
+    {
+      assert(type == "application" &&
+             subtype == "zip");
+
+      isZip_ = true;
+      ParseTransferSyntaxParameter(transcode_, targetSyntax_, parameters);
     }
   };
 }
 
 
-static void AcceptMultipartDicom(bool& transcode,
-                                 Orthanc::DicomTransferSyntax& targetSyntax /* only if transcoding */,
-                                 const OrthancPluginHttpRequest* request)
+static void AcceptDicom(bool& isZip,
+                        bool& transcode,
+                        Orthanc::DicomTransferSyntax& targetSyntax /* only if transcoding */,
+                        const OrthancPluginHttpRequest* request,
+                        bool allowZip)
 {
   /**
    * Up to release 1.4 of the DICOMweb plugin, WADO-RS
@@ -218,6 +325,7 @@ static void AcceptMultipartDicom(bool& transcode,
    **/
 
   // By default, return "multipart/related; type=application/dicom; transfer-syntax=1.2.840.10008.1.2.1"
+  isZip = false;
   transcode = true;
   targetSyntax = Orthanc::DicomTransferSyntax_LittleEndianExplicit;
   
@@ -229,6 +337,12 @@ static void AcceptMultipartDicom(bool& transcode,
     MultipartDicomNegotiation dicom(transcode, targetSyntax);
     negotiation.Register("multipart/related", dicom);
 
+    ZipDicomNegotiation zip(isZip, transcode, targetSyntax);
+    if (allowZip)
+    {
+      negotiation.Register("application/zip", zip);
+    }
+
     if (!negotiation.Apply(accept))
     {
       throw Orthanc::OrthancException(Orthanc::ErrorCode_BadRequest,
@@ -238,6 +352,15 @@ static void AcceptMultipartDicom(bool& transcode,
 }
 
 
+static void AcceptMultipartDicom(bool& transcode,
+                                 Orthanc::DicomTransferSyntax& targetSyntax /* only if transcoding */,
+                                 const OrthancPluginHttpRequest* request)
+{
+  bool isZip;
+  AcceptDicom(isZip, transcode, targetSyntax, request, false /* multipart only */);
+}
+
+
 namespace
 {
   class AcceptMetadataJson : public Orthanc::HttpContentNegociation::IHandler
@@ -359,17 +482,41 @@ namespace
       if (parameters.find("range") != parameters.end())
       {
         throw Orthanc::OrthancException(Orthanc::ErrorCode_BadRequest,
-                                        "This WADO-RS plugin does not support Range retrieval, "
-                                        "it can only return entire bulk data object");
+                                        "This WADO-RS plugin does not support the \"range\" parameter, "
+                                        "use the \"Range\" HTTP header instead");
       }
     }
   };
+
+
+  class SinglePartBulkDataNegotiation : public Orthanc::HttpContentNegociation::IHandler
+  {
+  private:
+    bool&  isSinglePart_;
+
+  public:
+    explicit SinglePartBulkDataNegotiation(bool& isSinglePart) :
+      isSinglePart_(isSinglePart)
+    {
+    }
+
+    virtual void Handle(const std::string& type,
+                        const std::string& subtype,
+                        const Orthanc::HttpContentNegociation::Dictionary& parameters) ORTHANC_OVERRIDE
+    {
+      assert(type == "application" &&
+             subtype == "octet-stream");
+      isSinglePart_ = true;
+    }
+  };
 }
 
 
-static void AcceptBulkData(const OrthancPluginHttpRequest* request)
+static void AcceptBulkData(bool& isSinglePart,
+                           const OrthancPluginHttpRequest* request)
 {
   // By default, return "multipart/related; type=application/octet-stream;"
+  isSinglePart = false;
 
   std::string accept;
 
@@ -380,6 +527,9 @@ static void AcceptBulkData(const OrthancPluginHttpRequest* request)
     BulkDataNegotiation bulk;
     negotiation.Register("multipart/related", bulk);
 
+    SinglePartBulkDataNegotiation singlePart(isSinglePart);
+    negotiation.Register("application/octet-stream", singlePart);
+
     if (!negotiation.Apply(accept))
     {
       throw Orthanc::OrthancException(Orthanc::ErrorCode_BadRequest,
@@ -412,28 +562,6 @@ public:
 };
 
 
-class LoadedInstance : public Orthanc::IDynamicObject
-{
-private:
-  std::unique_ptr<OrthancPlugins::DicomInstance> dicom_;
-
-public:
-  explicit LoadedInstance(OrthancPlugins::DicomInstance* dicom) : 
-    dicom_(dicom)
-  {
-  }
-
-  virtual ~LoadedInstance() ORTHANC_OVERRIDE
-  {
-  }
-
-  OrthancPlugins::DicomInstance* ReleaseInstance() 
-  {
-    return dicom_.release();
-  }
-};
-
-
 class InstanceLoader : public boost::noncopyable
 {
 protected:
@@ -442,10 +570,18 @@ protected:
 
   OrthancPlugins::DicomInstance* GetAndTranscodeDicom(InstanceToPreload* instanceToLoad)
   {
-    std::unique_ptr<OrthancPlugins::DicomInstance> dicom(OrthancPlugins::DicomInstance::Load(instanceToLoad->GetInstanceId(),
-                                                                                             OrthancPluginLoadDicomInstanceMode_WholeDicom));
+    // This is possibly run by a worker thread, hence the explicit route
+    std::unique_ptr<OrthancPlugins::DicomInstance> dicom;
+
+    {
+      OrthancPlugins::LatencyStageTimer timer(OrthancPlugins::LatencyRoute_WadoRsDicom, OrthancPlugins::LatencyStage_Load);
+      dicom.reset(OrthancPlugins::DicomInstance::Load(instanceToLoad->GetInstanceId(),
+                                                      OrthancPluginLoadDicomInstanceMode_WholeDicom));
+    }
+
     if (transcode_ && instanceToLoad->NeedsTranscoding())
     {
+      OrthancPlugins::LatencyStageTimer timer(OrthancPlugins::LatencyRoute_WadoRsDicom, OrthancPlugins::LatencyStage_Transcode);
       dicom.reset(dicom->Transcode(dicom->GetBuffer(),
                                     dicom->GetSize(),
                                     Orthanc::GetTransferSyntaxUid(targetTransferSyntax_)));
@@ -472,123 +608,206 @@ public:
 };
 
 
+// Loads the instances in parallel in the plugin-wide pool of workers,
+// but returns them in the order of the calls to "PrepareDicom()".  The
+// instances are only submitted to the workers ahead of the instances
+// that are being sent to the HTTP client within a bounded window (both
+// in number of instances and in bytes), which provides back-pressure
+// if the HTTP client is slow.
 class ThreadedInstanceLoader : public InstanceLoader
 {
 private:
-  std::vector<boost::thread*>         threads_;
+  class LoadingTask : public OrthancPlugins::WorkersPool::ITask
+  {
+  private:
+    ThreadedInstanceLoader&                         that_;
+    InstanceToPreload                               instance_;
+    std::unique_ptr<OrthancPlugins::DicomInstance>  dicom_;  // Protected by the mutex of the loader, NULL if the loading has failed
 
-  Orthanc::SharedMessageQueue         instancesToPreload_;
+  public:
+    LoadingTask(ThreadedInstanceLoader& that,
+                const std::string& instanceId,
+                bool transcode) :
+      that_(that),
+      instance_(instanceId, transcode)
+    {
+    }
 
-#if ORTHANC_FRAMEWORK_VERSION_IS_ABOVE(1, 12, 11)
-  Orthanc::BlockingSharedMessageQueue loadedInstances_;
-#else
-  Orthanc::SharedMessageQueue         loadedInstances_;
-#endif
+    virtual void Execute() ORTHANC_OVERRIDE
+    {
+      std::unique_ptr<OrthancPlugins::DicomInstance> dicom;
+
+      try
+      {
+        dicom.reset(that_.GetAndTranscodeDicom(&instance_));
+      }
+      catch (Orthanc::OrthancException& e)
+      {
+        LOG(ERROR) << "Error while loading instances " << e.GetDetails();
+      }
+      catch (...)
+      {
+        LOG(ERROR) << "Unknown error while loading instances ";
+      }
 
-  bool                                loadersShouldStop_;
+      if (dicom.get() != NULL)
+      {
+        boost::mutex::scoped_lock lock(that_.mutex_);
+        that_.bufferedBytes_ += dicom->GetSize();
+        UpdateReadAheadBufferedBytes(static_cast<int64_t>(dicom->GetSize()));
+        dicom_.reset(dicom.release());
+      }
+    }
 
-public:
-  ThreadedInstanceLoader(size_t threadCount, bool transcode, Orthanc::DicomTransferSyntax transferSyntax)
-  : InstanceLoader(transcode, transferSyntax),
-    instancesToPreload_(0),
-#if ORTHANC_FRAMEWORK_VERSION_IS_ABOVE(1, 12, 11)
-    loadedInstances_(3 * threadCount), // to limit the number of loaded instances in memory
-#else
-    loadedInstances_(0),  // don't limit the number of loaded instances, otherwise extra instances would be lost
-#endif
-    loadersShouldStop_(false)
-  {
-    for (size_t i = 0; i < threadCount; i++)
+    // The mutex of the loader must be locked
+    OrthancPlugins::DicomInstance* ReleaseDicom()
     {
-      threads_.push_back(new boost::thread(PreloaderWorkerThread, this));
+      return dicom_.release();
     }
-  }
+  };
 
-  virtual ~ThreadedInstanceLoader() ORTHANC_OVERRIDE
+  boost::mutex                                                mutex_;
+  size_t                                                      bufferedBytes_;  // Protected by the mutex
+  std::vector<boost::shared_ptr<LoadingTask> >                tasks_;
+  std::unique_ptr<OrthancPlugins::WorkersPool::TasksGroup>    group_;
+  size_t                                                      nextToSubmit_;
+  size_t                                                      nextToSend_;
+  size_t                                                      maxBufferedInstances_;
+  size_t                                                      maxBufferedBytes_;
+  bool                                                        isThrottled_;
+  boost::posix_time::ptime                                    throttlingStart_;
+
+  bool IsWindowOpen()
   {
-    Clear();
+    assert(nextToSubmit_ >= nextToSend_);
+
+    boost::mutex::scoped_lock lock(mutex_);
+
+    // If nothing is waiting to be sent, an instance that is larger
+    // than the window must still be loaded
+    return (nextToSubmit_ == nextToSend_ ||
+            (nextToSubmit_ - nextToSend_ < maxBufferedInstances_ &&
+             bufferedBytes_ < maxBufferedBytes_));
   }
 
-  void Clear()
+  void FillWindow()
   {
-    if (threads_.size() > 0)
+    while (nextToSubmit_ < tasks_.size())
     {
-      loadersShouldStop_ = true; // not need to protect this by a mutex.  This is the only "writer" and all loaders are "readers"
-
-      LOG(INFO) << "Waiting for loader threads to complete";
-
-      // unlock the loaders if they are waiting on this message queue (this happens when the job completes sucessfully)
-      for (size_t i = 0; i < threads_.size(); i++)
+      if (!IsWindowOpen())
       {
-        instancesToPreload_.Enqueue(NULL);
-      }
+        if (!isThrottled_)
+        {
+          // The HTTP client is slower than the loaders
+          isThrottled_ = true;
+          throttlingStart_ = boost::posix_time::microsec_clock::universal_time();
+        }
 
+        return;
+      }
 
-      for (size_t i = 0; i < threads_.size(); i++)
+      if (isThrottled_)
       {
-        if (threads_[i]->joinable())
-        {
-          threads_[i]->join();
-        }
-        delete threads_[i];
+        AddReadAheadWaitTime(boost::posix_time::microsec_clock::universal_time() - throttlingStart_);
+        isThrottled_ = false;
       }
 
-      threads_.clear();
+      group_->Submit(*tasks_[nextToSubmit_]);
+      nextToSubmit_++;
+    }
+  }
+
+public:
+  ThreadedInstanceLoader(size_t threadCount, bool transcode, Orthanc::DicomTransferSyntax transferSyntax)
+  : InstanceLoader(transcode, transferSyntax),
+    bufferedBytes_(0),
+    group_(new OrthancPlugins::WorkersPool::TasksGroup(OrthancPlugins::WorkersPool::GetInstance(), threadCount)),
+    nextToSubmit_(0),
+    nextToSend_(0),
+    maxBufferedInstances_(OrthancPlugins::Configuration::GetWadoRsReadAheadMaxInstances()),
+    maxBufferedBytes_(static_cast<size_t>(OrthancPlugins::Configuration::GetWadoRsReadAheadMaxSize()) * 1024 * 1024),
+    isThrottled_(false)
+  {
+    if (maxBufferedInstances_ == 0)
+    {
+      maxBufferedInstances_ = 3 * threadCount;
+    }
 
-      LOG(INFO) << "Waiting for loader threads to complete - done";
+    if (maxBufferedBytes_ == 0)
+    {
+      maxBufferedBytes_ = std::numeric_limits<size_t>::max();
     }
   }
 
-  static void PreloaderWorkerThread(ThreadedInstanceLoader* that)
+  virtual ~ThreadedInstanceLoader() ORTHANC_OVERRIDE
   {
-    Orthanc::Logging::ScopedThreadNameSetter setter(GetWadoLoaderThreadName());
+    Clear();
+  }
 
-    LOG(INFO) << "Loader thread has started";
+  void Clear()
+  {
+    // Cancel the pending instances, and wait for the workers that are
+    // loading instances of this request
+    group_.reset();
 
-    while (true)
+    // Free the instances that have not been sent (this happens if the HTTP client has disconnected)
+    for (size_t i = nextToSend_; i < nextToSubmit_; i++)
     {
-      std::unique_ptr<InstanceToPreload> instancesToPreload(dynamic_cast<InstanceToPreload*>(that->instancesToPreload_.Dequeue(0)));
-      if (instancesToPreload.get() == NULL || that->loadersShouldStop_)  // that's the signal to exit the thread
-      {
-        LOG(INFO) << "Loader thread has completed";
-        return;
-      }
-      
-      try
-      {
-        std::unique_ptr<OrthancPlugins::DicomInstance> dicom(that->GetAndTranscodeDicom(instancesToPreload.get()));
-        that->loadedInstances_.Enqueue(new LoadedInstance(dicom.release()));
-      }
-      catch (Orthanc::OrthancException& e)
-      {
-        LOG(ERROR) << "Error while loading instances " << e.GetDetails();
-        that->loadedInstances_.Enqueue(NULL);
-      }
-      catch (...)
+      std::unique_ptr<OrthancPlugins::DicomInstance> dicom(tasks_[i]->ReleaseDicom());
+
+      if (dicom.get() != NULL)
       {
-        LOG(ERROR) << "Unknown error while loading instances ";
-        that->loadedInstances_.Enqueue(NULL);
+        UpdateReadAheadBufferedBytes(-static_cast<int64_t>(dicom->GetSize()));
       }
     }
+
+    tasks_.clear();
+    bufferedBytes_ = 0;
   }
 
   virtual void PrepareDicom(const std::string& instanceId, bool transcode) ORTHANC_OVERRIDE
   {
-    instancesToPreload_.Enqueue(new InstanceToPreload(instanceId, transcode));
+    if (group_.get() == NULL)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+    }
+
+    tasks_.push_back(boost::shared_ptr<LoadingTask>(new LoadingTask(*this, instanceId, transcode)));
+    FillWindow();
   }
 
   virtual OrthancPlugins::DicomInstance* GetNextDicom() ORTHANC_OVERRIDE
   {
-    std::unique_ptr<LoadedInstance> loadedInstance(dynamic_cast<LoadedInstance*>(loadedInstances_.Dequeue(0)));
-    
-    if (loadedInstance.get() != NULL)
+    if (group_.get() == NULL ||
+        nextToSend_ >= tasks_.size())
     {
-      return loadedInstance->ReleaseInstance();
+      return NULL;
     }
-    else
+
+    FillWindow();
+    assert(nextToSend_ < nextToSubmit_);
+
+    // If no worker has started loading this instance yet, it is loaded by this thread
+    group_->Wait(nextToSend_);
+
+    std::unique_ptr<OrthancPlugins::DicomInstance> dicom;
+
     {
-      return NULL; // happens when the loader threads are exiting
+      boost::mutex::scoped_lock lock(mutex_);
+      dicom.reset(tasks_[nextToSend_]->ReleaseDicom());
+
+      if (dicom.get() != NULL)
+      {
+        assert(bufferedBytes_ >= dicom->GetSize());
+        bufferedBytes_ -= dicom->GetSize();
+        UpdateReadAheadBufferedBytes(-static_cast<int64_t>(dicom->GetSize()));
+      }
     }
+
+    nextToSend_++;
+    FillWindow();
+
+    return dicom.release();  // NULL if the loading has failed
   }
 };
 
@@ -633,32 +852,14 @@ public:
 };
 
 
-static void AnswerListOfDicomInstances(OrthancPluginRestOutput* output,
-                                       Orthanc::ResourceType level,
-                                       const std::string& publicId,
-                                       bool transcode,
-                                       Orthanc::DicomTransferSyntax targetSyntax /* only if transcoding */)
+// Lists the instances below "publicId" (or the instance itself), with
+// their transfer syntax in "Metadata" if transcoding is requested
+static bool ListInstancesToSend(Json::Value& instances,
+                                Orthanc::ResourceType level,
+                                const std::string& publicId,
+                                bool transcode,
+                                bool withMainDicomTags)
 {
-#if ORTHANC_FRAMEWORK_VERSION_IS_ABOVE(1, 12, 11)
-  Orthanc::ElapsedTimer perfTimer;
-#else
-  Orthanc::Toolbox::ElapsedTimer perfTimer;
-#endif
-
-  size_t perfTotalSizeInBytes = 0;
-  size_t perfTotalInstancesCount = 0;
-
-  if (level != Orthanc::ResourceType_Study &&
-      level != Orthanc::ResourceType_Series &&
-      level != Orthanc::ResourceType_Instance)
-  {
-    throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
-  }
-
-  OrthancPluginContext* context = OrthancPlugins::GetGlobalContext();
-
-  Json::Value instances;
-
   if (level == Orthanc::ResourceType_Instance)
   {
     Json::Value tmp = Json::objectValue;
@@ -691,6 +892,11 @@ static void AnswerListOfDicomInstances(OrthancPluginRestOutput* output,
       {
         toolsFindPayload["ResponseContent"].append("Metadata");
       }
+
+      if (withMainDicomTags)
+      {
+        toolsFindPayload["ResponseContent"].append("MainDicomTags");
+      }
       
       if (level == Orthanc::ResourceType_Patient)
       {
@@ -712,11 +918,10 @@ static void AnswerListOfDicomInstances(OrthancPluginRestOutput* output,
     }
     else
     {
+      // The expanded list of the instances contains their main DICOM tags
       if (!OrthancPlugins::RestApiGet(instances, GetResourceUri(level, publicId) + "/instances", false))
       {
-        // Internal error
-        OrthancPluginSendHttpStatusCode(context, output, 400);
-        return;
+        return false;
       }
 
       if (transcode)
@@ -736,44 +941,91 @@ static void AnswerListOfDicomInstances(OrthancPluginRestOutput* output,
     }
   }
 
-  if (OrthancPluginStartMultipartAnswer(context, output, "related", "application/dicom"))
+  return true;
+}
+
+
+static bool IsTranscodingNeeded(const Json::Value& instance,
+                                bool transcode,
+                                Orthanc::DicomTransferSyntax targetSyntax)
+{
+  Orthanc::DicomTransferSyntax currentSyntax;
+
+  if (!transcode || !instance.isMember("Metadata") || !instance["Metadata"].isMember("TransferSyntax"))
   {
-    throw Orthanc::OrthancException(Orthanc::ErrorCode_NetworkProtocol);
+    return false;
+  }
+  else if (Orthanc::LookupTransferSyntax(currentSyntax, instance["Metadata"]["TransferSyntax"].asString()))
+  {
+    return (currentSyntax != targetSyntax);
+  }
+  else
+  {
+    return true;
   }
+}
+
 
+static InstanceLoader* CreateInstanceLoader(Orthanc::ResourceType level,
+                                            bool transcode,
+                                            Orthanc::DicomTransferSyntax targetSyntax)
+{
   // single threaded or multi threaded loading ?
-  std::unique_ptr<InstanceLoader> loader;
-  
   const unsigned int workersCount = OrthancPlugins::Configuration::GetWadoRsLoaderThreadsCount();
 
   if (workersCount > 0 && level != Orthanc::ResourceType_Instance)
   {
-    loader.reset(new ThreadedInstanceLoader(workersCount, transcode, targetSyntax));
+    return new ThreadedInstanceLoader(workersCount, transcode, targetSyntax);
   }
   else
   {
-    loader.reset(new SynchronousInstanceLoader(transcode, targetSyntax));
+    return new SynchronousInstanceLoader(transcode, targetSyntax);
   }
-  
-  for (Json::Value::ArrayIndex i = 0; i < instances.size(); i++)
+}
+
+
+static void AnswerListOfDicomInstances(OrthancPluginRestOutput* output,
+                                       Orthanc::ResourceType level,
+                                       const std::string& publicId,
+                                       bool transcode,
+                                       Orthanc::DicomTransferSyntax targetSyntax /* only if transcoding */)
+{
+#if ORTHANC_FRAMEWORK_VERSION_IS_ABOVE(1, 12, 11)
+  Orthanc::ElapsedTimer perfTimer;
+#else
+  Orthanc::Toolbox::ElapsedTimer perfTimer;
+#endif
+
+  size_t perfTotalSizeInBytes = 0;
+  size_t perfTotalInstancesCount = 0;
+
+  if (level != Orthanc::ResourceType_Study &&
+      level != Orthanc::ResourceType_Series &&
+      level != Orthanc::ResourceType_Instance)
   {
-    bool transcodeThisInstance;
-    Orthanc::DicomTransferSyntax currentSyntax;
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+  }
 
-    if (!transcode || !instances[i].isMember("Metadata") || !instances[i]["Metadata"].isMember("TransferSyntax"))
-    {
-      transcodeThisInstance = false;      
-    }
-    else if (Orthanc::LookupTransferSyntax(currentSyntax, instances[i]["Metadata"]["TransferSyntax"].asString()))
-    {
-      transcodeThisInstance = (currentSyntax != targetSyntax);
-    }
-    else
-    {
-      transcodeThisInstance = true;
-    }
+  OrthancPluginContext* context = OrthancPlugins::GetGlobalContext();
+
+  Json::Value instances;
+  if (!ListInstancesToSend(instances, level, publicId, transcode, false))
+  {
+    // Internal error
+    OrthancPluginSendHttpStatusCode(context, output, 400);
+    return;
+  }
+
+  if (OrthancPluginStartMultipartAnswer(context, output, "related", "application/dicom"))
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_NetworkProtocol);
+  }
+
+  std::unique_ptr<InstanceLoader> loader(CreateInstanceLoader(level, transcode, targetSyntax));
 
-    loader->PrepareDicom(instances[i]["ID"].asString(), transcodeThisInstance);
+  for (Json::Value::ArrayIndex i = 0; i < instances.size(); i++)
+  {
+    loader->PrepareDicom(instances[i]["ID"].asString(), IsTranscodingNeeded(instances[i], transcode, targetSyntax));
   }
 
   perfTotalInstancesCount = instances.size();
@@ -784,12 +1036,16 @@ static void AnswerListOfDicomInstances(OrthancPluginRestOutput* output,
 
     if (dicom.get() != NULL)
     {
+      OrthancPlugins::LatencyStageTimer timer(OrthancPlugins::LatencyRoute_WadoRsDicom, OrthancPlugins::LatencyStage_Send);
+
       if (OrthancPluginSendMultipartItem(
           context, output, reinterpret_cast<const char*>(dicom->GetBuffer()),
           dicom->GetSize()) != 0)
       {
         throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
       }
+
+      timer.Stop();
       perfTotalSizeInBytes += dicom->GetSize();
 
       boost::mutex::scoped_lock lock(wadoRsTotalBytesTransferredMutex);
@@ -804,7 +1060,7 @@ static void AnswerListOfDicomInstances(OrthancPluginRestOutput* output,
   uint64_t elapsedMicrosends = perfTimer.GetElapsedMicroseconds();
 
   float bandwidth = float(perfTotalSizeInBytes) / float(elapsedMicrosends) * 8.0f; // this gives a bandwidth in MBps
-  wadorsAverageBandwidth.AddValue(bandwidth, float(perfTotalSizeInBytes));
+  wadorsAverageBandwidth.AddValue(bandwidth, static_cast<double>(perfTotalSizeInBytes));
 
   if (OrthancPlugins::Configuration::IsPerformanceLogsEnabled())
   {
@@ -815,6 +1071,171 @@ static void AnswerListOfDicomInstances(OrthancPluginRestOutput* output,
 
 
 
+namespace
+{
+  // The SDK can only answer a single-part body as one buffer whose size
+  // fits 32 bits. The archive is thus written to a buffer that is
+  // spilled to a memory-mapped temporary file once large enough, which
+  // bounds the memory that is used by the plugin.
+  class ZipArchiveBuffer : public OrthancPlugins::ZipStreamWriter::IOutput
+  {
+  private:
+    OrthancPlugins::SpillableBuffer  buffer_;
+
+  public:
+    explicit ZipArchiveBuffer(size_t spillThreshold) :
+      buffer_(spillThreshold)
+    {
+    }
+
+    virtual void Write(const void* data,
+                       size_t size) ORTHANC_OVERRIDE
+    {
+      if (static_cast<uint64_t>(buffer_.GetSize()) + static_cast<uint64_t>(size) >
+          static_cast<uint64_t>(std::numeric_limits<uint32_t>::max()))
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_NotEnoughMemory,
+                                        "ZIP archives larger than 4GB cannot be generated by DICOMweb, "
+                                        "use the \"/studies/{id}/archive\" route of the REST API of Orthanc");
+      }
+
+      buffer_.Append(data, size);
+    }
+
+    OrthancPlugins::SpillableBuffer& GetBuffer()
+    {
+      return buffer_;
+    }
+  };
+}
+
+
+static std::string GetMainDicomTag(const Json::Value& resource,
+                                   const char* tag,
+                                   const std::string& defaultValue)
+{
+  if (resource.type() == Json::objectValue &&
+      resource.isMember(MAIN_DICOM_TAGS) &&
+      resource[MAIN_DICOM_TAGS].type() == Json::objectValue &&
+      resource[MAIN_DICOM_TAGS].isMember(tag) &&
+      resource[MAIN_DICOM_TAGS][tag].type() == Json::stringValue &&
+      !resource[MAIN_DICOM_TAGS][tag].asString().empty())
+  {
+    return resource[MAIN_DICOM_TAGS][tag].asString();
+  }
+  else
+  {
+    return defaultValue;
+  }
+}
+
+
+// Answers RetrieveStudy as "application/zip" (DICOM sup 211). The
+// entries are named "{StudyInstanceUID}/{SeriesInstanceUID}/{SOPInstanceUID}.dcm".
+static void AnswerStudyArchive(OrthancPluginRestOutput* output,
+                               const std::string& studyOrthancId,
+                               const std::string& studyInstanceUid,
+                               bool transcode,
+                               Orthanc::DicomTransferSyntax targetSyntax /* only if transcoding */)
+{
+#if ORTHANC_FRAMEWORK_VERSION_IS_ABOVE(1, 12, 11)
+  Orthanc::ElapsedTimer perfTimer;
+#else
+  Orthanc::Toolbox::ElapsedTimer perfTimer;
+#endif
+
+  size_t perfTotalSizeInBytes = 0;
+  size_t perfTotalInstancesCount = 0;
+
+  OrthancPluginContext* context = OrthancPlugins::GetGlobalContext();
+
+  Json::Value study;
+  if (!OrthancPlugins::RestApiGet(study, "/studies/" + studyOrthancId, false) ||
+      study.type() != Json::objectValue ||
+      !study.isMember("Series") ||
+      study["Series"].type() != Json::arrayValue)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_UnknownResource, "Unable to list the series of study " + studyOrthancId);
+  }
+
+  ZipArchiveBuffer archive(static_cast<size_t>(OrthancPlugins::Configuration::GetWadoRsZipSpillThreshold()) * 1024 * 1024);
+  OrthancPlugins::ZipStreamWriter writer(archive, OrthancPlugins::Configuration::IsWadoRsZipCompression());
+
+  // The instances are listed series by series, so that the list of
+  // the instances of the whole study is never kept in memory
+  for (Json::Value::ArrayIndex i = 0; i < study["Series"].size(); i++)
+  {
+    const std::string seriesId = study["Series"][i].asString();
+
+    Json::Value series, instances;
+    if (!OrthancPlugins::RestApiGet(series, "/series/" + seriesId, false) ||
+        !ListInstancesToSend(instances, Orthanc::ResourceType_Series, seriesId, transcode, true /* for the SOP Instance UIDs */))
+    {
+      LOG(WARNING) << "Cannot list the instances of series " << seriesId << ", it has probably been deleted";
+      continue;
+    }
+
+    const std::string folder = studyInstanceUid + "/" + GetMainDicomTag(series, "SeriesInstanceUID", seriesId) + "/";
+
+    std::unique_ptr<InstanceLoader> loader(CreateInstanceLoader(Orthanc::ResourceType_Series, transcode, targetSyntax));
+
+    for (Json::Value::ArrayIndex j = 0; j < instances.size(); j++)
+    {
+      loader->PrepareDicom(instances[j]["ID"].asString(), IsTranscodingNeeded(instances[j], transcode, targetSyntax));
+    }
+
+    for (Json::Value::ArrayIndex j = 0; j < instances.size(); j++)
+    {
+      std::unique_ptr<OrthancPlugins::DicomInstance> dicom(loader->GetNextDicom());
+
+      if (dicom.get() != NULL)
+      {
+        const std::string filename = folder + GetMainDicomTag(instances[j], "SOPInstanceUID", instances[j]["ID"].asString()) + ".dcm";
+        writer.AddEntry(filename, dicom->GetBuffer(), dicom->GetSize());
+
+        perfTotalSizeInBytes += dicom->GetSize();
+        perfTotalInstancesCount++;
+      }
+      else
+      {
+        LOG(WARNING) << "Failed to load an instance";
+      }
+    }
+  }
+
+  writer.Close();
+
+  const std::string disposition = "attachment; filename=\"" + studyInstanceUid + ".zip\"";
+  OrthancPluginSetHttpHeader(context, output, "Content-Disposition", disposition.c_str());
+
+  OrthancPlugins::LatencyStageTimer timer(OrthancPlugins::LatencyRoute_WadoRsDicom, OrthancPlugins::LatencyStage_Send);
+
+  const size_t archiveSize = archive.GetBuffer().GetSize();
+  OrthancPluginAnswerBuffer(context, output, archive.GetBuffer().GetData(),
+                            static_cast<uint32_t>(archiveSize), "application/zip");
+
+  timer.Stop();
+
+  {
+    boost::mutex::scoped_lock lock(wadoRsTotalBytesTransferredMutex);
+    wadoRsTotalBytesTransferred += static_cast<int64_t>(archiveSize);
+  }
+
+  uint64_t elapsedMicrosends = perfTimer.GetElapsedMicroseconds();
+
+  float bandwidth = float(archiveSize) / float(elapsedMicrosends) * 8.0f; // this gives a bandwidth in MBps
+  wadorsAverageBandwidth.AddValue(bandwidth, static_cast<double>(archiveSize));
+
+  if (OrthancPlugins::Configuration::IsPerformanceLogsEnabled())
+  {
+    float instancesPerSeconds = float(perfTotalInstancesCount) / (float(elapsedMicrosends) / 1000000.0f);
+    LOG(INFO) << "WADO-RS ZIP: elapsed: " << elapsedMicrosends << " us, rate: " << std::fixed << std::setprecision(2)
+              << instancesPerSeconds << " instances/s, " << Orthanc::Toolbox::GetHumanTransferSpeed(false, perfTotalSizeInBytes, elapsedMicrosends * 1000)
+              << ", archive of " << archiveSize << " bytes" << (archive.GetBuffer().IsSpilled() ? " (spilled to disk)" : "");
+  }
+}
+
+
 namespace
 {
   class SetOfDicomInstances : public boost::noncopyable
@@ -1145,14 +1566,91 @@ namespace
     }
 
 
+    // Reads the main DICOM tags of all the instances of a series
+    // using a single call to "/tools/find", instead of one call to
+    // "/instances/{id}?full" per instance in "GetInstance()"
+    bool PrefetchSeriesInstances(std::set<std::string>& instancesIds,
+                                 const std::string& seriesOrthancId)
+    {
+      instancesIds.clear();
+
+      if (!CanUseExtendedFind())
+      {
+        return false;
+      }
+
+      Json::Value query;
+      query["Level"] = "Instance";
+      query["Query"] = Json::objectValue;
+      query["ParentSeries"] = seriesOrthancId;
+      query["Expand"] = true;
+      query["Full"] = true;
+      query["ResponseContent"] = Json::arrayValue;
+      query["ResponseContent"].append(MAIN_DICOM_TAGS);
+      query["ResponseContent"].append("Parent");
+
+      Json::Value instances;
+      if (!OrthancPlugins::RestApiPost(instances, "/tools/find", query, false) ||
+          instances.type() != Json::arrayValue)
+      {
+        return false;
+      }
+
+      for (Json::Value::ArrayIndex i = 0; i < instances.size(); i++)
+      {
+        const Json::Value& instance = instances[i];
+
+        if (instance.type() != Json::objectValue ||
+            !instance.isMember("ID") ||
+            instance["ID"].type() != Json::stringValue ||
+            !instance.isMember(MAIN_DICOM_TAGS) ||
+            !instance.isMember("ParentSeries") ||
+            instance["ParentSeries"].type() != Json::stringValue)
+        {
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+        }
+
+        const Index index(instance["ID"].asString(), Orthanc::ResourceType_Instance);
+
+        if (content_.find(index) == content_.end())
+        {
+          std::unique_ptr<Info> info(new Info);
+          info->dicom_.FromDicomAsJson(instance[MAIN_DICOM_TAGS], false /* append */, true /* parseSequences */);
+          info->parent_ = instance["ParentSeries"].asString();
+          content_[index] = info.release();
+        }
+
+        instancesIds.insert(index.first);
+      }
+
+      return true;
+    }
+
+
     bool GetInstance(Orthanc::DicomMap& dicom,
                      OrthancPlugins::MetadataMode mode,
                      const std::string& instanceOrthancId)
     {
       std::string seriesOrthancId, studyOrthancId, nope;
+
+      Content::iterator found = content_.find(std::make_pair(instanceOrthancId, Orthanc::ResourceType_Instance));
+
+      if (found != content_.end())
+      {
+        // Prefetched instance, which is only read once
+        assert(found->second != NULL);
+        dicom.Assign(found->second->dicom_);
+        seriesOrthancId = found->second->parent_;
+
+        delete found->second;
+        content_.erase(found);
+      }
+      else if (!ReadResource(dicom, seriesOrthancId, mode, instanceOrthancId, Orthanc::ResourceType_Instance))
+      {
+        return false;
+      }
       
-      return (ReadResource(dicom, seriesOrthancId, mode, instanceOrthancId, Orthanc::ResourceType_Instance) &&
-              Lookup(dicom, studyOrthancId, mode, seriesOrthancId, Orthanc::ResourceType_Series) &&
+      return (Lookup(dicom, studyOrthancId, mode, seriesOrthancId, Orthanc::ResourceType_Series) &&
               Lookup(dicom, nope /* patient id is unused */, mode, studyOrthancId, Orthanc::ResourceType_Study));
     }
 
@@ -1169,6 +1667,104 @@ namespace
 }
 
 
+// Computes the full DICOMweb JSON metadata of an instance whose
+// binary elements larger than "MetadataBinaryThreshold" are left out
+// before the file is parsed by the Orthanc core, and replaced by a
+// "BulkDataURI". Returns "false" if the size of the instance shows that
+// it cannot contain large elements, in which case the instance must be
+// loaded by the Orthanc core.  Once the file is downloaded, its JSON is
+// always computed from it, even if it has no large element.
+static bool FormatInstanceWithoutLargeElements(std::string& json,
+                                               const std::string& orthancId,
+                                               const std::string& bulkRoot)
+{
+  const size_t threshold = OrthancPlugins::Configuration::GetMetadataBinaryThreshold();
+  if (threshold == 0)
+  {
+    return false;
+  }
+
+  // Upper bound on the size of the elements before the pixel data,
+  // which avoids reading the files that cannot contain large elements
+  uint64_t headerSize;
+
+  try
+  {
+    std::string s;
+    if (!OrthancPlugins::RestApiGetString(s, "/instances/" + orthancId + "/attachments/dicom/size", false))
+    {
+      return false;
+    }
+
+    headerSize = boost::lexical_cast<uint64_t>(Orthanc::Toolbox::StripSpaces(s));
+
+    std::string offset;
+    if (OrthancPlugins::RestApiGetString(offset, "/instances/" + orthancId + "/metadata/PixelDataOffset", false))
+    {
+      headerSize = std::min(headerSize, boost::lexical_cast<uint64_t>(Orthanc::Toolbox::StripSpaces(offset)));
+    }
+  }
+  catch (boost::bad_lexical_cast&)
+  {
+    return false;
+  }
+
+  if (headerSize <= threshold)
+  {
+    return false;
+  }
+
+  std::string reduced;
+  OrthancPlugins::DicomHeaderScanner::LargeElements removed;
+
+  {
+    OrthancPlugins::MemoryBuffer dicom;
+    if (!dicom.RestApiGet("/instances/" + orthancId + "/file", false))
+    {
+      return false;
+    }
+
+    // From now on, the file is not read once more by the Orthanc core
+    // (e.g. if "PixelDataOffset" is not available)
+    if (!OrthancPlugins::DicomHeaderScanner::RemoveLargeBinaryElements(
+          reduced, removed, dicom.GetData(), dicom.GetSize(), threshold))
+    {
+      // Unsupported encoding, e.g. implicit VR
+      OrthancPlugins::DicomWebFormatter::Apply(json, OrthancPlugins::GetGlobalContext(), dicom.GetData(), dicom.GetSize(),
+                                               false /* xml */, OrthancPluginDicomWebBinaryMode_BulkDataUri, bulkRoot);
+      return true;
+    }
+  }
+
+  if (removed.empty())
+  {
+    // The reduced file only differs by its empty pixel data, as in
+    // "OrthancPluginLoadDicomInstanceMode_EmptyPixelData"
+    OrthancPlugins::DicomWebFormatter::Apply(json, OrthancPlugins::GetGlobalContext(), reduced.c_str(), reduced.size(),
+                                             false /* xml */, OrthancPluginDicomWebBinaryMode_BulkDataUri, bulkRoot);
+    return true;
+  }
+
+  std::string tmp;
+  OrthancPlugins::DicomWebFormatter::Apply(tmp, OrthancPlugins::GetGlobalContext(), reduced.c_str(), reduced.size(),
+                                           false /* xml */, OrthancPluginDicomWebBinaryMode_BulkDataUri, bulkRoot);
+
+  Json::Value item;
+  if (!OrthancPlugins::ReadJson(item, tmp))
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+  }
+
+  OrthancPlugins::DicomWebFormatter::AddBulkDataElements(item, removed, bulkRoot);
+  OrthancPlugins::WriteFastJson(json, item);
+
+  LOG(INFO) << "The metadata of instance " << orthancId << " has been computed without loading "
+            << removed.size() << " large binary elements";
+
+  return true;
+}
+
+
 static void WriteInstanceMetadata(OrthancPlugins::DicomWebFormatter::HttpWriter& writer,
                                   OrthancPlugins::MetadataMode mode,
                                   MainDicomTagsCache& cache,
@@ -1184,11 +1780,17 @@ static void WriteInstanceMetadata(OrthancPlugins::DicomWebFormatter::HttpWriter&
 
   Orthanc::DicomMap dicom;
 
-  if (!cache.GetInstance(dicom, mode, orthancId))
   {
-    throw Orthanc::OrthancException(Orthanc::ErrorCode_UnknownResource, "instance not found: " + orthancId);
+    OrthancPlugins::LatencyStageTimer timer(OrthancPlugins::LatencyStage_Load);
+
+    if (!cache.GetInstance(dicom, mode, orthancId))
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_UnknownResource, "instance not found: " + orthancId);
+    }
   }
 
+  OrthancPlugins::LatencyStageTimer timer(OrthancPlugins::LatencyStage_Format);
+
   switch (mode)
   {
     case OrthancPlugins::MetadataMode_MainDicomTags:
@@ -1205,6 +1807,14 @@ static void WriteInstanceMetadata(OrthancPlugins::DicomWebFormatter::HttpWriter&
                                     "/series/" + seriesInstanceUid + 
                                     "/instances/" + dicom.GetStringValue(Orthanc::DICOM_TAG_SOP_INSTANCE_UID, "", false) + "/bulk");
 
+      std::string json;
+      if (!writer.IsXml() &&
+          FormatInstanceWithoutLargeElements(json, orthancId, bulkRoot))
+      {
+        writer.AddDicomWebInstanceSerializedJson(json.c_str(), json.size());
+        break;
+      }
+
 #if ORTHANC_PLUGINS_VERSION_IS_ABOVE(1, 12, 1)
       std::unique_ptr<OrthancPlugins::DicomInstance> instance;
 
@@ -1312,6 +1922,31 @@ bool LocateResource(OrthancPluginRestOutput* output,
   }
 
   {
+    OrthancPlugins::LatencyStageTimer timer(OrthancPlugins::LatencyStage_Locate);
+
+    std::map<std::string, std::string> httpHeaders;
+    OrthancPlugins::GetHttpHeaders(httpHeaders, request);
+
+    // The cache is scoped by the HTTP headers that are forwarded to
+    // "/tools/find", so that the authorization plugin has granted the
+    // access to this resource for these credentials. As a hit skips
+    // the authorization plugin until the entry expires, the cache is
+    // only enabled if "ResourceLookupCacheTTL" is explicitly set, and
+    // never if the authorization plugin is loaded (cf. "Plugin.cpp").
+    OrthancPlugins::ResourceLookupCache& cache = OrthancPlugins::ResourceLookupCache::GetInstance();
+    std::string cacheKey;
+
+    if (cache.IsEnabled())
+    {
+      cacheKey = OrthancPlugins::ResourceLookupCache::ComputeKey(
+        level, studyInstanceUid, seriesInstanceUid, sopInstanceUid, firstResourceOnly, httpHeaders);
+
+      if (cache.Lookup(orthancId, metadata, cacheKey))
+      {
+        return true;
+      }
+    }
+
     Json::Value payload;
     Json::Value payloadQuery;
 
@@ -1337,9 +1972,6 @@ bool LocateResource(OrthancPluginRestOutput* output,
     payload["ResponseContent"] = Json::arrayValue;
     payload["ResponseContent"].append("Metadata");
 
-    std::map<std::string, std::string> httpHeaders;
-    OrthancPlugins::GetHttpHeaders(httpHeaders, request);
-
     Json::Value resources;
     if (!OrthancPlugins::RestApiPost(resources, "/tools/find", payload, httpHeaders, true) ||
         resources.type() != Json::arrayValue)
@@ -1364,6 +1996,11 @@ bool LocateResource(OrthancPluginRestOutput* output,
     {
       metadata[metadataMembers[i]] = resources[0]["Metadata"][metadataMembers[i]].asString();
     }
+
+    if (!cacheKey.empty())
+    {
+      cache.Store(cacheKey, orthancId, metadata);
+    }
     
     return true;
   }
@@ -1486,15 +2123,24 @@ void RetrieveDicomStudy(OrthancPluginRestOutput* output,
                         const char* url,
                         const OrthancPluginHttpRequest* request)
 {
-  bool transcode;
+  OrthancPlugins::LatencyRouteTimer routeTimer(OrthancPlugins::LatencyRoute_WadoRsDicom);
+
+  bool isZip, transcode;
   Orthanc::DicomTransferSyntax targetSyntax;
 
-  AcceptMultipartDicom(transcode, targetSyntax, request);
+  AcceptDicom(isZip, transcode, targetSyntax, request, true /* ZIP is allowed */);
   
   std::string orthancId, studyInstanceUid;
   if (LocateStudy(output, orthancId, studyInstanceUid, request))
   {
-    AnswerListOfDicomInstances(output, Orthanc::ResourceType_Study, orthancId, transcode, targetSyntax);
+    if (isZip)
+    {
+      AnswerStudyArchive(output, orthancId, studyInstanceUid, transcode, targetSyntax);
+    }
+    else
+    {
+      AnswerListOfDicomInstances(output, Orthanc::ResourceType_Study, orthancId, transcode, targetSyntax);
+    }
   }
 }
 
@@ -1503,6 +2149,8 @@ void RetrieveDicomSeries(OrthancPluginRestOutput* output,
                          const char* url,
                          const OrthancPluginHttpRequest* request)
 {
+  OrthancPlugins::LatencyRouteTimer routeTimer(OrthancPlugins::LatencyRoute_WadoRsDicom);
+
   bool transcode;
   Orthanc::DicomTransferSyntax targetSyntax;
   
@@ -1521,6 +2169,8 @@ void RetrieveDicomInstance(OrthancPluginRestOutput* output,
                            const char* url,
                            const OrthancPluginHttpRequest* request)
 {
+  OrthancPlugins::LatencyRouteTimer routeTimer(OrthancPlugins::LatencyRoute_WadoRsDicom);
+
   bool transcode;
   std::string transferSyntax;
   Orthanc::DicomTransferSyntax targetSyntax;
@@ -1565,6 +2215,8 @@ static void GetChildrenIdentifiers(std::set<std::string>& target,
   }
 
   assert(childrenTag != NULL && dicomUidTag != NULL);
+
+  OrthancPlugins::LatencyStageTimer timer(OrthancPlugins::LatencyStage_Load);
   
   Json::Value resource;
   if (OrthancPlugins::RestApiGet(resource, uri, false))
@@ -1588,82 +2240,126 @@ static void GetChildrenIdentifiers(std::set<std::string>& target,
 
 typedef std::map<std::string, boost::shared_ptr<Orthanc::DicomMap> >  ChildrenMainDicomMaps;
 
+// Reads the main DICOM tags of the children of a study or of a
+// series using a single call to "/tools/find", whose answer is
+// computed by a minimal number of SQL queries with ExtendedFind
 static void GetChildrenMainDicomTags(ChildrenMainDicomMaps& childrenDicomMaps,
-                                     std::string& resourceDicomUid,
                                      Orthanc::ResourceType level,
                                      const std::string& orthancId)
 {
   childrenDicomMaps.clear();
 
-  const char* childrenRoute = NULL;
-  const char* dicomUidTag = NULL;
-  std::string uri;
+  Json::Value query;
 
   switch (level)
   {
     case Orthanc::ResourceType_Study:
-      uri = "/studies/" + orthancId;
-      childrenRoute = "series";
-      dicomUidTag = "StudyInstanceUID";
+      query["Level"] = "Series";
+      query["ParentStudy"] = orthancId;
       break;
        
     case Orthanc::ResourceType_Series:
-      uri = "/series/" + orthancId;
-      childrenRoute = "instances";
-      dicomUidTag = "SeriesInstanceUID";
+      query["Level"] = "Instance";
+      query["ParentSeries"] = orthancId;
       break;
 
     default:
       throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
   }
 
-  assert(childrenRoute != NULL && dicomUidTag != NULL);
-  
-  // get the resource itself
-  Json::Value resource;
-  if (OrthancPlugins::RestApiGet(resource, uri, false))
-  {
-    if (resource.type() != Json::objectValue 
-      || !resource.isMember(MAIN_DICOM_TAGS) || !resource[MAIN_DICOM_TAGS].isMember(dicomUidTag))
-    {
-      throw Orthanc::OrthancException(Orthanc::ErrorCode_NetworkProtocol);
-    }
+  query["Query"] = Json::objectValue;
+  query["Expand"] = true;
+  query["Full"] = true;
+  query["ResponseContent"] = Json::arrayValue;
+  query["ResponseContent"].append(MAIN_DICOM_TAGS);
 
-    resourceDicomUid = resource[MAIN_DICOM_TAGS][dicomUidTag].asString();
+  OrthancPlugins::LatencyStageTimer timer(OrthancPlugins::LatencyStage_Load);
 
-    // get the children resources
-    Json::Value childResources;
-    if (OrthancPlugins::RestApiGet(childResources, uri + "/" + childrenRoute + "?expand&full", false))
+  Json::Value childResources;
+  if (OrthancPlugins::RestApiPost(childResources, "/tools/find", query, false) &&
+      childResources.type() == Json::arrayValue)
+  {
+    for (Json::Value::ArrayIndex i = 0; i < childResources.size(); i++)
     {
-      for (Json::Value::ArrayIndex i = 0; i < childResources.size(); i++)
-      {
-        const Json::Value& child = childResources[i];
-        Orthanc::DicomMap dicom;
-        dicom.FromDicomAsJson(child[MAIN_DICOM_TAGS], false /* append */, true /* parseSequences */);
-        childrenDicomMaps[child["ID"].asString()] = boost::shared_ptr<Orthanc::DicomMap>(dicom.Clone());
-      }
-
+      const Json::Value& child = childResources[i];
+      Orthanc::DicomMap dicom;
+      dicom.FromDicomAsJson(child[MAIN_DICOM_TAGS], false /* append */, true /* parseSequences */);
+      childrenDicomMaps[child["ID"].asString()] = boost::shared_ptr<Orthanc::DicomMap>(dicom.Clone());
     }
-
-  }  
+  }
 }
 
 
-static const char* EXIT_WORKER_MESSAGE = "exit";
-
-class InstanceToLoad : public Orthanc::IDynamicObject
+// Loads the metadata of one instance of a series, and sends it either
+// to a writer, or to the records of the series metadata cache
+class InstanceToLoad : public OrthancPlugins::WorkersPool::ITask
 {
 private:
   std::string                  orthancId_;
   std::string                  studyInstanceUid_;
   std::string                  seriesInstanceUid_;
   std::string                  bulkRoot_;
+  std::string                  wadoBase_;
   boost::mutex&                writerMutex_;
-  OrthancPlugins::DicomWebFormatter::HttpWriter& writer_;
+  OrthancPlugins::DicomWebFormatter::HttpWriter* writer_;
+  OrthancPlugins::SeriesMetadataRecords*         records_;
+
+  void LoadBulkRoot()
+  {
+    if (bulkRoot_.empty()) // we are not in oneLargeQuery mode -> we must load the instance tags to get the SOPInstanceUID
+    {
+      Json::Value instanceResource;
+
+      if (OrthancPlugins::RestApiGet(instanceResource, "/instances/" + orthancId_, false))
+      {
+        bulkRoot_ = (wadoBase_ +
+                     "studies/" + studyInstanceUid_ +
+                     "/series/" + seriesInstanceUid_ +
+                     "/instances/" + instanceResource[MAIN_DICOM_TAGS]["SOPInstanceUID"].asString() + "/bulk");
+      }
+    }
+  }
+
+  // "json" is the DICOMweb JSON of the instance
+  void AddSerializedInstance(const std::string& json)
+  {
+    if (records_ != NULL)
+    {
+      boost::mutex::scoped_lock lock(writerMutex_);
+      records_->SetInstance(orthancId_, json);
+    }
+    else
+    {
+      assert(writer_ != NULL);
+      boost::mutex::scoped_lock lock(writerMutex_);
+      writer_->AddDicomWebInstanceSerializedJson(json.c_str(), json.size());
+    }
+  }
+
+  void AddInstance(const OrthancPlugins::DicomInstance& instance)
+  {
+    if (records_ != NULL)
+    {
+      // each instance has its own record -> serialize outside of the lock
+      std::string json;
+      OrthancPlugins::DicomWebFormatter::Apply(json, OrthancPlugins::GetGlobalContext(), instance, false /* xml */,
+                                               OrthancPluginDicomWebBinaryMode_BulkDataUri, bulkRoot_);
+
+      boost::mutex::scoped_lock lock(writerMutex_);
+      records_->SetInstance(orthancId_, json);
+    }
+    else
+    {
+      assert(writer_ != NULL);
+      boost::mutex::scoped_lock lock(writerMutex_);
+      writer_->AddInstance(instance, bulkRoot_);
+    }
+  }
 
 public:
   InstanceToLoad(const std::string& orthancId,
                  const std::string& bulkRoot,
+                 const std::string& wadoBase,
                  boost::mutex& writerMutex,
                  OrthancPlugins::DicomWebFormatter::HttpWriter& writer,
                  const std::string& studyInstanceUid,
@@ -1672,135 +2368,158 @@ public:
     studyInstanceUid_(studyInstanceUid),
     seriesInstanceUid_(seriesInstanceUid),
     bulkRoot_(bulkRoot),
+    wadoBase_(wadoBase),
     writerMutex_(writerMutex),
-    writer_(writer)
+    writer_(&writer),
+    records_(NULL)
   {
   }
 
-  const std::string& GetStudyInstanceUid() const
+  InstanceToLoad(const std::string& orthancId,
+                 const std::string& bulkRoot,
+                 const std::string& wadoBase,
+                 boost::mutex& recordsMutex,
+                 OrthancPlugins::SeriesMetadataRecords& records,
+                 const std::string& studyInstanceUid,
+                 const std::string& seriesInstanceUid):
+    orthancId_(orthancId),
+    studyInstanceUid_(studyInstanceUid),
+    seriesInstanceUid_(seriesInstanceUid),
+    bulkRoot_(bulkRoot),
+    wadoBase_(wadoBase),
+    writerMutex_(recordsMutex),
+    writer_(NULL),
+    records_(&records)
   {
-    return studyInstanceUid_;
   }
 
-  const std::string& GetSeriesInstanceUid() const
+  virtual void Execute() ORTHANC_OVERRIDE
   {
-    return seriesInstanceUid_;
-  }
+    LoadBulkRoot();
 
-  const std::string& GetOrthancId() const
-  {
-    return orthancId_;
-  }
+    std::string json;
+    if ((records_ != NULL || !writer_->IsXml()) &&
+        FormatInstanceWithoutLargeElements(json, orthancId_, bulkRoot_))
+    {
+      AddSerializedInstance(json);
+      return;
+    }
 
-  const std::string& GetBulkRoot() const
-  {
-    return bulkRoot_;
-  }
+    std::unique_ptr<OrthancPlugins::DicomInstance> instance;
 
-  void SetBulkRoot(const std::string& root)
-  {
-    bulkRoot_ = root;
-  }
+    try
+    {
+      instance.reset(OrthancPlugins::DicomInstance::Load(orthancId_, OrthancPluginLoadDicomInstanceMode_EmptyPixelData));
+    }
+    catch (const Orthanc::OrthancException& e)
+    {
+    }
 
-  void AddInstance(const OrthancPlugins::DicomInstance& instance)
-  {
-    boost::mutex::scoped_lock lock(writerMutex_);
-    writer_.AddInstance(instance, bulkRoot_);
+    if (instance.get() != NULL)
+    {
+      AddInstance(*instance);
+    }
   }
 };
 
 
-class InstanceWorkerData : public boost::noncopyable
+typedef std::vector<boost::shared_ptr<InstanceToLoad> >  InstancesToLoad;
+
+
+// Maximum number of metadata tasks of one request that are run at once
+// by the workers.  With a single metadata worker, the metadata is
+// computed by the HTTP thread.
+static unsigned int GetMetadataWorkersPerRequest()
 {
-private:
-  Orthanc::SharedMessageQueue*  instancesQueue_;
-  std::string                   wadoBase_;
-  unsigned int                  threadId_;
+  const unsigned int workersCount = OrthancPlugins::Configuration::GetMetadataWorkerThreadsCount();
+  return (workersCount > 1 ? workersCount : 0);
+}
 
-public:
-  InstanceWorkerData(Orthanc::SharedMessageQueue* instancesQueue,
-                     const std::string& wadoBase,
-                     unsigned int threadId) :
-    instancesQueue_(instancesQueue),
-    wadoBase_(wadoBase),
-    threadId_(threadId)
-  {
-    if (instancesQueue == NULL)
-    {
-      throw Orthanc::OrthancException(Orthanc::ErrorCode_NullPointer);
-    }
-  }
 
-  InstanceToLoad* Dequeue()
+// Runs the tasks in the plugin-wide pool of workers
+static void LoadInstancesMetadata(InstancesToLoad& instances)
+{
+  OrthancPlugins::WorkersPool::TasksGroup group(OrthancPlugins::WorkersPool::GetInstance(), GetMetadataWorkersPerRequest());
+
+  for (size_t i = 0; i < instances.size(); i++)
   {
-    return dynamic_cast<InstanceToLoad*>(instancesQueue_->Dequeue(0));
+    group.Submit(*instances[i]);
   }
 
-  const std::string& GetWadoBase() const
+  group.WaitAll();
+}
+
+
+// Fast path of the "MainDicomTags" and "Extrapolate" modes: The main
+// DICOM tags of all the instances are read by a single call to
+// "/tools/find", the study/series tags are converted only once, and
+// the result is serialized to DICOMweb JSON without creating a DICOM
+// file for each instance. Returns "false" if not applicable.
+static bool WriteSeriesMainDicomTags(std::set<std::string>& instancesIds,
+                                     OrthancPlugins::DicomWebFormatter::HttpWriter& writer,
+                                     MainDicomTagsCache& cache,
+                                     OrthancPlugins::MetadataMode mode,
+                                     const std::string& seriesOrthancId)
+{
+  instancesIds.clear();
+
+  if (writer.IsXml() ||
+      !CanUseExtendedFind())
   {
-    return wadoBase_;
+    return false;
   }
 
-  unsigned int GetThreadId() const
+  // The values read from the REST API are in UTF-8
+  Orthanc::DicomMap parents;
+  parents.SetValue(Orthanc::DICOM_TAG_SPECIFIC_CHARACTER_SET, "ISO_IR 192", false);
+
+  Json::Value parentsJson;
+  if (!cache.GetSeries(parents, mode, seriesOrthancId) ||
+      !OrthancPlugins::DicomWebFormatter::ConvertToDicomWebJson(parentsJson, parents))
   {
-    return threadId_;
+    return false;
   }
-};
 
-void InstanceWorkerThread(InstanceWorkerData* data)
-{
-  Orthanc::Logging::ScopedThreadNameSetter setter(std::string("DW-META-") + boost::lexical_cast<std::string>(data->GetThreadId()));
+  const Json::Value::Members parentsTags = parentsJson.getMemberNames();
 
-  while (true)
-  {
-    try
-    {
-      std::unique_ptr<InstanceToLoad> instanceToLoad(data->Dequeue());
-      if (instanceToLoad.get() == NULL)
-      {
-        throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
-      }
+  ChildrenMainDicomMaps instancesDicomMaps;
+  GetChildrenMainDicomTags(instancesDicomMaps, Orthanc::ResourceType_Series, seriesOrthancId);
 
-      if (instanceToLoad->GetOrthancId() == EXIT_WORKER_MESSAGE)
-      {
-        return;
-      }
+  for (ChildrenMainDicomMaps::const_iterator it = instancesDicomMaps.begin(); it != instancesDicomMaps.end(); ++it)
+  {
+    assert(it->second.get() != NULL);
+    Orthanc::DicomMap& dicom = *it->second;
+    dicom.SetValue(Orthanc::DICOM_TAG_SPECIFIC_CHARACTER_SET, "ISO_IR 192", false);
 
-      if (instanceToLoad->GetBulkRoot().empty()) // we are not in oneLargeQuery mode -> we must load the instance tags to get the SOPInstanceUID
+    Json::Value item;
+    if (OrthancPlugins::DicomWebFormatter::ConvertToDicomWebJson(item, dicom))
+    {
+      // Same as "DicomMap::Merge()": The tags of the instance have priority
+      for (Json::Value::Members::const_iterator tag = parentsTags.begin(); tag != parentsTags.end(); ++tag)
       {
-        Json::Value instanceResource;
-
-        if (OrthancPlugins::RestApiGet(instanceResource, "/instances/" + instanceToLoad->GetOrthancId(), false))
+        if (!item.isMember(*tag))
         {
-          instanceToLoad->SetBulkRoot((data->GetWadoBase() +
-                                       "studies/" + instanceToLoad->GetStudyInstanceUid() +
-                                       "/series/" + instanceToLoad->GetSeriesInstanceUid() +
-                                       "/instances/" + instanceResource[MAIN_DICOM_TAGS]["SOPInstanceUID"].asString() + "/bulk"));
+          item[*tag] = parentsJson[*tag];
         }
       }
 
-      std::unique_ptr<OrthancPlugins::DicomInstance> instance;
-
-      try
-      {
-        instance.reset(OrthancPlugins::DicomInstance::Load(instanceToLoad->GetOrthancId(), OrthancPluginLoadDicomInstanceMode_EmptyPixelData));
-      }
-      catch (const Orthanc::OrthancException& e)
-      {
-      }
-
-      if (instance.get() != NULL)
-      {
-        instanceToLoad->AddInstance(*instance);
-      }
+      std::string json;
+      OrthancPlugins::WriteFastJson(json, item);
+      writer.AddDicomWebInstanceSerializedJson(json.c_str(), json.size());
     }
-    catch(...)
+    else
     {
-      // ignore errors but don't exit the thread to make sure all workers end correctly
+      dicom.Merge(parents);
+      writer.AddOrthancMap(dicom);
     }
+
+    instancesIds.insert(it->first);
   }
+
+  return true;
 }
 
+
 void RetrieveSeriesMetadataInternal(std::set<std::string>& instancesIds,
                                     OrthancPlugins::DicomWebFormatter::HttpWriter& writer,
                                     MainDicomTagsCache& cache,
@@ -1816,11 +2535,10 @@ void RetrieveSeriesMetadataInternal(std::set<std::string>& instancesIds,
   if (workersCount > 1 && mode == OrthancPlugins::MetadataMode_Full)
   {
     ChildrenMainDicomMaps instancesDicomMaps;
-    std::string seriesDicomUid;
 
-    if (CanUseExtendedFind()) // in this case, /series/.../instances?full has been optimized to minimize the SQL queries
+    if (CanUseExtendedFind())
     {
-      GetChildrenMainDicomTags(instancesDicomMaps, seriesDicomUid, Orthanc::ResourceType_Series, seriesOrthancId);
+      GetChildrenMainDicomTags(instancesDicomMaps, Orthanc::ResourceType_Series, seriesOrthancId);
       for (ChildrenMainDicomMaps::const_iterator it = instancesDicomMaps.begin(); it != instancesDicomMaps.end(); ++it)
       {
         instancesIds.insert(it->first);
@@ -1828,21 +2546,14 @@ void RetrieveSeriesMetadataInternal(std::set<std::string>& instancesIds,
     }
     else
     {
+      std::string seriesDicomUid;  // not used
       GetChildrenIdentifiers(instancesIds, seriesDicomUid, Orthanc::ResourceType_Series, seriesOrthancId);
     }
 
-    // span a few workers to get the tags from the core and serialize them
-    Orthanc::SharedMessageQueue instancesQueue;
-    std::vector<boost::shared_ptr<boost::thread> > instancesWorkers;
+    // the workers get the tags from the core and serialize them
     boost::mutex writerMutex;
-    std::vector<boost::shared_ptr<InstanceWorkerData> > instancesWorkersData;
-
-    for (unsigned int t = 0; t < workersCount; t++)
-    {
-      InstanceWorkerData* threadData = new InstanceWorkerData(&instancesQueue, wadoBase, t);
-      instancesWorkersData.push_back(boost::shared_ptr<InstanceWorkerData>(threadData));
-      instancesWorkers.push_back(boost::shared_ptr<boost::thread>(new boost::thread(InstanceWorkerThread, threadData)));
-    }
+    InstancesToLoad instances;
+    instances.reserve(instancesIds.size());
 
     if (CanUseExtendedFind())  // we must correct the bulkRoot
     {
@@ -1853,40 +2564,36 @@ void RetrieveSeriesMetadataInternal(std::set<std::string>& instancesIds,
                                 "/series/" + seriesInstanceUid + 
                                 "/instances/" + i->second->GetStringValue(Orthanc::DICOM_TAG_SOP_INSTANCE_UID, "", false) + "/bulk");
 
-        instancesQueue.Enqueue(new InstanceToLoad(i->first, bulkRoot, writerMutex, writer, studyInstanceUid, seriesInstanceUid));
+        instances.push_back(boost::shared_ptr<InstanceToLoad>(
+                              new InstanceToLoad(i->first, bulkRoot, wadoBase, writerMutex, writer, studyInstanceUid, seriesInstanceUid)));
       }
     }
     else
     {
       for (std::set<std::string>::const_iterator i = instancesIds.begin(); i != instancesIds.end(); ++i)
       {
-        instancesQueue.Enqueue(new InstanceToLoad(*i, "", writerMutex, writer, studyInstanceUid, seriesInstanceUid));
-      }
-    }
-
-    // send a dummy "exit" message to all workers such that they stop waiting for messages on the queue
-    for (size_t i = 0; i < instancesWorkers.size(); i++)
-    {
-      instancesQueue.Enqueue(new InstanceToLoad(EXIT_WORKER_MESSAGE, "", writerMutex, writer, studyInstanceUid, seriesInstanceUid));
-    }
-
-    for (size_t i = 0; i < instancesWorkers.size(); i++)
-    {
-      if (instancesWorkers[i]->joinable())
-      {
-        instancesWorkers[i]->join();
+        instances.push_back(boost::shared_ptr<InstanceToLoad>(
+                              new InstanceToLoad(*i, "", wadoBase, writerMutex, writer, studyInstanceUid, seriesInstanceUid)));
       }
     }
 
-    instancesWorkers.clear();
+    LoadInstancesMetadata(instances);
+  }
+  else if (mode != OrthancPlugins::MetadataMode_Full &&
+           WriteSeriesMainDicomTags(instancesIds, writer, cache, mode, seriesOrthancId))
+  {
+    // the main DICOM tags have been written by the fast path
   }
   else
   {
     // old single threaded code
     std::set<std::string> instances;
-    std::string seriesDicomUid;  // not used
 
-    GetChildrenIdentifiers(instances, seriesDicomUid, Orthanc::ResourceType_Series, seriesOrthancId);
+    if (!cache.PrefetchSeriesInstances(instances, seriesOrthancId))
+    {
+      std::string seriesDicomUid;  // not used
+      GetChildrenIdentifiers(instances, seriesDicomUid, Orthanc::ResourceType_Series, seriesOrthancId);
+    }
 
     for (std::set<std::string>::const_iterator i = instances.begin(); i != instances.end(); ++i)
     {
@@ -1895,201 +2602,1278 @@ void RetrieveSeriesMetadataInternal(std::set<std::string>& instancesIds,
   }
 }
 
-void CacheSeriesMetadataInternal(std::string& serializedSeriesMetadata,
-                                 OrthancPlugins::DicomWebFormatter::HttpWriter& writer,
-                                 MainDicomTagsCache& cache,
-                                 const std::string& studyInstanceUid, 
-                                 const std::string& seriesInstanceUid, 
-                                 const std::string& seriesOrthancId)
+// Computes the DICOMweb JSON of the given instances of a series and
+// stores it in the records, with a placeholder WADO base url because
+// the base url might change (e.g if there are 2 Orthanc connected to
+// the same DB)
+static void ComputeSeriesMetadataRecords(OrthancPlugins::SeriesMetadataRecords& records,
+                                         const std::set<std::string>& instancesIds,
+                                         const std::string& seriesOrthancId,
+                                         const std::string& studyInstanceUid,
+                                         const std::string& seriesInstanceUid)
 {
-  Orthanc::GzipCompressor compressor;
-  std::set<std::string> instancesIds;
-
-  // compute the series metadata with a placeholder WADO base url because, the base url might change (e.g if there are 2 Orthanc connected to the same DB)
-  RetrieveSeriesMetadataInternal(instancesIds, writer, cache, OrthancPlugins::MetadataMode_Full, false /* isXml */, seriesOrthancId, studyInstanceUid, seriesInstanceUid, WADO_BASE_PLACEHOLDER);
-  writer.CloseAndGetJsonOutput(serializedSeriesMetadata);
-
-  if (!IsSystemReadOnly())
+  if (instancesIds.empty())
   {
-    // save in attachments for future use
-    std::string compressedSeriesMetadata;
-    Orthanc::IBufferCompressor::Compress(compressedSeriesMetadata, compressor, serializedSeriesMetadata);
-    std::string instancesMd5;
-    Orthanc::Toolbox::ComputeMD5(instancesMd5, instancesIds);
-
-    std::string cacheContent = "2;" + instancesMd5 + ";" + compressedSeriesMetadata; 
+    return;
+  }
 
-    Json::Value putResult;
-    std::string attachmentUrl = "/series/" + seriesOrthancId + "/attachments/" + SERIES_METADATA_ATTACHMENT_ID;
+  ChildrenMainDicomMaps instancesDicomMaps;
 
-    OrthancPlugins::RestApiClient client;
-    client.SetMethod(OrthancPluginHttpMethod_Get);
-    client.SetPath(attachmentUrl);
+  if (CanUseExtendedFind() &&
+      instancesIds.size() > 1)
+  {
+    // get all the SOPInstanceUID in a single call to "/tools/find"
+    GetChildrenMainDicomTags(instancesDicomMaps, Orthanc::ResourceType_Series, seriesOrthancId);
+  }
 
-    std::string etag;
-    bool hasRevision = (client.Execute() &&
-                        client.LookupAnswerHeader(etag, "etag"));
+  boost::mutex recordsMutex;
+  InstancesToLoad instances;
+  instances.reserve(instancesIds.size());
 
-    client.SetMethod(OrthancPluginHttpMethod_Put);
-    client.SwapRequestBody(cacheContent);
+  for (std::set<std::string>::const_iterator i = instancesIds.begin(); i != instancesIds.end(); ++i)
+  {
+    std::string bulkRoot;
 
-    if (hasRevision)
+    ChildrenMainDicomMaps::const_iterator found = instancesDicomMaps.find(*i);
+    if (found != instancesDicomMaps.end())
     {
-      client.AddRequestHeader("If-Match", etag);
+      bulkRoot = (WADO_BASE_PLACEHOLDER +
+                  "studies/" + studyInstanceUid +
+                  "/series/" + seriesInstanceUid +
+                  "/instances/" + found->second->GetStringValue(Orthanc::DICOM_TAG_SOP_INSTANCE_UID, "", false) + "/bulk");
     }
 
-    if (!client.Execute())
-    {
-      LOG(WARNING) << "DicomWEB: failed to write series metadata attachment";
-    }
+    instances.push_back(boost::shared_ptr<InstanceToLoad>(
+                          new InstanceToLoad(*i, bulkRoot, WADO_BASE_PLACEHOLDER, recordsMutex, records, studyInstanceUid, seriesInstanceUid)));
   }
+
+  LoadInstancesMetadata(instances);
 }
 
-void CacheSeriesMetadata(const std::string& seriesOrthancId)
+
+static bool ReadSeriesMetadataCache(OrthancPlugins::SeriesMetadataRecords& records,
+                                    const std::string& seriesOrthancId)
 {
-  if (!OrthancPlugins::Configuration::IsMetadataCacheEnabled())
+  records.Clear();
+
+  OrthancPlugins::LatencyStageTimer timer(OrthancPlugins::LatencyStage_Load);
+
+  std::string cacheContent;
+  if (!OrthancPlugins::RestApiGetString(cacheContent, "/series/" + seriesOrthancId + "/attachments/" + SERIES_METADATA_ATTACHMENT_ID + "/data", false))
   {
-    return;
+    return false;
   }
 
-  LOG(INFO) << "DicomWEB: pre-computing the WADO-RS series metadata for series " << seriesOrthancId;
+  std::string lastUpdate;
+  size_t count, recordsOffset;
 
-  Json::Value result;
-  if (OrthancPlugins::RestApiGet(result, "/series/" + seriesOrthancId, false))
+  if (!OrthancPlugins::SeriesMetadataRecords::ParseHeader(lastUpdate, count, recordsOffset, cacheContent))
   {
-    const std::string seriesInstanceUid = result[MAIN_DICOM_TAGS]["SeriesInstanceUID"].asString();
+    // e.g. version 2 or 3 of the cache, which is regenerated in version 4
+    return false;
+  }
 
-    if (OrthancPlugins::RestApiGet(result, "/studies/" + result["ParentStudy"].asString(), false))
-    {
-      const std::string studyInstanceUid = result[MAIN_DICOM_TAGS]["StudyInstanceUID"].asString();
+  if (count > 0)
+  {
+    std::string serializedRecords;
 
-      MainDicomTagsCache cache;
-      OrthancPlugins::DicomWebFormatter::HttpWriter writer(NULL /* output */, false /* isXml */);  // we cache only the JSON format -> no need for an HttpOutput
+    try
+    {
+      Orthanc::GzipCompressor compressor;
+      compressor.Uncompress(serializedRecords, cacheContent.c_str() + recordsOffset, cacheContent.size() - recordsOffset);
+    }
+    catch (Orthanc::OrthancException&)
+    {
+      LOG(WARNING) << "DicomWEB: corrupted series metadata attachment for series " << seriesOrthancId;
+      return false;
+    }
 
-      std::string serializedSeriesMetadataNotUsed;
-      CacheSeriesMetadataInternal(serializedSeriesMetadataNotUsed, writer, cache, studyInstanceUid, seriesInstanceUid, seriesOrthancId);
+    if (!records.UnserializeRecords(serializedRecords) ||
+        records.GetSize() != count)
+    {
+      LOG(WARNING) << "DicomWEB: corrupted series metadata attachment for series " << seriesOrthancId;
+      records.Clear();
+      return false;
     }
   }
+
+  records.SetLastUpdate(lastUpdate);
+  return true;
 }
 
-void UpdateSeriesMetadataCache(OrthancPluginRestOutput* output,
-                               const char* /*url*/,
-                               const OrthancPluginHttpRequest* request)
+
+static void WriteSeriesMetadataCache(const OrthancPlugins::SeriesMetadataRecords& records,
+                                     const std::string& seriesOrthancId)
 {
-  if (request->method != OrthancPluginHttpMethod_Post)
+  std::string cacheContent;
+  records.FormatHeader(cacheContent);
+
+  if (records.GetSize() > 0)
   {
-    OrthancPluginSendMethodNotAllowed(OrthancPlugins::GetGlobalContext(), output, "POST");
-    return;
+    std::string serializedRecords, compressedRecords;
+    records.SerializeRecords(serializedRecords);
+
+    Orthanc::GzipCompressor compressor;
+    Orthanc::IBufferCompressor::Compress(compressedRecords, compressor, serializedRecords);
+    cacheContent += compressedRecords;
   }
 
-  if (request->groupsCount != 1)
+  std::string attachmentUrl = "/series/" + seriesOrthancId + "/attachments/" + SERIES_METADATA_ATTACHMENT_ID;
+
+  OrthancPlugins::RestApiClient client;
+  client.SetMethod(OrthancPluginHttpMethod_Get);
+  client.SetPath(attachmentUrl);
+
+  std::string etag;
+  bool hasRevision = (client.Execute() &&
+                      client.LookupAnswerHeader(etag, "etag"));
+
+  client.SetMethod(OrthancPluginHttpMethod_Put);
+  client.SwapRequestBody(cacheContent);
+
+  if (hasRevision)
   {
-    throw Orthanc::OrthancException(Orthanc::ErrorCode_BadRequest);
+    client.AddRequestHeader("If-Match", etag);
   }
 
-  if (!OrthancPlugins::Configuration::IsMetadataCacheEnabled())
+  if (!client.Execute())
   {
-    throw Orthanc::OrthancException(Orthanc::ErrorCode_BadRequest, "The metadata cache is disabled in the Orthanc configuration.");
+    LOG(WARNING) << "DicomWEB: failed to write series metadata attachment";
   }
+}
 
-  std::string studyId(request->groups[0]);
-
-  LOG(INFO) << "DicomWEB: updating the series metadata cache for study " << studyId;
-
-  Json::Value study;
 
-  if (OrthancPlugins::RestApiGet(study, "/studies/" + studyId, false) && study.type() == Json::objectValue)
+// Reads the revision of the series that is compared with the one
+// stored in the cache.  Adding instances updates "LastUpdate", and
+// deleting instances updates the instances count.  With ExtendedFind,
+// this avoids listing all the instances of the series.
+static bool LookupSeriesRevision(std::string& lastUpdate,
+                                 size_t& instancesCount,
+                                 const std::string& seriesOrthancId)
+{
+  if (CanUseExtendedFind())
   {
-    for (Json::ArrayIndex i = 0; i < study["Series"].size(); ++i)
+    Json::Value query;
+    query["Level"] = "Instance";
+    query["Query"] = Json::objectValue;
+    query["ParentSeries"] = seriesOrthancId;
+
+    Json::Value count;
+    if (!OrthancPlugins::RestApiGetString(lastUpdate, "/series/" + seriesOrthancId + "/metadata/LastUpdate", false) ||
+        !OrthancPlugins::RestApiPost(count, "/tools/count-resources", query, false) ||
+        count.type() != Json::objectValue ||
+        !count.isMember("Count") ||
+        !count["Count"].isIntegral())
     {
-      CacheSeriesMetadata(study["Series"][i].asString());
+      return false;
     }
+
+    instancesCount = count["Count"].asUInt();
+    return true;
   }
+  else
+  {
+    Json::Value series;
+    if (!OrthancPlugins::RestApiGet(series, "/series/" + seriesOrthancId, false) ||
+        series.type() != Json::objectValue ||
+        !series.isMember("LastUpdate") ||
+        series["LastUpdate"].type() != Json::stringValue ||
+        !series.isMember("Instances") ||
+        series["Instances"].type() != Json::arrayValue)
+    {
+      return false;
+    }
 
-  std::string answer = "{}"; 
-  OrthancPluginAnswerBuffer(OrthancPlugins::GetGlobalContext(), output, answer.c_str(), answer.size(), "application/json");
+    lastUpdate = series["LastUpdate"].asString();
+    instancesCount = series["Instances"].size();
+    return true;
+  }
 }
 
 
-
-void RetrieveSeriesMetadataInternalWithCache(OrthancPlugins::DicomWebFormatter::HttpWriter& writer,
-                                             MainDicomTagsCache& cache,
-                                             const OrthancPlugins::MetadataMode& mode,
-                                             bool isXml,
-                                             const std::string& seriesOrthancId,
-                                             const std::string& studyInstanceUid,
-                                             const std::string& seriesInstanceUid,
-                                             const std::string& wadoBase)
+// Lists the instances of a series together with their stamp in the
+// series metadata cache, which is their "ReceptionDate": If an
+// instance is overwritten, it keeps its Orthanc ID, but the Orthanc
+// core stores it again with a new "ReceptionDate".  With ExtendedFind,
+// the stamps are read by a single call to "/tools/find".
+static void LookupInstancesStamps(OrthancPlugins::SeriesMetadataRecords::Stamps& stamps,
+                                  const Json::Value& series,
+                                  const std::string& seriesOrthancId)
 {
-  if (OrthancPlugins::Configuration::IsMetadataCacheEnabled() &&
-      mode == OrthancPlugins::MetadataMode_Full && 
-      !isXml)
-  {
-    // check if we already have computed the series metadata and saved them in an attachment
-    std::string serializedSeriesMetadata;
-    std::string cacheContent;
-    bool hasBeenReadFromCache = false;
-    Orthanc::GzipCompressor compressor;
+  stamps.clear();
 
-    std::string attachmentUrl = "/series/" + seriesOrthancId + "/attachments/" + SERIES_METADATA_ATTACHMENT_ID;
-
-    if (OrthancPlugins::RestApiGetString(cacheContent, attachmentUrl + "/data", false))
+  if (CanUseExtendedFind())
+  {
+    Json::Value query;
+    query["Level"] = "Instance";
+    query["Query"] = Json::objectValue;
+    query["ParentSeries"] = seriesOrthancId;
+    query["Expand"] = true;
+    query["ResponseContent"] = Json::arrayValue;
+    query["ResponseContent"].append("Metadata");
+
+    Json::Value instances;
+    if (OrthancPlugins::RestApiPost(instances, "/tools/find", query, false) &&
+        instances.type() == Json::arrayValue)
     {
-      if (boost::starts_with(cacheContent, "2;"))  // version 2, cacheContent is "2;sorted-instances-list-md5;compressedSeriesMetadata"
+      for (Json::Value::ArrayIndex i = 0; i < instances.size(); i++)
       {
-        // check that the instances count have not changed since we have saved the data in cache 
-        // StableSeries event will always overwrite it but this is usefull if retrieving the metadata while
-        // the instances are being received
-        // Note: we can not use Toolbox::SplitString because the compressed metadata contain a lot of ";"
-        const char* secondSemiColon = strchr(&cacheContent[2], ';');
-        std::string instancesMd5InCache(&cacheContent[2], secondSemiColon - &cacheContent[2]);
-        std::string compressedSeriesMetadata(secondSemiColon + 1, cacheContent.size() - (secondSemiColon+1 - cacheContent.c_str()));
-        
-        Json::Value seriesInfo;
-
-        if (!OrthancPlugins::RestApiGet(seriesInfo, "/series/" + seriesOrthancId, false))
-        {
-          throw Orthanc::OrthancException(Orthanc::ErrorCode_UnknownResource);
-        }
-        std::set<std::string> currentInstancesIds;
-        Orthanc::SerializationToolbox::ReadSetOfStrings(currentInstancesIds, seriesInfo, "Instances");
-        std::string currentInstancesMd5;
-        Orthanc::Toolbox::ComputeMD5(currentInstancesMd5, currentInstancesIds);
-
-        if (currentInstancesMd5 == instancesMd5InCache)
+        const Json::Value& instance = instances[i];
+        if (instance.type() == Json::objectValue &&
+            instance.isMember("ID") &&
+            instance["ID"].type() == Json::stringValue)
         {
-          Orthanc::IBufferCompressor::Uncompress(serializedSeriesMetadata, compressor, compressedSeriesMetadata);
+          std::string& stamp = stamps[instance["ID"].asString()];
 
-          hasBeenReadFromCache = true;
+          if (instance.isMember("Metadata") &&
+              instance["Metadata"].type() == Json::objectValue &&
+              instance["Metadata"].isMember("ReceptionDate") &&
+              instance["Metadata"]["ReceptionDate"].type() == Json::stringValue)
+          {
+            stamp = instance["Metadata"]["ReceptionDate"].asString();
+          }
         }
       }
+
+      return;
     }
+  }
 
-    if (!hasBeenReadFromCache)  // regenerate and overwrite current cache
-    {
-      MainDicomTagsCache tmpCache;
-      OrthancPlugins::DicomWebFormatter::HttpWriter tmpWriter(NULL /* output */, false /* isXml */);  // we cache only the JSON format -> no need for an HttpOutput
+  std::set<std::string> instancesIds;
+  Orthanc::SerializationToolbox::ReadSetOfStrings(instancesIds, series, "Instances");
 
-      CacheSeriesMetadataInternal(serializedSeriesMetadata, tmpWriter, tmpCache, studyInstanceUid, seriesInstanceUid, seriesOrthancId);
+  for (std::set<std::string>::const_iterator it = instancesIds.begin(); it != instancesIds.end(); ++it)
+  {
+    std::string& stamp = stamps[*it];
+    if (!OrthancPlugins::RestApiGetString(stamp, "/instances/" + *it + "/metadata/ReceptionDate", false))
+    {
+      stamp.clear();
     }
+  }
+}
 
-    boost::replace_all(serializedSeriesMetadata, WADO_BASE_PLACEHOLDER, wadoBase);
 
-    writer.AddDicomWebSeriesSerializedJson(serializedSeriesMetadata.c_str(), serializedSeriesMetadata.size());
+// Drops the records of the deleted and of the overwritten instances,
+// computes the records of the new instances, and saves the result in
+// the cache
+static void UpdateSeriesMetadataRecords(OrthancPlugins::SeriesMetadataRecords& records,
+                                        const std::string& studyInstanceUid,
+                                        const std::string& seriesInstanceUid,
+                                        const std::string& seriesOrthancId)
+{
+  Json::Value series;
+  if (!OrthancPlugins::RestApiGet(series, "/series/" + seriesOrthancId, false) ||
+      series.type() != Json::objectValue)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_UnknownResource);
+  }
+
+  OrthancPlugins::SeriesMetadataRecords::Stamps instancesStamps;
+  LookupInstancesStamps(instancesStamps, series, seriesOrthancId);
+
+  // "LastUpdate" is read before the instances are loaded, so that an
+  // instance that is received in the meantime is detected next time
+  if (series.isMember("LastUpdate") &&
+      series["LastUpdate"].type() == Json::stringValue)
+  {
+    records.SetLastUpdate(series["LastUpdate"].asString());
   }
   else
   {
-    std::set<std::string> instancesIdsNotUsed;
-    RetrieveSeriesMetadataInternal(instancesIdsNotUsed, writer, cache, mode, isXml, seriesOrthancId, studyInstanceUid, seriesInstanceUid, wadoBase);
+    records.SetLastUpdate("");
   }
 
-}
+  std::set<std::string> missingInstancesIds;
+  records.Synchronize(missingInstancesIds, instancesStamps);
 
+  if (!missingInstancesIds.empty())
+  {
+    LOG(INFO) << "DicomWEB: computing the WADO-RS metadata of " << missingInstancesIds.size() << "/" << instancesStamps.size()
+              << " instances of series " << seriesOrthancId;
+  }
+
+  ComputeSeriesMetadataRecords(records, missingInstancesIds, seriesOrthancId, studyInstanceUid, seriesInstanceUid);
+
+  if (!IsSystemReadOnly())
+  {
+    // save in attachments for future use
+    WriteSeriesMetadataCache(records, seriesOrthancId);
+  }
+}
+
+void CacheSeriesMetadata(const std::string& seriesOrthancId)
+{
+  if (!OrthancPlugins::Configuration::IsMetadataCacheEnabled())
+  {
+    return;
+  }
+
+  LOG(INFO) << "DicomWEB: pre-computing the WADO-RS series metadata for series " << seriesOrthancId;
+
+  Json::Value result;
+  if (OrthancPlugins::RestApiGet(result, "/series/" + seriesOrthancId, false))
+  {
+    const std::string seriesInstanceUid = result[MAIN_DICOM_TAGS]["SeriesInstanceUID"].asString();
+
+    if (OrthancPlugins::RestApiGet(result, "/studies/" + result["ParentStudy"].asString(), false))
+    {
+      const std::string studyInstanceUid = result[MAIN_DICOM_TAGS]["StudyInstanceUID"].asString();
+
+      // start from empty records: the StableSeries event regenerates
+      // all the instances, because an instance might have been
+      // overwritten without its Orthanc ID being changed
+      OrthancPlugins::SeriesMetadataRecords records;
+      UpdateSeriesMetadataRecords(records, studyInstanceUid, seriesInstanceUid, seriesOrthancId);
+    }
+  }
+}
+
+static const char* const UPDATE_METADATA_CACHE_JOB = "DicomWebUpdateMetadataCache";
+
+namespace
+{
+  // Job that regenerates the series metadata cache of one study, of
+  // one patient, or of the whole archive.  The series are processed
+  // by pages, in the alphabetical order of their Orthanc IDs, and the
+  // ID of the last processed series is saved in the serialized state
+  // of the job, so that a rebuild of a large archive can be resumed
+  // after a restart of Orthanc.  The Orthanc core guarantees no order
+  // for its lists of resources, and the deletion of series would
+  // shift an offset into such a list: The series are thus listed
+  // again each time the job is (re)started, and those that come
+  // before the saved ID are skipped.
+  class UpdateMetadataCacheJob :
+    public OrthancPlugins::SingleFunctionJob,
+    private OrthancPlugins::SingleFunctionJob::IFunctionFactory
+  {
+  public:
+    enum Scope
+    {
+      Scope_Study,
+      Scope_Patient,
+      Scope_Archive
+    };
+
+  private:
+    enum Action
+    {
+      Action_None,
+      Action_Pause,
+      Action_Cancel
+    };
+
+    // Number of series between two updates of the serialized state
+    static const unsigned int PAGE_SIZE = 100;
+
+    class SeriesTask : public OrthancPlugins::WorkersPool::ITask
+    {
+    private:
+      UpdateMetadataCacheJob&  job_;
+      std::string              seriesId_;
+      bool                     success_;
+
+    public:
+      SeriesTask(UpdateMetadataCacheJob& job,
+                 const std::string& seriesId) :
+        job_(job),
+        seriesId_(seriesId),
+        success_(true)
+      {
+      }
+
+      virtual void Execute() ORTHANC_OVERRIDE
+      {
+        if (!job_.IsStopping())
+        {
+          try
+          {
+            CacheSeriesMetadata(seriesId_);
+          }
+          catch (Orthanc::OrthancException& e)
+          {
+            LOG(ERROR) << "DicomWEB: cannot update the metadata cache of series "
+                       << seriesId_ << ": " << e.What();
+            success_ = false;
+          }
+        }
+      }
+
+      bool IsSuccess() const
+      {
+        return success_;
+      }
+    };
+
+
+    class F : public IFunction
+    {
+    private:
+      UpdateMetadataCacheJob&  that_;
+
+    public:
+      explicit F(UpdateMetadataCacheJob& that) :
+        that_(that)
+      {
+      }
+
+      virtual void Execute(JobContext& context) ORTHANC_OVERRIDE
+      {
+        std::vector<std::string> series;
+        that_.ListSeries(series);
+
+        const unsigned int total = series.size();
+
+        const boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+        unsigned int processed = 0;  // Since the job has been (re)started
+
+        context.SetContent("TotalSeries", total);
+
+        for (;;)
+        {
+          std::string lastSeries;
+
+          {
+            boost::mutex::scoped_lock lock(that_.mutex_);
+            if (that_.action_ != Action_None)
+            {
+              break;
+            }
+
+            lastSeries = that_.lastSeries_;
+          }
+
+          // Skip the series that have already been processed
+          const std::vector<std::string>::const_iterator first =
+            std::upper_bound(series.begin(), series.end(), lastSeries);
+
+          std::vector<std::string> page;
+          for (std::vector<std::string>::const_iterator it = first;
+               it != series.end() && page.size() < PAGE_SIZE; ++it)
+          {
+            page.push_back(*it);
+          }
+
+          if (page.empty())
+          {
+            break;
+          }
+
+          const unsigned int position = static_cast<unsigned int>(first - series.begin()) + page.size();
+
+          unsigned int failures = 0;
+
+          {
+            std::vector<boost::shared_ptr<SeriesTask> > tasks(page.size());  // Must outlive the group
+
+            OrthancPlugins::WorkersPool::TasksGroup group(OrthancPlugins::WorkersPool::GetInstance(),
+                                                          that_.threads_ > 1 ? that_.threads_ : 0);
+
+            for (size_t i = 0; i < page.size(); i++)
+            {
+              tasks[i].reset(new SeriesTask(that_, page[i]));
+              group.Submit(*tasks[i]);
+            }
+
+            group.WaitAll();
+
+            for (size_t i = 0; i < tasks.size(); i++)
+            {
+              if (!tasks[i]->IsSuccess())
+              {
+                failures++;
+              }
+            }
+          }
+
+          unsigned int failed;
+
+          {
+            boost::mutex::scoped_lock lock(that_.mutex_);
+            if (that_.action_ != Action_None)
+            {
+              // The page was interrupted, it will be processed again
+              // if the job is resumed
+              break;
+            }
+
+            that_.lastSeries_ = page.back();
+            that_.failed_ += failures;
+            failed = that_.failed_;
+            that_.SaveState();
+          }
+
+          processed += page.size();
+
+          const int64_t elapsed = (boost::posix_time::microsec_clock::universal_time() - start).total_milliseconds();
+
+          context.SetContent("ProcessedSeries", position);
+          context.SetContent("FailedSeries", failed);
+          context.SetContent("SeriesPerSecond", elapsed > 0 ?
+                             static_cast<double>(processed) * 1000.0 / static_cast<double>(elapsed) : 0.0);
+          context.SetProgress(position, total);
+        }
+
+        {
+          boost::mutex::scoped_lock lock(that_.mutex_);
+
+          if (that_.action_ == Action_Cancel)
+          {
+            // A canceled job restarts from the beginning if it is resubmitted
+            that_.lastSeries_.clear();
+            that_.failed_ = 0;
+            that_.SaveState();
+          }
+          else if (that_.action_ == Action_None)
+          {
+            context.SetProgress(1, 1);
+          }
+        }
+      }
+    };
+
+
+    boost::mutex  mutex_;
+    Scope         scope_;
+    std::string   resource_;
+    unsigned int  threads_;
+    std::string   lastSeries_;  // Empty if no series has been processed yet
+    unsigned int  failed_;
+    Action        action_;
+
+    static const char* EnumerationToString(Scope scope)
+    {
+      switch (scope)
+      {
+        case Scope_Study:
+          return "Study";
+
+        case Scope_Patient:
+          return "Patient";
+
+        case Scope_Archive:
+          return "Archive";
+
+        default:
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+      }
+    }
+
+    static Scope StringToScope(const std::string& scope)
+    {
+      if (scope == "Study")
+      {
+        return Scope_Study;
+      }
+      else if (scope == "Patient")
+      {
+        return Scope_Patient;
+      }
+      else if (scope == "Archive")
+      {
+        return Scope_Archive;
+      }
+      else
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                        "Unknown scope for a job updating the DICOMweb cache: " + scope);
+      }
+    }
+
+    bool IsStopping()
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      return action_ != Action_None;
+    }
+
+    // The mutex must be locked
+    void SaveState()
+    {
+      Json::Value serialized = Json::objectValue;
+      serialized["Scope"] = EnumerationToString(scope_);
+      serialized["Resource"] = resource_;
+      serialized["Threads"] = threads_;
+      serialized["LastSeries"] = lastSeries_;
+      serialized["FailedSeries"] = failed_;
+      SetSerialized(serialized);
+    }
+
+    // The series are sorted, so that the ID of the last processed
+    // series is still meaningful after a restart
+    void ListSeries(std::vector<std::string>& series) const
+    {
+      series.clear();
+
+      Json::Value answer;
+
+      switch (scope_)
+      {
+        case Scope_Study:
+          if (!OrthancPlugins::RestApiGet(answer, "/studies/" + resource_, false) ||
+              answer.type() != Json::objectValue ||
+              !answer.isMember("Series") ||
+              answer["Series"].type() != Json::arrayValue)
+          {
+            throw Orthanc::OrthancException(Orthanc::ErrorCode_UnknownResource, "Unknown study: " + resource_);
+          }
+
+          for (Json::Value::ArrayIndex i = 0; i < answer["Series"].size(); i++)
+          {
+            series.push_back(answer["Series"][i].asString());
+          }
+          break;
+
+        case Scope_Patient:
+          if (!OrthancPlugins::RestApiGet(answer, "/patients/" + resource_ + "/series", false) ||
+              answer.type() != Json::arrayValue)
+          {
+            throw Orthanc::OrthancException(Orthanc::ErrorCode_UnknownResource, "Unknown patient: " + resource_);
+          }
+
+          for (Json::Value::ArrayIndex i = 0; i < answer.size(); i++)
+          {
+            if (answer[i].type() == Json::objectValue &&
+                answer[i].isMember("ID"))
+            {
+              series.push_back(answer[i]["ID"].asString());
+            }
+          }
+          break;
+
+        case Scope_Archive:
+          if (!OrthancPlugins::RestApiGet(answer, "/series", false) ||
+              answer.type() != Json::arrayValue)
+          {
+            throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+          }
+
+          series.reserve(answer.size());
+
+          for (Json::Value::ArrayIndex i = 0; i < answer.size(); i++)
+          {
+            if (answer[i].type() == Json::stringValue)
+            {
+              series.push_back(answer[i].asString());
+            }
+          }
+          break;
+
+        default:
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+      }
+
+      std::sort(series.begin(), series.end());
+    }
+
+    virtual void CancelFunction() ORTHANC_OVERRIDE
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      action_ = Action_Cancel;
+    }
+
+    virtual void PauseFunction() ORTHANC_OVERRIDE
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      action_ = Action_Pause;
+    }
+
+    virtual IFunction* CreateFunction() ORTHANC_OVERRIDE
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      action_ = Action_None;
+      return new F(*this);
+    }
+
+  public:
+    UpdateMetadataCacheJob(Scope scope,
+                           const std::string& resource,
+                           unsigned int threads) :
+      OrthancPlugins::SingleFunctionJob(UPDATE_METADATA_CACHE_JOB),
+      scope_(scope),
+      resource_(resource),
+      threads_(threads),
+      failed_(0),
+      action_(Action_None)
+    {
+      SetContent("Scope", EnumerationToString(scope_));
+      if (scope_ != Scope_Archive)
+      {
+        SetContent("Resource", resource_);
+      }
+
+      SetContent("Threads", threads_);
+
+      SaveState();
+      SetFactory(*this);
+    }
+
+    virtual ~UpdateMetadataCacheJob() ORTHANC_OVERRIDE
+    {
+      OrthancPlugins::SingleFunctionJob::Finalize();
+    }
+
+    static UpdateMetadataCacheJob* Unserialize(const Json::Value& serialized)
+    {
+      std::unique_ptr<UpdateMetadataCacheJob> job(
+        new UpdateMetadataCacheJob(StringToScope(Orthanc::SerializationToolbox::ReadString(serialized, "Scope")),
+                                   Orthanc::SerializationToolbox::ReadString(serialized, "Resource"),
+                                   Orthanc::SerializationToolbox::ReadUnsignedInteger(serialized, "Threads")));
+
+      job->lastSeries_ = Orthanc::SerializationToolbox::ReadString(serialized, "LastSeries", "");
+      job->failed_ = Orthanc::SerializationToolbox::ReadUnsignedInteger(serialized, "FailedSeries", 0);
+
+      {
+        boost::mutex::scoped_lock lock(job->mutex_);
+        job->SaveState();
+      }
+
+      return job.release();
+    }
+  };
+}
+
+
+static void SubmitUpdateMetadataCacheJob(OrthancPluginRestOutput* output,
+                                         const OrthancPluginHttpRequest* request,
+                                         UpdateMetadataCacheJob::Scope scope,
+                                         const std::string& resource)
+{
+  if (request->method != OrthancPluginHttpMethod_Post)
+  {
+    OrthancPluginSendMethodNotAllowed(OrthancPlugins::GetGlobalContext(), output, "POST");
+    return;
+  }
+
+  if (!OrthancPlugins::Configuration::IsMetadataCacheEnabled())
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_BadRequest, "The metadata cache is disabled in the Orthanc configuration.");
+  }
+
+  // An empty body is accepted for compatibility with the previous versions
+  Json::Value body = Json::objectValue;
+  if (request->bodySize != 0)
+  {
+    OrthancPlugins::ParseJsonBody(body, request);
+
+    if (body.type() != Json::objectValue)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat, "The body must be a JSON object");
+    }
+  }
+
+  const unsigned int threads = Orthanc::SerializationToolbox::ReadUnsignedInteger(body, "Threads", 1);
+
+  LOG(INFO) << "DicomWEB: updating the series metadata cache for "
+            << (scope == UpdateMetadataCacheJob::Scope_Archive ? "the whole archive" : resource)
+            << " with " << threads << " thread(s)";
+
+  // Synchronous by default, as in the previous versions
+  OrthancPlugins::OrthancJob::SubmitFromRestApiPost(output, body, new UpdateMetadataCacheJob(scope, resource, threads));
+}
+
+
+void UpdateSeriesMetadataCache(OrthancPluginRestOutput* output,
+                               const char* /*url*/,
+                               const OrthancPluginHttpRequest* request)
+{
+  if (request->groupsCount != 1)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_BadRequest);
+  }
+
+  SubmitUpdateMetadataCacheJob(output, request, UpdateMetadataCacheJob::Scope_Study, request->groups[0]);
+}
+
+
+void UpdatePatientMetadataCache(OrthancPluginRestOutput* output,
+                                const char* /*url*/,
+                                const OrthancPluginHttpRequest* request)
+{
+  if (request->groupsCount != 1)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_BadRequest);
+  }
+
+  SubmitUpdateMetadataCacheJob(output, request, UpdateMetadataCacheJob::Scope_Patient, request->groups[0]);
+}
+
+
+void UpdateArchiveMetadataCache(OrthancPluginRestOutput* output,
+                                const char* /*url*/,
+                                const OrthancPluginHttpRequest* request)
+{
+  SubmitUpdateMetadataCacheJob(output, request, UpdateMetadataCacheJob::Scope_Archive, "");
+}
+
+
+OrthancPluginJob* UnserializeUpdateMetadataCacheJob(const char* jobType,
+                                                    const char* serialized)
+{
+  if (jobType == NULL ||
+      serialized == NULL ||
+      std::string(jobType) != UPDATE_METADATA_CACHE_JOB)
+  {
+    return NULL;
+  }
+
+  try
+  {
+    Json::Value json;
+    if (!OrthancPlugins::ReadJson(json, serialized))
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat);
+    }
+
+    return OrthancPlugins::OrthancJob::Create(UpdateMetadataCacheJob::Unserialize(json));
+  }
+  catch (Orthanc::OrthancException& e)
+  {
+    LOG(ERROR) << "DicomWEB: cannot unserialize a job updating the metadata cache: " << e.What();
+    return NULL;
+  }
+}
+
+
+
+// Reads the records of the series from the cache, and updates the
+// cache if the series has changed
+static void SynchronizeSeriesMetadataCache(OrthancPlugins::SeriesMetadataRecords& records,
+                                           const std::string& seriesOrthancId,
+                                           const std::string& studyInstanceUid,
+                                           const std::string& seriesInstanceUid)
+{
+  // check if we already have computed the series metadata and saved them in an attachment
+  bool isUpToDate = false;
+
+  if (ReadSeriesMetadataCache(records, seriesOrthancId))
+  {
+    // check that the series has not changed since we have saved the data in cache 
+    // StableSeries event will always overwrite it but this is usefull if retrieving the metadata while
+    // the instances are being received
+    std::string lastUpdate;
+    size_t instancesCount;
+
+    isUpToDate = (LookupSeriesRevision(lastUpdate, instancesCount, seriesOrthancId) &&
+                  lastUpdate == records.GetLastUpdate() &&
+                  instancesCount == records.GetSize());
+  }
+
+  if (!isUpToDate)  // only compute the metadata of the new instances and overwrite current cache
+  {
+    UpdateSeriesMetadataRecords(records, studyInstanceUid, seriesInstanceUid, seriesOrthancId);
+  }
+}
+
+
+// Same as above, if the "LastUpdate" and the instances of the series
+// are already known, e.g. from a study-level "/tools/find"
+static void SynchronizeSeriesMetadataCache(OrthancPlugins::SeriesMetadataRecords& records,
+                                           const std::string& seriesOrthancId,
+                                           const std::string& studyInstanceUid,
+                                           const std::string& seriesInstanceUid,
+                                           const std::string& lastUpdate,
+                                           const std::set<std::string>& instancesIds)
+{
+  if (!ReadSeriesMetadataCache(records, seriesOrthancId) ||
+      lastUpdate != records.GetLastUpdate() ||
+      !records.HasSameInstances(instancesIds))
+  {
+    UpdateSeriesMetadataRecords(records, studyInstanceUid, seriesInstanceUid, seriesOrthancId);
+  }
+}
+
+
+// Gets the DICOMweb JSON array of the series from the cache, that is
+// updated if the series has changed.  "serializedSeriesMetadata" is
+// empty if the series has no instance.
+static void GetSeriesMetadataFromCache(std::string& serializedSeriesMetadata,
+                                       const std::string& seriesOrthancId,
+                                       const std::string& studyInstanceUid,
+                                       const std::string& seriesInstanceUid,
+                                       const std::string& wadoBase)
+{
+  OrthancPlugins::SeriesMetadataRecords records;
+  SynchronizeSeriesMetadataCache(records, seriesOrthancId, studyInstanceUid, seriesInstanceUid);
+
+  if (records.GetSize() > 0)
+  {
+    records.FormatSeries(serializedSeriesMetadata);
+    boost::replace_all(serializedSeriesMetadata, WADO_BASE_PLACEHOLDER, wadoBase);
+  }
+  else
+  {
+    serializedSeriesMetadata.clear();
+  }
+}
+
+
+void WarmStudyCaches(const std::string& studyOrthancId)
+{
+  Json::Value study;
+  if (!OrthancPlugins::RestApiGet(study, "/studies/" + studyOrthancId, false) ||
+      study.type() != Json::objectValue ||
+      !study.isMember(MAIN_DICOM_TAGS) ||
+      !study.isMember("Series") ||
+      study["Series"].type() != Json::arrayValue)
+  {
+    return;  // The study might have been deleted in the meantime
+  }
+
+  LOG(INFO) << "DicomWEB: warming up the caches of study " << studyOrthancId;
+
+  // The UID lookups of "LocateResource()" are not warmed up, as they
+  // must go through the authorization plugin with the HTTP headers of
+  // the actual requester
+
+  const std::string studyInstanceUid = study[MAIN_DICOM_TAGS]["StudyInstanceUID"].asString();
+
+  const bool metadata = (OrthancPlugins::Configuration::IsMetadataCacheEnabled() &&
+                         !IsSystemReadOnly());
+  const bool thumbnails = OrthancPlugins::Configuration::IsRenderedCachePregenerate();
+
+  for (Json::Value::ArrayIndex i = 0; i < study["Series"].size(); i++)
+  {
+    const std::string seriesOrthancId = study["Series"][i].asString();
+
+    Json::Value series;
+    if (OrthancPlugins::RestApiGet(series, "/series/" + seriesOrthancId, false) &&
+        series.type() == Json::objectValue &&
+        series.isMember(MAIN_DICOM_TAGS))
+    {
+      const std::string seriesInstanceUid = series[MAIN_DICOM_TAGS]["SeriesInstanceUID"].asString();
+
+      if (metadata)
+      {
+        // Unlike "CacheSeriesMetadata()", only the series that have
+        // changed are computed again
+        OrthancPlugins::SeriesMetadataRecords records;
+        SynchronizeSeriesMetadataCache(records, seriesOrthancId, studyInstanceUid, seriesInstanceUid);
+      }
+
+      if (thumbnails)
+      {
+        PregenerateSeriesThumbnail(seriesOrthancId);
+      }
+    }
+  }
+}
+
+
+void EnqueueRecentStudiesWarmUp(unsigned int days)
+{
+  const boost::gregorian::date since = boost::gregorian::day_clock::local_day() - boost::gregorian::days(days);
+
+  Json::Value query;
+  query["Level"] = "Study";
+  query["Expand"] = false;
+  query["Query"] = Json::objectValue;
+  query["Query"]["StudyDate"] = boost::gregorian::to_iso_string(since) + "-";
+
+  Json::Value studies;
+  if (!OrthancPlugins::RestApiPost(studies, "/tools/find", query, false) ||
+      studies.type() != Json::arrayValue)
+  {
+    LOG(WARNING) << "DicomWEB: cannot list the studies whose caches must be warmed up";
+    return;
+  }
+
+  size_t count = 0;
+  for (Json::Value::ArrayIndex i = 0; i < studies.size(); i++)
+  {
+    if (studies[i].type() == Json::stringValue &&
+        OrthancPlugins::CacheWarmer::GetInstance().Enqueue(studies[i].asString()))
+    {
+      count++;
+    }
+  }
+
+  LOG(WARNING) << "DicomWEB: warming up the caches of " << count << "/" << studies.size()
+               << " studies from the last " << days << " days";
+}
+
+
+void WarmUpStudies(OrthancPluginRestOutput* output,
+                   const char* /*url*/,
+                   const OrthancPluginHttpRequest* request)
+{
+  if (request->method != OrthancPluginHttpMethod_Post)
+  {
+    OrthancPluginSendMethodNotAllowed(OrthancPlugins::GetGlobalContext(), output, "POST");
+    return;
+  }
+
+  if (!OrthancPlugins::CacheWarmer::GetInstance().IsStarted())
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_BadRequest, "The cache warming is disabled in the Orthanc configuration.");
+  }
+
+  Json::Value body;
+  if (!OrthancPlugins::ReadJson(body, request->body, request->bodySize) ||
+      body.type() != Json::arrayValue)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat,
+                                    "The body must be a JSON array listing the Orthanc identifiers of studies");
+  }
+
+  unsigned int queued = 0;
+  unsigned int dropped = 0;
+
+  for (Json::Value::ArrayIndex i = 0; i < body.size(); i++)
+  {
+    if (body[i].type() != Json::stringValue)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat,
+                                      "The body must be a JSON array listing the Orthanc identifiers of studies");
+    }
+    else if (OrthancPlugins::CacheWarmer::GetInstance().Enqueue(body[i].asString()))
+    {
+      queued++;
+    }
+    else
+    {
+      dropped++;
+    }
+  }
+
+  Json::Value answer;
+  answer["Queued"] = queued;
+  answer["Dropped"] = dropped;
+
+  std::string s = answer.toStyledString();
+  OrthancPluginAnswerBuffer(OrthancPlugins::GetGlobalContext(), output, s.c_str(), s.size(), "application/json");
+}
+
+
+void RetrieveSeriesMetadataInternalWithCache(OrthancPlugins::DicomWebFormatter::HttpWriter& writer,
+                                             MainDicomTagsCache& cache,
+                                             const OrthancPlugins::MetadataMode& mode,
+                                             bool isXml,
+                                             const std::string& seriesOrthancId,
+                                             const std::string& studyInstanceUid,
+                                             const std::string& seriesInstanceUid,
+                                             const std::string& wadoBase)
+{
+  if (OrthancPlugins::Configuration::IsMetadataCacheEnabled() &&
+      mode == OrthancPlugins::MetadataMode_Full && 
+      !isXml)
+  {
+    std::string serializedSeriesMetadata;
+    GetSeriesMetadataFromCache(serializedSeriesMetadata, seriesOrthancId, studyInstanceUid, seriesInstanceUid, wadoBase);
+
+    if (!serializedSeriesMetadata.empty())
+    {
+      writer.AddDicomWebSeriesSerializedJson(serializedSeriesMetadata.c_str(), serializedSeriesMetadata.size());
+    }
+  }
+  else
+  {
+    std::set<std::string> instancesIdsNotUsed;
+    RetrieveSeriesMetadataInternal(instancesIdsNotUsed, writer, cache, mode, isXml, seriesOrthancId, studyInstanceUid, seriesInstanceUid, wadoBase);
+  }
+
+}
+
+
+// Reads the cached metadata of one series of a study in a metadata
+// worker, while the previous series are being written.  The revision
+// of the series is either given by a study-level "/tools/find", or read
+// by the worker.
+class SeriesMetadataFromCache : public OrthancPlugins::WorkersPool::ITask
+{
+private:
+  std::string            seriesOrthancId_;
+  std::string            studyInstanceUid_;
+  std::string            wadoBase_;
+  bool                   hasRevision_;
+  std::string            seriesInstanceUid_;
+  std::string            lastUpdate_;
+  std::set<std::string>  instancesIds_;
+  std::string            serializedSeriesMetadata_;
+  Orthanc::ErrorCode     error_;
+  std::string            errorDetails_;
+
+  // Reads the DICOM UID, the "LastUpdate" and the instances of the
+  // series from "GET /series/{id}", or from one item of "/tools/find"
+  bool ReadRevision(const Json::Value& series)
+  {
+    if (series.type() != Json::objectValue ||
+        !series.isMember(MAIN_DICOM_TAGS) ||
+        series[MAIN_DICOM_TAGS].type() != Json::objectValue ||
+        !series[MAIN_DICOM_TAGS].isMember("SeriesInstanceUID") ||
+        !series.isMember("Instances") ||
+        series["Instances"].type() != Json::arrayValue)
+    {
+      return false;
+    }
+
+    if (series.isMember("Metadata") &&
+        series["Metadata"].type() == Json::objectValue &&
+        series["Metadata"].isMember("LastUpdate") &&
+        series["Metadata"]["LastUpdate"].type() == Json::stringValue)
+    {
+      lastUpdate_ = series["Metadata"]["LastUpdate"].asString();
+    }
+    else if (series.isMember("LastUpdate") &&
+             series["LastUpdate"].type() == Json::stringValue)
+    {
+      lastUpdate_ = series["LastUpdate"].asString();
+    }
+    else
+    {
+      return false;
+    }
+
+    seriesInstanceUid_ = series[MAIN_DICOM_TAGS]["SeriesInstanceUID"].asString();
+
+    instancesIds_.clear();
+    Orthanc::SerializationToolbox::ReadSetOfStrings(instancesIds_, series, "Instances");
+
+    hasRevision_ = true;
+    return true;
+  }
+
+public:
+  SeriesMetadataFromCache(const std::string& seriesOrthancId,
+                          const std::string& studyInstanceUid,
+                          const std::string& wadoBase) :
+    seriesOrthancId_(seriesOrthancId),
+    studyInstanceUid_(studyInstanceUid),
+    wadoBase_(wadoBase),
+    hasRevision_(false),
+    error_(Orthanc::ErrorCode_InternalError)
+  {
+  }
+
+  // If "series" does not contain the revision of the series, the
+  // revision is read by the worker
+  void SetRevision(const Json::Value& series)
+  {
+    hasRevision_ = false;
+    ReadRevision(series);
+  }
+
+  virtual void Execute() ORTHANC_OVERRIDE
+  {
+    try
+    {
+      if (!hasRevision_)
+      {
+        Json::Value series;
+        if (!OrthancPlugins::RestApiGet(series, "/series/" + seriesOrthancId_, false) ||
+            !ReadRevision(series))
+        {
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_UnknownResource);
+        }
+      }
+
+      OrthancPlugins::SeriesMetadataRecords records;
+      SynchronizeSeriesMetadataCache(records, seriesOrthancId_, studyInstanceUid_, seriesInstanceUid_, lastUpdate_, instancesIds_);
+
+      if (records.GetSize() > 0)
+      {
+        records.FormatSeries(serializedSeriesMetadata_);
+        boost::replace_all(serializedSeriesMetadata_, WADO_BASE_PLACEHOLDER, wadoBase_);
+      }
+      else
+      {
+        serializedSeriesMetadata_.clear();
+      }
+
+      error_ = Orthanc::ErrorCode_Success;
+    }
+    catch (Orthanc::OrthancException& e)
+    {
+      error_ = e.GetErrorCode();
+      errorDetails_ = (e.HasDetails() ? e.GetDetails() : "");
+    }
+  }
+
+  void Write(OrthancPlugins::DicomWebFormatter::HttpWriter& writer)
+  {
+    if (error_ != Orthanc::ErrorCode_Success)
+    {
+      if (errorDetails_.empty())
+      {
+        throw Orthanc::OrthancException(error_);
+      }
+      else
+      {
+        throw Orthanc::OrthancException(error_, errorDetails_);
+      }
+    }
+
+    if (!serializedSeriesMetadata_.empty())
+    {
+      writer.AddDicomWebSeriesSerializedJson(serializedSeriesMetadata_.c_str(), serializedSeriesMetadata_.size());
+
+      std::string empty;
+      serializedSeriesMetadata_.swap(empty);  // release the memory
+    }
+  }
+};
+
+
+// Sets the revisions of the series of a study, which are listed in
+// alphabetical order in "series" as in "tasks"
+static void LookupStudySeriesRevisions(std::vector<boost::shared_ptr<SeriesMetadataFromCache> >& tasks,
+                                       const std::set<std::string>& series,
+                                       const std::string& studyOrthancId)
+{
+  assert(tasks.size() == series.size());
+
+  Json::Value query;
+  query["Level"] = "Series";
+  query["Query"] = Json::objectValue;
+  query["ParentStudy"] = studyOrthancId;
+  query["Expand"] = true;
+  query["ResponseContent"] = Json::arrayValue;
+  query["ResponseContent"].append(MAIN_DICOM_TAGS);
+  query["ResponseContent"].append("Metadata");
+  query["ResponseContent"].append("Children");
+
+  Json::Value answer;
+
+  {
+    OrthancPlugins::LatencyStageTimer timer(OrthancPlugins::LatencyStage_Load);
+
+    if (!OrthancPlugins::RestApiPost(answer, "/tools/find", query, false) ||
+        answer.type() != Json::arrayValue)
+    {
+      return;  // the workers read the revisions by themselves
+    }
+  }
+
+  std::map<std::string, Json::ArrayIndex> index;
+  for (Json::Value::ArrayIndex i = 0; i < answer.size(); i++)
+  {
+    if (answer[i].type() == Json::objectValue &&
+        answer[i].isMember("ID") &&
+        answer[i]["ID"].type() == Json::stringValue)
+    {
+      index[answer[i]["ID"].asString()] = i;
+    }
+  }
+
+  size_t position = 0;
+  for (std::set<std::string>::const_iterator s = series.begin(); s != series.end(); ++s, ++position)
+  {
+    std::map<std::string, Json::ArrayIndex>::const_iterator found = index.find(*s);
+
+    // a series that was received in the meantime, or a revision that
+    // cannot be read, is handled by the worker
+    if (found != index.end())
+    {
+      tasks[position]->SetRevision(answer[found->second]);
+    }
+  }
+}
+
+
+void RetrieveSeriesMetadata(OrthancPluginRestOutput* output,
+                            const char* /*url*/,
+                            const OrthancPluginHttpRequest* request)
+{
+  OrthancPlugins::LatencyRouteTimer routeTimer(OrthancPlugins::LatencyRoute_WadoRsMetadata);
 
-void RetrieveSeriesMetadata(OrthancPluginRestOutput* output,
-                            const char* /*url*/,
-                            const OrthancPluginHttpRequest* request)
-{
   bool isXml;
   AcceptMetadata(request, isXml);
 
@@ -2107,6 +3891,7 @@ void RetrieveSeriesMetadata(OrthancPluginRestOutput* output,
     RetrieveSeriesMetadataInternalWithCache(writer, cache, mode, isXml, seriesOrthancId, studyInstanceUid, seriesInstanceUid, wadoBase);
   }
 
+  OrthancPlugins::LatencyStageTimer timer(OrthancPlugins::LatencyStage_Send);
   writer.Send();
 }
 
@@ -2115,6 +3900,8 @@ void RetrieveStudyMetadata(OrthancPluginRestOutput* output,
                            const char* url,
                            const OrthancPluginHttpRequest* request)
 {
+  OrthancPlugins::LatencyRouteTimer routeTimer(OrthancPlugins::LatencyRoute_WadoRsMetadata);
+
   bool isXml;
   AcceptMetadata(request, isXml);
 
@@ -2134,15 +3921,54 @@ void RetrieveStudyMetadata(OrthancPluginRestOutput* output,
     std::string studyDicomUid;
     GetChildrenIdentifiers(series, studyDicomUid, Orthanc::ResourceType_Study, studyOrthancId);
 
-    for (std::set<std::string>::const_iterator s = series.begin(); s != series.end(); ++s)
+    if (OrthancPlugins::Configuration::IsMetadataCacheEnabled() &&
+        mode == OrthancPlugins::MetadataMode_Full &&
+        !isXml)
+    {
+      // the metadata workers read (or update) the cache of several
+      // series in parallel, and the series are written in order as
+      // soon as they are available
+      std::vector<boost::shared_ptr<SeriesMetadataFromCache> > tasks;
+      tasks.reserve(series.size());
+
+      for (std::set<std::string>::const_iterator s = series.begin(); s != series.end(); ++s)
+      {
+        tasks.push_back(boost::shared_ptr<SeriesMetadataFromCache>(new SeriesMetadataFromCache(*s, studyDicomUid, wadoBase)));
+      }
+
+      if (CanUseExtendedFind())
+      {
+        // get the revisions of all the series in a single call to
+        // "/tools/find", instead of one call per series
+        LookupStudySeriesRevisions(tasks, series, studyOrthancId);
+      }
+
+      OrthancPlugins::WorkersPool::TasksGroup group(OrthancPlugins::WorkersPool::GetInstance(), GetMetadataWorkersPerRequest());
+
+      for (size_t i = 0; i < tasks.size(); i++)
+      {
+        group.Submit(*tasks[i]);
+      }
+
+      for (size_t i = 0; i < tasks.size(); i++)
+      {
+        group.Wait(i);
+        tasks[i]->Write(writer);
+      }
+    }
+    else
     {
-      std::set<std::string> instances;
-      std::string seriesDicomUid;
-      GetChildrenIdentifiers(instances, seriesDicomUid, Orthanc::ResourceType_Series, *s);
+      for (std::set<std::string>::const_iterator s = series.begin(); s != series.end(); ++s)
+      {
+        std::set<std::string> instances;
+        std::string seriesDicomUid;
+        GetChildrenIdentifiers(instances, seriesDicomUid, Orthanc::ResourceType_Series, *s);
 
-      RetrieveSeriesMetadataInternalWithCache(writer, cache, mode, isXml, *s, studyDicomUid, seriesDicomUid, wadoBase);
+        RetrieveSeriesMetadataInternalWithCache(writer, cache, mode, isXml, *s, studyDicomUid, seriesDicomUid, wadoBase);
+      }
     }
 
+    OrthancPlugins::LatencyStageTimer timer(OrthancPlugins::LatencyStage_Send);
     writer.Send();
   }
 }
@@ -2152,6 +3978,8 @@ void RetrieveInstanceMetadata(OrthancPluginRestOutput* output,
                               const char* url,
                               const OrthancPluginHttpRequest* request)
 {
+  OrthancPlugins::LatencyRouteTimer routeTimer(OrthancPlugins::LatencyRoute_WadoRsMetadata);
+
   bool isXml;
   std::string transferSyntax;
 
@@ -2165,109 +3993,301 @@ void RetrieveInstanceMetadata(OrthancPluginRestOutput* output,
     OrthancPlugins::DicomWebFormatter::HttpWriter writer(output, isXml);
     WriteInstanceMetadata(writer, OrthancPlugins::MetadataMode_Full, cache, orthancId, studyInstanceUid,
                           seriesInstanceUid, OrthancPlugins::Configuration::GetBasePublicUrl(request));
+
+    OrthancPlugins::LatencyStageTimer timer(OrthancPlugins::LatencyStage_Send);
     writer.Send();
   }
 }
 
 
-void RetrieveBulkData(OrthancPluginRestOutput* output,
-                      const char* url,
-                      const OrthancPluginHttpRequest* request)
+// Maps the bulk data URI to the Orthanc "/instances/.../content/..."
+// built-in URI, which is parsed by DCMTK in the Orthanc core
+static void RetrieveBulkDataFromCore(OrthancPluginRestOutput* output,
+                                     const std::string& orthancId,
+                                     const std::vector<std::string>& path,
+                                     const std::string& bulk)
 {
   OrthancPluginContext* context = OrthancPlugins::GetGlobalContext();
-  std::string transferSyntax;
 
-  AcceptBulkData(request);
+  std::string orthanc = "/instances/" + orthancId + "/content";
 
-  std::string orthancId, studyInstanceUid, seriesInstanceUid, sopInstanceUid;
-  OrthancPlugins::MemoryBuffer content;
-  if (LocateInstance(output, orthancId, studyInstanceUid, seriesInstanceUid, sopInstanceUid, transferSyntax, request) &&
-      content.RestApiGet("/instances/" + orthancId + "/file", false))
+  Orthanc::DicomTag tmp(0, 0);
+  
+  if (path.size() == 1 &&
+      Orthanc::DicomTag::ParseHexadecimal(tmp, path[0].c_str()) &&
+      tmp == Orthanc::DICOM_TAG_PIXEL_DATA)
   {
-    std::string bulk(request->groups[3]);
-
-    std::vector<std::string> path;
-    Orthanc::Toolbox::TokenizeString(path, bulk, '/');
+    // Accessing pixel data: Return the raw content of the fragments in a multipart stream.
+    // TODO - Is this how DICOMweb should work?
+    orthanc += "/" + Orthanc::DICOM_TAG_PIXEL_DATA.Format();
 
-    // Map the bulk data URI to the Orthanc "/instances/.../content/..." built-in URI
-    std::string orthanc = "/instances/" + orthancId + "/content";
-
-    Orthanc::DicomTag tmp(0, 0);
-    
-    if (path.size() == 1 &&
-        Orthanc::DicomTag::ParseHexadecimal(tmp, path[0].c_str()) &&
-        tmp == Orthanc::DICOM_TAG_PIXEL_DATA)
+    Json::Value frames;
+    if (OrthancPlugins::RestApiGet(frames, orthanc, false))
     {
-      // Accessing pixel data: Return the raw content of the fragments in a multipart stream.
-      // TODO - Is this how DICOMweb should work?
-      orthanc += "/" + Orthanc::DICOM_TAG_PIXEL_DATA.Format();
+      if (frames.type() != Json::arrayValue ||
+          OrthancPluginStartMultipartAnswer(context, output, "related", "application/octet-stream") != 0)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_Plugin);
+      }
 
-      Json::Value frames;
-      if (OrthancPlugins::RestApiGet(frames, orthanc, false))
+      for (Json::Value::ArrayIndex i = 0; i < frames.size(); i++)
       {
-        if (frames.type() != Json::arrayValue ||
-            OrthancPluginStartMultipartAnswer(context, output, "related", "application/octet-stream") != 0)
+        std::string frame;
+        
+        if (frames[i].type() != Json::stringValue ||
+            !OrthancPlugins::RestApiGetString(frame, orthanc + "/" + frames[i].asString(), false) ||
+            OrthancPluginSendMultipartItem(context, output, frame.c_str(), frame.size()) != 0)
         {
           throw Orthanc::OrthancException(Orthanc::ErrorCode_Plugin);
         }
-
-        for (Json::Value::ArrayIndex i = 0; i < frames.size(); i++)
-        {
-          std::string frame;
-          
-          if (frames[i].type() != Json::stringValue ||
-              !OrthancPlugins::RestApiGetString(frame, orthanc + "/" + frames[i].asString(), false) ||
-              OrthancPluginSendMultipartItem(context, output, frame.c_str(), frame.size()) != 0)
-          {
-            throw Orthanc::OrthancException(Orthanc::ErrorCode_Plugin);
-          }
-        }
       }
-      else
-      {
-        throw Orthanc::OrthancException(Orthanc::ErrorCode_InexistentItem);
-      }      
     }
     else
     {
-      if (path.size() % 2 != 1)
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_InexistentItem);
+    }      
+  }
+  else
+  {
+    assert(path.size() % 2 == 1);
+
+    for (size_t i = 0; i < path.size() / 2; i++)
+    {
+      int index;
+
+      try
+      {
+        index = boost::lexical_cast<int>(path[2 * i + 1]);
+      }
+      catch (boost::bad_lexical_cast&)
       {
         throw Orthanc::OrthancException(Orthanc::ErrorCode_BadRequest,
-                                        "Bulk data URI in WADO-RS should have an odd number of items: " + bulk);
+                                        "Bad sequence index in bulk data URI: " + bulk);
       }
 
-      for (size_t i = 0; i < path.size() / 2; i++)
+      orthanc += "/" + path[2 * i] + "/" + boost::lexical_cast<std::string>(index - 1);
+    }
+
+    orthanc += "/" + path.back();
+
+    std::string result; 
+    if (OrthancPlugins::RestApiGetString(result, orthanc, false))
+    {
+      if (OrthancPluginStartMultipartAnswer(context, output, "related", "application/octet-stream") != 0 ||
+          OrthancPluginSendMultipartItem(context, output, result.c_str(), result.size()) != 0)
       {
-        int index;
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_Plugin);
+      }
+    }
+    else
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_InexistentItem);
+    }
+  }
+}
 
-        try
-        {
-          index = boost::lexical_cast<int>(path[2 * i + 1]);
-        }
-        catch (boost::bad_lexical_cast&)
-        {
-          throw Orthanc::OrthancException(Orthanc::ErrorCode_BadRequest,
-                                          "Bad sequence index in bulk data URI: " + bulk);
-        }
 
-        orthanc += "/" + path[2 * i] + "/" + boost::lexical_cast<std::string>(index - 1);
+// Parses a bulk data URI ("{tag}/{index}/.../{tag}", with 1-based
+// indexes and hexadecimal tags). Returns "false" if the tags are not
+// formatted as in the URIs generated by "DicomWebFormatter".
+static bool ParseBulkDataPath(OrthancPlugins::DicomHeaderScanner::Parents& parents,
+                              Orthanc::DicomTag& tag,
+                              const std::vector<std::string>& path)
+{
+  assert(path.size() % 2 == 1);
+
+  parents.clear();
+
+  for (size_t i = 0; i + 1 < path.size(); i += 2)
+  {
+    Orthanc::DicomTag sequence(0, 0);
+    size_t index;
+
+    try
+    {
+      index = boost::lexical_cast<size_t>(path[i + 1]);
+    }
+    catch (boost::bad_lexical_cast&)
+    {
+      return false;
+    }
+
+    if (index == 0 ||
+        !Orthanc::DicomTag::ParseHexadecimal(sequence, path[i].c_str()))
+    {
+      return false;
+    }
+
+    parents.push_back(std::make_pair(sequence, index - 1));
+  }
+
+  return Orthanc::DicomTag::ParseHexadecimal(tag, path.back().c_str());
+}
+
+
+static void AnswerBulkDataFromFile(OrthancPluginRestOutput* output,
+                                   const OrthancPluginHttpRequest* request,
+                                   const std::string& file,
+                                   const OrthancPlugins::DicomHeaderScanner::ElementLocation& location,
+                                   bool isSinglePart)
+{
+  OrthancPluginContext* context = OrthancPlugins::GetGlobalContext();
+
+  OrthancPlugins::LatencyStageTimer timer(OrthancPlugins::LatencyStage_Send);
+
+  if (location.isEncapsulated_)
+  {
+    // One part per fragment, as with "/instances/.../content/7fe0-0010/..."
+    if (OrthancPluginStartMultipartAnswer(context, output, "related", "application/octet-stream") != 0)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_Plugin);
+    }
+
+    for (size_t i = 0; i < location.fragments_.size(); i++)
+    {
+      if (OrthancPluginSendMultipartItem(context, output, file.c_str() + location.fragments_[i].first,
+                                         location.fragments_[i].second) != 0)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_Plugin);
+      }
+    }
+
+    return;
+  }
+
+  assert(location.offset_ + location.length_ <= file.size());
+  const char* value = file.c_str() + location.offset_;
+
+  if (static_cast<uint64_t>(location.length_) > static_cast<uint64_t>(std::numeric_limits<uint32_t>::max()))
+  {
+    // The answers of the Orthanc SDK are limited to 4GB
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_NotEnoughMemory,
+                                    "Bulk data larger than 4GB cannot be retrieved by DICOMweb");
+  }
+
+  std::string range;
+  if (OrthancPlugins::Configuration::IsBulkDataRangeAvailable() &&
+      OrthancPlugins::LookupHttpHeader(range, request, "range"))
+  {
+    // A range is always answered as a single part, as a slice of a
+    // multipart body would be meaningless
+    uint64_t first, last;
+
+    switch (OrthancPlugins::HttpByteRange::Parse(first, last, range, location.length_))
+    {
+      case OrthancPlugins::HttpByteRange::Result_Satisfiable:
+      {
+        const std::string contentRange = OrthancPlugins::HttpByteRange::FormatContentRange(first, last, location.length_);
+        OrthancPluginSetHttpHeader(context, output, "Content-Type", "application/octet-stream");
+        OrthancPluginSetHttpHeader(context, output, "Content-Range", contentRange.c_str());
+        OrthancPluginSendHttpStatus(context, output, 206 /* Partial Content */, value + first,
+                                    static_cast<uint32_t>(last - first + 1));
+        return;
+      }
+
+      case OrthancPlugins::HttpByteRange::Result_Unsatisfiable:
+      {
+        const std::string contentRange = OrthancPlugins::HttpByteRange::FormatUnsatisfiedRange(location.length_);
+        OrthancPluginSetHttpHeader(context, output, "Content-Range", contentRange.c_str());
+        OrthancPluginSendHttpStatus(context, output, 416 /* Range Not Satisfiable */, NULL, 0);
+        return;
       }
 
-      orthanc += "/" + path.back();
+      case OrthancPlugins::HttpByteRange::Result_Ignored:
+        break;
+
+      default:
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+    }
+  }
+
+  if (isSinglePart)
+  {
+    if (OrthancPlugins::Configuration::IsBulkDataRangeAvailable())
+    {
+      OrthancPluginSetHttpHeader(context, output, "Accept-Ranges", "bytes");
+    }
+
+    OrthancPluginAnswerBuffer(context, output, value, static_cast<uint32_t>(location.length_), "application/octet-stream");
+  }
+  else if (OrthancPluginStartMultipartAnswer(context, output, "related", "application/octet-stream") != 0 ||
+           OrthancPluginSendMultipartItem(context, output, value, static_cast<uint32_t>(location.length_)) != 0)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_Plugin);
+  }
+}
+
+
+void RetrieveBulkData(OrthancPluginRestOutput* output,
+                      const char* url,
+                      const OrthancPluginHttpRequest* request)
+{
+  std::string transferSyntax;
+
+  bool isSinglePart;
+  AcceptBulkData(isSinglePart, request);
+
+  std::string orthancId, studyInstanceUid, seriesInstanceUid, sopInstanceUid;
+  if (LocateInstance(output, orthancId, studyInstanceUid, seriesInstanceUid, sopInstanceUid, transferSyntax, request))
+  {
+    std::string bulk(request->groups[3]);
+
+    std::vector<std::string> path;
+    Orthanc::Toolbox::TokenizeString(path, bulk, '/');
+
+    if (path.size() % 2 != 1)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadRequest,
+                                      "Bulk data URI in WADO-RS should have an odd number of items: " + bulk);
+    }
+
+    OrthancPlugins::DicomHeaderScanner::Parents parents;
+    Orthanc::DicomTag tag(0, 0);
 
-      std::string result; 
-      if (OrthancPlugins::RestApiGetString(result, orthanc, false))
+    if (ParseBulkDataPath(parents, tag, path))
+    {
+      OrthancPlugins::BulkDataCache& cache = OrthancPlugins::BulkDataCache::GetInstance();
+
+      // The location is indexed even if the file is too large for the
+      // cache, which avoids scanning the file again, e.g. for each
+      // "Range" request of a viewer
+      OrthancPlugins::DicomHeaderScanner::ElementLocation location;
+      const bool isIndexed = cache.LookupLocation(location, orthancId, bulk);
+
+      OrthancPlugins::BulkDataCache::FilePtr file = cache.LookupFile(orthancId);
+
+      if (file.get() == NULL)
       {
-        if (OrthancPluginStartMultipartAnswer(context, output, "related", "application/octet-stream") != 0 ||
-            OrthancPluginSendMultipartItem(context, output, result.c_str(), result.size()) != 0)
+        // The stored file is read without being parsed by the Orthanc core
+        boost::shared_ptr<std::string> loaded(new std::string);
+
         {
-          throw Orthanc::OrthancException(Orthanc::ErrorCode_Plugin);
+          OrthancPlugins::LatencyStageTimer timer(OrthancPlugins::LatencyStage_Load);
+          if (!OrthancPlugins::RestApiGetString(*loaded, "/instances/" + orthancId + "/file", false))
+          {
+            throw Orthanc::OrthancException(Orthanc::ErrorCode_UnknownResource);
+          }
         }
+
+        file = loaded;
+        cache.StoreFile(orthancId, file);
       }
-      else
+
+      if (isIndexed &&
+          location.offset_ + location.length_ <= file->size())
+      {
+        AnswerBulkDataFromFile(output, request, *file, location, isSinglePart);
+        return;
+      }
+      else if (OrthancPlugins::DicomHeaderScanner::LocateElement(location, parents, tag, file->c_str(), file->size()))
       {
-        throw Orthanc::OrthancException(Orthanc::ErrorCode_InexistentItem);
+        cache.StoreLocation(orthancId, bulk, location);
+        AnswerBulkDataFromFile(output, request, *file, location, isSinglePart);
+        return;
       }
     }
+
+    // Unsupported transfer syntax (e.g. big endian), or inexistent element
+    RetrieveBulkDataFromCore(output, orthancId, path, bulk);
   }
 }
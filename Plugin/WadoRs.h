@@ -76,8 +76,31 @@ void UpdateSeriesMetadataCache(OrthancPluginRestOutput* output,
                                const char* url,
                                const OrthancPluginHttpRequest* request);
 
+void UpdatePatientMetadataCache(OrthancPluginRestOutput* output,
+                                const char* url,
+                                const OrthancPluginHttpRequest* request);
+
+void UpdateArchiveMetadataCache(OrthancPluginRestOutput* output,
+                                const char* url,
+                                const OrthancPluginHttpRequest* request);
+
+// Unserializes the jobs updating the series metadata cache after a
+// restart of Orthanc (returns NULL for the other types of jobs)
+OrthancPluginJob* UnserializeUpdateMetadataCacheJob(const char* jobType,
+                                                    const char* serialized);
+
 void CacheSeriesMetadata(const std::string& seriesOrthancId);
 
+// Warms up the caches of a study (series metadata, thumbnails)
+void WarmStudyCaches(const std::string& studyOrthancId);
+
+// Queues the studies of the last days in the cache warmer
+void EnqueueRecentStudiesWarmUp(unsigned int days);
+
+void WarmUpStudies(OrthancPluginRestOutput* output,
+                   const char* url,
+                   const OrthancPluginHttpRequest* request);
+
 void RetrieveInstanceMetadata(OrthancPluginRestOutput* output,
                               const char* url,
                               const OrthancPluginHttpRequest* request);
@@ -114,10 +137,26 @@ void RetrieveStudyRendered(OrthancPluginRestOutput* output,
                            const OrthancPluginHttpRequest* request,
                            bool isThumbnail);
 
+// Renders a frame for WADO-URI, using the same cache as the WADO-RS
+// RetrieveRendered transaction. Returns "false" if the plugin cannot
+// render the instance (PDF).
+bool RenderFrameWadoUri(std::string& content,
+                        std::string& etag,
+                        const std::string& instanceId,
+                        Orthanc::MimeType mime,
+                        const OrthancPluginHttpRequest* request);
+
+// Renders the default thumbnail of the series, to be served from the cache
+void PregenerateSeriesThumbnail(const std::string& seriesOrthancId);
+
 void SetPluginCanDownloadTranscodedFile(bool enable);
 
 void SetPluginCanUseExtendedFind(bool enable);
 
+bool CanUseExtendedFind();
+
 void SetSystemIsReadOnly(bool isReadOnly);
 
+bool IsSystemReadOnly();
+
 void RefreshWadoRsMetrics();
\ No newline at end of file
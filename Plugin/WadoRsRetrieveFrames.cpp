@@ -22,303 +22,23 @@
 
 
 #include "WadoRs.h"
+#include "FramesRequestParser.h"
+#include "LatencyMetrics.h"
+#include "TranscodedInstancesCache.h"
 
 #include "../Resources/Orthanc/Plugins/OrthancPluginCppWrapper.h"
 
+#include <Compatibility.h>
 #include <Toolbox.h>
 #include <Logging.h>
 
 #include <memory>
 #include <list>
-#include <boost/algorithm/string/replace.hpp>
 #include <boost/lexical_cast.hpp>
 
 static bool pluginCanDownloadTranscodedFile = false;
 
 
-static void TokenizeAndNormalize(std::vector<std::string>& tokens,
-                                 const std::string& source,
-                                 char separator)
-{
-  Orthanc::Toolbox::TokenizeString(tokens, source, separator);
-
-  for (size_t i = 0; i < tokens.size(); i++)
-  {
-    tokens[i] = Orthanc::Toolbox::StripSpaces(tokens[i]);
-    Orthanc::Toolbox::ToLowerCase(tokens[i]);
-  }
-}
-
-
-static void RemoveSurroundingQuotes(std::string& value)
-{
-  if (!value.empty() &&
-      value[0] == '\"' &&
-      value[value.size() - 1] == '\"')
-  {
-    value = value.substr(1, value.size() - 2);
-  }  
-}
-
-
-
-static void ParseTransferSyntax(Orthanc::DicomTransferSyntax& syntax,
-                                const OrthancPluginHttpRequest* request)
-{
-  for (uint32_t i = 0; i < request->headersCount; i++)
-  {
-    std::string key(request->headersKeys[i]);
-    Orthanc::Toolbox::ToLowerCase(key);
-
-    if (key == "accept")
-    {
-      std::vector<std::string> tokens;
-      TokenizeAndNormalize(tokens, request->headersValues[i], ';');
-
-      if (tokens.size() == 0 ||
-          tokens[0] == "*/*")
-      {
-        syntax = Orthanc::DicomTransferSyntax_LittleEndianExplicit;
-        return;
-      }
-
-      if (tokens[0] != "multipart/related")
-      {
-        throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange, "expecting 'Accept: multipart/related' HTTP header");
-      }
-
-      std::string type("application/octet-stream");
-      std::string transferSyntax;
-      
-      for (size_t j = 1; j < tokens.size(); j++)
-      {
-        std::vector<std::string> parsed;
-        TokenizeAndNormalize(parsed, tokens[j], '=');
-
-        if (parsed.size() != 2)
-        {
-          throw Orthanc::OrthancException(Orthanc::ErrorCode_BadRequest);
-        }
-
-        if (parsed[0] == "type")
-        {
-          type = parsed[1];
-          RemoveSurroundingQuotes(type);
-        }
-
-        if (parsed[0] == "transfer-syntax")
-        {
-          transferSyntax = parsed[1];
-          RemoveSurroundingQuotes(transferSyntax);
-        }
-      }
-
-      if (type == "application/octet-stream")
-      {
-        if (transferSyntax.empty())
-        {
-          syntax = Orthanc::DicomTransferSyntax_LittleEndianExplicit;
-          return;
-        }
-        else if (transferSyntax == "*")
-        {
-          // don't change transferSyntax, it must have been set to the 'current' value before calling this method
-          return;
-        }
-        else
-        {
-          if (!Orthanc::LookupTransferSyntax(syntax, transferSyntax))
-          {
-            throw Orthanc::OrthancException(Orthanc::ErrorCode_NotImplemented,
-                                            "Unknown transfer syntax in 'Accept' header: " + transferSyntax);
-          }
-          return;         
-        }
-      }
-      else
-      {
-        /**
-         * DICOM 2017c
-         * http://dicom.nema.org/medical/dicom/current/output/html/part18.html#table_6.1.1.8-3b
-         **/
-        if (type == "image/jpeg" && (transferSyntax.empty() ||  // Default
-                                     transferSyntax == "1.2.840.10008.1.2.4.70"))
-        {
-          syntax = Orthanc::DicomTransferSyntax_JPEGProcess14SV1;
-          return;
-        }
-        else if (type == "image/jpeg" && transferSyntax == "1.2.840.10008.1.2.4.50")
-        {
-          syntax = Orthanc::DicomTransferSyntax_JPEGProcess1;
-          return;
-        }
-        else if (type == "image/jpeg" && transferSyntax == "1.2.840.10008.1.2.4.51")
-        {
-          syntax = Orthanc::DicomTransferSyntax_JPEGProcess2_4;
-          return;
-        }
-        else if (type == "image/jpeg" && transferSyntax == "1.2.840.10008.1.2.4.57")
-        {
-          syntax = Orthanc::DicomTransferSyntax_JPEGProcess14;
-          return;
-        }
-        else if ((type == "image/x-dicom-rle" ||   // Table 6.1.1.8-3b of DICOM 2017c (backward compatibility)
-                  type == "image/dicom-rle") &&    // Table 8.7.3-5 of DICOM 2021a
-                 (transferSyntax.empty() ||        // Default
-                  transferSyntax == "1.2.840.10008.1.2.5"))
-        {
-          syntax = Orthanc::DicomTransferSyntax_RLELossless;
-          return;
-        }
-        else if ((type == "image/x-jls" ||   // Table 6.1.1.8-3b of DICOM 2017c (backward compatibility)
-                  type == "image/jls") &&    // Table 8.7.3-5 of DICOM 2021a
-                 (transferSyntax.empty() ||  // Default
-                  transferSyntax == "1.2.840.10008.1.2.4.80"))
-        {
-          syntax = Orthanc::DicomTransferSyntax_JPEGLSLossless;
-          return;
-        }
-        else if ((type == "image/x-jls" ||   // Table 6.1.1.8-3b of DICOM 2017c (backward compatibility)
-                  type == "image/jls") &&    // Table 8.7.3-5 of DICOM 2021a
-                 transferSyntax == "1.2.840.10008.1.2.4.81")
-        {
-          syntax = Orthanc::DicomTransferSyntax_JPEGLSLossy;
-          return;
-        }
-        else if (type == "image/jp2" && (transferSyntax.empty() ||  // Default
-                                         transferSyntax == "1.2.840.10008.1.2.4.90"))
-        {
-          syntax = Orthanc::DicomTransferSyntax_JPEG2000LosslessOnly;
-          return;
-        }
-        else if (type == "image/jp2" && transferSyntax == "1.2.840.10008.1.2.4.91")
-        {
-          syntax = Orthanc::DicomTransferSyntax_JPEG2000;
-          return;
-        }
-        else if (type == "image/jpx" && (transferSyntax.empty() ||  // Default
-                                         transferSyntax == "1.2.840.10008.1.2.4.92"))
-        {
-          syntax = Orthanc::DicomTransferSyntax_JPEG2000MulticomponentLosslessOnly;
-          return;
-        }
-        else if (type == "image/jpx" && transferSyntax == "1.2.840.10008.1.2.4.93")
-        {
-          syntax = Orthanc::DicomTransferSyntax_JPEG2000Multicomponent;
-          return;
-        }
-
-
-        /**
-         * Backward compatibility with DICOM 2014a
-         * http://dicom.nema.org/medical/dicom/2014a/output/html/part18.html#table_6.5-1
-         **/
-        if (type == "image/dicom+jpeg" && transferSyntax == "1.2.840.10008.1.2.4.50")
-        {
-          syntax = Orthanc::DicomTransferSyntax_JPEGProcess1;
-          return;
-        }
-        else if (type == "image/dicom+jpeg" && transferSyntax == "1.2.840.10008.1.2.4.51")
-        {
-          syntax = Orthanc::DicomTransferSyntax_JPEGProcess2_4;
-          return;
-        }
-        else if (type == "image/dicom+jpeg" && transferSyntax == "1.2.840.10008.1.2.4.57")
-        {
-          syntax = Orthanc::DicomTransferSyntax_JPEGProcess14;
-          return;
-        }
-        else if (type == "image/dicom+jpeg" && (transferSyntax.empty() ||
-                                                transferSyntax == "1.2.840.10008.1.2.4.70"))
-        {
-          syntax = Orthanc::DicomTransferSyntax_JPEGProcess14SV1;
-          return;
-        }
-        else if (type == "image/dicom+rle" && (transferSyntax.empty() ||
-                                               transferSyntax == "1.2.840.10008.1.2.5"))
-        {
-          syntax = Orthanc::DicomTransferSyntax_RLELossless;
-          return;
-        }
-        else if (type == "image/dicom+jpeg-ls" && (transferSyntax.empty() ||
-                                                   transferSyntax == "1.2.840.10008.1.2.4.80"))
-        {
-          syntax = Orthanc::DicomTransferSyntax_JPEGLSLossless;
-          return;
-        }
-        else if (type == "image/dicom+jpeg-ls" && transferSyntax == "1.2.840.10008.1.2.4.81")
-        {
-          syntax = Orthanc::DicomTransferSyntax_JPEGLSLossy;
-          return;
-        }
-        else if (type == "image/dicom+jp2" && (transferSyntax.empty() ||
-                                               transferSyntax == "1.2.840.10008.1.2.4.90"))
-        {
-          syntax = Orthanc::DicomTransferSyntax_JPEG2000LosslessOnly;
-          return;
-        }
-        else if (type == "image/dicom+jp2" && transferSyntax == "1.2.840.10008.1.2.4.91")
-        {
-          syntax = Orthanc::DicomTransferSyntax_JPEG2000;
-          return;
-        }
-        else if (type == "image/dicom+jpx" && (transferSyntax.empty() ||
-                                               transferSyntax == "1.2.840.10008.1.2.4.92"))
-        {
-          syntax = Orthanc::DicomTransferSyntax_JPEG2000MulticomponentLosslessOnly;
-          return;
-        }
-        else if (type == "image/dicom+jpx" && transferSyntax == "1.2.840.10008.1.2.4.93")
-        {
-          syntax = Orthanc::DicomTransferSyntax_JPEG2000Multicomponent;
-          return;
-        }
-
-        throw Orthanc::OrthancException(
-          Orthanc::ErrorCode_BadRequest,
-          "DICOMweb RetrieveFrames: Transfer syntax \"" + 
-          transferSyntax + "\" is incompatible with media type \"" + type + "\"");
-      }
-    }
-  }
-
-  // By default, DICOMweb expects Little Endian uncompressed pixel data
-  syntax = Orthanc::DicomTransferSyntax_LittleEndianExplicit;
-}
-
-
-static void ParseFrameList(std::list<unsigned int>& frames,
-                           const OrthancPluginHttpRequest* request)
-{
-  frames.clear();
-
-  if (request->groupsCount <= 3 ||
-      request->groups[3] == NULL)
-  {
-    return;
-  }
-
-  std::string source(request->groups[3]);
-  Orthanc::Toolbox::ToLowerCase(source);
-  boost::replace_all(source, "%2c", ",");
-
-  std::vector<std::string> tokens;
-  Orthanc::Toolbox::TokenizeString(tokens, source, ',');
-
-  for (size_t i = 0; i < tokens.size(); i++)
-  {
-    int frame = boost::lexical_cast<int>(tokens[i]);
-    if (frame <= 0)
-    {
-      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
-                                      "Invalid frame number (must be > 0): " + tokens[i]);
-    }
-
-    frames.push_back(static_cast<unsigned int>(frame - 1));
-  }
-}                           
-
-
 static const char* GetMimeType(const Orthanc::DicomTransferSyntax& syntax)
 {
   // http://dicom.nema.org/medical/dicom/current/output/html/part18.html#table_6.1.1.8-3b
@@ -416,7 +136,7 @@ static const char* GetMimeType(const Orthanc::DicomTransferSyntax& syntax)
 
 static void AnswerFrames(OrthancPluginRestOutput* output,
                          const OrthancPluginHttpRequest* request,
-                         const OrthancPlugins::DicomInstance& instance,
+                         OrthancPlugins::TranscodedInstancesCache::CachedInstance& instance,
                          const std::string& studyInstanceUid,
                          const std::string& seriesInstanceUid,
                          const std::string& sopInstanceUid,
@@ -435,12 +155,23 @@ static void AnswerFrames(OrthancPluginRestOutput* output,
          frame = frames.begin(); frame != frames.end(); ++frame)
   {
     std::string content;
-    instance.GetRawFrame(content, *frame);
+    const void* data;
+    size_t size;
 
-    const char* data = content.empty() ? NULL : content.c_str();
-    size_t size = content.size();
+    if (instance.IsUncompressed())
+    {
+      // zero-copy: the frame is sent directly from the buffer of the DICOM file
+      instance.GetUncompressedFrame(data, size, *frame);
+    }
+    else
+    {
+      instance.GetRawFrame(content, *frame);
+      data = content.empty() ? NULL : content.c_str();
+      size = content.size();
+    }
         
     OrthancPluginErrorCode error;
+    OrthancPlugins::LatencyStageTimer timer(OrthancPlugins::LatencyRoute_WadoRsFrames, OrthancPlugins::LatencyStage_Send);
 
 #if HAS_SEND_MULTIPART_ITEM_2 == 1
     const std::string base = OrthancPlugins::Configuration::GetBasePublicUrl(request);
@@ -480,6 +211,7 @@ static void AnswerFrame(OrthancPluginRestOutput* output,
   }
 
   OrthancPluginErrorCode error;
+  OrthancPlugins::LatencyStageTimer timer(OrthancPlugins::LatencyRoute_WadoRsFrames, OrthancPlugins::LatencyStage_Send);
 
 #if HAS_SEND_MULTIPART_ITEM_2 == 1
   const std::string base = OrthancPlugins::Configuration::GetBasePublicUrl(request);
@@ -499,19 +231,105 @@ static void AnswerFrame(OrthancPluginRestOutput* output,
   }
 }
 
+class FramesSourceFactory : public OrthancPlugins::TranscodedInstancesCache::IInstanceFactory
+{
+private:
+  std::string                   orthancId_;
+  Orthanc::DicomTransferSyntax  targetSyntax_;
+  bool                          transcode_;
+
+  static OrthancPlugins::TranscodedInstancesCache::CachedInstance* CreateFromFile(OrthancPlugins::MemoryBuffer& content)
+  {
+    // if the pixel data is not compressed, the frames are directly
+    // read from the file, which avoids parsing it in the core
+    OrthancPlugins::UncompressedFramesIndex frames;
+
+    if (frames.Parse(content.GetData(), content.GetSize()))
+    {
+      return new OrthancPlugins::TranscodedInstancesCache::CachedInstance(content, frames);
+    }
+    else
+    {
+      return new OrthancPlugins::TranscodedInstancesCache::CachedInstance(
+        new OrthancPlugins::DicomInstance(content.GetData(), content.GetSize()));
+    }
+  }
+
+public:
+  FramesSourceFactory(const std::string& orthancId,
+                      Orthanc::DicomTransferSyntax targetSyntax,
+                      bool transcode) :
+    orthancId_(orthancId),
+    targetSyntax_(targetSyntax),
+    transcode_(transcode)
+  {
+  }
+
+  virtual OrthancPlugins::TranscodedInstancesCache::CachedInstance* Create() ORTHANC_OVERRIDE
+  {
+    typedef OrthancPlugins::TranscodedInstancesCache::CachedInstance  CachedInstance;
+
+    OrthancPlugins::MemoryBuffer content;
+
+    // maximize the use the Orthanc storage cache.  Since 1.12.2, transcoded file may be stored in the storage cache
+    if (pluginCanDownloadTranscodedFile && transcode_)
+    {
+      // The core loads and transcodes the file
+      OrthancPlugins::LatencyStageTimer timer(OrthancPlugins::LatencyRoute_WadoRsFrames, OrthancPlugins::LatencyStage_Transcode);
+
+      if (!content.RestApiGet("/instances/" + orthancId_ + "/file?transcode=" + Orthanc::GetTransferSyntaxUid(targetSyntax_), false))
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError, "DICOMweb: Unable to get transcoded file for instance " + orthancId_);
+      }
+
+      // TODO-OPTI: this takes a huge amount of time; e.g: 1.5s for a 600MB file while the DicomInstance usually already exists in the Orthanc core
+      //            call /instances/../frames/../transcoded (to be implemented in future Orthanc release)
+      return CreateFromFile(content);
+    }
+    else
+    {
+      {
+        OrthancPlugins::LatencyStageTimer timer(OrthancPlugins::LatencyRoute_WadoRsFrames, OrthancPlugins::LatencyStage_Load);
+
+        if (!content.RestApiGet("/instances/" + orthancId_ + "/file", false))
+        {
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError, "DICOMweb: Unable to get file for instance " + orthancId_);
+        }
+      }
+
+      if (transcode_)
+      {
+        OrthancPlugins::LatencyStageTimer timer(OrthancPlugins::LatencyRoute_WadoRsFrames, OrthancPlugins::LatencyStage_Transcode);
+
+        LOG(INFO) << "DICOMweb RetrieveFrames: Transcoding instance " + orthancId_
+                  << " to transfer syntax " << Orthanc::GetTransferSyntaxUid(targetSyntax_);
+
+        return new CachedInstance(OrthancPlugins::DicomInstance::Transcode(
+                                    content.GetData(), content.GetSize(), GetTransferSyntaxUid(targetSyntax_)));
+      }
+      else
+      {
+        return CreateFromFile(content);
+      }
+    }
+  }
+};
+
+
 static void RetrieveFrames(OrthancPluginRestOutput* output,
                            const OrthancPluginHttpRequest* request,
                            bool allFrames,
                            std::list<unsigned int>& frames)
 {
+  OrthancPlugins::LatencyRouteTimer routeTimer(OrthancPlugins::LatencyRoute_WadoRsFrames);
+
   std::string orthancId, studyInstanceUid, seriesInstanceUid, sopInstanceUid;
   std::string transferSyntax;
 
   if (LocateInstance(output, orthancId, studyInstanceUid, seriesInstanceUid, sopInstanceUid, transferSyntax, request))
   {
-    OrthancPlugins::MemoryBuffer content;
     Orthanc::DicomTransferSyntax currentSyntax;
-    std::unique_ptr<OrthancPlugins::DicomInstance> instance;
+    OrthancPlugins::TranscodedInstancesCache::InstancePtr instance;
 
     { // logging only
       if (allFrames)
@@ -548,26 +366,30 @@ static void RetrieveFrames(OrthancPluginRestOutput* output,
     }    
 
     
-    ParseTransferSyntax(targetSyntax, request);
+    OrthancPlugins::FramesRequestParser::ParseTransferSyntax(targetSyntax, request);
     const bool transcodeThisInstance = (targetSyntax != currentSyntax);
 
-    // maximize the use the Orthanc storage cache.  Since 1.12.2, transcoded file may be stored in the storage cache
-    if (pluginCanDownloadTranscodedFile && transcodeThisInstance)
+    if (!allFrames && frames.size() == 1 && !transcodeThisInstance)
     {
-      if (!content.RestApiGet("/instances/" + orthancId + "/file?transcode=" + Orthanc::GetTransferSyntaxUid(targetSyntax), false))
-      {
-        throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError, "DICOMweb: Unable to get transcoded file for instance " + orthancId);
-      }
+      // If another request has already loaded this instance, reuse it
+      instance = OrthancPlugins::TranscodedInstancesCache::GetInstance().LookupLoaded(orthancId, targetSyntax);
+    }
 
-      // TODO-OPTI: this takes a huge amount of time; e.g: 1.5s for a 600MB file while the DicomInstance usually already exists in the Orthanc core
-      //            call /instances/../frames/../transcoded (to be implemented in future Orthanc release)
-      instance.reset(new OrthancPlugins::DicomInstance(content.GetData(), content.GetSize()));
+    if (instance.get() != NULL)
+    {
+      // Already loaded by a previous/concurrent request
     }
     else if (!allFrames && frames.size() == 1 && !transcodeThisInstance) // no transcoding needed, let's retrieve the raw frame directly from the core to avoid Orthanc to recreate a DicomInstance for every frame
     {
-      if (!content.RestApiGet("/instances/" + orthancId + "/frames/" + boost::lexical_cast<std::string>(frames.front()) + "/raw", false))
+      OrthancPlugins::MemoryBuffer content;
+
       {
-        throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError, "DICOMweb: Unable to get file for instance " + orthancId);
+        OrthancPlugins::LatencyStageTimer timer(OrthancPlugins::LatencyRoute_WadoRsFrames, OrthancPlugins::LatencyStage_Load);
+
+        if (!content.RestApiGet("/instances/" + orthancId + "/frames/" + boost::lexical_cast<std::string>(frames.front()) + "/raw", false))
+        {
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError, "DICOMweb: Unable to get file for instance " + orthancId);
+        }
       }
 
       AnswerFrame(output, request, content, studyInstanceUid, seriesInstanceUid,
@@ -576,20 +398,10 @@ static void RetrieveFrames(OrthancPluginRestOutput* output,
     }
     else
     {
-      if (!content.RestApiGet("/instances/" + orthancId + "/file", false))
-      {
-        throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError, "DICOMweb: Unable to get file for instance " + orthancId);
-      }
-      instance.reset(new OrthancPlugins::DicomInstance(content.GetData(), content.GetSize()));
-
-      if (transcodeThisInstance)
-      {
-        LOG(INFO) << "DICOMweb RetrieveFrames: Transcoding instance " + orthancId
-                  << " to transfer syntax " << Orthanc::GetTransferSyntaxUid(targetSyntax);
-
-        instance.reset(OrthancPlugins::DicomInstance::Transcode(
-                       content.GetData(), content.GetSize(), GetTransferSyntaxUid(targetSyntax)));
-      }
+      // The parsed (and possibly transcoded) instance is shared between the
+      // successive/concurrent requests to the frames of the same instance
+      FramesSourceFactory factory(orthancId, targetSyntax, transcodeThisInstance);
+      instance = OrthancPlugins::TranscodedInstancesCache::GetInstance().Acquire(orthancId, targetSyntax, factory);
     }
 
     if (instance.get() == NULL)
@@ -602,7 +414,7 @@ static void RetrieveFrames(OrthancPluginRestOutput* output,
       frames.clear();
       for (unsigned int i = 0; i < instance->GetFramesCount(); i++)
       {
-        frames.push_back(i + 1);  // Frames are numbered starting from 1
+        frames.push_back(i);  // Frame indices start at 0, as in "FramesRequestParser::ParseFrameList()"
       }
     }
 
@@ -626,7 +438,7 @@ void RetrieveSelectedFrames(OrthancPluginRestOutput* output,
                             const OrthancPluginHttpRequest* request)
 {
   std::list<unsigned int> frames;
-  ParseFrameList(frames, request);
+  OrthancPlugins::FramesRequestParser::ParseFrameList(frames, request);
   RetrieveFrames(output, request, false, frames);
 }
 
@@ -22,6 +22,10 @@
 
 #include "WadoRs.h"
 
+#include "LatencyMetrics.h"
+#include "RenderedFramesCache.h"
+#include "RenderingKernels.h"
+
 #include "../Resources/Orthanc/Plugins/OrthancPluginCppWrapper.h"
 
 #include <Images/Image.h>
@@ -130,14 +134,6 @@ static bool ParseFirstFloat(float& target,
 
 namespace
 {
-  enum WindowingMode
-  {
-    WindowingMode_WholeDynamics,
-    WindowingMode_Linear,
-    WindowingMode_LinearExact,
-    WindowingMode_Sigmoid
-  };
-
   class RenderingParameters : public boost::noncopyable
   {
   private:
@@ -148,6 +144,7 @@ namespace
     bool          hasVH_;
     bool          hasSW_;
     bool          hasSH_;
+    bool          keepAspectRatio_;  // Scale the missing dimension of the target (WADO-URI)
     unsigned int  vw_;
     unsigned int  vh_;
     unsigned int  sx_;
@@ -159,7 +156,7 @@ namespace
     unsigned int  quality_;
     float         windowCenter_;
     float         windowWidth_;
-    WindowingMode windowingMode_;
+    OrthancPlugins::WindowingMode windowingMode_;
     float         rescaleSlope_;
     float         rescaleIntercept_;
 
@@ -204,6 +201,7 @@ namespace
     }
     
   public:
+    // If "request" is NULL, the default parameters are used
     explicit RenderingParameters(const OrthancPluginHttpRequest* request) :
       hasViewport_(false),
       hasQuality_(false),
@@ -212,6 +210,7 @@ namespace
       hasVH_(false),
       hasSW_(false),
       hasSH_(false),
+      keepAspectRatio_(false),
       vw_(0),
       vh_(0),
       sx_(0),
@@ -223,14 +222,14 @@ namespace
       quality_(90),   // Default quality for JPEG previews (the same as in Orthanc core)
       windowCenter_(128),
       windowWidth_(256),
-      windowingMode_(WindowingMode_WholeDynamics),
+      windowingMode_(OrthancPlugins::WindowingMode_WholeDynamics),
       rescaleSlope_(1),
       rescaleIntercept_(0)
     {
       static const std::string VIEWPORT("\"viewport\" in WADO-RS Retrieve Rendered Transaction");
       static const std::string WINDOW("\"window\" in WADO-RS Retrieve Rendered Transaction");
       
-      for (uint32_t i = 0; i < request->getCount; i++)
+      for (uint32_t i = 0; request != NULL && i < request->getCount; i++)
       {
         const std::string key = request->getKeys[i];
         const std::string value = request->getValues[i];
@@ -346,15 +345,15 @@ namespace
 
           if (tokens[2] == "linear")
           {
-            windowingMode_ = WindowingMode_Linear;
+            windowingMode_ = OrthancPlugins::WindowingMode_Linear;
           }
           else if (tokens[2] == "linear-exact")
           {
-            windowingMode_ = WindowingMode_LinearExact;
+            windowingMode_ = OrthancPlugins::WindowingMode_LinearExact;
           }
           else if (tokens[2] == "sigmoid")
           {
-            windowingMode_ = WindowingMode_Sigmoid;
+            windowingMode_ = OrthancPlugins::WindowingMode_Sigmoid;
           }
           else
           {
@@ -367,24 +366,181 @@ namespace
     }
 
 
-    unsigned int GetTargetWidth(unsigned int sourceWidth) const
+    // Reads the arguments of a WADO-URI request (DICOM PS3.18 Section
+    // 8.1.x), and returns the requested 1-based frame number. Only
+    // "rows", "columns", "windowCenter", "windowWidth", "imageQuality"
+    // and "frameNumber" are supported, the other arguments are ignored.
+    unsigned int ParseWadoUri(const OrthancPluginHttpRequest* request)
+    {
+      static const std::string ARGUMENT("argument in WADO-URI: ");
+
+      unsigned int frame = 1;
+      bool hasCenter = false;
+      bool hasWidth = false;
+      float center = 0;
+      float width = 0;
+
+      for (uint32_t i = 0; i < request->getCount; i++)
+      {
+        const std::string key = request->getKeys[i];
+        std::vector<std::string> tokens;
+        tokens.push_back(request->getValues[i]);
+
+        int tmp;
+
+        if (key == "rows" &&
+            GetIntegerValue(tmp, tokens, 0, false, false, "\"rows\" " + ARGUMENT) &&
+            tmp > 0)
+        {
+          hasViewport_ = true;
+          hasVH_ = true;
+          vh_ = static_cast<unsigned int>(tmp);
+        }
+        else if (key == "columns" &&
+                 GetIntegerValue(tmp, tokens, 0, false, false, "\"columns\" " + ARGUMENT) &&
+                 tmp > 0)
+        {
+          hasViewport_ = true;
+          hasVW_ = true;
+          vw_ = static_cast<unsigned int>(tmp);
+        }
+        else if (key == "frameNumber" &&
+                 GetIntegerValue(tmp, tokens, 0, false, false, "\"frameNumber\" " + ARGUMENT))
+        {
+          if (tmp <= 0)
+          {
+            throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                            "The frame number in WADO-URI must start at 1");
+          }
+
+          frame = static_cast<unsigned int>(tmp);
+        }
+        else if (key == "imageQuality" &&
+                 GetIntegerValue(tmp, tokens, 0, false, false, "\"imageQuality\" " + ARGUMENT))
+        {
+          if (tmp < 1 || tmp > 100)
+          {
+            throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                            "The value of \"imageQuality\" in WADO-URI must be between 1 and 100");
+          }
+
+          hasQuality_ = true;
+          quality_ = static_cast<unsigned int>(tmp);
+        }
+        else if (key == "windowCenter" ||
+                 key == "windowWidth")
+        {
+          float value;
+
+          try
+          {
+            value = boost::lexical_cast<float>(tokens[0]);
+          }
+          catch (boost::bad_lexical_cast&)
+          {
+            throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                            "Not a float for \"" + key + "\" " + ARGUMENT + tokens[0]);
+          }
+
+          if (key == "windowCenter")
+          {
+            hasCenter = true;
+            center = value;
+          }
+          else
+          {
+            hasWidth = true;
+            width = value;
+          }
+        }
+      }
+
+      // The window is only applied if both its center and its width are provided
+      if (hasCenter &&
+          hasWidth)
+      {
+        SetWindow(center, width);
+        windowingMode_ = OrthancPlugins::WindowingMode_Linear;
+      }
+
+      // If only one of "rows" and "columns" is provided, the aspect ratio is preserved
+      keepAspectRatio_ = true;
+
+      return frame;
+    }
+
+
+    // Parameters of the request that are not taken from the DICOM
+    // instance, normalized to be used as a key in the cache
+    std::string Format() const
+    {
+      std::string s = "viewport=";
+
+      if (hasViewport_)
+      {
+        s += ((hasVW_ ? boost::lexical_cast<std::string>(vw_) : "") + "," +
+              (hasVH_ ? boost::lexical_cast<std::string>(vh_) : "") + "," +
+              boost::lexical_cast<std::string>(sx_) + "," +
+              boost::lexical_cast<std::string>(sy_) + "," +
+              (hasSW_ ? boost::lexical_cast<std::string>(sw_) : "") + "," +
+              (hasSH_ ? boost::lexical_cast<std::string>(sh_) : "") + "," +
+              (flipX_ ? "1" : "0") + (flipY_ ? "1" : "0") + (keepAspectRatio_ ? "1" : "0"));
+      }
+
+      s += "&quality=" + boost::lexical_cast<std::string>(quality_);
+
+      if (hasWindowing_)
+      {
+        s += ("&window=" + boost::lexical_cast<std::string>(windowCenter_) + "," +
+              boost::lexical_cast<std::string>(windowWidth_) + "," +
+              boost::lexical_cast<std::string>(static_cast<int>(windowingMode_)));
+      }
+
+      return s;
+    }
+
+    // Whether no parameter was provided in the request
+    bool IsDefault() const
+    {
+      return (!hasViewport_ &&
+              !hasQuality_ &&
+              !hasWindowing_);
+    }
+
+    unsigned int GetTargetWidth(unsigned int sourceWidth,
+                                unsigned int sourceHeight) const
     {
       if (hasVW_)
       {
         return vw_;
       }
+      else if (keepAspectRatio_ &&
+               hasVH_ &&
+               sourceHeight != 0)
+      {
+        return std::max(1u, static_cast<unsigned int>(Orthanc::Math::iround(
+                              static_cast<float>(vh_) * static_cast<float>(sourceWidth) / static_cast<float>(sourceHeight))));
+      }
       else
       {
         return sourceWidth;
       }
     }
 
-    unsigned int GetTargetHeight(unsigned int sourceHeight) const
+    unsigned int GetTargetHeight(unsigned int sourceWidth,
+                                 unsigned int sourceHeight) const
     {
       if (hasVH_)
       {
         return vh_;
       }
+      else if (keepAspectRatio_ &&
+               hasVW_ &&
+               sourceWidth != 0)
+      {
+        return std::max(1u, static_cast<unsigned int>(Orthanc::Math::iround(
+                              static_cast<float>(vw_) * static_cast<float>(sourceHeight) / static_cast<float>(sourceWidth))));
+      }
       else
       {
         return sourceHeight;
@@ -461,7 +617,7 @@ namespace
       return windowWidth_;
     }
 
-    WindowingMode GetWindowingMode() const
+    OrthancPlugins::WindowingMode GetWindowingMode() const
     {
       return windowingMode_;
     }    
@@ -529,174 +685,6 @@ static Orthanc::PixelFormat Convert(OrthancPluginPixelFormat format)
 }
 
 
-template <Orthanc::PixelFormat SourceFormat>
-static void ApplyWindowing(Orthanc::ImageAccessor& target,
-                           const Orthanc::ImageAccessor& source,
-                           float c,
-                           float w,
-                           WindowingMode mode,
-                           float rescaleSlope,
-                           float rescaleIntercept)
-{
-  assert(target.GetFormat() == Orthanc::PixelFormat_Grayscale8 &&
-         source.GetFormat() == SourceFormat);
-
-  if (source.GetWidth() != target.GetWidth() ||
-      source.GetHeight() != target.GetHeight())
-  {
-    throw Orthanc::OrthancException(Orthanc::ErrorCode_IncompatibleImageSize);
-  }
-
-  const unsigned int width = source.GetWidth();
-  const unsigned int height = source.GetHeight();
-
-  const float ymin = 0;
-  const float ymax = 255;
-  
-
-  /**
-     
-     LINEAR:
-     http://dicom.nema.org/MEDICAL/dicom/2019a/output/chtml/part03/sect_C.11.2.html#sect_C.11.2.1.2.1
-
-     Python
-     ------
-
-     import sympy as sym
-     x, c, w, ymin, ymax = sym.symbols('x c w ymin ymax')
-
-     e = ((x - (c - 0.5)) / (w-1) + 0.5) * (ymax- ymin) + ymin
-     print(sym.simplify(sym.collect(sym.expand(e), [ x, ymin, ymax ])))
-
-     Result
-     ------
-
-     (x*(ymax - ymin) + ymax*(-c + 0.5*w) + ymin*(c + 0.5*w - 1.0))/(w - 1)
-
-   **/
-
-  const float linearXMin = (c - 0.5f - (w - 1.0f) / 2.0f);
-  const float linearXMax = (c - 0.5f + (w - 1.0f) / 2.0f);
-  const float linearYScaling = (ymax - ymin) / (w - 1.0f);
-  const float linearYOffset = (ymax * (-c + 0.5f * w) + ymin * (c + 0.5f * w - 1.0f)) / (w - 1.0f);
-
-
-  /**
-
-     LINEAR-EXACT:
-     http://dicom.nema.org/MEDICAL/dicom/2019a/output/chtml/part03/sect_C.11.2.html#sect_C.11.2.1.3.2
-
-     Python
-     ------
-
-     import sympy as sym
-     x, c, w, ymin, ymax = sym.symbols('x c w ymin ymax')
-
-     e = (x - c) / w * (ymax- ymin) + ymin
-     print(sym.simplify(sym.collect(sym.expand(e), [ x, ymin, ymax ])))
-
-     Result
-     ------
-
-     (-c*ymax + x*(ymax - ymin) + ymin*(c + w))/w
-
-   **/
-  const float exactXMin = (c - w / 2.0f);
-  const float exactXMax = (c + w / 2.0f);
-  const float exactYScaling = (ymax - ymin) / w;
-  const float exactYOffset = (-c * ymax + ymin * (c + w)) / w;
-       
-
-  float minValue = std::numeric_limits<float>::infinity();
-  float maxValue = -std::numeric_limits<float>::infinity();
-  float wholeDynamicsScale = 1;
- 
-  if (mode == WindowingMode_WholeDynamics)
-  {
-    for (unsigned int y = 0; y < height; y++)
-    {
-      for (unsigned int x = 0; x < width; x++)
-      {
-        float a = Orthanc::ImageTraits<SourceFormat>::GetFloatPixel(source, x, y);
-        minValue = std::min(minValue, a);
-        maxValue = std::max(maxValue, a);
-      }
-    }
-
-    minValue = rescaleSlope * minValue + rescaleIntercept;
-    maxValue = rescaleSlope * maxValue + rescaleIntercept;
-    wholeDynamicsScale = 255.0f / (maxValue - minValue);
-  }
-  
-  
-  for (unsigned int y = 0; y < height; y++)
-  {
-    for (unsigned int x = 0; x < width; x++)
-    {
-      float a = Orthanc::ImageTraits<SourceFormat>::GetFloatPixel(source, x, y);
-      a = rescaleSlope * a + rescaleIntercept;
-
-      float b;
-
-      switch (mode)
-      {
-        case WindowingMode_WholeDynamics:
-          b = (a - minValue) * wholeDynamicsScale;
-          break;
-
-        case WindowingMode_Linear:
-        {
-          if (a <= linearXMin)
-          {
-            b = ymin;
-          }
-          else if (a > linearXMax)
-          {
-            b = ymax;
-          }
-          else
-          {
-            b = a * linearYScaling + linearYOffset;
-          }
-
-          break;
-        }
-
-        case WindowingMode_LinearExact:
-        {
-          if (a <= exactXMin)
-          {
-            b = ymin;
-          }
-          else if (a > exactXMax)
-          {
-            b = ymax;
-          }
-          else
-          {
-            b = a * exactYScaling + exactYOffset;
-          }
-
-          break;
-        }
-
-        case WindowingMode_Sigmoid:
-        {
-          // http://dicom.nema.org/MEDICAL/dicom/2019a/output/chtml/part03/sect_C.11.2.html#sect_C.11.2.1.3.1
-          b = ymax / (1.0f + expf(-4.0f * (a - c) / w));
-          break;
-        }
-
-        default:
-          throw Orthanc::OrthancException(Orthanc::ErrorCode_NotImplemented);
-      }
-
-      Orthanc::ImageTraits<Orthanc::PixelFormat_Grayscale8>::SetFloatPixel(target, b, x, y);
-    }
-  }
-}
-
-
 static void ApplyRendering(Orthanc::ImageAccessor& target,
                            const Orthanc::ImageAccessor& source,
                            const RenderingParameters& parameters,
@@ -723,39 +711,12 @@ static void ApplyRendering(Orthanc::ImageAccessor& target,
       break;
 
     case Orthanc::PixelFormat_Grayscale8:
-    {
-      switch (source.GetFormat())
-      {
-        case Orthanc::PixelFormat_Grayscale8:
-          ApplyWindowing<Orthanc::PixelFormat_Grayscale8>(scaled, region, parameters.GetWindowCenter(),
-                                                          parameters.GetWindowWidth(),
-                                                          parameters.GetWindowingMode(),
-                                                          parameters.GetRescaleSlope(),
-                                                          parameters.GetRescaleIntercept());
-          break;
-
-        case Orthanc::PixelFormat_Grayscale16:
-          ApplyWindowing<Orthanc::PixelFormat_Grayscale16>(scaled, region, parameters.GetWindowCenter(),
-                                                           parameters.GetWindowWidth(),
-                                                           parameters.GetWindowingMode(),
-                                                           parameters.GetRescaleSlope(),
-                                                           parameters.GetRescaleIntercept());
-          break;
-
-        case Orthanc::PixelFormat_SignedGrayscale16:
-          ApplyWindowing<Orthanc::PixelFormat_SignedGrayscale16>(scaled, region, parameters.GetWindowCenter(),
-                                                                 parameters.GetWindowWidth(),
-                                                                 parameters.GetWindowingMode(),
-                                                                 parameters.GetRescaleSlope(),
-                                                                 parameters.GetRescaleIntercept());
-          break;
-
-        default:
-          throw Orthanc::OrthancException(Orthanc::ErrorCode_NotImplemented);
-      }
-          
+      OrthancPlugins::RenderingKernels::ApplyWindowing(scaled, region, parameters.GetWindowCenter(),
+                                                       parameters.GetWindowWidth(),
+                                                       parameters.GetWindowingMode(),
+                                                       parameters.GetRescaleSlope(),
+                                                       parameters.GetRescaleIntercept());
       break;
-    }
 
     default:
       throw Orthanc::OrthancException(Orthanc::ErrorCode_NotImplemented);
@@ -882,6 +843,220 @@ static void AnswerRawData(OrthancPluginRestOutput* output,
 }
 
 
+static const std::string RENDERED_THUMBNAIL_ATTACHMENT_ID = "4302";
+
+
+// Returns "false" if the instance is a PDF, that cannot be rendered
+static bool RenderFrame(std::string& content,
+                        const std::string& instanceId,
+                        unsigned int f /* frame index */,
+                        RenderingParameters& parameters,
+                        Orthanc::MimeType mime)
+{
+  static const char* const PHOTOMETRIC_INTERPRETATION = "0028,0004";
+  static const char* const PER_FRAME_FUNCTIONAL_GROUPS_SEQUENCE = "5200,9230";
+  static const char* const PIXEL_VALUE_TRANSFORMATION_SEQUENCE = "0028,9145";
+  static const char* const FRAME_VOI_LUT_SEQUENCE = "0028,9132";
+  static const char* const SOP_CLASS_UID = "0008,0016";
+
+  // The stages are only recorded if rendering for a request, not for the pregeneration of the thumbnails
+  OrthancPlugins::LatencyStageTimer loadTimer(OrthancPlugins::LatencyStage_Load);
+
+  OrthancPlugins::MemoryBuffer buffer;
+  buffer.GetDicomInstance(instanceId);
+
+  Json::Value tags;
+  buffer.DicomToJson(tags, OrthancPluginDicomToJsonFormat_Short, OrthancPluginDicomToJsonFlags_None, 255);
+
+  loadTimer.Stop();
+
+  if (tags.isMember(SOP_CLASS_UID))
+  {
+    std::string sopClassUid = tags[SOP_CLASS_UID].asString();
+    if (sopClassUid == "1.2.840.10008.5.1.4.1.1.104.1")  // if the instance is a PDF
+    {
+      return false;
+    }
+  }
+
+  if (ReadRescale(parameters, tags))
+  {
+  }
+  else if (tags.isMember(PER_FRAME_FUNCTIONAL_GROUPS_SEQUENCE) &&
+           tags[PER_FRAME_FUNCTIONAL_GROUPS_SEQUENCE].type() == Json::arrayValue &&
+           static_cast<Json::Value::ArrayIndex>(f) < tags[PER_FRAME_FUNCTIONAL_GROUPS_SEQUENCE].size() &&
+           tags[PER_FRAME_FUNCTIONAL_GROUPS_SEQUENCE][f].type() == Json::objectValue &&
+           tags[PER_FRAME_FUNCTIONAL_GROUPS_SEQUENCE][f].isMember(PIXEL_VALUE_TRANSFORMATION_SEQUENCE) &&
+           tags[PER_FRAME_FUNCTIONAL_GROUPS_SEQUENCE][f][PIXEL_VALUE_TRANSFORMATION_SEQUENCE].type() == Json::arrayValue &&
+           tags[PER_FRAME_FUNCTIONAL_GROUPS_SEQUENCE][f][PIXEL_VALUE_TRANSFORMATION_SEQUENCE].size() == 1)
+  {
+    ReadRescale(parameters, tags[PER_FRAME_FUNCTIONAL_GROUPS_SEQUENCE][f][PIXEL_VALUE_TRANSFORMATION_SEQUENCE][0]);
+  }
+
+  if (!parameters.HasWindowing())
+  {
+    if (ReadDefaultWindow(parameters, tags))
+    {
+    }
+    else if (tags.isMember(PER_FRAME_FUNCTIONAL_GROUPS_SEQUENCE) &&
+             tags[PER_FRAME_FUNCTIONAL_GROUPS_SEQUENCE].type() == Json::arrayValue &&
+             static_cast<Json::Value::ArrayIndex>(f) < tags[PER_FRAME_FUNCTIONAL_GROUPS_SEQUENCE].size() &&
+             tags[PER_FRAME_FUNCTIONAL_GROUPS_SEQUENCE][f].type() == Json::objectValue &&
+             tags[PER_FRAME_FUNCTIONAL_GROUPS_SEQUENCE][f].isMember(FRAME_VOI_LUT_SEQUENCE) &&
+             tags[PER_FRAME_FUNCTIONAL_GROUPS_SEQUENCE][f][FRAME_VOI_LUT_SEQUENCE].type() == Json::arrayValue &&
+             tags[PER_FRAME_FUNCTIONAL_GROUPS_SEQUENCE][f][FRAME_VOI_LUT_SEQUENCE].size() == 1)
+    {
+      ReadDefaultWindow(parameters, tags[PER_FRAME_FUNCTIONAL_GROUPS_SEQUENCE][f][FRAME_VOI_LUT_SEQUENCE][0]);
+    }
+  }
+
+  OrthancPlugins::LatencyStageTimer transcodeTimer(OrthancPlugins::LatencyStage_Transcode);
+
+  OrthancPlugins::OrthancImage dicom;
+  dicom.DecodeDicomImage(buffer.GetData(), buffer.GetSize(), f);
+
+  Orthanc::PixelFormat targetFormat;
+  OrthancPluginPixelFormat sdkFormat;
+  if (dicom.GetPixelFormat() == OrthancPluginPixelFormat_RGB24)
+  {
+    targetFormat = Orthanc::PixelFormat_RGB24;
+    sdkFormat = OrthancPluginPixelFormat_RGB24;
+  }
+  else
+  {
+    targetFormat = Orthanc::PixelFormat_Grayscale8;
+    sdkFormat = OrthancPluginPixelFormat_Grayscale8;
+  }
+
+  Orthanc::ImageAccessor source;
+  source.AssignReadOnly(Convert(dicom.GetPixelFormat()),
+                        dicom.GetWidth(), dicom.GetHeight(), dicom.GetPitch(), dicom.GetBuffer());
+          
+  Orthanc::Image target(targetFormat, parameters.GetTargetWidth(source.GetWidth(), source.GetHeight()),
+                        parameters.GetTargetHeight(source.GetWidth(), source.GetHeight()), false);
+
+  // New in 1.3: Fix for MONOCHROME1 images
+  bool invert = false;
+  if (target.GetFormat() == Orthanc::PixelFormat_Grayscale8 &&
+      tags.isMember(PHOTOMETRIC_INTERPRETATION) &&
+      tags[PHOTOMETRIC_INTERPRETATION].type() == Json::stringValue)
+  {
+    std::string s = tags[PHOTOMETRIC_INTERPRETATION].asString();
+    s = Orthanc::Toolbox::StripSpaces(s);
+    if (s == "MONOCHROME1")
+    {
+      invert = true;
+    }
+  }
+      
+  ApplyRendering(target, source, parameters, invert);
+
+  OrthancPlugins::OrthancImage rendered(sdkFormat, target.GetWidth(), target.GetHeight(),
+                                        target.GetPitch(), target.GetBuffer());
+
+  OrthancPlugins::MemoryBuffer compressed;
+
+  switch (mime)
+  {
+    case Orthanc::MimeType_Png:
+      rendered.CompressPngImage(compressed);
+      break;
+              
+    case Orthanc::MimeType_Jpeg:
+      rendered.CompressJpegImage(compressed, parameters.GetQuality());
+      break;
+
+    default:
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_NotImplemented);
+  }
+
+  compressed.ToString(content);
+  return true;
+}
+
+
+// The default thumbnail (first frame, JPEG, no rendering parameter)
+// is the one requested by the study browsers: it can be persisted as
+// an attachment of the instance
+static bool IsPersistentThumbnail(unsigned int frame,
+                                  Orthanc::MimeType mime,
+                                  const RenderingParameters& parameters)
+{
+  return (frame == 1 &&
+          mime == Orthanc::MimeType_Jpeg &&
+          parameters.IsDefault() &&
+          OrthancPlugins::Configuration::IsRenderedCachePersistent());
+}
+
+
+static bool ReadPersistentThumbnail(std::string& content,
+                                    const std::string& instanceId)
+{
+  return OrthancPlugins::RestApiGetString(
+    content, "/instances/" + instanceId + "/attachments/" + RENDERED_THUMBNAIL_ATTACHMENT_ID + "/data", false);
+}
+
+
+static void WritePersistentThumbnail(const std::string& instanceId,
+                                     const std::string& content)
+{
+  if (!IsSystemReadOnly() &&
+      !OrthancPlugins::Configuration::IsReadOnly())
+  {
+    Json::Value answer;
+    if (!OrthancPlugins::RestApiPut(answer, "/instances/" + instanceId + "/attachments/" + RENDERED_THUMBNAIL_ATTACHMENT_ID,
+                                    content, false))
+    {
+      LOG(WARNING) << "Cannot store the thumbnail of instance " << instanceId << " as an attachment";
+    }
+  }
+}
+
+
+// Looks for the rendering in the memory cache, then in the attachment
+// if applicable, then renders the frame.  Returns "false" for PDF.
+static bool GetRenderedFrame(std::string& content,
+                             std::string& etag,
+                             const std::string& instanceId,
+                             unsigned int frame,
+                             RenderingParameters& parameters,
+                             Orthanc::MimeType mime)
+{
+  OrthancPlugins::RenderedFramesCache& cache = OrthancPlugins::RenderedFramesCache::GetInstance();
+
+  const std::string key = OrthancPlugins::RenderedFramesCache::ComputeKey(
+    instanceId, frame, Orthanc::EnumerationToString(mime), parameters.Format());
+
+  if (cache.Lookup(content, etag, key))
+  {
+    return true;
+  }
+
+  const bool isPersistent = IsPersistentThumbnail(frame, mime, parameters);
+
+  if (isPersistent &&
+      ReadPersistentThumbnail(content, instanceId))
+  {
+    etag = cache.Store(key, content);
+    return true;
+  }
+
+  if (!RenderFrame(content, instanceId, frame - 1, parameters, mime))
+  {
+    return false;
+  }
+
+  etag = cache.Store(key, content);
+
+  if (isPersistent)
+  {
+    WritePersistentThumbnail(instanceId, content);
+  }
+
+  return true;
+}
+
+
 static void AnswerFrameRendered(OrthancPluginRestOutput* output,
                                 const std::string& instanceId,
                                 const std::string& transferSyntax,
@@ -902,13 +1077,8 @@ static void AnswerFrameRendered(OrthancPluginRestOutput* output,
 
   // for other media types, try to generate a single image preview.
 
-  static const char* const PHOTOMETRIC_INTERPRETATION = "0028,0004";
-  static const char* const PER_FRAME_FUNCTIONAL_GROUPS_SEQUENCE = "5200,9230";
-  static const char* const PIXEL_VALUE_TRANSFORMATION_SEQUENCE = "0028,9145";
-  static const char* const FRAME_VOI_LUT_SEQUENCE = "0028,9132";
-  static const char* const SOP_CLASS_UID = "0008,0016";
-
   Orthanc::MimeType mime = Orthanc::MimeType_Jpeg;  // This is the default in DICOMweb
+  std::string ifNoneMatch;
       
   for (uint32_t i = 0; i < request->headersCount; i++)
   {
@@ -933,11 +1103,13 @@ static void AnswerFrameRendered(OrthancPluginRestOutput* output,
         throw;
       }
     }
+    else if (boost::iequals(request->headersKeys[i], "If-None-Match"))
+    {
+      ifNoneMatch = request->headersValues[i];
+    }
   }
 
   RenderingParameters parameters(request);
-      
-  OrthancPlugins::MemoryBuffer buffer;
 
   if (frame <= 0)
   {
@@ -946,108 +1118,27 @@ static void AnswerFrameRendered(OrthancPluginRestOutput* output,
   }
   else
   {
-    buffer.GetDicomInstance(instanceId);
-
-    Json::Value tags;
-    buffer.DicomToJson(tags, OrthancPluginDicomToJsonFormat_Short, OrthancPluginDicomToJsonFlags_None, 255);
-
-    if (tags.isMember(SOP_CLASS_UID))
-    {
-      std::string sopClassUid = tags[SOP_CLASS_UID].asString();
-      if (sopClassUid == "1.2.840.10008.5.1.4.1.1.104.1")  // if the instance is a PDF
-      {
-        AnswerRawData(output, isThumbnail, Orthanc::EmbeddedResources::PDF_THUMBNAIL, "image/jpeg", std::string("/instances/") + instanceId + "/pdf");
-        return;
-      }
-    }
-
-    const unsigned int f = static_cast<unsigned int>(frame - 1);
-    
-    if (ReadRescale(parameters, tags))
-    {
-    }
-    else if (tags.isMember(PER_FRAME_FUNCTIONAL_GROUPS_SEQUENCE) &&
-             tags[PER_FRAME_FUNCTIONAL_GROUPS_SEQUENCE].type() == Json::arrayValue &&
-             static_cast<Json::Value::ArrayIndex>(f) < tags[PER_FRAME_FUNCTIONAL_GROUPS_SEQUENCE].size() &&
-             tags[PER_FRAME_FUNCTIONAL_GROUPS_SEQUENCE][f].type() == Json::objectValue &&
-             tags[PER_FRAME_FUNCTIONAL_GROUPS_SEQUENCE][f].isMember(PIXEL_VALUE_TRANSFORMATION_SEQUENCE) &&
-             tags[PER_FRAME_FUNCTIONAL_GROUPS_SEQUENCE][f][PIXEL_VALUE_TRANSFORMATION_SEQUENCE].type() == Json::arrayValue &&
-             tags[PER_FRAME_FUNCTIONAL_GROUPS_SEQUENCE][f][PIXEL_VALUE_TRANSFORMATION_SEQUENCE].size() == 1)
-    {
-      ReadRescale(parameters, tags[PER_FRAME_FUNCTIONAL_GROUPS_SEQUENCE][f][PIXEL_VALUE_TRANSFORMATION_SEQUENCE][0]);
-    }
+    std::string content, etag;
 
-    if (!parameters.HasWindowing())
+    if (!GetRenderedFrame(content, etag, instanceId, static_cast<unsigned int>(frame), parameters, mime))
     {
-      if (ReadDefaultWindow(parameters, tags))
-      {
-      }
-      else if (tags.isMember(PER_FRAME_FUNCTIONAL_GROUPS_SEQUENCE) &&
-               tags[PER_FRAME_FUNCTIONAL_GROUPS_SEQUENCE].type() == Json::arrayValue &&
-               static_cast<Json::Value::ArrayIndex>(f) < tags[PER_FRAME_FUNCTIONAL_GROUPS_SEQUENCE].size() &&
-               tags[PER_FRAME_FUNCTIONAL_GROUPS_SEQUENCE][f].type() == Json::objectValue &&
-               tags[PER_FRAME_FUNCTIONAL_GROUPS_SEQUENCE][f].isMember(FRAME_VOI_LUT_SEQUENCE) &&
-               tags[PER_FRAME_FUNCTIONAL_GROUPS_SEQUENCE][f][FRAME_VOI_LUT_SEQUENCE].type() == Json::arrayValue &&
-               tags[PER_FRAME_FUNCTIONAL_GROUPS_SEQUENCE][f][FRAME_VOI_LUT_SEQUENCE].size() == 1)
-      {
-        ReadDefaultWindow(parameters, tags[PER_FRAME_FUNCTIONAL_GROUPS_SEQUENCE][f][FRAME_VOI_LUT_SEQUENCE][0]);
-      }
+      AnswerRawData(output, isThumbnail, Orthanc::EmbeddedResources::PDF_THUMBNAIL, "image/jpeg", std::string("/instances/") + instanceId + "/pdf");
+      return;
     }
 
-    OrthancPlugins::OrthancImage dicom;
-    dicom.DecodeDicomImage(buffer.GetData(), buffer.GetSize(), f);
+    OrthancPluginSetHttpHeader(OrthancPlugins::GetGlobalContext(), output, "ETag", etag.c_str());
 
-    Orthanc::PixelFormat targetFormat;
-    OrthancPluginPixelFormat sdkFormat;
-    if (dicom.GetPixelFormat() == OrthancPluginPixelFormat_RGB24)
+    if (!ifNoneMatch.empty() &&
+        OrthancPlugins::RenderedFramesCache::MatchesETag(ifNoneMatch, etag))
     {
-      targetFormat = Orthanc::PixelFormat_RGB24;
-      sdkFormat = OrthancPluginPixelFormat_RGB24;
+      OrthancPlugins::RenderedFramesCache::GetInstance().CountNotModified();
+      OrthancPluginSendHttpStatusCode(OrthancPlugins::GetGlobalContext(), output, 304);
     }
     else
     {
-      targetFormat = Orthanc::PixelFormat_Grayscale8;
-      sdkFormat = OrthancPluginPixelFormat_Grayscale8;
-    }
-
-    Orthanc::ImageAccessor source;
-    source.AssignReadOnly(Convert(dicom.GetPixelFormat()),
-                          dicom.GetWidth(), dicom.GetHeight(), dicom.GetPitch(), dicom.GetBuffer());
-          
-    Orthanc::Image target(targetFormat, parameters.GetTargetWidth(source.GetWidth()),
-                          parameters.GetTargetHeight(source.GetHeight()), false);
-
-    // New in 1.3: Fix for MONOCHROME1 images
-    bool invert = false;
-    if (target.GetFormat() == Orthanc::PixelFormat_Grayscale8 &&
-        tags.isMember(PHOTOMETRIC_INTERPRETATION) &&
-        tags[PHOTOMETRIC_INTERPRETATION].type() == Json::stringValue)
-    {
-      std::string s = tags[PHOTOMETRIC_INTERPRETATION].asString();
-      s = Orthanc::Toolbox::StripSpaces(s);
-      if (s == "MONOCHROME1")
-      {
-        invert = true;
-      }
-    }
-      
-    ApplyRendering(target, source, parameters, invert);
-
-    switch (mime)
-    {
-      case Orthanc::MimeType_Png:
-        OrthancPluginCompressAndAnswerPngImage(OrthancPlugins::GetGlobalContext(), output, sdkFormat,
-                                               target.GetWidth(), target.GetHeight(), target.GetPitch(), target.GetBuffer());
-        break;
-              
-      case Orthanc::MimeType_Jpeg:
-        OrthancPluginCompressAndAnswerJpegImage(OrthancPlugins::GetGlobalContext(), output, sdkFormat,
-                                                target.GetWidth(), target.GetHeight(), target.GetPitch(), target.GetBuffer(),
-                                                parameters.GetQuality());
-        break;
-
-      default:
-        throw Orthanc::OrthancException(Orthanc::ErrorCode_NotImplemented);
+      OrthancPlugins::LatencyStageTimer timer(OrthancPlugins::LatencyStage_Send);
+      OrthancPluginAnswerBuffer(OrthancPlugins::GetGlobalContext(), output, content.empty() ? NULL : content.c_str(),
+                                content.size(), Orthanc::EnumerationToString(mime));
     }
   }
 }
@@ -1079,11 +1170,26 @@ static void AnswerFrameRendered(OrthancPluginRestOutput* output,
 }
 
 
+bool RenderFrameWadoUri(std::string& content,
+                        std::string& etag,
+                        const std::string& instanceId,
+                        Orthanc::MimeType mime,
+                        const OrthancPluginHttpRequest* request)
+{
+  RenderingParameters parameters(NULL);
+  const unsigned int frame = parameters.ParseWadoUri(request);
+
+  return GetRenderedFrame(content, etag, instanceId, frame, parameters, mime);
+}
+
+
 void RetrieveInstanceRendered(OrthancPluginRestOutput* output,
                               const char* url,
                               const OrthancPluginHttpRequest* request,
                               bool isThumbnail)
 {
+  OrthancPlugins::LatencyRouteTimer routeTimer(OrthancPlugins::LatencyRoute_WadoRsRendered);
+
   assert(request->groupsCount == 3);
   AnswerFrameRendered(output, 1 /* first frame */, request, isThumbnail);
 }
@@ -1094,6 +1200,8 @@ void RetrieveFrameRendered(OrthancPluginRestOutput* output,
                            const OrthancPluginHttpRequest* request,
                            bool isThumbnail)
 {
+  OrthancPlugins::LatencyRouteTimer routeTimer(OrthancPlugins::LatencyRoute_WadoRsRendered);
+
   assert(request->groupsCount == 4);
   const char* frame = request->groups[3];
 
@@ -1106,6 +1214,8 @@ void RetrieveSeriesRendered(OrthancPluginRestOutput* output,
                             const OrthancPluginHttpRequest* request,
                             bool isThumbnail)
 {
+  OrthancPlugins::LatencyRouteTimer routeTimer(OrthancPlugins::LatencyRoute_WadoRsRendered);
+
   assert(request->groupsCount == 2);
 
   if (request->method != OrthancPluginHttpMethod_Get)
@@ -1131,6 +1241,8 @@ void RetrieveStudyRendered(OrthancPluginRestOutput* output,
                            const OrthancPluginHttpRequest* request,
                            bool isThumbnail)
 {
+  OrthancPlugins::LatencyRouteTimer routeTimer(OrthancPlugins::LatencyRoute_WadoRsRendered);
+
   assert(request->groupsCount == 1);
 
   if (request->method != OrthancPluginHttpMethod_Get)
@@ -1149,3 +1261,37 @@ void RetrieveStudyRendered(OrthancPluginRestOutput* output,
     throw Orthanc::OrthancException(Orthanc::ErrorCode_InexistentItem, "Inexistent study");
   }
 }
+
+
+void PregenerateSeriesThumbnail(const std::string& seriesOrthancId)
+{
+  Json::Value series;
+  if (!OrthancPlugins::RestApiGet(series, "/series/" + seriesOrthancId, false) ||
+      !series.isMember("Instances") ||
+      series["Instances"].type() != Json::arrayValue ||
+      series["Instances"].size() == 0)
+  {
+    return;
+  }
+
+  // Same choice of the instance as in "LocateOneInstance()"
+  const std::string instanceId = series["Instances"][0].asString();
+
+  std::string transferSyntax;
+  Orthanc::DicomTransferSyntax syntax;
+  if (OrthancPlugins::RestApiGetString(transferSyntax, "/instances/" + instanceId + "/metadata/TransferSyntax", false) &&
+      Orthanc::LookupTransferSyntax(syntax, transferSyntax) &&
+      syntax >= Orthanc::DicomTransferSyntax_MPEG2MainProfileAtMainLevel &&
+      syntax <= Orthanc::DicomTransferSyntax_HEVCMain10ProfileLevel5_1)
+  {
+    return;  // Videos are not rendered
+  }
+
+  RenderingParameters parameters(NULL);
+
+  std::string content, etag;
+  if (GetRenderedFrame(content, etag, instanceId, 1 /* first frame */, parameters, Orthanc::MimeType_Jpeg))
+  {
+    LOG(INFO) << "Pre-generated the thumbnail of series " << seriesOrthancId << " from instance " << instanceId;
+  }
+}
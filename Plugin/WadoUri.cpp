@@ -25,13 +25,19 @@
 
 #include "../Resources/Orthanc/Plugins/OrthancPluginCppWrapper.h"
 #include "Configuration.h"
+#include "LatencyMetrics.h"
 #include "Logging.h"
+#include "RenderedFramesCache.h"
+#include "ResourceLookupCache.h"
+#include "WadoRs.h"
 
 #include <string>
+#include <boost/algorithm/string/predicate.hpp>
 
 
 
 static bool LocateInstanceWadoUri(std::string& instance,
+                                  std::string& transferSyntax,
                                   std::string& contentType,
                                   const OrthancPluginHttpRequest* request)
 {
@@ -76,16 +82,55 @@ static bool LocateInstanceWadoUri(std::string& instance,
     return false;
   }
 
+  if ((studyUid.empty() || seriesUid.empty()) &&
+      OrthancPlugins::Configuration::IsWadoUriStudyAndSeriesRequired())
+  {
+    // The three UIDs are mandatory in DICOM PS3.18, and are the only
+    // way to tell apart instances that share the same SOPInstanceUID
+    LOG(ERROR) << "WADO-URI: Both studyUID and seriesUID must be provided";
+    return false;
+  }
+
+  std::map<std::string, std::string> httpHeaders;
+  OrthancPlugins::GetHttpHeaders(httpHeaders, request);
+
+  OrthancPlugins::LatencyStageTimer timer(OrthancPlugins::LatencyRoute_WadoUri, OrthancPlugins::LatencyStage_Locate);
+
+  // Same cache as in WADO-RS, which is scoped by the HTTP headers
+  // that are forwarded to "/tools/find", and which is disabled if the
+  // authorization plugin is loaded
+  OrthancPlugins::ResourceLookupCache& cache = OrthancPlugins::ResourceLookupCache::GetInstance();
+  std::string cacheKey;
+
+  if (cache.IsEnabled())
+  {
+    cacheKey = OrthancPlugins::ResourceLookupCache::ComputeKey(
+      "Instance", studyUid, seriesUid, objectUid, false, httpHeaders);
+
+    OrthancPlugins::ResourceLookupCache::Metadata metadata;
+    if (cache.Lookup(instance, metadata, cacheKey))
+    {
+      OrthancPlugins::ResourceLookupCache::Metadata::const_iterator found = metadata.find("TransferSyntax");
+      if (found != metadata.end())
+      {
+        transferSyntax = found->second;
+      }
+
+      return true;
+    }
+  }
+
   /**
-  * Below are only sanity checks to ensure that the possibly provided
-  * "seriesUID" and "studyUID" match that of the provided instance.
-  **/
+   * The possibly provided "seriesUID" and "studyUID" are part of the
+   * query, which ensures that they match that of the instance, and
+   * which resolves the instances that share the same SOPInstanceUID.
+   * The metadata are retrieved by the same call.
+   **/
 
   Json::Value payload;
   Json::Value payloadQuery;
 
-  payload["Level"] = "instance";
-  payload["Expand"] = false;
+  payload["Level"] = "Instance";
 
   payloadQuery["SOPInstanceUID"] = objectUid;
   if (!seriesUid.empty())
@@ -98,9 +143,8 @@ static bool LocateInstanceWadoUri(std::string& instance,
   }
 
   payload["Query"] = payloadQuery;
-
-  std::map<std::string, std::string> httpHeaders;
-  OrthancPlugins::GetHttpHeaders(httpHeaders, request);
+  payload["ResponseContent"] = Json::arrayValue;
+  payload["ResponseContent"].append("Metadata");
 
   Json::Value resources;
   if (!OrthancPlugins::RestApiPost(resources, "/tools/find", payload, httpHeaders, true) ||
@@ -117,11 +161,44 @@ static bool LocateInstanceWadoUri(std::string& instance,
   
   if (resources.size() > 1)
   {
-    LOG(ERROR) << "WADO-URI: Multiple SOPInstanceUID found in Orthanc: \"" << objectUid;
+    LOG(ERROR) << "WADO-URI: Multiple SOPInstanceUID found in Orthanc: \"" << objectUid
+               << "\", the studyUID and seriesUID arguments must be provided";
     return false;
   }
 
-  instance = resources[0].asString();
+  if (resources[0].type() != Json::objectValue ||
+      !resources[0].isMember("ID") ||
+      resources[0]["ID"].type() != Json::stringValue)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+  }
+
+  instance = resources[0]["ID"].asString();
+
+  OrthancPlugins::ResourceLookupCache::Metadata metadata;
+
+  if (resources[0].isMember("Metadata") &&
+      resources[0]["Metadata"].type() == Json::objectValue)
+  {
+    const Json::Value::Members members = resources[0]["Metadata"].getMemberNames();
+
+    for (size_t i = 0; i < members.size(); i++)
+    {
+      metadata[members[i]] = resources[0]["Metadata"][members[i]].asString();
+    }
+  }
+
+  OrthancPlugins::ResourceLookupCache::Metadata::const_iterator found = metadata.find("TransferSyntax");
+  if (found != metadata.end())
+  {
+    transferSyntax = found->second;
+  }
+
+  if (!cacheKey.empty())
+  {
+    cache.Store(cacheKey, instance, metadata);
+  }
+
   return true;
 }
 
@@ -133,9 +210,14 @@ static void AnswerDicom(OrthancPluginRestOutput* output,
 
   std::string uri = "/instances/" + instance + "/file";
 
+  OrthancPlugins::LatencyStageTimer loadTimer(OrthancPlugins::LatencyRoute_WadoUri, OrthancPlugins::LatencyStage_Load);
+
   OrthancPlugins::MemoryBuffer dicom;
   if (dicom.RestApiGet(uri, false))
   {
+    loadTimer.Stop();
+
+    OrthancPlugins::LatencyStageTimer sendTimer(OrthancPlugins::LatencyRoute_WadoUri, OrthancPlugins::LatencyStage_Send);
     OrthancPluginAnswerBuffer(context, output, 
                               dicom.GetData(), dicom.GetSize(), "application/dicom");
   }
@@ -147,10 +229,55 @@ static void AnswerDicom(OrthancPluginRestOutput* output,
 }
 
 
+static bool IsVideo(const std::string& transferSyntax)
+{
+  Orthanc::DicomTransferSyntax syntax;
+  return (Orthanc::LookupTransferSyntax(syntax, transferSyntax) &&
+          syntax >= Orthanc::DicomTransferSyntax_MPEG2MainProfileAtMainLevel &&
+          syntax <= Orthanc::DicomTransferSyntax_HEVCMain10ProfileLevel5_1);
+}
+
+
 static void AnswerPreview(OrthancPluginRestOutput* output,
                           const std::string& instance,
-                          const std::map<std::string, std::string>& httpHeaders)
+                          const std::string& transferSyntax,
+                          Orthanc::MimeType mime,
+                          const OrthancPluginHttpRequest* request)
 {
+  OrthancPluginContext* context = OrthancPlugins::GetGlobalContext();
+
+  /**
+   * The plugin renders the frame with the same code and the same
+   * cache as the WADO-RS RetrieveRendered transaction. This takes the
+   * "frameNumber", "rows", "columns", "windowCenter", "windowWidth"
+   * and "imageQuality" arguments into account, and repeated requests
+   * are served from the cache. The videos and the PDF are still
+   * rendered by the Orthanc core.
+   **/
+  std::string content, etag;
+
+  if (!IsVideo(transferSyntax) &&
+      RenderFrameWadoUri(content, etag, instance, mime, request))
+  {
+    OrthancPluginSetHttpHeader(context, output, "ETag", etag.c_str());
+
+    for (uint32_t i = 0; i < request->headersCount; i++)
+    {
+      if (boost::iequals(request->headersKeys[i], "If-None-Match") &&
+          OrthancPlugins::RenderedFramesCache::MatchesETag(request->headersValues[i], etag))
+      {
+        OrthancPlugins::RenderedFramesCache::GetInstance().CountNotModified();
+        OrthancPluginSendHttpStatusCode(context, output, 304);
+        return;
+      }
+    }
+
+    OrthancPlugins::LatencyStageTimer sendTimer(OrthancPlugins::LatencyRoute_WadoUri, OrthancPlugins::LatencyStage_Send);
+    OrthancPluginAnswerBuffer(context, output, content.empty() ? NULL : content.c_str(),
+                              content.size(), Orthanc::EnumerationToString(mime));
+    return;
+  }
+
   /**
    * (*) We can use "/rendered" that was introduced in the REST API of
    * Orthanc 1.6.0, as since release 1.2 of the DICOMweb plugin, the
@@ -161,12 +288,19 @@ static void AnswerPreview(OrthancPluginRestOutput* output,
    **/
   const std::string uri = "/instances/" + instance + "/rendered";
 
-  OrthancPluginContext* context = OrthancPlugins::GetGlobalContext();
+  std::map<std::string, std::string> httpHeaders;
+  httpHeaders["Accept"] = Orthanc::EnumerationToString(mime);
+
+  // The core loads and renders the instance
+  OrthancPlugins::LatencyStageTimer transcodeTimer(OrthancPlugins::LatencyRoute_WadoUri, OrthancPlugins::LatencyStage_Transcode);
 
   OrthancPlugins::MemoryBuffer png;
   if (png.RestApiGet(uri, httpHeaders, true))
   {
-    OrthancPluginAnswerBuffer(context, output, png.GetData(), png.GetSize(), "image/png");
+    transcodeTimer.Stop();
+
+    OrthancPlugins::LatencyStageTimer sendTimer(OrthancPlugins::LatencyRoute_WadoUri, OrthancPlugins::LatencyStage_Send);
+    OrthancPluginAnswerBuffer(context, output, png.GetData(), png.GetSize(), Orthanc::EnumerationToString(mime));
   }
   else
   {
@@ -176,28 +310,12 @@ static void AnswerPreview(OrthancPluginRestOutput* output,
 }
 
 
-static void AnswerPngPreview(OrthancPluginRestOutput* output,
-                              const std::string& instance)
-{
-  std::map<std::string, std::string> httpHeaders;
-  httpHeaders["Accept"] = "image/png";
-  AnswerPreview(output, instance, httpHeaders);
-}
-
-
-static void AnswerJpegPreview(OrthancPluginRestOutput* output,
-                              const std::string& instance)
-{
-  std::map<std::string, std::string> httpHeaders;
-  httpHeaders["Accept"] = "image/jpeg";
-  AnswerPreview(output, instance, httpHeaders);
-}
-
-
 void WadoUriCallback(OrthancPluginRestOutput* output,
                      const char* url,
                      const OrthancPluginHttpRequest* request)
 {
+  OrthancPlugins::LatencyRouteTimer routeTimer(OrthancPlugins::LatencyRoute_WadoUri);
+
   if (request->method != OrthancPluginHttpMethod_Get)
   {
     OrthancPluginSendMethodNotAllowed(OrthancPlugins::GetGlobalContext(), output, "GET");
@@ -205,8 +323,9 @@ void WadoUriCallback(OrthancPluginRestOutput* output,
   }
 
   std::string instance;
+  std::string transferSyntax;
   std::string contentType = "image/jpg";  // By default, JPEG image will be returned
-  if (!LocateInstanceWadoUri(instance, contentType, request))
+  if (!LocateInstanceWadoUri(instance, transferSyntax, contentType, request))
   {
     throw Orthanc::OrthancException(Orthanc::ErrorCode_UnknownResource);
   }
@@ -217,12 +336,12 @@ void WadoUriCallback(OrthancPluginRestOutput* output,
   }
   else if (contentType == "image/png")
   {
-    AnswerPngPreview(output, instance);
+    AnswerPreview(output, instance, transferSyntax, Orthanc::MimeType_Png, request);
   }
   else if (contentType == "image/jpeg" ||
            contentType == "image/jpg")
   {
-    AnswerJpegPreview(output, instance);
+    AnswerPreview(output, instance, transferSyntax, Orthanc::MimeType_Jpeg, request);
   }
   else
   {
@@ -0,0 +1,350 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "WorkersPool.h"
+
+#include "../Resources/Orthanc/Plugins/OrthancPluginCppWrapper.h"
+
+#include <Logging.h>
+#include <OrthancException.h>
+
+#include <boost/lexical_cast.hpp>
+
+
+namespace OrthancPlugins
+{
+  WorkersPool::TasksGroup::~TasksGroup()
+  {
+    try
+    {
+      boost::mutex::scoped_lock lock(pool_.mutex_);
+
+      pool_.queuedTasks_ -= queue_.size();
+      queue_.clear();
+      pool_.Unschedule(*this);
+
+      for (size_t i = 0; i < status_.size(); i++)
+      {
+        if (status_[i] == TaskStatus_Pending)
+        {
+          status_[i] = TaskStatus_Done;
+        }
+
+        while (status_[i] != TaskStatus_Done)
+        {
+          taskDone_.wait(lock);
+        }
+      }
+    }
+    catch (...)
+    {
+      // Don't throw exceptions in destructors
+    }
+  }
+
+
+  size_t WorkersPool::TasksGroup::Submit(ITask& task)
+  {
+    boost::mutex::scoped_lock lock(pool_.mutex_);
+
+    const size_t index = tasks_.size();
+    tasks_.push_back(&task);
+    status_.push_back(TaskStatus_Pending);
+
+    if (maxRunning_ == 0 ||
+        pool_.workers_.empty())
+    {
+      // The task will be run by "Wait()"
+      return index;
+    }
+
+    if (queue_.empty())
+    {
+      pool_.groups_.push_back(this);
+    }
+
+    queue_.push_back(index);
+    pool_.queuedTasks_++;
+
+    if (running_ < maxRunning_)
+    {
+      pool_.jobAvailable_.notify_one();
+    }
+
+    return index;
+  }
+
+
+  void WorkersPool::TasksGroup::Wait(size_t index)
+  {
+    if (index >= tasks_.size())
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+
+    ITask* task = NULL;
+
+    {
+      boost::mutex::scoped_lock lock(pool_.mutex_);
+
+      if (status_[index] != TaskStatus_Pending)
+      {
+        while (status_[index] != TaskStatus_Done)
+        {
+          taskDone_.wait(lock);
+        }
+
+        return;
+      }
+
+      // The task has not been started by a worker yet: run it in this thread
+      for (std::deque<size_t>::iterator it = queue_.begin(); it != queue_.end(); ++it)
+      {
+        if (*it == index)
+        {
+          queue_.erase(it);
+          pool_.queuedTasks_--;
+          break;
+        }
+      }
+
+      if (queue_.empty())
+      {
+        pool_.Unschedule(*this);
+      }
+
+      status_[index] = TaskStatus_Running;
+      task = tasks_[index];
+    }
+
+    ExecuteTask(*task);
+
+    {
+      boost::mutex::scoped_lock lock(pool_.mutex_);
+      status_[index] = TaskStatus_Done;
+      taskDone_.notify_all();
+    }
+  }
+
+
+  void WorkersPool::TasksGroup::WaitAll()
+  {
+    for (size_t i = 0; i < tasks_.size(); i++)
+    {
+      Wait(i);
+    }
+  }
+
+
+  void WorkersPool::ExecuteTask(ITask& task)
+  {
+    try
+    {
+      task.Execute();
+    }
+    catch (Orthanc::OrthancException& e)
+    {
+      LOG(ERROR) << "Exception in a DICOMweb worker: " << e.What();
+    }
+    catch (...)
+    {
+      LOG(ERROR) << "Native exception in a DICOMweb worker";
+    }
+  }
+
+
+  void WorkersPool::Unschedule(TasksGroup& group)
+  {
+    for (std::list<TasksGroup*>::iterator it = groups_.begin(); it != groups_.end(); ++it)
+    {
+      if (*it == &group)
+      {
+        groups_.erase(it);
+        return;
+      }
+    }
+  }
+
+
+  bool WorkersPool::DequeueTask(TasksGroup*& group,
+                                size_t& index,
+                                ITask*& task)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    for (;;)
+    {
+      if (stopping_)
+      {
+        return false;
+      }
+
+      // Take the first group that has not reached its maximum number
+      // of running tasks, and move it to the end of the round-robin
+      for (std::list<TasksGroup*>::iterator it = groups_.begin(); it != groups_.end(); ++it)
+      {
+        if ((*it)->IsRunnable())
+        {
+          group = *it;
+          groups_.erase(it);
+
+          index = group->queue_.front();
+          task = group->tasks_[index];
+          group->queue_.pop_front();
+          group->status_[index] = TasksGroup::TaskStatus_Running;
+          group->running_++;
+
+          if (!group->queue_.empty())
+          {
+            groups_.push_back(group);
+          }
+
+          queuedTasks_--;
+          activeTasks_++;
+          return true;
+        }
+      }
+
+      jobAvailable_.wait(lock);
+    }
+  }
+
+
+  void WorkersPool::Worker(WorkersPool* that,
+                           std::string name)
+  {
+    Orthanc::Logging::ScopedThreadNameSetter setter(name);
+
+    TasksGroup* group = NULL;
+    size_t index = 0;
+    ITask* task = NULL;
+
+    while (that->DequeueTask(group, index, task))
+    {
+      ExecuteTask(*task);
+
+      boost::mutex::scoped_lock lock(that->mutex_);
+      group->status_[index] = TasksGroup::TaskStatus_Done;
+      group->running_--;
+      that->activeTasks_--;
+      group->taskDone_.notify_all();
+
+      if (group->IsRunnable())
+      {
+        // The group was waiting for one of its tasks to complete
+        that->jobAvailable_.notify_one();
+      }
+    }
+  }
+
+
+  WorkersPool::~WorkersPool()
+  {
+    Stop();
+  }
+
+
+  WorkersPool& WorkersPool::GetInstance()
+  {
+    static WorkersPool instance;
+    return instance;
+  }
+
+
+  void WorkersPool::Start(unsigned int threadsCount,
+                          const std::string& threadsName)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (!workers_.empty())
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+    }
+
+    stopping_ = false;
+
+    for (unsigned int i = 0; i < threadsCount; i++)
+    {
+      workers_.push_back(boost::shared_ptr<boost::thread>(
+                           new boost::thread(Worker, this, threadsName + boost::lexical_cast<std::string>(i))));
+    }
+  }
+
+
+  void WorkersPool::Stop()
+  {
+    std::vector<boost::shared_ptr<boost::thread> > workers;
+
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      stopping_ = true;
+      workers.swap(workers_);
+      jobAvailable_.notify_all();
+    }
+
+    for (size_t i = 0; i < workers.size(); i++)
+    {
+      if (workers[i]->joinable())
+      {
+        workers[i]->join();
+      }
+    }
+
+    // The tasks that are still queued are run by the threads waiting for them
+    boost::mutex::scoped_lock lock(mutex_);
+
+    for (std::list<TasksGroup*>::iterator it = groups_.begin(); it != groups_.end(); ++it)
+    {
+      (*it)->queue_.clear();
+    }
+
+    groups_.clear();
+    queuedTasks_ = 0;
+  }
+
+
+  unsigned int WorkersPool::GetThreadsCount()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return static_cast<unsigned int>(workers_.size());
+  }
+
+
+  void WorkersPool::GetStatistics(size_t& queued,
+                                  size_t& active)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    queued = queuedTasks_;
+    active = activeTasks_;
+  }
+
+
+  void WorkersPool::RefreshMetrics()
+  {
+    size_t queued, active;
+    GetStatistics(queued, active);
+
+    OrthancPlugins::SetMetricsValue("orthanc_dicomweb_workers_queue_depth", static_cast<int64_t>(queued));
+    OrthancPlugins::SetMetricsValue("orthanc_dicomweb_workers_active", static_cast<int64_t>(active));
+  }
+}
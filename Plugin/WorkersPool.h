@@ -0,0 +1,172 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include <deque>
+#include <list>
+#include <string>
+#include <vector>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+
+namespace OrthancPlugins
+{
+  // Plugin-wide, fixed-size pool of worker threads that are created
+  // once at the startup of the plugin, instead of being created for
+  // each HTTP request.  This bounds the total number of threads that
+  // load DICOM instances or metadata, whatever the number of requests.
+  //
+  // The tasks of one request are submitted to a "TasksGroup".  The
+  // workers serve the groups in a round-robin fashion, so that a huge
+  // study cannot starve the small requests, and each group has a
+  // maximum number of tasks that can be run at once by the workers.
+  //
+  // A thread that waits for a task that has not been started yet runs
+  // it by itself.  This makes it safe for a task to submit subtasks to
+  // the pool and to wait for them, even if all the workers are busy,
+  // and makes the pool work without any worker thread.
+  class WorkersPool : public boost::noncopyable
+  {
+  public:
+    class ITask : public boost::noncopyable
+    {
+    public:
+      virtual ~ITask()
+      {
+      }
+
+      // Exceptions are caught and ignored by the pool: the task must
+      // record its errors by itself if they must be reported
+      virtual void Execute() = 0;
+    };
+
+    // A group must only be used by the thread that has created it
+    class TasksGroup : public boost::noncopyable
+    {
+    private:
+      enum TaskStatus
+      {
+        TaskStatus_Pending,
+        TaskStatus_Running,
+        TaskStatus_Done
+      };
+
+      friend class WorkersPool;
+
+      WorkersPool&               pool_;
+      unsigned int               maxRunning_;
+      unsigned int               running_;    // Number of tasks run by the workers
+      std::vector<ITask*>        tasks_;
+      std::vector<TaskStatus>    status_;
+      std::deque<size_t>         queue_;      // Pending tasks that can be run by the workers
+      boost::condition_variable  taskDone_;
+
+      // The mutex of the pool must be locked
+      bool IsRunnable() const
+      {
+        return !queue_.empty() && running_ < maxRunning_;
+      }
+
+    public:
+      // If "maxRunning" is zero, all the tasks are run by the thread
+      // that waits for them
+      TasksGroup(WorkersPool& pool,
+                 unsigned int maxRunning) :
+        pool_(pool),
+        maxRunning_(maxRunning),
+        running_(0)
+      {
+      }
+
+      // Cancels the tasks that are still pending, and waits for the
+      // running tasks to complete
+      ~TasksGroup();
+
+      // The task is not owned by the group, and must outlive it.
+      // Returns the index of the task in the group.
+      size_t Submit(ITask& task);
+
+      size_t GetSize() const
+      {
+        return tasks_.size();
+      }
+
+      void Wait(size_t index);
+
+      void WaitAll();
+    };
+
+  private:
+    boost::mutex                                     mutex_;
+    boost::condition_variable                        jobAvailable_;
+    std::list<TasksGroup*>                           groups_;  // Groups with pending tasks, in round-robin order
+    size_t                                           queuedTasks_;
+    size_t                                           activeTasks_;
+    bool                                             stopping_;
+    std::vector<boost::shared_ptr<boost::thread> >   workers_;
+
+    static void Worker(WorkersPool* that,
+                       std::string name);
+
+    static void ExecuteTask(ITask& task);
+
+    // The mutex must be locked
+    void Unschedule(TasksGroup& group);
+
+    bool DequeueTask(TasksGroup*& group,
+                     size_t& index,
+                     ITask*& task);
+
+  public:
+    WorkersPool() :
+      queuedTasks_(0),
+      activeTasks_(0),
+      stopping_(false)
+    {
+    }
+
+    ~WorkersPool();
+
+    static WorkersPool& GetInstance();
+
+    // "threadsCount" can be zero, in which case the tasks are run by
+    // the threads that wait for them
+    void Start(unsigned int threadsCount,
+               const std::string& threadsName);
+
+    void Stop();
+
+    unsigned int GetThreadsCount();
+
+    // "queued" is the number of tasks waiting for a worker, "active"
+    // is the number of tasks being run by the workers
+    void GetStatistics(size_t& queued,
+                       size_t& active);
+
+    void RefreshMetrics();
+  };
+}
@@ -0,0 +1,387 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#include "ZipStreamWriter.h"
+
+#include <OrthancException.h>
+
+#include <algorithm>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <limits>
+#include <string.h>
+#include <zlib.h>
+
+
+static const uint32_t SIGNATURE_LOCAL_HEADER = 0x04034b50;
+static const uint32_t SIGNATURE_CENTRAL_HEADER = 0x02014b50;
+static const uint32_t SIGNATURE_ZIP64_END = 0x06064b50;
+static const uint32_t SIGNATURE_ZIP64_LOCATOR = 0x07064b50;
+static const uint32_t SIGNATURE_END = 0x06054b50;
+
+static const uint16_t VERSION_DEFAULT = 20;  // Deflate and directories
+static const uint16_t VERSION_ZIP64 = 45;
+
+static const uint16_t FLAG_UTF8 = (1 << 11);
+
+static const uint16_t METHOD_STORED = 0;
+static const uint16_t METHOD_DEFLATE = 8;
+
+static const uint16_t ZIP64_EXTRA_FIELD = 0x0001;
+
+static const uint32_t MAX_UINT32 = 0xffffffffu;
+static const uint16_t MAX_UINT16 = 0xffffu;
+
+
+static void WriteUInt16(std::string& target,
+                        uint16_t value)
+{
+  target.push_back(static_cast<char>(value & 0xff));
+  target.push_back(static_cast<char>((value >> 8) & 0xff));
+}
+
+
+static void WriteUInt32(std::string& target,
+                        uint32_t value)
+{
+  for (unsigned int i = 0; i < 4; i++)
+  {
+    target.push_back(static_cast<char>((value >> (8 * i)) & 0xff));
+  }
+}
+
+
+static void WriteUInt64(std::string& target,
+                        uint64_t value)
+{
+  for (unsigned int i = 0; i < 8; i++)
+  {
+    target.push_back(static_cast<char>((value >> (8 * i)) & 0xff));
+  }
+}
+
+
+static uint32_t Truncate32(uint64_t value)
+{
+  return (value >= MAX_UINT32 ? MAX_UINT32 : static_cast<uint32_t>(value));
+}
+
+
+static uint32_t ComputeCrc32(const void* data,
+                             size_t size)
+{
+  uLong crc = crc32(0L, Z_NULL, 0);
+
+  const Bytef* p = reinterpret_cast<const Bytef*>(data);
+
+  while (size > 0)
+  {
+    // "crc32()" only accepts 32-bit lengths
+    const uInt chunk = static_cast<uInt>(std::min(size, static_cast<size_t>(1024 * 1024 * 1024)));
+    crc = crc32(crc, p, chunk);
+    p += chunk;
+    size -= chunk;
+  }
+
+  return static_cast<uint32_t>(crc);
+}
+
+
+// Raw deflate (without zlib header), as expected by the ZIP format.
+// Returns "false" if the compressed data would not be smaller.
+static bool Deflate(std::string& target,
+                    const void* data,
+                    size_t size)
+{
+  if (size == 0 ||
+      size > static_cast<size_t>(std::numeric_limits<uInt>::max()))
+  {
+    return false;
+  }
+
+  z_stream stream;
+  memset(&stream, 0, sizeof(stream));
+
+  if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS /* raw */,
+                   8, Z_DEFAULT_STRATEGY) != Z_OK)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError, "Cannot initialize zlib");
+  }
+
+  // Stop as soon as the compressed data is not smaller than the source
+  target.resize(size);
+
+  stream.next_in = const_cast<Bytef*>(reinterpret_cast<const Bytef*>(data));
+  stream.avail_in = static_cast<uInt>(size);
+  stream.next_out = reinterpret_cast<Bytef*>(&target[0]);
+  stream.avail_out = static_cast<uInt>(size);
+
+  const int code = deflate(&stream, Z_FINISH);
+  const size_t compressedSize = static_cast<size_t>(stream.total_out);
+  deflateEnd(&stream);
+
+  if (code == Z_STREAM_END &&
+      compressedSize < size)
+  {
+    target.resize(compressedSize);
+    return true;
+  }
+  else if (code == Z_STREAM_END ||
+           code == Z_OK ||
+           code == Z_BUF_ERROR)
+  {
+    // The output buffer is full: The data is not compressible
+    target.clear();
+    return false;
+  }
+  else
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError, "Error in zlib");
+  }
+}
+
+
+namespace OrthancPlugins
+{
+  void ZipStreamWriter::Write(const std::string& data)
+  {
+    if (!data.empty())
+    {
+      output_.Write(data.c_str(), data.size());
+      position_ += data.size();
+    }
+  }
+
+
+  ZipStreamWriter::ZipStreamWriter(IOutput& output,
+                                   bool deflate) :
+    output_(output),
+    deflate_(deflate),
+    position_(0),
+    entriesCount_(0),
+    isClosed_(false)
+  {
+    // MS-DOS date and time of the entries
+    const boost::posix_time::ptime now = boost::posix_time::second_clock::local_time();
+    const boost::gregorian::date date = now.date();
+    const boost::posix_time::time_duration time = now.time_of_day();
+
+    dosTime_ = static_cast<uint16_t>((time.hours() << 11) |
+                                     (time.minutes() << 5) |
+                                     (time.seconds() / 2));
+    dosDate_ = static_cast<uint16_t>(((date.year() - 1980) << 9) |
+                                     (date.month() << 5) |
+                                     date.day());
+  }
+
+
+  void ZipStreamWriter::AddEntry(const std::string& filename,
+                                 const void* data,
+                                 size_t size)
+  {
+    if (isClosed_)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+    }
+
+    if (filename.empty() ||
+        filename.size() > MAX_UINT16)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                      "Bad filename in a ZIP archive: " + filename);
+    }
+
+    if (size > 0 &&
+        data == NULL)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_NullPointer);
+    }
+
+    const uint32_t crc = ComputeCrc32(data, size);
+
+    std::string compressed;
+    const bool isDeflated = (deflate_ && Deflate(compressed, data, size));
+
+    const uint16_t method = (isDeflated ? METHOD_DEFLATE : METHOD_STORED);
+    const uint64_t uncompressedSize = size;
+    const uint64_t compressedSize = (isDeflated ? compressed.size() : size);
+    const uint64_t offset = position_;
+
+    // Local file header
+    const bool isLocalZip64 = (uncompressedSize >= MAX_UINT32 ||
+                               compressedSize >= MAX_UINT32);
+
+    std::string header;
+    header.reserve(30 + filename.size() + 20);
+    WriteUInt32(header, SIGNATURE_LOCAL_HEADER);
+    WriteUInt16(header, isLocalZip64 ? VERSION_ZIP64 : VERSION_DEFAULT);
+    WriteUInt16(header, FLAG_UTF8);
+    WriteUInt16(header, method);
+    WriteUInt16(header, dosTime_);
+    WriteUInt16(header, dosDate_);
+    WriteUInt32(header, crc);
+
+    if (isLocalZip64)
+    {
+      // Both sizes must be in the extra field of the local header
+      WriteUInt32(header, MAX_UINT32);
+      WriteUInt32(header, MAX_UINT32);
+      WriteUInt16(header, static_cast<uint16_t>(filename.size()));
+      WriteUInt16(header, 20);
+      header += filename;
+      WriteUInt16(header, ZIP64_EXTRA_FIELD);
+      WriteUInt16(header, 16);
+      WriteUInt64(header, uncompressedSize);
+      WriteUInt64(header, compressedSize);
+    }
+    else
+    {
+      WriteUInt32(header, static_cast<uint32_t>(compressedSize));
+      WriteUInt32(header, static_cast<uint32_t>(uncompressedSize));
+      WriteUInt16(header, static_cast<uint16_t>(filename.size()));
+      WriteUInt16(header, 0);
+      header += filename;
+    }
+
+    Write(header);
+
+    if (isDeflated)
+    {
+      Write(compressed);
+    }
+    else if (size > 0)
+    {
+      output_.Write(data, size);
+      position_ += size;
+    }
+
+    // Central directory header, only the overflowing values go to the ZIP64 extra field
+    std::string extra;
+
+    if (uncompressedSize >= MAX_UINT32)
+    {
+      WriteUInt64(extra, uncompressedSize);
+    }
+
+    if (compressedSize >= MAX_UINT32)
+    {
+      WriteUInt64(extra, compressedSize);
+    }
+
+    if (offset >= MAX_UINT32)
+    {
+      WriteUInt64(extra, offset);
+    }
+
+    const bool isCentralZip64 = !extra.empty();
+
+    WriteUInt32(centralDirectory_, SIGNATURE_CENTRAL_HEADER);
+    WriteUInt16(centralDirectory_, VERSION_ZIP64);  // Version made by
+    WriteUInt16(centralDirectory_, (isLocalZip64 || isCentralZip64) ? VERSION_ZIP64 : VERSION_DEFAULT);
+    WriteUInt16(centralDirectory_, FLAG_UTF8);
+    WriteUInt16(centralDirectory_, method);
+    WriteUInt16(centralDirectory_, dosTime_);
+    WriteUInt16(centralDirectory_, dosDate_);
+    WriteUInt32(centralDirectory_, crc);
+    WriteUInt32(centralDirectory_, Truncate32(compressedSize));
+    WriteUInt32(centralDirectory_, Truncate32(uncompressedSize));
+    WriteUInt16(centralDirectory_, static_cast<uint16_t>(filename.size()));
+    WriteUInt16(centralDirectory_, isCentralZip64 ? static_cast<uint16_t>(4 + extra.size()) : 0);
+    WriteUInt16(centralDirectory_, 0);  // File comment length
+    WriteUInt16(centralDirectory_, 0);  // Disk number
+    WriteUInt16(centralDirectory_, 0);  // Internal attributes
+    WriteUInt32(centralDirectory_, 0);  // External attributes
+    WriteUInt32(centralDirectory_, Truncate32(offset));
+    centralDirectory_ += filename;
+
+    if (isCentralZip64)
+    {
+      WriteUInt16(centralDirectory_, ZIP64_EXTRA_FIELD);
+      WriteUInt16(centralDirectory_, static_cast<uint16_t>(extra.size()));
+      centralDirectory_ += extra;
+    }
+
+    entriesCount_++;
+  }
+
+
+  void ZipStreamWriter::Close()
+  {
+    if (isClosed_)
+    {
+      return;
+    }
+
+    isClosed_ = true;
+
+    const uint64_t centralDirectoryOffset = position_;
+    const uint64_t centralDirectorySize = centralDirectory_.size();
+
+    Write(centralDirectory_);
+
+    {
+      std::string empty;
+      centralDirectory_.swap(empty);
+    }
+
+    std::string end;
+
+    if (entriesCount_ >= MAX_UINT16 ||
+        centralDirectorySize >= MAX_UINT32 ||
+        centralDirectoryOffset >= MAX_UINT32)
+    {
+      const uint64_t zip64EndOffset = position_;
+
+      // ZIP64 end of central directory record
+      WriteUInt32(end, SIGNATURE_ZIP64_END);
+      WriteUInt64(end, 44);  // Size of the remaining of the record
+      WriteUInt16(end, VERSION_ZIP64);
+      WriteUInt16(end, VERSION_ZIP64);
+      WriteUInt32(end, 0);  // Number of this disk
+      WriteUInt32(end, 0);  // Disk of the central directory
+      WriteUInt64(end, entriesCount_);
+      WriteUInt64(end, entriesCount_);
+      WriteUInt64(end, centralDirectorySize);
+      WriteUInt64(end, centralDirectoryOffset);
+
+      // ZIP64 end of central directory locator
+      WriteUInt32(end, SIGNATURE_ZIP64_LOCATOR);
+      WriteUInt32(end, 0);  // Disk of the ZIP64 end of central directory
+      WriteUInt64(end, zip64EndOffset);
+      WriteUInt32(end, 1);  // Total number of disks
+    }
+
+    const uint16_t count = (entriesCount_ >= MAX_UINT16 ? MAX_UINT16 : static_cast<uint16_t>(entriesCount_));
+
+    WriteUInt32(end, SIGNATURE_END);
+    WriteUInt16(end, 0);  // Number of this disk
+    WriteUInt16(end, 0);  // Disk of the central directory
+    WriteUInt16(end, count);
+    WriteUInt16(end, count);
+    WriteUInt32(end, Truncate32(centralDirectorySize));
+    WriteUInt32(end, Truncate32(centralDirectoryOffset));
+    WriteUInt16(end, 0);  // Comment length
+
+    Write(end);
+  }
+}
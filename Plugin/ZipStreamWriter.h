@@ -0,0 +1,95 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#pragma once
+
+#include <boost/noncopyable.hpp>
+#include <stdint.h>
+#include <string>
+
+
+namespace OrthancPlugins
+{
+  // Writer of ZIP archives that never seeks backward in its output,
+  // and that only keeps the central directory in memory (a few dozen
+  // bytes per entry). The ZIP64 records are emitted only if the
+  // archive needs them (more than 65535 entries, or sizes/offsets
+  // above 4GB), so that small archives remain readable by old tools.
+  class ZipStreamWriter : public boost::noncopyable
+  {
+  public:
+    class IOutput : public boost::noncopyable
+    {
+    public:
+      virtual ~IOutput()
+      {
+      }
+
+      virtual void Write(const void* data,
+                         size_t size) = 0;
+    };
+
+  private:
+    IOutput&     output_;
+    bool         deflate_;
+    uint64_t     position_;
+    uint64_t     entriesCount_;
+    std::string  centralDirectory_;
+    uint16_t     dosTime_;
+    uint16_t     dosDate_;
+    bool         isClosed_;
+
+    void Write(const std::string& data);
+
+  public:
+    // If "deflate" is false, the entries are stored without compression
+    ZipStreamWriter(IOutput& output,
+                    bool deflate);
+
+    // The entry is stored uncompressed if the compression does not
+    // reduce its size (which is typical of compressed transfer syntaxes)
+    void AddEntry(const std::string& filename,
+                  const void* data,
+                  size_t size);
+
+    void AddEntry(const std::string& filename,
+                  const std::string& data)
+    {
+      AddEntry(filename, data.empty() ? NULL : data.c_str(), data.size());
+    }
+
+    // Writes the central directory, no entry can be added afterwards
+    void Close();
+
+    uint64_t GetArchiveSize() const
+    {
+      return position_;
+    }
+
+    uint64_t GetEntriesCount() const
+    {
+      return entriesCount_;
+    }
+  };
+}
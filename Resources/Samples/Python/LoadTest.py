@@ -0,0 +1,298 @@
+#!/usr/bin/python3
+
+# Orthanc - A Lightweight, RESTful DICOM Store
+# Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+# Department, University Hospital of Liege, Belgium
+# Copyright (C) 2017-2023 Osimis S.A., Belgium
+# Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+# Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+#
+# This program is free software: you can redistribute it and/or
+# modify it under the terms of the GNU Affero General Public License
+# as published by the Free Software Foundation, either version 3 of
+# the License, or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# Affero General Public License for more details.
+# 
+# You should have received a copy of the GNU Affero General Public License
+# along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+
+
+
+# Load test of a running Orthanc with the DICOMweb plugin. Three
+# scenarios reproduce the usual access patterns of the viewers and of
+# the modalities:
+#
+#  - "metadata": WADO-RS series metadata, as requested by a viewer
+#    when a study is opened
+#  - "frames": WADO-RS frames of a series retrieved one by one, in
+#    the order of the instances, as done by OHIF
+#  - "stow": bursts of concurrent STOW-RS requests
+#
+# For each scenario, the script reports the throughput and the
+# percentiles of the latency of the requests. The "metadata" and
+# "frames" scenarios use the studies that are already stored in
+# Orthanc. The "stow" scenario uploads the DICOM files given on the
+# command line, which are stored again by each burst.
+
+import argparse
+import concurrent.futures
+import math
+import os
+import sys
+import threading
+import time
+import uuid
+
+import requests
+
+
+parser = argparse.ArgumentParser(description = 'Load test of the DICOMweb plugin of Orthanc.')
+parser.add_argument('url', help = 'Root of the DICOMweb API (e.g. http://localhost:8042/dicom-web)')
+parser.add_argument('--username', help = 'Username of the HTTP authentication')
+parser.add_argument('--password', help = 'Password of the HTTP authentication')
+parser.add_argument('--scenarios', default = 'metadata,frames,stow',
+                    help = 'Comma-separated list of the scenarios to run (default: metadata,frames,stow)')
+parser.add_argument('--threads', type = int, default = 8,
+                    help = 'Number of concurrent clients (default: 8)')
+parser.add_argument('--studies', type = int, default = 10,
+                    help = 'Maximum number of studies used by "metadata" and "frames" (default: 10)')
+parser.add_argument('--repeat', type = int, default = 3,
+                    help = 'Number of times each series is processed by "metadata" and "frames" (default: 3)')
+parser.add_argument('--stow-bursts', type = int, default = 5,
+                    help = 'Number of STOW-RS bursts (default: 5)')
+parser.add_argument('--stow-instances', type = int, default = 10,
+                    help = 'Number of instances in each STOW-RS request (default: 10)')
+parser.add_argument('files', nargs = '*', help = 'DICOM files to be sent by the "stow" scenario')
+
+args = parser.parse_args()
+
+URL = args.url.rstrip('/')
+SCENARIOS = args.scenarios.split(',')
+
+for s in SCENARIOS:
+    if not s in [ 'metadata', 'frames', 'stow' ]:
+        print('Unknown scenario: %s' % s)
+        sys.exit(-1)
+
+if 'stow' in SCENARIOS and len(args.files) == 0:
+    print('The "stow" scenario needs at least one DICOM file')
+    sys.exit(-1)
+
+AUTH = None
+if args.username != None:
+    AUTH = requests.auth.HTTPBasicAuth(args.username, args.password)
+
+# One HTTP session per thread, to reuse the connections
+LOCAL = threading.local()
+
+def GetSession():
+    if not hasattr(LOCAL, 'session'):
+        LOCAL.session = requests.Session()
+        LOCAL.session.auth = AUTH
+    return LOCAL.session
+
+
+class Statistics:
+    def __init__(self, name):
+        self.name = name
+        self.lock = threading.Lock()
+        self.latencies = []
+        self.errors = 0
+        self.size = 0
+        self.start = time.time()
+        self.end = self.start
+
+    def Add(self, latency, size, success):
+        with self.lock:
+            self.latencies.append(latency)
+            self.size += size
+            if not success:
+                self.errors += 1
+
+    def Stop(self):
+        self.end = time.time()
+
+    def GetPercentile(self, q):
+        # Nearest-rank method
+        s = sorted(self.latencies)
+        index = max(0, min(len(s) - 1, int(math.ceil(q * len(s))) - 1))
+        return s[index]
+
+    def Print(self):
+        elapsed = max(self.end - self.start, 0.000001)
+        count = len(self.latencies)
+        print('%s:' % self.name)
+        print('  requests: %d (%d errors) in %.2f s' % (count, self.errors, elapsed))
+
+        if count > 0:
+            print('  throughput: %.2f requests/s, %.2f MB/s' % (count / elapsed, self.size / elapsed / (1024.0 * 1024.0)))
+            print('  latency (ms): p50=%.1f p95=%.1f p99=%.1f max=%.1f' % (
+                1000.0 * self.GetPercentile(0.5), 1000.0 * self.GetPercentile(0.95),
+                1000.0 * self.GetPercentile(0.99), 1000.0 * max(self.latencies)))
+        print('')
+
+
+def Request(statistics, method, uri, headers = {}, body = None):
+    start = time.time()
+    size = 0
+    success = False
+
+    try:
+        r = GetSession().request(method, URL + uri, headers = headers, data = body)
+        size = len(r.content) + (0 if body == None else len(body))
+        success = (r.status_code >= 200 and r.status_code < 300)
+    except requests.exceptions.RequestException as e:
+        print('Error in %s %s: %s' % (method, uri, e))
+
+    if statistics != None:
+        statistics.Add(time.time() - start, size, success)
+
+    if success:
+        return r
+    else:
+        return None
+
+
+def GetValue(dataset, tag):
+    if tag in dataset and 'Value' in dataset[tag] and len(dataset[tag]['Value']) > 0:
+        return dataset[tag]['Value'][0]
+    else:
+        return None
+
+
+def ListSeries():
+    series = []
+
+    r = Request(None, 'GET', '/studies?limit=%d' % args.studies, { 'Accept' : 'application/dicom+json' })
+    if r == None:
+        print('Cannot list the studies, is Orthanc running?')
+        sys.exit(-1)
+
+    for study in r.json():
+        studyUid = GetValue(study, '0020000D')
+        s = Request(None, 'GET', '/studies/%s/series' % studyUid, { 'Accept' : 'application/dicom+json' })
+        if s != None:
+            for item in s.json():
+                series.append((studyUid, GetValue(item, '0020000E')))
+
+    return series
+
+
+def RunMetadata(series):
+    statistics = Statistics('WADO-RS series metadata')
+
+    def Process(s):
+        Request(statistics, 'GET', '/studies/%s/series/%s/metadata' % s, { 'Accept' : 'application/dicom+json' })
+
+    with concurrent.futures.ThreadPoolExecutor(max_workers = args.threads) as executor:
+        list(executor.map(Process, series * args.repeat))
+
+    statistics.Stop()
+    return statistics
+
+
+def RunFrames(series):
+    # First, list the frames of each series, in the order of the
+    # instance numbers, as a viewer would do with the metadata
+    frames = []
+
+    for (studyUid, seriesUid) in series:
+        r = Request(None, 'GET', '/studies/%s/series/%s/metadata' % (studyUid, seriesUid),
+                    { 'Accept' : 'application/dicom+json' })
+        if r != None:
+            instances = []
+            for instance in r.json():
+                if '00280010' in instance:  # Only the images, that have "Rows"
+                    instanceNumber = GetValue(instance, '00200013')
+                    numberOfFrames = GetValue(instance, '00280008')
+                    instances.append((0 if instanceNumber == None else int(instanceNumber),
+                                      GetValue(instance, '00080018'),
+                                      1 if numberOfFrames == None else int(numberOfFrames)))
+
+            instances.sort()
+            for (instanceNumber, sopInstanceUid, numberOfFrames) in instances:
+                for frame in range(numberOfFrames):
+                    frames.append('/studies/%s/series/%s/instances/%s/frames/%d' % (
+                        studyUid, seriesUid, sopInstanceUid, frame + 1))
+
+    statistics = Statistics('WADO-RS frames (%d frames)' % len(frames))
+
+    def Process(uri):
+        Request(statistics, 'GET', uri, {
+            'Accept' : 'multipart/related; type="application/octet-stream"; transfer-syntax=*'
+        })
+
+    with concurrent.futures.ThreadPoolExecutor(max_workers = args.threads) as executor:
+        list(executor.map(Process, frames * args.repeat))
+
+    statistics.Stop()
+    return statistics
+
+
+def RunStow():
+    contents = []
+    for path in args.files:
+        if os.path.isfile(path):
+            with open(path, 'rb') as f:
+                contents.append(f.read())
+
+    # Each request contains "--stow-instances" files, reused cyclically
+    bodies = []
+    for i in range(args.threads):
+        boundary = str(uuid.uuid4())
+        body = bytearray()
+
+        for j in range(args.stow_instances):
+            content = contents[(i * args.stow_instances + j) % len(contents)]
+            body += bytearray('--%s\r\n' % boundary, 'ascii')
+            body += bytearray('Content-Length: %d\r\n' % len(content), 'ascii')
+            body += bytearray('Content-Type: application/dicom\r\n\r\n', 'ascii')
+            body += content
+            body += bytearray('\r\n', 'ascii')
+
+        body += bytearray('--%s--' % boundary, 'ascii')
+        bodies.append((boundary, bytes(body)))
+
+    statistics = Statistics('STOW-RS bursts (%d requests of %d instances per burst)' % (args.threads, args.stow_instances))
+
+    def Process(item):
+        (boundary, body) = item
+        Request(statistics, 'POST', '/studies', {
+            'Accept' : 'application/dicom+json',
+            'Content-Type' : 'multipart/related; type="application/dicom"; boundary=%s' % boundary,
+        }, body)
+
+    # In each burst, all the clients send their request at the same time
+    with concurrent.futures.ThreadPoolExecutor(max_workers = args.threads) as executor:
+        for i in range(args.stow_bursts):
+            list(executor.map(Process, bodies))
+
+    statistics.Stop()
+    return statistics
+
+
+results = []
+
+if 'metadata' in SCENARIOS or 'frames' in SCENARIOS:
+    series = ListSeries()
+    print('Using %d series\n' % len(series))
+
+    if 'metadata' in SCENARIOS:
+        results.append(RunMetadata(series))
+
+    if 'frames' in SCENARIOS:
+        results.append(RunFrames(series))
+
+if 'stow' in SCENARIOS:
+    results.append(RunStow())
+
+for statistics in results:
+    statistics.Print()
+
+if any(s.errors > 0 for s in results):
+    sys.exit(1)
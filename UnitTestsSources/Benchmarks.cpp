@@ -0,0 +1,436 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+/**
+ * Micro-benchmarks of the hot paths of the plugin that do not need a
+ * running Orthanc server. Each benchmark prints its throughput on the
+ * standard output. Use "--gtest_filter" to run only some of them. The
+ * end-to-end load test against a running Orthanc is
+ * "Resources/Samples/Python/LoadTest.py".
+ **/
+
+#include <gtest/gtest.h>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include <ChunkedBuffer.h>
+#include <Compatibility.h>
+#include <DicomFormat/DicomMap.h>
+#include <HttpServer/MultipartStreamReader.h>
+#include <Images/Image.h>
+#include <algorithm>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+
+#include "../Plugin/DicomWebFormatter.h"
+#include "../Plugin/FramesRequestParser.h"
+#include "../Plugin/RenderingKernels.h"
+#include "../Plugin/StreamingMultipartParser.h"
+
+using namespace OrthancPlugins;
+
+
+namespace
+{
+  class BenchmarkTimer : public boost::noncopyable
+  {
+  private:
+    std::string               name_;
+    boost::posix_time::ptime  start_;
+
+  public:
+    explicit BenchmarkTimer(const std::string& name) :
+      name_(name),
+      start_(boost::posix_time::microsec_clock::universal_time())
+    {
+    }
+
+    // "bytes" is only used to report a bandwidth if it is non-zero
+    void Report(unsigned int iterations,
+                uint64_t bytes) const
+    {
+      const int64_t elapsed = (boost::posix_time::microsec_clock::universal_time() - start_).total_microseconds();
+
+      std::cout << std::left << std::setw(50) << name_ << std::right << std::fixed << std::setprecision(2)
+                << std::setw(12) << (iterations == 0 ? 0.0 : static_cast<double>(elapsed) / static_cast<double>(iterations))
+                << " us/iteration";
+
+      if (bytes != 0 &&
+          elapsed > 0)
+      {
+        // Bytes per microsecond, which gives a bandwidth in MB/s
+        std::cout << std::setw(12) << static_cast<double>(bytes) / static_cast<double>(elapsed) << " MB/s";
+      }
+
+      std::cout << std::endl;
+    }
+  };
+
+
+  class PartsCounter :
+    public StreamingMultipartParser::IHandler,
+    public Orthanc::MultipartStreamReader::IHandler
+  {
+  private:
+    size_t    count_;
+    uint64_t  size_;
+
+  public:
+    PartsCounter() :
+      count_(0),
+      size_(0)
+    {
+    }
+
+    virtual void StartPart(const StreamingMultipartParser::HttpHeaders& headers) ORTHANC_OVERRIDE
+    {
+      count_++;
+    }
+
+    virtual void AddPartContent(const void* data,
+                                size_t size) ORTHANC_OVERRIDE
+    {
+      size_ += size;
+    }
+
+    virtual void EndPart() ORTHANC_OVERRIDE
+    {
+    }
+
+    virtual void HandlePart(const Orthanc::MultipartStreamReader::HttpHeaders& headers,
+                            const void* part,
+                            size_t size) ORTHANC_OVERRIDE
+    {
+      count_++;
+      size_ += size;
+    }
+
+    size_t GetCount() const
+    {
+      return count_;
+    }
+
+    uint64_t GetSize() const
+    {
+      return size_;
+    }
+  };
+}
+
+
+static const size_t MULTIPART_PARTS_COUNT = 200;
+static const size_t MULTIPART_PART_SIZE = 512 * 1024;
+static const size_t MULTIPART_CHUNK_SIZE = 64 * 1024;  // Typical size of the chunks received by the HTTP server
+
+
+// Body of a STOW-RS request, or of a WADO-RS answer, with instances
+// of 512KB whose content is such that the boundary is never found
+static void CreateMultipartBody(std::string& body,
+                                const std::string& boundary)
+{
+  Orthanc::ChunkedBuffer buffer;
+
+  for (size_t i = 0; i < MULTIPART_PARTS_COUNT; i++)
+  {
+    buffer.AddChunk("--" + boundary + "\r\nContent-Type: application/dicom\r\n\r\n");
+
+    std::string part(MULTIPART_PART_SIZE, '\0');
+    for (size_t j = 0; j < part.size(); j++)
+    {
+      part[j] = static_cast<char>((j * 7 + i) % 251);
+    }
+
+    buffer.AddChunk(part);
+    buffer.AddChunk("\r\n");
+  }
+
+  buffer.AddChunk("--" + boundary + "--\r\n");
+  buffer.Flatten(body);
+}
+
+
+static void CreateInstanceTags(Orthanc::DicomMap& tags,
+                               unsigned int index)
+{
+  const std::string suffix = boost::lexical_cast<std::string>(index);
+
+  tags.SetValue(Orthanc::DICOM_TAG_SPECIFIC_CHARACTER_SET, "ISO_IR 192", false);
+  tags.SetValue(Orthanc::DICOM_TAG_SOP_CLASS_UID, "1.2.840.10008.5.1.4.1.1.2", false);
+  tags.SetValue(Orthanc::DICOM_TAG_SOP_INSTANCE_UID, "1.2.276.0.7230010.3.1.4.8323329.1." + suffix, false);
+  tags.SetValue(Orthanc::DICOM_TAG_STUDY_INSTANCE_UID, "1.2.276.0.7230010.3.1.2.8323329.1", false);
+  tags.SetValue(Orthanc::DICOM_TAG_SERIES_INSTANCE_UID, "1.2.276.0.7230010.3.1.3.8323329.1", false);
+  tags.SetValue(Orthanc::DicomTag(0x0020, 0x0013), suffix, false);  // InstanceNumber
+  tags.SetValue(Orthanc::DICOM_TAG_ROWS, "512", false);
+  tags.SetValue(Orthanc::DICOM_TAG_COLUMNS, "512", false);
+  tags.SetValue(Orthanc::DICOM_TAG_NUMBER_OF_FRAMES, "1", false);
+  tags.SetValue(Orthanc::DicomTag(0x0008, 0x0060), "CT", false);  // Modality
+  tags.SetValue(Orthanc::DicomTag(0x0010, 0x0010), "Doe^John", false);  // PatientName
+  tags.SetValue(Orthanc::DicomTag(0x0018, 0x0050), "0.625", false);  // SliceThickness
+  tags.SetValue(Orthanc::DicomTag(0x0020, 0x0032), "-250\\-250\\" + suffix, false);  // ImagePositionPatient
+  tags.SetValue(Orthanc::DicomTag(0x0020, 0x0037), "1\\0\\0\\0\\1\\0", false);  // ImageOrientationPatient
+  tags.SetValue(Orthanc::DicomTag(0x0028, 0x0030), "0.488\\0.488", false);  // PixelSpacing
+  tags.SetValue(Orthanc::DicomTag(0x0028, 0x0100), "16", false);  // BitsAllocated
+  tags.SetValue(Orthanc::DicomTag(0x0028, 0x1050), "40", false);  // WindowCenter
+  tags.SetValue(Orthanc::DicomTag(0x0028, 0x1051), "400", false);  // WindowWidth
+}
+
+
+/**
+ * "DicomWebFormatter::Apply()" and "DicomWebFormatter::HttpWriter"
+ * need the Orthanc core to encode a DICOM file as DICOMweb JSON. This
+ * benchmark covers the part that is done by the plugin in the fast
+ * path of the series metadata: Conversion of the main DICOM tags to
+ * DICOMweb JSON, then serialization in a JSON array as "HttpWriter".
+ **/
+TEST(Benchmark, SeriesMetadataSerialization)
+{
+  const unsigned int INSTANCES_COUNT = 1000;
+
+  std::vector<Orthanc::DicomMap*> instances;
+  for (unsigned int i = 0; i < INSTANCES_COUNT; i++)
+  {
+    instances.push_back(new Orthanc::DicomMap);
+    CreateInstanceTags(*instances.back(), i);
+  }
+
+  const unsigned int count = 10;
+  uint64_t size = 0;
+
+  BenchmarkTimer timer("Series metadata of 1000 instances");
+
+  for (unsigned int k = 0; k < count; k++)
+  {
+    Orthanc::ChunkedBuffer buffer;
+    buffer.AddChunk("[");
+
+    for (size_t i = 0; i < instances.size(); i++)
+    {
+      Json::Value json;
+      ASSERT_TRUE(DicomWebFormatter::ConvertToDicomWebJson(json, *instances[i]));
+
+      std::string item;
+      WriteFastJson(item, json);
+
+      if (i != 0)
+      {
+        buffer.AddChunk(",");
+      }
+
+      buffer.AddChunk(item);
+    }
+
+    buffer.AddChunk("]");
+
+    std::string answer;
+    buffer.Flatten(answer);
+    size += answer.size();
+  }
+
+  timer.Report(count, size);
+
+  for (size_t i = 0; i < instances.size(); i++)
+  {
+    delete instances[i];
+  }
+}
+
+
+static void FillTestImage(Orthanc::ImageAccessor& image)
+{
+  // Deterministic pseudo-random content in the range of a CT
+  uint32_t seed = 42;
+
+  for (unsigned int y = 0; y < image.GetHeight(); y++)
+  {
+    int16_t* p = reinterpret_cast<int16_t*>(image.GetRow(y));
+
+    for (unsigned int x = 0; x < image.GetWidth(); x++)
+    {
+      seed = seed * 1103515245u + 12345u;
+      p[x] = static_cast<int16_t>(-1024 + static_cast<int>((seed >> 8) % 4096u));
+    }
+  }
+}
+
+
+// Comparison of the per-pixel evaluation with the lookup table on a
+// 512x512 CT slice
+TEST(Benchmark, ApplyWindowing)
+{
+  Orthanc::Image source(Orthanc::PixelFormat_SignedGrayscale16, 512, 512, false);
+  FillTestImage(source);
+
+  Orthanc::Image target(Orthanc::PixelFormat_Grayscale8, 512, 512, false);
+
+  const WindowingMode modes[] = {
+    WindowingMode_Linear,
+    WindowingMode_Sigmoid
+  };
+
+  for (size_t i = 0; i < sizeof(modes) / sizeof(WindowingMode); i++)
+  {
+    for (unsigned int lookup = 0; lookup < 2; lookup++)
+    {
+      const unsigned int count = 50;
+
+      BenchmarkTimer timer(std::string("Windowing, ") + (modes[i] == WindowingMode_Linear ? "linear" : "sigmoid") +
+                           (lookup == 1 ? ", lookup table" : ", per pixel"));
+
+      for (unsigned int k = 0; k < count; k++)
+      {
+        RenderingKernels::ApplyWindowing(target, source, 40, 400, modes[i], 1, -1024, lookup == 1);
+      }
+
+      timer.Report(count, static_cast<uint64_t>(count) * source.GetPitch() * source.GetHeight());
+    }
+  }
+}
+
+
+// Parameters of the requests issued by a viewer that loads the
+// frames of a series one by one
+TEST(Benchmark, FramesRequestParser)
+{
+  const char* headersKeys[] = { "host", "accept", "user-agent" };
+  const char* headersValues[] = {
+    "localhost:8042",
+    "multipart/related; type=\"application/octet-stream\"; transfer-syntax=*",
+    "Mozilla/5.0"
+  };
+
+  const char* groups[] = { "1.2.3", "1.2.3.4", "1.2.3.4.5", "1%2C2%2C3%2C4" };
+
+  OrthancPluginHttpRequest request;
+  memset(&request, 0, sizeof(request));
+  request.method = OrthancPluginHttpMethod_Get;
+  request.groupsCount = 4;
+  request.groups = groups;
+  request.headersCount = 3;
+  request.headersKeys = headersKeys;
+  request.headersValues = headersValues;
+
+  const unsigned int count = 100000;
+
+  {
+    BenchmarkTimer timer("ParseTransferSyntax()");
+
+    for (unsigned int i = 0; i < count; i++)
+    {
+      Orthanc::DicomTransferSyntax syntax = Orthanc::DicomTransferSyntax_JPEG2000;
+      FramesRequestParser::ParseTransferSyntax(syntax, &request);
+      ASSERT_EQ(Orthanc::DicomTransferSyntax_JPEG2000, syntax);
+    }
+
+    timer.Report(count, 0);
+  }
+
+  {
+    BenchmarkTimer timer("ParseFrameList()");
+
+    for (unsigned int i = 0; i < count; i++)
+    {
+      std::list<unsigned int> frames;
+      FramesRequestParser::ParseFrameList(frames, &request);
+      ASSERT_EQ(4u, frames.size());
+    }
+
+    timer.Report(count, 0);
+  }
+}
+
+
+// Parser used by STOW-RS if "StowRsSpillThreshold" is set
+TEST(Benchmark, StreamingMultipartParser)
+{
+  std::string body;
+  CreateMultipartBody(body, "BOUNDARY");
+
+  const unsigned int count = 5;
+
+  BenchmarkTimer timer("StreamingMultipartParser, 200 parts of 512KB");
+
+  for (unsigned int k = 0; k < count; k++)
+  {
+    PartsCounter counter;
+
+    {
+      StreamingMultipartParser parser(counter, "BOUNDARY");
+
+      for (size_t pos = 0; pos < body.size(); pos += MULTIPART_CHUNK_SIZE)
+      {
+        parser.AddChunk(body.c_str() + pos, std::min(MULTIPART_CHUNK_SIZE, body.size() - pos));
+      }
+
+      parser.CloseStream();
+    }
+
+    ASSERT_EQ(MULTIPART_PARTS_COUNT, counter.GetCount());
+    ASSERT_EQ(MULTIPART_PARTS_COUNT * MULTIPART_PART_SIZE, counter.GetSize());
+  }
+
+  timer.Report(count, static_cast<uint64_t>(count) * body.size());
+}
+
+
+// Parser used by STOW-RS by default, and by the answers of the
+// WADO-RS client ("WadoRetrieveAnswer")
+TEST(Benchmark, MultipartStreamReader)
+{
+  std::string body;
+  CreateMultipartBody(body, "BOUNDARY");
+
+  const unsigned int count = 5;
+
+  BenchmarkTimer timer("MultipartStreamReader, 200 parts of 512KB");
+
+  for (unsigned int k = 0; k < count; k++)
+  {
+    PartsCounter counter;
+
+    {
+      Orthanc::MultipartStreamReader reader("BOUNDARY");
+      reader.SetHandler(counter);
+
+      for (size_t pos = 0; pos < body.size(); pos += MULTIPART_CHUNK_SIZE)
+      {
+        reader.AddChunk(body.c_str() + pos, std::min(MULTIPART_CHUNK_SIZE, body.size() - pos));
+      }
+
+      reader.CloseStream();
+    }
+
+    ASSERT_EQ(MULTIPART_PARTS_COUNT, counter.GetCount());
+    ASSERT_EQ(MULTIPART_PARTS_COUNT * MULTIPART_PART_SIZE, counter.GetSize());
+  }
+
+  timer.Report(count, static_cast<uint64_t>(count) * body.size());
+}
+
+
+int main(int argc, char **argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
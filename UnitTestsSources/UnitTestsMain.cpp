@@ -24,9 +24,36 @@
 #include <gtest/gtest.h>
 #include <boost/lexical_cast.hpp>
 #include <boost/algorithm/string/predicate.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/thread.hpp>
 
+#include <Images/Image.h>
+#include <cstring>
+#include <iostream>
+#include <zlib.h>
+
+#include "../Plugin/BulkDataCache.h"
+#include "../Plugin/CacheWarmer.h"
 #include "../Plugin/Configuration.h"
+#include "../Plugin/DicomElementReader.h"
+#include "../Plugin/DicomHeaderScanner.h"
+#include "../Plugin/DicomWebFormatter.h"
 #include "../Plugin/DicomWebServers.h"
+#include "../Plugin/FramesRequestParser.h"
+#include "../Plugin/HttpByteRange.h"
+#include "../Plugin/LatencyMetrics.h"
+#include "../Plugin/QidoResultsCache.h"
+#include "../Plugin/RenderedFramesCache.h"
+#include "../Plugin/RenderingKernels.h"
+#include "../Plugin/ResourceLookupCache.h"
+#include "../Plugin/SeriesMetadataRecords.h"
+#include "../Plugin/SlidingWindowMetrics.h"
+#include "../Plugin/SpillableBuffer.h"
+#include "../Plugin/StreamingMultipartParser.h"
+#include "../Plugin/TranscodedInstancesCache.h"
+#include "../Plugin/UncompressedFramesIndex.h"
+#include "../Plugin/WorkersPool.h"
+#include "../Plugin/ZipStreamWriter.h"
 
 using namespace OrthancPlugins;
 
@@ -77,6 +104,2361 @@ TEST(DicomWebServers, Serialization)
 }
 
 
+static void AddElement(std::string& target,
+                       uint16_t group,
+                       uint16_t element,
+                       const char* vr,  // NULL for implicit VR
+                       const std::string& value,
+                       bool undefinedLength = false)
+{
+  target.push_back(static_cast<char>(group & 0xff));
+  target.push_back(static_cast<char>(group >> 8));
+  target.push_back(static_cast<char>(element & 0xff));
+  target.push_back(static_cast<char>(element >> 8));
+
+  const uint32_t length = (undefinedLength ? 0xffffffffu : static_cast<uint32_t>(value.size()));
+
+  if (vr != NULL &&
+      group != 0xfffe)
+  {
+    target.append(vr, 2);
+
+    const std::string s(vr);
+    if (s == "OB" || s == "OD" || s == "OF" || s == "OL" || s == "OV" ||
+        s == "OW" || s == "SQ" || s == "UN" || s == "UT")
+    {
+      target.append(2, '\0');
+    }
+    else
+    {
+      target.push_back(static_cast<char>(length & 0xff));
+      target.push_back(static_cast<char>(length >> 8));
+      target.append(value);
+      return;
+    }
+  }
+
+  for (unsigned int i = 0; i < 4; i++)
+  {
+    target.push_back(static_cast<char>((length >> (8 * i)) & 0xff));
+  }
+
+  target.append(value);
+}
+
+
+static std::string CreateDicomFile(const std::string& transferSyntax,
+                                   const std::string& dataset)
+{
+  std::string s(128, '\0');
+  s += "DICM";
+  AddElement(s, 0x0002, 0x0001, "OB", std::string("\0\1", 2));
+  AddElement(s, 0x0002, 0x0010, "UI", transferSyntax);
+  return s + dataset;
+}
+
+
+TEST(DicomElementReader, Basic)
+{
+  // Sequence whose VR is "UN", with an item in implicit VR
+  std::string item;
+  AddElement(item, 0x0008, 0x1150, NULL, "1.2\0");
+  AddElement(item, 0xfffe, 0xe00d, NULL, "");
+
+  std::string dataset;
+  AddElement(dataset, 0x0008, 0x0018, "UI", " 1.2.3\0");
+  AddElement(dataset, 0x0008, 0x1140, "UN", "", true);
+  AddElement(dataset, 0xfffe, 0xe000, NULL, item, true);
+  AddElement(dataset, 0xfffe, 0xe0dd, NULL, "");
+  AddElement(dataset, 0x0010, 0x0010, "PN", "Doe");
+
+  const std::string dicom = CreateDicomFile("1.2.840.10008.1.2.1", dataset);
+  DicomElementReader reader(dicom.c_str(), dicom.size());
+
+  size_t position;
+  std::string transferSyntax;
+  ASSERT_TRUE(reader.ReadMetaHeader(position, transferSyntax));
+  ASSERT_EQ("1.2.840.10008.1.2.1", transferSyntax);
+  ASSERT_EQ(dicom.size() - dataset.size(), position);
+
+  bool implicit = true;
+  ASSERT_TRUE(DicomElementReader::IsLittleEndian(implicit, transferSyntax));
+  ASSERT_FALSE(implicit);
+  ASSERT_TRUE(DicomElementReader::IsLittleEndian(implicit, "1.2.840.10008.1.2"));
+  ASSERT_TRUE(implicit);
+  ASSERT_FALSE(DicomElementReader::IsLittleEndian(implicit, "1.2.840.10008.1.2.2"));
+  ASSERT_FALSE(DicomElementReader::IsLittleEndian(implicit, "1.2.840.10008.1.2.1.99"));
+
+  DicomElementReader::Element element;
+  ASSERT_TRUE(reader.ReadElement(element, position, dicom.size(), false));
+  ASSERT_EQ(0x0008, element.group_);
+  ASSERT_EQ(0x0018, element.element_);
+  ASSERT_TRUE(element.IsVR("UI"));
+  ASSERT_EQ(8u, element.GetHeaderSize());
+  ASSERT_EQ("1.2.3", DicomElementReader::StripPadding(reader.GetValue(element), element.length_));
+  ASSERT_TRUE(reader.SkipValue(position, element, dicom.size(), 0));
+
+  ASSERT_TRUE(reader.ReadElement(element, position, dicom.size(), false));
+  ASSERT_EQ(0x1140, element.element_);
+  ASSERT_TRUE(element.IsVR("UN"));
+  ASSERT_TRUE(element.HasUndefinedLength());
+  ASSERT_TRUE(element.implicitItems_);
+  ASSERT_EQ(12u, element.GetHeaderSize());
+  ASSERT_TRUE(reader.SkipValue(position, element, dicom.size(), 0));
+
+  // The depth of the nested sequences is bounded
+  size_t tmp = position;
+  ASSERT_FALSE(reader.SkipValue(tmp, element, dicom.size(), DicomElementReader::MAX_DEPTH));
+
+  ASSERT_TRUE(reader.ReadElement(element, position, dicom.size(), false));
+  ASSERT_EQ(0x0010, element.group_);
+  ASSERT_TRUE(element.IsVR("PN"));
+  ASSERT_FALSE(reader.ReadElement(element, position, dicom.size() - 1, false));  // Truncated value
+  ASSERT_TRUE(reader.SkipValue(position, element, dicom.size(), 0));
+  ASSERT_EQ(dicom.size(), position);
+  ASSERT_FALSE(reader.ReadElement(element, position, dicom.size(), false));
+
+  ASSERT_FALSE(DicomElementReader("nope", 4).ReadMetaHeader(position, transferSyntax));
+}
+
+
+TEST(DicomHeaderScanner, Basic)
+{
+  std::set<Orthanc::DicomTag> tags;
+  tags.insert(Orthanc::DICOM_TAG_SOP_INSTANCE_UID);
+  tags.insert(Orthanc::DICOM_TAG_STUDY_INSTANCE_UID);
+  tags.insert(Orthanc::DICOM_TAG_SERIES_INSTANCE_UID);
+
+  OrthancPlugins::DicomHeaderScanner::Values values;
+
+  for (unsigned int implicit = 0; implicit < 2; implicit++)
+  {
+    const char* ui = (implicit ? NULL : "UI");
+
+    // A sequence with undefined length, in which an item with undefined length
+    std::string item;
+    AddElement(item, 0x0008, 0x1150, ui, "1.2.3.4");
+    AddElement(item, 0xfffe, 0xe00d, NULL, "");
+
+    std::string sequence;
+    AddElement(sequence, 0xfffe, 0xe000, NULL, item, true);
+    AddElement(sequence, 0xfffe, 0xe000, NULL, std::string(16, 'x'));  // Item with defined length
+    AddElement(sequence, 0xfffe, 0xe0dd, NULL, "");
+
+    std::string dataset;
+    AddElement(dataset, 0x0008, 0x0016, ui, "1.2.840.10008.5.1.4.1.1.2");
+    AddElement(dataset, 0x0008, 0x0018, ui, std::string("1.2.3\0", 6));
+    AddElement(dataset, 0x0008, 0x1140, (implicit ? NULL : "SQ"), sequence, true);
+    AddElement(dataset, 0x0010, 0x0010, (implicit ? NULL : "PN"), "Doe^John");
+    AddElement(dataset, 0x0020, 0x000d, ui, "1.2.4");
+    AddElement(dataset, 0x0020, 0x000e, ui, " 1.2.5 ");
+    AddElement(dataset, 0x7fe0, 0x0010, (implicit ? NULL : "OB"), "garbage: not scanned", true);
+
+    const std::string dicom = CreateDicomFile(implicit ? "1.2.840.10008.1.2" : "1.2.840.10008.1.2.4.50", dataset);
+
+    ASSERT_TRUE(OrthancPlugins::DicomHeaderScanner::Scan(values, tags, dicom.c_str(), dicom.size()));
+    ASSERT_EQ(3u, values.size());
+    ASSERT_EQ("1.2.3", values[Orthanc::DICOM_TAG_SOP_INSTANCE_UID]);
+    ASSERT_EQ("1.2.4", values[Orthanc::DICOM_TAG_STUDY_INSTANCE_UID]);
+    ASSERT_EQ("1.2.5", values[Orthanc::DICOM_TAG_SERIES_INSTANCE_UID]);
+
+    // Truncated file
+    ASSERT_FALSE(OrthancPlugins::DicomHeaderScanner::Scan(values, tags, dicom.c_str(), 132 + 60));
+    ASSERT_TRUE(values.empty());
+
+    // Missing tags are not reported
+    std::set<Orthanc::DicomTag> others;
+    others.insert(Orthanc::DICOM_TAG_SOP_CLASS_UID);
+    others.insert(Orthanc::DicomTag(0x0008, 0x0060));
+    ASSERT_TRUE(OrthancPlugins::DicomHeaderScanner::Scan(values, others, dicom.c_str(), dicom.size()));
+    ASSERT_EQ(1u, values.size());
+    ASSERT_EQ("1.2.840.10008.5.1.4.1.1.2", values[Orthanc::DICOM_TAG_SOP_CLASS_UID]);
+  }
+
+  {
+    // Unsupported transfer syntaxes
+    std::string dataset;
+    AddElement(dataset, 0x0008, 0x0018, "UI", "1.2.3");
+    const std::string bigEndian = CreateDicomFile("1.2.840.10008.1.2.2", dataset);
+    ASSERT_FALSE(OrthancPlugins::DicomHeaderScanner::Scan(values, tags, bigEndian.c_str(), bigEndian.size()));
+    const std::string deflated = CreateDicomFile("1.2.840.10008.1.2.1.99", dataset);
+    ASSERT_FALSE(OrthancPlugins::DicomHeaderScanner::Scan(values, tags, deflated.c_str(), deflated.size()));
+  }
+
+  ASSERT_FALSE(OrthancPlugins::DicomHeaderScanner::Scan(values, tags, "nope", 4));
+}
+
+
+TEST(DicomHeaderScanner, RemoveLargeBinaryElements)
+{
+  const std::string smallBinary(8, 'a');
+  const std::string largeBinary(64, 'b');
+
+  // Source dataset: a large "OF" array nested in two levels of
+  // sequences, a small "OB" element, and a large "OB" element
+  std::string nestedItem;
+  AddElement(nestedItem, 0x0066, 0x0016, "OF", largeBinary);
+  AddElement(nestedItem, 0x0066, 0x0017, "UL", "1234");
+  AddElement(nestedItem, 0xfffe, 0xe00d, NULL, "");
+
+  std::string nestedSequence;
+  AddElement(nestedSequence, 0xfffe, 0xe000, NULL, nestedItem, true);
+  AddElement(nestedSequence, 0xfffe, 0xe0dd, NULL, "");
+
+  std::string item;
+  AddElement(item, 0x0066, 0x0002, "SQ", nestedSequence, true);
+  AddElement(item, 0x0066, 0x0009, "CS", "YES ");
+
+  std::string sequence;
+  AddElement(sequence, 0xfffe, 0xe000, NULL, item);
+
+  std::string dataset;
+  AddElement(dataset, 0x0008, 0x0018, "UI", "1.2.3");
+  AddElement(dataset, 0x0066, 0x0001, "SQ", sequence);
+  AddElement(dataset, 0x0067, 0x0010, "OB", smallBinary);
+  AddElement(dataset, 0x0069, 0x0010, "OB", largeBinary);
+  AddElement(dataset, 0x7fe0, 0x0010, "OW", std::string(32, 'p'));
+
+  // Expected dataset, with the lengths of the defined-length
+  // sequence and item recomputed
+  std::string expectedNestedItem;
+  AddElement(expectedNestedItem, 0x0066, 0x0017, "UL", "1234");
+  AddElement(expectedNestedItem, 0xfffe, 0xe00d, NULL, "");
+
+  std::string expectedNestedSequence;
+  AddElement(expectedNestedSequence, 0xfffe, 0xe000, NULL, expectedNestedItem, true);
+  AddElement(expectedNestedSequence, 0xfffe, 0xe0dd, NULL, "");
+
+  std::string expectedItem;
+  AddElement(expectedItem, 0x0066, 0x0002, "SQ", expectedNestedSequence, true);
+  AddElement(expectedItem, 0x0066, 0x0009, "CS", "YES ");
+
+  std::string expectedSequence;
+  AddElement(expectedSequence, 0xfffe, 0xe000, NULL, expectedItem);
+
+  std::string expectedDataset;
+  AddElement(expectedDataset, 0x0008, 0x0018, "UI", "1.2.3");
+  AddElement(expectedDataset, 0x0066, 0x0001, "SQ", expectedSequence);
+  AddElement(expectedDataset, 0x0067, 0x0010, "OB", smallBinary);
+  AddElement(expectedDataset, 0x7fe0, 0x0010, "OW", "");  // Emptied pixel data
+
+  const std::string dicom = CreateDicomFile("1.2.840.10008.1.2.1", dataset);
+
+  std::string reduced;
+  OrthancPlugins::DicomHeaderScanner::LargeElements removed;
+  ASSERT_TRUE(OrthancPlugins::DicomHeaderScanner::RemoveLargeBinaryElements(
+                reduced, removed, dicom.c_str(), dicom.size(), 16));
+  ASSERT_EQ(CreateDicomFile("1.2.840.10008.1.2.1", expectedDataset), reduced);
+  ASSERT_EQ(2u, removed.size());
+
+  OrthancPlugins::DicomHeaderScanner::LargeElements::const_iterator it = removed.begin();
+  ASSERT_EQ(Orthanc::DicomTag(0x0066, 0x0016), it->tag_);
+  ASSERT_EQ("OF", it->vr_);
+  ASSERT_EQ(2u, it->parents_.size());
+  ASSERT_EQ(Orthanc::DicomTag(0x0066, 0x0001), it->parents_[0].first);
+  ASSERT_EQ(0u, it->parents_[0].second);
+  ASSERT_EQ(Orthanc::DicomTag(0x0066, 0x0002), it->parents_[1].first);
+  ASSERT_EQ(0u, it->parents_[1].second);
+
+  ++it;
+  ASSERT_EQ(Orthanc::DicomTag(0x0069, 0x0010), it->tag_);
+  ASSERT_EQ("OB", it->vr_);
+  ASSERT_TRUE(it->parents_.empty());
+
+  // The reduced file can still be scanned
+  std::set<Orthanc::DicomTag> tags;
+  tags.insert(Orthanc::DICOM_TAG_SOP_INSTANCE_UID);
+  OrthancPlugins::DicomHeaderScanner::Values values;
+  ASSERT_TRUE(OrthancPlugins::DicomHeaderScanner::Scan(values, tags, reduced.c_str(), reduced.size()));
+  ASSERT_EQ("1.2.3", values[Orthanc::DICOM_TAG_SOP_INSTANCE_UID]);
+
+  // High threshold: Only the pixel data is emptied
+  ASSERT_TRUE(OrthancPlugins::DicomHeaderScanner::RemoveLargeBinaryElements(
+                reduced, removed, dicom.c_str(), dicom.size(), 1024));
+  ASSERT_TRUE(removed.empty());
+  ASSERT_EQ(dicom.size() - 32, reduced.size());
+
+  // Truncated file
+  ASSERT_FALSE(OrthancPlugins::DicomHeaderScanner::RemoveLargeBinaryElements(
+                 reduced, removed, dicom.c_str(), dicom.size() - 40, 16));
+
+  // Implicit VR: The VR of the elements is unknown
+  std::string implicitDataset;
+  AddElement(implicitDataset, 0x0008, 0x0018, NULL, "1.2.3");
+  const std::string implicitDicom = CreateDicomFile("1.2.840.10008.1.2", implicitDataset);
+  ASSERT_FALSE(OrthancPlugins::DicomHeaderScanner::RemoveLargeBinaryElements(
+                 reduced, removed, implicitDicom.c_str(), implicitDicom.size(), 16));
+}
+
+
+TEST(DicomHeaderScanner, LocateElement)
+{
+  typedef OrthancPlugins::DicomHeaderScanner  Scanner;
+
+  const std::string array(24, 'f');
+
+  for (unsigned int implicit = 0; implicit < 2; implicit++)
+  {
+    // Two items in a sequence, the second one containing an array
+    std::string firstItem;
+    AddElement(firstItem, 0x0066, 0x0016, implicit ? NULL : "OF", std::string(8, 'x'));
+    AddElement(firstItem, 0xfffe, 0xe00d, NULL, "");
+
+    std::string secondItem;
+    AddElement(secondItem, 0x0066, 0x0009, implicit ? NULL : "CS", "NO");
+    AddElement(secondItem, 0x0066, 0x0016, implicit ? NULL : "OF", array);
+
+    std::string sequence;
+    AddElement(sequence, 0xfffe, 0xe000, NULL, firstItem, true);
+    AddElement(sequence, 0xfffe, 0xe000, NULL, secondItem);
+    AddElement(sequence, 0xfffe, 0xe0dd, NULL, "");
+
+    std::string dataset;
+    AddElement(dataset, 0x0008, 0x0018, implicit ? NULL : "UI", "1.2.3");
+    AddElement(dataset, 0x0066, 0x0001, implicit ? NULL : "SQ", sequence, true);
+    AddElement(dataset, 0x0069, 0x0010, implicit ? NULL : "OB", std::string(6, 'b'));
+    AddElement(dataset, 0x7fe0, 0x0010, implicit ? NULL : "OW", std::string(32, 'p'));
+
+    const std::string dicom = CreateDicomFile(implicit ? "1.2.840.10008.1.2" : "1.2.840.10008.1.2.1", dataset);
+
+    Scanner::Parents parents;
+    Scanner::ElementLocation location;
+
+    ASSERT_TRUE(Scanner::LocateElement(location, parents, Orthanc::DicomTag(0x7fe0, 0x0010), dicom.c_str(), dicom.size()));
+    ASSERT_FALSE(location.isEncapsulated_);
+    ASSERT_EQ(32u, location.length_);
+    ASSERT_EQ(std::string(32, 'p'), dicom.substr(location.offset_, location.length_));
+
+    ASSERT_TRUE(Scanner::LocateElement(location, parents, Orthanc::DicomTag(0x0069, 0x0010), dicom.c_str(), dicom.size()));
+    ASSERT_EQ(std::string(6, 'b'), dicom.substr(location.offset_, location.length_));
+
+    ASSERT_FALSE(Scanner::LocateElement(location, parents, Orthanc::DicomTag(0x0069, 0x0011), dicom.c_str(), dicom.size()));
+    ASSERT_FALSE(Scanner::LocateElement(location, parents, Orthanc::DicomTag(0x0066, 0x0016), dicom.c_str(), dicom.size()));
+
+    parents.push_back(std::make_pair(Orthanc::DicomTag(0x0066, 0x0001), 1));
+    ASSERT_TRUE(Scanner::LocateElement(location, parents, Orthanc::DicomTag(0x0066, 0x0016), dicom.c_str(), dicom.size()));
+    ASSERT_EQ(array, dicom.substr(location.offset_, location.length_));
+
+    parents[0].second = 0;
+    ASSERT_TRUE(Scanner::LocateElement(location, parents, Orthanc::DicomTag(0x0066, 0x0016), dicom.c_str(), dicom.size()));
+    ASSERT_EQ(std::string(8, 'x'), dicom.substr(location.offset_, location.length_));
+
+    // Inexistent item
+    parents[0].second = 2;
+    ASSERT_FALSE(Scanner::LocateElement(location, parents, Orthanc::DicomTag(0x0066, 0x0016), dicom.c_str(), dicom.size()));
+
+    // Not a sequence
+    parents[0].first = Orthanc::DicomTag(0x0069, 0x0010);
+    parents[0].second = 0;
+    ASSERT_FALSE(Scanner::LocateElement(location, parents, Orthanc::DicomTag(0x0066, 0x0016), dicom.c_str(), dicom.size()));
+  }
+
+  {
+    // Encapsulated pixel data: The basic offset table is not reported
+    std::string pixelData;
+    AddElement(pixelData, 0xfffe, 0xe000, NULL, "");
+    AddElement(pixelData, 0xfffe, 0xe000, NULL, "first");
+    AddElement(pixelData, 0xfffe, 0xe000, NULL, "second");
+    AddElement(pixelData, 0xfffe, 0xe0dd, NULL, "");
+
+    std::string dataset;
+    AddElement(dataset, 0x0008, 0x0018, "UI", "1.2.3");
+    AddElement(dataset, 0x7fe0, 0x0010, "OB", pixelData, true);
+
+    const std::string dicom = CreateDicomFile("1.2.840.10008.1.2.4.50", dataset);
+
+    Scanner::Parents parents;
+    Scanner::ElementLocation location;
+    ASSERT_TRUE(Scanner::LocateElement(location, parents, Orthanc::DicomTag(0x7fe0, 0x0010), dicom.c_str(), dicom.size()));
+    ASSERT_TRUE(location.isEncapsulated_);
+    ASSERT_EQ(2u, location.fragments_.size());
+    ASSERT_EQ("first", dicom.substr(location.fragments_[0].first, location.fragments_[0].second));
+    ASSERT_EQ("second", dicom.substr(location.fragments_[1].first, location.fragments_[1].second));
+
+    // Truncated file
+    ASSERT_FALSE(Scanner::LocateElement(location, parents, Orthanc::DicomTag(0x7fe0, 0x0010), dicom.c_str(), dicom.size() - 4));
+  }
+}
+
+TEST(DicomWebFormatter, AddBulkDataElements)
+{
+  Json::Value json;
+  json["00660001"]["vr"] = "SQ";
+  json["00660001"]["Value"][0]["00660002"]["vr"] = "SQ";
+  json["00660001"]["Value"][0]["00660002"]["Value"][0] = Json::objectValue;
+
+  OrthancPlugins::DicomHeaderScanner::Parents parents;
+  OrthancPlugins::DicomHeaderScanner::LargeElements elements;
+  elements.push_back(OrthancPlugins::DicomHeaderScanner::LargeElement(parents, Orthanc::DicomTag(0x0069, 0x00ab), "OB"));
+
+  parents.push_back(std::make_pair(Orthanc::DicomTag(0x0066, 0x0001), 0));
+  parents.push_back(std::make_pair(Orthanc::DicomTag(0x0066, 0x0002), 0));
+  elements.push_back(OrthancPlugins::DicomHeaderScanner::LargeElement(parents, Orthanc::DicomTag(0x0066, 0x0016), "OF"));
+
+  OrthancPlugins::DicomWebFormatter::AddBulkDataElements(json, elements, "http://localhost/bulk");
+
+  ASSERT_EQ("OB", json["006900AB"]["vr"].asString());
+  ASSERT_EQ("http://localhost/bulk/006900ab", json["006900AB"]["BulkDataURI"].asString());
+
+  const Json::Value& nested = json["00660001"]["Value"][0]["00660002"]["Value"][0]["00660016"];
+  ASSERT_EQ("OF", nested["vr"].asString());
+  ASSERT_EQ("http://localhost/bulk/00660001/1/00660002/1/00660016", nested["BulkDataURI"].asString());
+
+  // Unknown parent
+  elements.clear();
+  parents.clear();
+  parents.push_back(std::make_pair(Orthanc::DicomTag(0x0066, 0x0001), 3));
+  elements.push_back(OrthancPlugins::DicomHeaderScanner::LargeElement(parents, Orthanc::DicomTag(0x0066, 0x0016), "OF"));
+  ASSERT_THROW(OrthancPlugins::DicomWebFormatter::AddBulkDataElements(json, elements, "http://localhost/bulk"),
+               Orthanc::OrthancException);
+}
+
+
+TEST(DicomWebFormatter, ConvertToDicomWebJson)
+{
+  Orthanc::DicomMap m;
+  m.SetValue(Orthanc::DicomTag(0x0010, 0x0010), "Doe^John=Ideo^Graphic", false);
+  m.SetValue(Orthanc::DicomTag(0x0020, 0x000d), "1.2.3", false);
+  m.SetValue(Orthanc::DicomTag(0x0020, 0x1208), "42", false);
+  m.SetValue(Orthanc::DicomTag(0x0010, 0x1030), "70.5", false);
+  m.SetValue(Orthanc::DicomTag(0x0020, 0x0037), "1\\0\\0\\0\\1\\0", false);
+  m.SetValue(Orthanc::DicomTag(0x0008, 0x0061), "CT\\MR", false);
+  m.SetValue(Orthanc::DicomTag(0x0008, 0x0020), "", false);
+
+  Json::Value json;
+  ASSERT_FALSE(OrthancPlugins::DicomWebFormatter::ConvertToDicomWebJson(json, m));  // Not UTF-8
+
+  m.SetValue(Orthanc::DICOM_TAG_SPECIFIC_CHARACTER_SET, "ISO_IR 192", false);
+  ASSERT_TRUE(OrthancPlugins::DicomWebFormatter::ConvertToDicomWebJson(json, m));
+
+  ASSERT_EQ(8u, json.size());
+  ASSERT_EQ("CS", json["00080005"]["vr"].asString());
+  ASSERT_EQ("ISO_IR 192", json["00080005"]["Value"][0].asString());
+  ASSERT_EQ("DA", json["00080020"]["vr"].asString());
+  ASSERT_FALSE(json["00080020"].isMember("Value"));
+  ASSERT_EQ(2u, json["00080061"]["Value"].size());
+  ASSERT_EQ("MR", json["00080061"]["Value"][1].asString());
+  ASSERT_EQ("PN", json["00100010"]["vr"].asString());
+  ASSERT_EQ("Doe^John", json["00100010"]["Value"][0]["Alphabetic"].asString());
+  ASSERT_EQ("Ideo^Graphic", json["00100010"]["Value"][0]["Ideographic"].asString());
+  ASSERT_FALSE(json["00100010"]["Value"][0].isMember("Phonetic"));
+  ASSERT_EQ(Json::realValue, json["00101030"]["Value"][0].type());
+  ASSERT_DOUBLE_EQ(70.5, json["00101030"]["Value"][0].asDouble());
+  ASSERT_EQ(6u, json["00200037"]["Value"].size());
+  ASSERT_EQ(Json::uintValue, json["00200037"]["Value"][0].type());
+  ASSERT_EQ(1u, json["00200037"]["Value"][0].asUInt());
+  ASSERT_EQ("UI", json["0020000D"]["vr"].asString());
+  ASSERT_EQ(Json::uintValue, json["00201208"]["Value"][0].type());
+  ASSERT_EQ(42u, json["00201208"]["Value"][0].asUInt());
+
+  // Rows that must go through the Orthanc core
+  {
+    Orthanc::DicomMap n;
+    n.Assign(m);
+    n.SetValue(Orthanc::DicomTag(0x0011, 0x0010), "Private", false);
+    ASSERT_FALSE(OrthancPlugins::DicomWebFormatter::ConvertToDicomWebJson(json, n));
+  }
+
+  {
+    Orthanc::DicomMap n;
+    n.Assign(m);
+    n.SetValue(Orthanc::DicomTag(0x0020, 0x1208), "nope", false);
+    ASSERT_FALSE(OrthancPlugins::DicomWebFormatter::ConvertToDicomWebJson(json, n));
+  }
+
+  {
+    Orthanc::DicomMap n;
+    n.Assign(m);
+    n.SetValue(Orthanc::DicomTag(0x0008, 0x1030), "Padded ", false);
+    ASSERT_FALSE(OrthancPlugins::DicomWebFormatter::ConvertToDicomWebJson(json, n));
+  }
+}
+
+
+TEST(DicomWebFormatter, SameOutputAsCore)
+{
+  // Expected output of the Orthanc core for a DICOM file created from
+  // the same main DICOM tags, i.e. the result of "DicomWebJsonVisitor"
+  // serialized by "toStyledString()" of JsonCpp 1.9 (tab indentation,
+  // escaped non-ASCII characters, and a trailing newline)
+  static const char* const CORE =
+    "{\n"
+    "\t\"00080005\" : \n"
+    "\t{\n"
+    "\t\t\"Value\" : \n"
+    "\t\t[\n"
+    "\t\t\t\"ISO_IR 192\"\n"
+    "\t\t],\n"
+    "\t\t\"vr\" : \"CS\"\n"
+    "\t},\n"
+    "\t\"00080020\" : \n"
+    "\t{\n"
+    "\t\t\"vr\" : \"DA\"\n"
+    "\t},\n"
+    "\t\"00080050\" : \n"
+    "\t{\n"
+    "\t\t\"Value\" : \n"
+    "\t\t[\n"
+    "\t\t\t\"A\",\n"
+    "\t\t\tnull,\n"
+    "\t\t\t\"B\"\n"
+    "\t\t],\n"
+    "\t\t\"vr\" : \"SH\"\n"
+    "\t},\n"
+    "\t\"00080090\" : \n"
+    "\t{\n"
+    "\t\t\"vr\" : \"PN\"\n"
+    "\t},\n"
+    "\t\"00081030\" : \n"
+    "\t{\n"
+    "\t\t\"Value\" : \n"
+    "\t\t[\n"
+    "\t\t\t\"\\u00c9tude\"\n"
+    "\t\t],\n"
+    "\t\t\"vr\" : \"LO\"\n"
+    "\t},\n"
+    "\t\"00100010\" : \n"
+    "\t{\n"
+    "\t\t\"Value\" : \n"
+    "\t\t[\n"
+    "\t\t\t{\n"
+    "\t\t\t\t\"Alphabetic\" : \"M\\u00fcller^Hans\",\n"
+    "\t\t\t\t\"Ideographic\" : \"\\u30df\\u30e5\\u30e9\\u30fc^\\u30cf\\u30f3\\u30b9\"\n"
+    "\t\t\t}\n"
+    "\t\t],\n"
+    "\t\t\"vr\" : \"PN\"\n"
+    "\t},\n"
+    "\t\"00101020\" : \n"
+    "\t{\n"
+    "\t\t\"Value\" : \n"
+    "\t\t[\n"
+    "\t\t\t2\n"
+    "\t\t],\n"
+    "\t\t\"vr\" : \"DS\"\n"
+    "\t},\n"
+    "\t\"00101030\" : \n"
+    "\t{\n"
+    "\t\t\"Value\" : \n"
+    "\t\t[\n"
+    "\t\t\t70.5\n"
+    "\t\t],\n"
+    "\t\t\"vr\" : \"DS\"\n"
+    "\t},\n"
+    "\t\"0020000D\" : \n"
+    "\t{\n"
+    "\t\t\"Value\" : \n"
+    "\t\t[\n"
+    "\t\t\t\"1.2.3\"\n"
+    "\t\t],\n"
+    "\t\t\"vr\" : \"UI\"\n"
+    "\t},\n"
+    "\t\"00200011\" : \n"
+    "\t{\n"
+    "\t\t\"Value\" : \n"
+    "\t\t[\n"
+    "\t\t\t-3\n"
+    "\t\t],\n"
+    "\t\t\"vr\" : \"IS\"\n"
+    "\t},\n"
+    "\t\"00201208\" : \n"
+    "\t{\n"
+    "\t\t\"Value\" : \n"
+    "\t\t[\n"
+    "\t\t\t42\n"
+    "\t\t],\n"
+    "\t\t\"vr\" : \"IS\"\n"
+    "\t},\n"
+    "\t\"00280030\" : \n"
+    "\t{\n"
+    "\t\t\"Value\" : \n"
+    "\t\t[\n"
+    "\t\t\t0.5,\n"
+    "\t\t\t0.5\n"
+    "\t\t],\n"
+    "\t\t\"vr\" : \"DS\"\n"
+    "\t},\n"
+    "\t\"00321032\" : \n"
+    "\t{\n"
+    "\t\t\"Value\" : \n"
+    "\t\t[\n"
+    "\t\t\t{\n"
+    "\t\t\t\t\"Alphabetic\" : \"Doe^John\"\n"
+    "\t\t\t},\n"
+    "\t\t\t{\n"
+    "\t\t\t\t\"Alphabetic\" : \"Smith^Jane\"\n"
+    "\t\t\t}\n"
+    "\t\t],\n"
+    "\t\t\"vr\" : \"PN\"\n"
+    "\t}\n"
+    "}\n";
+
+  Orthanc::DicomMap m;
+  m.SetValue(Orthanc::DICOM_TAG_SPECIFIC_CHARACTER_SET, "ISO_IR 192", false);
+  m.SetValue(Orthanc::DicomTag(0x0008, 0x0020), "", false);
+  m.SetValue(Orthanc::DicomTag(0x0008, 0x0050), "A\\\\B", false);
+  m.SetValue(Orthanc::DicomTag(0x0008, 0x0090), "", false);
+  m.SetValue(Orthanc::DicomTag(0x0008, 0x1030), "\xc3\x89tude", false);
+  m.SetValue(Orthanc::DicomTag(0x0010, 0x0010), "M\xc3\xbcller^Hans=\xe3\x83\x9f\xe3\x83\xa5\xe3\x83\xa9"
+             "\xe3\x83\xbc^\xe3\x83\x8f\xe3\x83\xb3\xe3\x82\xb9", false);
+  m.SetValue(Orthanc::DicomTag(0x0010, 0x1020), "2.0", false);
+  m.SetValue(Orthanc::DicomTag(0x0010, 0x1030), "70.5", false);
+  m.SetValue(Orthanc::DicomTag(0x0020, 0x000d), "1.2.3", false);
+  m.SetValue(Orthanc::DicomTag(0x0020, 0x0011), "-3", false);
+  m.SetValue(Orthanc::DicomTag(0x0020, 0x1208), "42", false);
+  m.SetValue(Orthanc::DicomTag(0x0028, 0x0030), "0.5\\0.5", false);
+  m.SetValue(Orthanc::DicomTag(0x0032, 0x1032), "Doe^John\\Smith^Jane", false);
+
+  std::string s;
+  ASSERT_TRUE(OrthancPlugins::DicomWebFormatter::SerializeToDicomWebJson(s, m));
+  ASSERT_EQ(std::string(CORE), s);
+}
+
+
+TEST(FramesRequestParser, Basic)
+{
+  const char* headersKeys[] = { "Accept" };
+  const char* headersValues[] = { "" };
+  const char* groups[] = { "1.2.3", "1.2.3.4", "1.2.3.4.5", "1%2C3,10" };
+
+  OrthancPluginHttpRequest request;
+  memset(&request, 0, sizeof(request));
+  request.groupsCount = 4;
+  request.groups = groups;
+  request.headersKeys = headersKeys;
+  request.headersValues = headersValues;
+
+  std::list<unsigned int> frames;
+  FramesRequestParser::ParseFrameList(frames, &request);
+  ASSERT_EQ(3u, frames.size());
+  ASSERT_EQ(0u, frames.front());
+  ASSERT_EQ(9u, frames.back());
+
+  groups[3] = "2,0";
+  ASSERT_THROW(FramesRequestParser::ParseFrameList(frames, &request), Orthanc::OrthancException);
+
+  request.groupsCount = 3;
+  FramesRequestParser::ParseFrameList(frames, &request);
+  ASSERT_TRUE(frames.empty());
+
+  Orthanc::DicomTransferSyntax syntax = Orthanc::DicomTransferSyntax_JPEGProcess1;
+  FramesRequestParser::ParseTransferSyntax(syntax, &request);  // No "Accept" header
+  ASSERT_EQ(Orthanc::DicomTransferSyntax_LittleEndianExplicit, syntax);
+
+  request.headersCount = 1;
+
+  headersValues[0] = "multipart/related; type=\"application/octet-stream\"; transfer-syntax=*";
+  syntax = Orthanc::DicomTransferSyntax_JPEGProcess1;
+  FramesRequestParser::ParseTransferSyntax(syntax, &request);
+  ASSERT_EQ(Orthanc::DicomTransferSyntax_JPEGProcess1, syntax);
+
+  headersValues[0] = "multipart/related; type=image/jp2";
+  FramesRequestParser::ParseTransferSyntax(syntax, &request);
+  ASSERT_EQ(Orthanc::DicomTransferSyntax_JPEG2000LosslessOnly, syntax);
+
+  headersValues[0] = "Multipart/Related; Type=\"image/jls\"; Transfer-Syntax=1.2.840.10008.1.2.4.81";
+  FramesRequestParser::ParseTransferSyntax(syntax, &request);
+  ASSERT_EQ(Orthanc::DicomTransferSyntax_JPEGLSLossy, syntax);
+
+  headersValues[0] = "*/*";
+  FramesRequestParser::ParseTransferSyntax(syntax, &request);
+  ASSERT_EQ(Orthanc::DicomTransferSyntax_LittleEndianExplicit, syntax);
+
+  headersValues[0] = "multipart/related; type=image/jpeg; transfer-syntax=1.2.840.10008.1.2.4.90";
+  ASSERT_THROW(FramesRequestParser::ParseTransferSyntax(syntax, &request), Orthanc::OrthancException);
+
+  headersValues[0] = "application/json";
+  ASSERT_THROW(FramesRequestParser::ParseTransferSyntax(syntax, &request), Orthanc::OrthancException);
+}
+
+
+TEST(ResourceLookupCache, Basic)
+{
+  std::map<std::string, std::string> alice, bob;
+  alice["authorization"] = "Bearer alice";
+  alice["accept"] = "application/dicom+json";
+  bob["authorization"] = "Bearer bob";
+
+  const std::string key = ResourceLookupCache::ComputeKey("Instance", "1", "2", "3", false, alice);
+  ASSERT_NE(key, ResourceLookupCache::ComputeKey("Instance", "1", "2", "3", false, bob));
+  ASSERT_NE(key, ResourceLookupCache::ComputeKey("Instance", "1", "2", "3", true, alice));
+  ASSERT_NE(key, ResourceLookupCache::ComputeKey("Series", "1", "2", "3", false, alice));
+
+  // Headers that are not related to authorization are ignored
+  alice["accept"] = "multipart/related; type=application/octet-stream";
+  alice["User-Agent"] = "curl";
+  ASSERT_EQ(key, ResourceLookupCache::ComputeKey("Instance", "1", "2", "3", false, alice));
+
+  ResourceLookupCache cache;
+  ASSERT_FALSE(cache.IsEnabled());
+
+  ResourceLookupCache::Metadata metadata;
+  metadata["TransferSyntax"] = "1.2.840.10008.1.2.1";
+
+  cache.Store(key, "instance", metadata);  // Ignored, as the cache is disabled
+  ASSERT_EQ(0u, cache.GetSize());
+
+  cache.SetParameters(60, 2);
+  ASSERT_TRUE(cache.IsEnabled());
+
+  std::string id;
+  ResourceLookupCache::Metadata m;
+  ASSERT_FALSE(cache.Lookup(id, m, key));
+
+  cache.Store(key, "instance", metadata);
+  ASSERT_TRUE(cache.Lookup(id, m, key));
+  ASSERT_EQ("instance", id);
+  ASSERT_EQ(1u, m.size());
+  ASSERT_EQ("1.2.840.10008.1.2.1", m["TransferSyntax"]);
+
+  cache.Store("a", "instance", metadata);
+  cache.Store("b", "other", metadata);  // Evicts "key", the oldest entry
+  ASSERT_EQ(2u, cache.GetSize());
+  ASSERT_FALSE(cache.Lookup(id, m, key));
+  ASSERT_TRUE(cache.Lookup(id, m, "a"));
+
+  cache.Invalidate("instance");
+  ASSERT_EQ(1u, cache.GetSize());
+  ASSERT_FALSE(cache.Lookup(id, m, "a"));
+  ASSERT_TRUE(cache.Lookup(id, m, "b"));
+  ASSERT_EQ("other", id);
+
+  uint64_t hits, misses;
+  cache.GetStatistics(hits, misses);
+  ASSERT_EQ(3u, hits);
+  ASSERT_EQ(3u, misses);
+
+  cache.Clear();
+  ASSERT_EQ(0u, cache.GetSize());
+}
+
+
+TEST(SeriesMetadataRecords, Basic)
+{
+  SeriesMetadataRecords records;
+  records.SetLastUpdate("20250101T120000");
+  records.SetInstance("b", "{\"b\":\";2;\"}");
+  records.SetInstance("a", "{}");
+  records.SetInstance("c", "");
+  ASSERT_THROW(records.SetInstance("d;", "{}"), Orthanc::OrthancException);
+
+  std::string s;
+  records.FormatSeries(s);
+  ASSERT_EQ("[{},{\"b\":\";2;\"},]", s);
+
+  std::string header, lastUpdate;
+  size_t count, offset;
+  records.FormatHeader(header);
+  ASSERT_EQ("4;20250101T120000;3;", header);
+  ASSERT_TRUE(SeriesMetadataRecords::ParseHeader(lastUpdate, count, offset, header + "payload"));
+  ASSERT_EQ("20250101T120000", lastUpdate);
+  ASSERT_EQ(3u, count);
+  ASSERT_EQ(header.size(), offset);
+  ASSERT_FALSE(SeriesMetadataRecords::ParseHeader(lastUpdate, count, offset, "2;md5;payload"));
+  ASSERT_FALSE(SeriesMetadataRecords::ParseHeader(lastUpdate, count, offset, "3;20250101T120000;3;"));
+  ASSERT_FALSE(SeriesMetadataRecords::ParseHeader(lastUpdate, count, offset, "4;20250101T120000;x;"));
+
+  std::string serialized;
+  records.SerializeRecords(serialized);
+
+  SeriesMetadataRecords copy;
+  ASSERT_TRUE(copy.UnserializeRecords(serialized));
+  ASSERT_EQ(3u, copy.GetSize());
+  copy.FormatSeries(s);
+  ASSERT_EQ("[{},{\"b\":\";2;\"},]", s);
+
+  ASSERT_FALSE(copy.UnserializeRecords(serialized.substr(0, serialized.size() - 3)));
+  ASSERT_EQ(0u, copy.GetSize());
+
+  // The records that were set before any synchronization have no stamp
+  std::set<std::string> missing;
+  SeriesMetadataRecords::Stamps instances;
+  instances["a"] = "";
+  instances["e"] = "20250101T120000";
+  records.Synchronize(missing, instances);
+  ASSERT_EQ(1u, records.GetSize());
+  ASSERT_TRUE(records.HasInstance("a"));
+  ASSERT_EQ(1u, missing.size());
+  ASSERT_EQ("e", *missing.begin());
+
+  records.SetInstance("e", "{\"e\":1}");
+  records.SerializeRecords(serialized);
+  ASSERT_TRUE(copy.UnserializeRecords(serialized));
+  ASSERT_EQ(2u, copy.GetSize());
+
+  // "e" is overwritten with the same Orthanc ID: its record is dropped
+  instances["e"] = "20250101T130000";
+  copy.Synchronize(missing, instances);
+  ASSERT_EQ(1u, copy.GetSize());
+  ASSERT_TRUE(copy.HasInstance("a"));
+  ASSERT_FALSE(copy.HasInstance("e"));
+  ASSERT_EQ(1u, missing.size());
+  ASSERT_EQ("e", *missing.begin());
+
+  copy.SetInstance("e", "{\"e\":2}");
+  copy.Synchronize(missing, instances);
+  ASSERT_EQ(2u, copy.GetSize());
+  ASSERT_TRUE(missing.empty());
+
+  std::set<std::string> ids;
+  ids.insert("a");
+  ASSERT_FALSE(copy.HasSameInstances(ids));
+  ids.insert("f");
+  ASSERT_FALSE(copy.HasSameInstances(ids));
+  ids.erase("f");
+  ids.insert("e");
+  ASSERT_TRUE(copy.HasSameInstances(ids));
+
+  instances["f"] = "bad;stamp";
+  ASSERT_THROW(copy.Synchronize(missing, instances), Orthanc::OrthancException);
+}
+
+
+namespace
+{
+  class CounterTask : public WorkersPool::ITask
+  {
+  private:
+    boost::mutex&  mutex_;
+    unsigned int&  counter_;
+
+  public:
+    CounterTask(boost::mutex& mutex,
+                unsigned int& counter) :
+      mutex_(mutex),
+      counter_(counter)
+    {
+    }
+
+    virtual void Execute() ORTHANC_OVERRIDE
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      counter_++;
+    }
+  };
+
+  class SleepTask : public WorkersPool::ITask
+  {
+  public:
+    virtual void Execute() ORTHANC_OVERRIDE
+    {
+      boost::this_thread::sleep(boost::posix_time::milliseconds(20));
+    }
+  };
+
+  class NestedTask : public WorkersPool::ITask
+  {
+  private:
+    WorkersPool&   pool_;
+    boost::mutex&  mutex_;
+    unsigned int&  counter_;
+
+  public:
+    NestedTask(WorkersPool& pool,
+               boost::mutex& mutex,
+               unsigned int& counter) :
+      pool_(pool),
+      mutex_(mutex),
+      counter_(counter)
+    {
+    }
+
+    virtual void Execute() ORTHANC_OVERRIDE
+    {
+      // Waiting for subtasks must not deadlock, even if all the workers are busy
+      CounterTask a(mutex_, counter_), b(mutex_, counter_);
+      WorkersPool::TasksGroup group(pool_, 2);
+      group.Submit(a);
+      group.Submit(b);
+      group.WaitAll();
+    }
+  };
+}
+
+
+TEST(WorkersPool, Basic)
+{
+  for (unsigned int threads = 0; threads < 3; threads++)
+  {
+    WorkersPool pool;
+    pool.Start(threads, "test-");
+    ASSERT_EQ(threads, pool.GetThreadsCount());
+
+    boost::mutex mutex;
+    unsigned int counter = 0;
+
+    {
+      std::vector<boost::shared_ptr<WorkersPool::ITask> > tasks;
+      for (unsigned int i = 0; i < 50; i++)
+      {
+        tasks.push_back(boost::shared_ptr<WorkersPool::ITask>(new CounterTask(mutex, counter)));
+        tasks.push_back(boost::shared_ptr<WorkersPool::ITask>(new NestedTask(pool, mutex, counter)));
+      }
+
+      WorkersPool::TasksGroup group(pool, 2);
+      for (size_t i = 0; i < tasks.size(); i++)
+      {
+        ASSERT_EQ(i, group.Submit(*tasks[i]));
+      }
+
+      group.Wait(tasks.size() - 1);
+      group.WaitAll();
+    }
+
+    ASSERT_EQ(150u, counter);
+
+    {
+      // Pending tasks are cancelled by the destruction of the group
+      CounterTask task(mutex, counter);
+      WorkersPool::TasksGroup group(pool, 1);
+      group.Submit(task);
+    }
+
+    {
+      // The workers never run more tasks of a group than its limit
+      SleepTask a, b, c, d;
+      WorkersPool::TasksGroup group(pool, 1);
+      group.Submit(a);
+      group.Submit(b);
+      group.Submit(c);
+      group.Submit(d);
+      boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+
+      size_t queued, active;
+      pool.GetStatistics(queued, active);
+      ASSERT_LE(active, 1u);
+
+      group.WaitAll();
+      pool.GetStatistics(queued, active);
+      ASSERT_EQ(0u, queued);
+      ASSERT_EQ(0u, active);
+    }
+
+    pool.Stop();
+    ASSERT_EQ(0u, pool.GetThreadsCount());
+  }
+}
+
+
+namespace
+{
+  class DicomFileBuilder
+  {
+  private:
+    std::string  content_;
+    bool         explicitVR_;
+
+    void AddUInt16(uint16_t value)
+    {
+      content_.push_back(static_cast<char>(value & 0xff));
+      content_.push_back(static_cast<char>(value >> 8));
+    }
+
+    void AddUInt32(uint32_t value)
+    {
+      AddUInt16(static_cast<uint16_t>(value & 0xffff));
+      AddUInt16(static_cast<uint16_t>(value >> 16));
+    }
+
+  public:
+    DicomFileBuilder(const std::string& transferSyntax,
+                     bool explicitVR) :
+      content_(128, '\0'),
+      explicitVR_(true)
+    {
+      content_ += "DICM";
+      AddElement(0x0002, 0x0010, "UI", transferSyntax + '\0');
+      explicitVR_ = explicitVR;
+    }
+
+    void AddHeader(uint16_t group,
+                   uint16_t element,
+                   const std::string& vr,
+                   uint32_t length)
+    {
+      AddUInt16(group);
+      AddUInt16(element);
+
+      if (group == 0xfffe ||
+          !explicitVR_)
+      {
+        AddUInt32(length);
+      }
+      else if (vr == "OB" || vr == "OW" || vr == "SQ" || vr == "UN")
+      {
+        content_ += vr;
+        AddUInt16(0);
+        AddUInt32(length);
+      }
+      else
+      {
+        content_ += vr;
+        AddUInt16(static_cast<uint16_t>(length));
+      }
+    }
+
+    void AddElement(uint16_t group,
+                    uint16_t element,
+                    const std::string& vr,
+                    const std::string& value)
+    {
+      AddHeader(group, element, vr, static_cast<uint32_t>(value.size()));
+      content_ += value;
+    }
+
+    void AddUnsignedShort(uint16_t group,
+                          uint16_t element,
+                          uint16_t value)
+    {
+      AddHeader(group, element, "US", 2);
+      AddUInt16(value);
+    }
+
+    const std::string& GetContent() const
+    {
+      return content_;
+    }
+  };
+}
+
+
+static void BuildUncompressedFile(std::string& target,
+                                  const std::string& transferSyntax,
+                                  bool explicitVR,
+                                  bool encapsulated)
+{
+  DicomFileBuilder builder(transferSyntax, explicitVR);
+
+  // Sequence and item of undefined length, that must be skipped
+  builder.AddHeader(0x0008, 0x1140, "SQ", 0xffffffffu);
+  builder.AddHeader(0xfffe, 0xe000, "", 0xffffffffu);
+  builder.AddElement(0x0008, 0x1150, "UI", "1.2\0");
+  builder.AddHeader(0xfffe, 0xe00d, "", 0);
+  builder.AddHeader(0xfffe, 0xe000, "", 0);
+  builder.AddHeader(0xfffe, 0xe0dd, "", 0);
+
+  builder.AddUnsignedShort(0x0028, 0x0002, 1);
+  builder.AddElement(0x0028, 0x0008, "IS", "2 ");
+  builder.AddUnsignedShort(0x0028, 0x0010, 2);
+  builder.AddUnsignedShort(0x0028, 0x0011, 3);
+  builder.AddUnsignedShort(0x0028, 0x0100, 16);
+
+  if (encapsulated)
+  {
+    builder.AddHeader(0x7fe0, 0x0010, "OB", 0xffffffffu);
+    target = builder.GetContent();
+  }
+  else
+  {
+    std::string pixels;
+    for (unsigned int i = 0; i < 24; i++)
+    {
+      pixels.push_back(static_cast<char>(i));
+    }
+
+    builder.AddElement(0x7fe0, 0x0010, "OW", pixels);
+    target = builder.GetContent();
+  }
+}
+
+
+static boost::mutex warmedStudiesMutex_;
+static std::set<std::string> warmedStudies_;
+
+static void WarmStudyForTest(const std::string& studyOrthancId)
+{
+  {
+    boost::mutex::scoped_lock lock(warmedStudiesMutex_);
+    warmedStudies_.insert(studyOrthancId);
+  }
+
+  if (studyOrthancId == "failure")
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+  }
+}
+
+TEST(CacheWarmer, Basic)
+{
+  CacheWarmer warmer;
+  warmer.SetMaxQueueSize(3);
+  ASSERT_FALSE(warmer.IsStarted());
+
+  ASSERT_TRUE(warmer.Enqueue("a"));
+  ASSERT_TRUE(warmer.Enqueue("b"));
+  ASSERT_TRUE(warmer.Enqueue("a"));  // Already queued
+  ASSERT_TRUE(warmer.Enqueue("failure"));
+  ASSERT_FALSE(warmer.Enqueue("c"));  // The queue is full
+
+  size_t queued, running;
+  uint64_t warmed, dropped, failed;
+  warmer.GetStatistics(queued, running, warmed, dropped, failed);
+  ASSERT_EQ(3u, queued);
+  ASSERT_EQ(0u, running);
+  ASSERT_EQ(0u, warmed);
+  ASSERT_EQ(1u, dropped);
+  ASSERT_EQ(0u, failed);
+
+  warmer.Start(2, WarmStudyForTest);
+  ASSERT_TRUE(warmer.IsStarted());
+  ASSERT_THROW(warmer.Start(1, WarmStudyForTest), Orthanc::OrthancException);
+
+  for (unsigned int i = 0; i < 1000; i++)
+  {
+    warmer.GetStatistics(queued, running, warmed, dropped, failed);
+    if (warmed + failed == 3)
+    {
+      break;
+    }
+
+    boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+  }
+
+  ASSERT_EQ(0u, queued);
+  ASSERT_EQ(0u, running);
+  ASSERT_EQ(2u, warmed);
+  ASSERT_EQ(1u, failed);
+
+  warmer.Stop();
+  ASSERT_FALSE(warmer.IsStarted());
+
+  ASSERT_EQ(3u, warmedStudies_.size());
+  ASSERT_TRUE(warmedStudies_.find("a") != warmedStudies_.end());
+  ASSERT_TRUE(warmedStudies_.find("b") != warmedStudies_.end());
+  ASSERT_TRUE(warmedStudies_.find("failure") != warmedStudies_.end());
+}
+
+
+TEST(LatencyHistogram, Quantiles)
+{
+  LatencyHistogram h;
+  ASSERT_EQ(0u, h.GetCount());
+  ASSERT_DOUBLE_EQ(0, h.GetQuantile(0.5));
+  ASSERT_THROW(h.GetQuantile(1.5), Orthanc::OrthancException);
+
+  ASSERT_DOUBLE_EQ(0.1, LatencyHistogram::GetBucketUpperBound(0));
+  ASSERT_DOUBLE_EQ(60000, LatencyHistogram::GetBucketUpperBound(LatencyHistogram::BUCKETS_COUNT - 2));
+  ASSERT_TRUE(LatencyHistogram::GetBucketUpperBound(LatencyHistogram::BUCKETS_COUNT - 1) > 1e100);
+
+  h.Add(100);    // 0.1 ms, upper bound of the first bucket
+  h.Add(101);
+  ASSERT_EQ(1u, h.GetBucketCount(0));
+  ASSERT_EQ(1u, h.GetBucketCount(1));
+
+  h.Clear();
+  for (unsigned int i = 0; i < 10; i++)
+  {
+    h.Add(3000);  // In the bucket "(2.5, 5] ms"
+  }
+
+  ASSERT_EQ(10u, h.GetCount());
+  ASSERT_EQ(10u, h.GetBucketCount(5));
+  ASSERT_DOUBLE_EQ(2.5, h.GetQuantile(0));
+  ASSERT_DOUBLE_EQ(3.75, h.GetQuantile(0.5));
+  ASSERT_DOUBLE_EQ(5, h.GetQuantile(1));
+
+  LatencyHistogram h2;
+  for (unsigned int i = 0; i < 90; i++)
+  {
+    h2.Add(50);  // In the first bucket
+  }
+
+  h2.Add(120000000);  // 2 minutes, in the last bucket
+  h.Merge(h2);
+
+  ASSERT_EQ(101u, h.GetCount());
+  ASSERT_NEAR(0.05, h.GetQuantile(45.0 / 101.0), 0.000001);
+  ASSERT_TRUE(h.GetQuantile(0.95) > 2.5 && h.GetQuantile(0.95) <= 5);
+  ASSERT_DOUBLE_EQ(60000, h.GetQuantile(1));
+}
+
+
+TEST(LatencyMetrics, Timers)
+{
+  LatencyHistogram histograms[LatencyRoute_Count][LatencyStage_Count];
+  LatencyMetrics::GetInstance().Collect(histograms);  // Flush
+
+  {
+    // Not within a route: Ignored
+    LatencyStageTimer timer(LatencyStage_Load);
+  }
+
+  {
+    LatencyRouteTimer route(LatencyRoute_WadoRsFrames);
+    ASSERT_EQ(&route, LatencyRouteTimer::GetCurrent());
+
+    {
+      LatencyStageTimer timer(LatencyStage_Load);
+      timer.Stop();
+      timer.Stop();  // Only recorded once
+    }
+
+    {
+      LatencyRouteTimer nested(LatencyRoute_Qido);
+      LatencyStageTimer timer(LatencyStage_Locate);
+    }
+
+    ASSERT_EQ(&route, LatencyRouteTimer::GetCurrent());
+    LatencyStageTimer timer(LatencyRoute_Stow, LatencyStage_Send);
+  }
+
+  ASSERT_TRUE(LatencyRouteTimer::GetCurrent() == NULL);
+
+  for (unsigned int i = 0; i < LatencyRoute_Count; i++)
+  {
+    for (unsigned int j = 0; j < LatencyStage_Count; j++)
+    {
+      histograms[i][j].Clear();
+    }
+  }
+
+  LatencyMetrics::GetInstance().Collect(histograms);
+  ASSERT_EQ(1u, histograms[LatencyRoute_WadoRsFrames][LatencyStage_Total].GetCount());
+  ASSERT_EQ(1u, histograms[LatencyRoute_WadoRsFrames][LatencyStage_Load].GetCount());
+  ASSERT_EQ(0u, histograms[LatencyRoute_WadoRsFrames][LatencyStage_Locate].GetCount());
+  ASSERT_EQ(1u, histograms[LatencyRoute_Qido][LatencyStage_Total].GetCount());
+  ASSERT_EQ(1u, histograms[LatencyRoute_Qido][LatencyStage_Locate].GetCount());
+  ASSERT_EQ(1u, histograms[LatencyRoute_Stow][LatencyStage_Send].GetCount());
+  ASSERT_EQ(0u, histograms[LatencyRoute_WadoUri][LatencyStage_Load].GetCount());
+
+  ASSERT_STREQ("wadors_frames", LatencyMetrics::GetRouteName(LatencyRoute_WadoRsFrames));
+  ASSERT_STREQ("transcode", LatencyMetrics::GetStageName(LatencyStage_Transcode));
+}
+
+
+TEST(SlidingWindowMetrics, Basic)
+{
+  ASSERT_THROW(SlidingWindowMetrics(0), Orthanc::OrthancException);
+
+  SlidingWindowMetrics m(10);
+  ASSERT_EQ(10u, m.GetWindowSeconds());
+
+  SlidingWindowMetrics::Statistics s;
+  m.GetStatistics(s, 1000);
+  ASSERT_EQ(0u, s.GetCount());
+  ASSERT_DOUBLE_EQ(0, s.GetWeightedAverage());
+  ASSERT_DOUBLE_EQ(0, s.GetRate());
+
+  m.AddValue(10, 1, 1000);
+  m.AddValue(40, 2, 1000);
+  m.AddValue(100, 1, 1005);
+
+  m.GetStatistics(s, 1005);
+  ASSERT_EQ(3u, s.GetCount());
+  ASSERT_DOUBLE_EQ(150, s.GetSum());
+  ASSERT_DOUBLE_EQ(50, s.GetAverage());
+  ASSERT_DOUBLE_EQ(47.5, s.GetWeightedAverage());  // (10 + 80 + 100) / 4
+  ASSERT_DOUBLE_EQ(0.3, s.GetRate());
+  ASSERT_DOUBLE_EQ(15, s.GetSumRate());
+
+  // The samples at second 1000 are out of the window
+  m.GetStatistics(s, 1010);
+  ASSERT_EQ(1u, s.GetCount());
+  ASSERT_DOUBLE_EQ(100, s.GetWeightedAverage());
+
+  // The ring wraps around: The bucket of second 1005 is reused
+  m.AddValue(7, 1, 1015);
+  m.GetStatistics(s, 1015);
+  ASSERT_EQ(1u, s.GetCount());
+  ASSERT_DOUBLE_EQ(7, s.GetSum());
+
+  m.GetStatistics(s, 1030);
+  ASSERT_EQ(0u, s.GetCount());
+
+  // No histograms by default
+  m.AddDuration(5000, 1030);
+  m.GetStatistics(s, 1030);
+  ASSERT_EQ(1u, s.GetCount());
+  ASSERT_DOUBLE_EQ(5, s.GetAverage());
+  ASSERT_EQ(0u, s.GetHistogram().GetCount());
+}
+
+
+TEST(SlidingWindowMetrics, Histograms)
+{
+  SlidingWindowMetrics m(60, true);
+
+  for (unsigned int i = 0; i < 100; i++)
+  {
+    m.AddDuration(2000 /* 2ms */, 100 + i / 10);
+  }
+
+  m.AddDuration(50000 /* 50ms */, 150);
+
+  SlidingWindowMetrics::Statistics s;
+  m.GetStatistics(s, 150);
+  ASSERT_EQ(101u, s.GetCount());
+  ASSERT_EQ(101u, s.GetHistogram().GetCount());
+  ASSERT_LE(s.GetHistogram().GetQuantile(0.5), 2.5);
+  ASSERT_GE(s.GetHistogram().GetQuantile(0.999), 25.0);
+
+  // Only the last sample remains in the window
+  m.GetStatistics(s, 200);
+  ASSERT_EQ(1u, s.GetCount());
+  ASSERT_EQ(1u, s.GetHistogram().GetCount());
+  ASSERT_DOUBLE_EQ(50, s.GetAverage());
+}
+
+
+TEST(UncompressedFramesIndex, Basic)
+{
+  for (unsigned int i = 0; i < 2; i++)
+  {
+    const bool explicitVR = (i == 0);
+
+    std::string dicom;
+    BuildUncompressedFile(dicom, explicitVR ? "1.2.840.10008.1.2.1" : "1.2.840.10008.1.2", explicitVR, false);
+
+    UncompressedFramesIndex index;
+    ASSERT_TRUE(index.Parse(dicom.c_str(), dicom.size()));
+    ASSERT_EQ(2u, index.GetFramesCount());
+    ASSERT_EQ(12u, index.GetFrameSize());
+    ASSERT_EQ(dicom.size() - 24, index.GetFrameOffset(0));
+    ASSERT_EQ(12, dicom[index.GetFrameOffset(1)]);
+    ASSERT_THROW(index.GetFrameOffset(2), Orthanc::OrthancException);
+
+    // Truncated file
+    ASSERT_FALSE(index.Parse(dicom.c_str(), dicom.size() - 13));
+    ASSERT_EQ(0u, index.GetFramesCount());
+  }
+
+  std::string dicom;
+  UncompressedFramesIndex index;
+
+  BuildUncompressedFile(dicom, "1.2.840.10008.1.2.1", true, true);
+  ASSERT_FALSE(index.Parse(dicom.c_str(), dicom.size()));
+
+  BuildUncompressedFile(dicom, "1.2.840.10008.1.2.4.50", true, false);
+  ASSERT_FALSE(index.Parse(dicom.c_str(), dicom.size()));
+
+  ASSERT_FALSE(index.Parse("nope", 4));
+}
+
+
+namespace
+{
+  // The memory buffers of the Orthanc SDK are freed through the global
+  // context of the plugin, which does not exist in the unit tests
+  class FakePluginContext : public boost::noncopyable
+  {
+  private:
+    OrthancPluginContext  context_;
+
+    static void Free(void* buffer)
+    {
+      free(buffer);
+    }
+
+  public:
+    FakePluginContext()
+    {
+      memset(&context_, 0, sizeof(context_));
+      context_.Free = Free;
+      OrthancPlugins::SetGlobalContext(&context_);
+    }
+
+    ~FakePluginContext()
+    {
+      OrthancPlugins::ResetGlobalContext();
+    }
+  };
+
+
+  class FakeInstanceFactory : public TranscodedInstancesCache::IInstanceFactory
+  {
+  private:
+    boost::mutex               mutex_;
+    boost::condition_variable  changed_;
+    size_t                     size_;
+    bool                       isBlocking_;
+    bool                       isFailure_;
+    unsigned int               started_;
+    unsigned int               created_;
+
+  public:
+    explicit FakeInstanceFactory(size_t size) :
+      size_(size),
+      isBlocking_(false),
+      isFailure_(false),
+      started_(0),
+      created_(0)
+    {
+    }
+
+    void SetBlocking(bool blocking)
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      isBlocking_ = blocking;
+      changed_.notify_all();
+    }
+
+    void SetFailure(bool failure)
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      isFailure_ = failure;
+    }
+
+    // Waits until "count" calls to "Create()" have started
+    void WaitStarted(unsigned int count)
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      while (started_ < count)
+      {
+        changed_.wait(lock);
+      }
+    }
+
+    unsigned int GetStartedCount()
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      return started_;
+    }
+
+    unsigned int GetCreatedCount()
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      return created_;
+    }
+
+    virtual TranscodedInstancesCache::CachedInstance* Create() ORTHANC_OVERRIDE
+    {
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+        started_++;
+        changed_.notify_all();
+
+        while (isBlocking_)
+        {
+          changed_.wait(lock);
+        }
+
+        if (isFailure_)
+        {
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+        }
+
+        created_++;
+      }
+
+      OrthancPluginMemoryBuffer buffer;
+      buffer.data = malloc(size_);
+      buffer.size = static_cast<uint32_t>(size_);
+
+      MemoryBuffer file;
+      file.Assign(buffer);
+      return new TranscodedInstancesCache::CachedInstance(file, UncompressedFramesIndex());
+    }
+  };
+
+
+  struct AcquireResult
+  {
+    TranscodedInstancesCache::InstancePtr  instance_;
+    bool                                   isFailure_;
+
+    AcquireResult() :
+      isFailure_(false)
+    {
+    }
+  };
+
+
+  void AcquireInThread(TranscodedInstancesCache* cache,
+                       FakeInstanceFactory* factory,
+                       std::string orthancId,
+                       AcquireResult* result)
+  {
+    try
+    {
+      result->instance_ = cache->Acquire(orthancId, Orthanc::DicomTransferSyntax_LittleEndianExplicit, *factory);
+    }
+    catch (Orthanc::OrthancException&)
+    {
+      result->isFailure_ = true;
+    }
+  }
+}
+
+
+static const Orthanc::DicomTransferSyntax TEST_SYNTAX = Orthanc::DicomTransferSyntax_LittleEndianExplicit;
+
+
+TEST(TranscodedInstancesCache, Coalescing)
+{
+  FakePluginContext context;
+  TranscodedInstancesCache cache;
+  cache.SetLimits(1000, 0);
+
+  FakeInstanceFactory factory(10);
+  factory.SetBlocking(true);
+
+  std::vector<AcquireResult> results(5);
+  std::vector<boost::shared_ptr<boost::thread> > threads(results.size());
+
+  for (size_t i = 0; i < threads.size(); i++)
+  {
+    threads[i].reset(new boost::thread(AcquireInThread, &cache, &factory, "a", &results[i]));
+  }
+
+  factory.WaitStarted(1);
+  ASSERT_TRUE(cache.LookupLoaded("a", TEST_SYNTAX).get() == NULL);  // Being loaded
+  boost::this_thread::sleep(boost::posix_time::milliseconds(50));   // Let the other threads wait
+  factory.SetBlocking(false);
+
+  for (size_t i = 0; i < threads.size(); i++)
+  {
+    threads[i]->join();
+  }
+
+  // Whatever the scheduling, the instance is only loaded once
+  ASSERT_EQ(1u, factory.GetStartedCount());
+
+  for (size_t i = 0; i < results.size(); i++)
+  {
+    ASSERT_FALSE(results[i].isFailure_);
+    ASSERT_TRUE(results[i].instance_.get() != NULL);
+    ASSERT_EQ(results[0].instance_.get(), results[i].instance_.get());
+  }
+
+  ASSERT_EQ(results[0].instance_.get(), cache.LookupLoaded("a", TEST_SYNTAX).get());
+  ASSERT_TRUE(cache.LookupLoaded("a", Orthanc::DicomTransferSyntax_LittleEndianImplicit).get() == NULL);
+}
+
+
+TEST(TranscodedInstancesCache, Failure)
+{
+  FakePluginContext context;
+  TranscodedInstancesCache cache;
+  cache.SetLimits(1000, 0);
+
+  {
+    FakeInstanceFactory failing(10);
+    failing.SetFailure(true);
+    ASSERT_THROW(cache.Acquire("a", TEST_SYNTAX, failing), Orthanc::OrthancException);
+    ASSERT_TRUE(cache.LookupLoaded("a", TEST_SYNTAX).get() == NULL);
+  }
+
+  {
+    // A thread waiting for a failing load, loads the instance by itself
+    FakeInstanceFactory failing(10);
+    failing.SetFailure(true);
+    failing.SetBlocking(true);
+
+    AcquireResult first;
+    boost::thread thread1(AcquireInThread, &cache, &failing, "a", &first);
+    failing.WaitStarted(1);
+
+    FakeInstanceFactory working(10);
+    AcquireResult second;
+    boost::thread thread2(AcquireInThread, &cache, &working, "a", &second);
+
+    boost::this_thread::sleep(boost::posix_time::milliseconds(50));
+    ASSERT_EQ(0u, working.GetStartedCount());  // Waiting for the first thread
+    failing.SetBlocking(false);
+
+    thread1.join();
+    thread2.join();
+
+    ASSERT_TRUE(first.isFailure_);
+    ASSERT_FALSE(second.isFailure_);
+    ASSERT_TRUE(second.instance_.get() != NULL);
+    ASSERT_EQ(1u, working.GetCreatedCount());
+    ASSERT_EQ(second.instance_.get(), cache.LookupLoaded("a", TEST_SYNTAX).get());
+  }
+}
+
+
+TEST(TranscodedInstancesCache, InvalidateWhileLoading)
+{
+  FakePluginContext context;
+  TranscodedInstancesCache cache;
+  cache.SetLimits(1000, 0);
+
+  FakeInstanceFactory factory(10);
+  factory.SetBlocking(true);
+
+  AcquireResult result;
+  boost::thread thread(AcquireInThread, &cache, &factory, "a", &result);
+  factory.WaitStarted(1);
+
+  cache.Invalidate("a");
+  factory.SetBlocking(false);
+  thread.join();
+
+  // The instance is given to the caller, but not kept in the cache
+  ASSERT_FALSE(result.isFailure_);
+  ASSERT_TRUE(result.instance_.get() != NULL);
+  ASSERT_TRUE(cache.LookupLoaded("a", TEST_SYNTAX).get() == NULL);
+
+  TranscodedInstancesCache::InstancePtr reloaded = cache.Acquire("a", TEST_SYNTAX, factory);
+  ASSERT_EQ(2u, factory.GetCreatedCount());
+  ASSERT_NE(result.instance_.get(), reloaded.get());
+  ASSERT_EQ(reloaded.get(), cache.LookupLoaded("a", TEST_SYNTAX).get());
+
+  cache.Invalidate("a");
+  ASSERT_TRUE(cache.LookupLoaded("a", TEST_SYNTAX).get() == NULL);
+}
+
+
+TEST(TranscodedInstancesCache, Eviction)
+{
+  FakePluginContext context;
+  TranscodedInstancesCache cache;
+
+  FakeInstanceFactory factory(40);
+
+  // Size limit
+  cache.SetLimits(100, 0);
+
+  TranscodedInstancesCache::InstancePtr a = cache.Acquire("a", TEST_SYNTAX, factory);
+  cache.Acquire("b", TEST_SYNTAX, factory);
+  ASSERT_TRUE(cache.LookupLoaded("a", TEST_SYNTAX).get() != NULL);  // "b" becomes the oldest
+  cache.Acquire("c", TEST_SYNTAX, factory);
+
+  ASSERT_EQ(a.get(), cache.LookupLoaded("a", TEST_SYNTAX).get());
+  ASSERT_TRUE(cache.LookupLoaded("b", TEST_SYNTAX).get() == NULL);
+  ASSERT_TRUE(cache.LookupLoaded("c", TEST_SYNTAX).get() != NULL);
+
+  // An instance that is evicted while in use remains valid for its users
+  cache.Acquire("d", TEST_SYNTAX, factory);
+  ASSERT_TRUE(cache.LookupLoaded("a", TEST_SYNTAX).get() == NULL);
+  ASSERT_EQ(40u, a->GetSize());
+  ASSERT_TRUE(a->IsUncompressed());
+  ASSERT_EQ(0u, a->GetFramesCount());
+
+  // Count limit
+  cache.Clear();
+  cache.SetLimits(1000, 2);
+  cache.Acquire("a", TEST_SYNTAX, factory);
+  cache.Acquire("b", TEST_SYNTAX, factory);
+  cache.Acquire("c", TEST_SYNTAX, factory);
+  ASSERT_TRUE(cache.LookupLoaded("a", TEST_SYNTAX).get() == NULL);
+  ASSERT_TRUE(cache.LookupLoaded("b", TEST_SYNTAX).get() != NULL);
+  ASSERT_TRUE(cache.LookupLoaded("c", TEST_SYNTAX).get() != NULL);
+
+  // Shrinking the cache
+  cache.SetLimits(1000, 1);
+  ASSERT_TRUE(cache.LookupLoaded("b", TEST_SYNTAX).get() == NULL);
+  ASSERT_TRUE(cache.LookupLoaded("c", TEST_SYNTAX).get() != NULL);
+}
+
+
+TEST(TranscodedInstancesCache, Lingering)
+{
+  FakePluginContext context;
+  TranscodedInstancesCache cache;
+
+  FakeInstanceFactory large(200);
+
+  {
+    // Cache disabled: The instance is shared while in use, but doesn't linger
+    cache.SetLimits(0, 0);
+    cache.SetCoalescingWindow(1000);
+
+    TranscodedInstancesCache::InstancePtr a = cache.Acquire("a", TEST_SYNTAX, large);
+    ASSERT_EQ(a.get(), cache.LookupLoaded("a", TEST_SYNTAX).get());
+    ASSERT_EQ(a.get(), cache.Acquire("a", TEST_SYNTAX, large).get());
+    ASSERT_EQ(1u, large.GetCreatedCount());
+  }
+
+  ASSERT_TRUE(cache.LookupLoaded("a", TEST_SYNTAX).get() == NULL);
+
+  {
+    // Instance larger than the cache: It lingers during the coalescing window
+    cache.SetLimits(100, 0);
+    cache.SetCoalescingWindow(50);
+    cache.Acquire("a", TEST_SYNTAX, large);
+  }
+
+  ASSERT_TRUE(cache.LookupLoaded("a", TEST_SYNTAX).get() != NULL);
+  boost::this_thread::sleep(boost::posix_time::milliseconds(100));
+  ASSERT_TRUE(cache.LookupLoaded("a", TEST_SYNTAX).get() == NULL);
+
+  {
+    // The lingering instances are bounded by the limits of the cache,
+    // but the last one is always kept
+    cache.SetCoalescingWindow(10000);
+    cache.Acquire("a", TEST_SYNTAX, large);
+    cache.Acquire("b", TEST_SYNTAX, large);
+  }
+
+  ASSERT_TRUE(cache.LookupLoaded("a", TEST_SYNTAX).get() == NULL);
+  ASSERT_TRUE(cache.LookupLoaded("b", TEST_SYNTAX).get() != NULL);
+
+  cache.Invalidate("b");
+  ASSERT_TRUE(cache.LookupLoaded("b", TEST_SYNTAX).get() == NULL);
+
+  // Disabling the window drops the lingering instances
+  cache.Acquire("c", TEST_SYNTAX, large);
+  ASSERT_TRUE(cache.LookupLoaded("c", TEST_SYNTAX).get() != NULL);
+  cache.SetCoalescingWindow(0);
+  ASSERT_TRUE(cache.LookupLoaded("c", TEST_SYNTAX).get() == NULL);
+}
+
+
+TEST(QidoResultsCache, Basic)
+{
+  OrthancPlugins::QidoResultsCache cache;
+  ASSERT_FALSE(cache.IsEnabled());
+
+  std::map<std::string, std::string> headers;
+  headers["Authorization"] = "Bearer a";
+  headers["User-Agent"] = "Firefox";
+
+  const std::string key = OrthancPlugins::QidoResultsCache::ComputeKey("{\"Level\":\"Study\"}", "http://localhost/", headers);
+
+  headers["User-Agent"] = "Chrome";
+  ASSERT_EQ(key, OrthancPlugins::QidoResultsCache::ComputeKey("{\"Level\":\"Study\"}", "http://localhost/", headers));
+
+  headers["Authorization"] = "Bearer b";
+  const std::string other = OrthancPlugins::QidoResultsCache::ComputeKey("{\"Level\":\"Study\"}", "http://localhost/", headers);
+  ASSERT_NE(key, other);
+  ASSERT_NE(key, OrthancPlugins::QidoResultsCache::ComputeKey("{\"Level\":\"Study\"}", "http://remote/", headers));
+
+  std::string answer;
+  cache.Store(key, "[1]", cache.GetGeneration(), boost::posix_time::milliseconds(5));
+  ASSERT_FALSE(cache.Lookup(answer, key));  // Disabled
+
+  cache.SetParameters(10, 60);
+  ASSERT_TRUE(cache.IsEnabled());
+
+  cache.Store(key, "[1]", cache.GetGeneration(), boost::posix_time::milliseconds(5));
+  cache.Store(other, "[12345678901]", cache.GetGeneration(), boost::posix_time::milliseconds(5));  // Too large
+  ASSERT_EQ(1u, cache.GetSize());
+  ASSERT_EQ(3u, cache.GetMemoryUsage());
+
+  ASSERT_TRUE(cache.Lookup(answer, key));
+  ASSERT_EQ("[1]", answer);
+  ASSERT_FALSE(cache.Lookup(answer, other));
+
+  // A change that occurs during the computation prevents the storage
+  const uint64_t generation = cache.GetGeneration();
+  cache.Invalidate();
+  ASSERT_EQ(0u, cache.GetSize());
+  ASSERT_FALSE(cache.Lookup(answer, key));
+  cache.Store(key, "[2]", generation, boost::posix_time::milliseconds(5));
+  ASSERT_FALSE(cache.Lookup(answer, key));
+  cache.Store(key, "[2]", cache.GetGeneration(), boost::posix_time::milliseconds(5));
+  ASSERT_TRUE(cache.Lookup(answer, key));
+  ASSERT_EQ("[2]", answer);
+
+  // LRU eviction
+  cache.Store(other, "[3456]", cache.GetGeneration(), boost::posix_time::milliseconds(5));
+  ASSERT_TRUE(cache.Lookup(answer, other));
+  cache.Store("third", "[7]", cache.GetGeneration(), boost::posix_time::milliseconds(5));
+  ASSERT_EQ(2u, cache.GetSize());
+  ASSERT_FALSE(cache.Lookup(answer, key));
+  ASSERT_TRUE(cache.Lookup(answer, other));
+  ASSERT_TRUE(cache.Lookup(answer, "third"));
+
+  uint64_t hits, misses, savedTime;
+  cache.GetStatistics(hits, misses, savedTime);
+  ASSERT_EQ(5u, hits);
+  ASSERT_EQ(5u, misses);
+  ASSERT_EQ(25000u, savedTime);
+
+  cache.SetParameters(10, 0);
+  ASSERT_FALSE(cache.IsEnabled());
+  ASSERT_EQ(0u, cache.GetSize());
+}
+
+
+TEST(RenderedFramesCache, Basic)
+{
+  ASSERT_NE(RenderedFramesCache::ComputeKey("a", 1, "image/jpeg", ""),
+            RenderedFramesCache::ComputeKey("a", 2, "image/jpeg", ""));
+  ASSERT_NE(RenderedFramesCache::ComputeKey("a", 1, "image/jpeg", ""),
+            RenderedFramesCache::ComputeKey("a", 1, "image/png", ""));
+  ASSERT_NE(RenderedFramesCache::ComputeKey("a", 1, "image/jpeg", ""),
+            RenderedFramesCache::ComputeKey("a", 1, "image/jpeg", "quality=50"));
+
+  const std::string etag = RenderedFramesCache::ComputeETag("hello");
+  ASSERT_EQ('"', etag[0]);
+  ASSERT_EQ('"', etag[etag.size() - 1]);
+  ASSERT_NE(etag, RenderedFramesCache::ComputeETag("world"));
+
+  ASSERT_TRUE(RenderedFramesCache::MatchesETag(etag, etag));
+  ASSERT_TRUE(RenderedFramesCache::MatchesETag("*", etag));
+  ASSERT_TRUE(RenderedFramesCache::MatchesETag("\"nope\", W/" + etag, etag));
+  ASSERT_FALSE(RenderedFramesCache::MatchesETag("\"nope\"", etag));
+  ASSERT_FALSE(RenderedFramesCache::MatchesETag("", etag));
+
+  RenderedFramesCache cache;
+  ASSERT_FALSE(cache.IsEnabled());
+
+  const std::string a1 = RenderedFramesCache::ComputeKey("a", 1, "image/jpeg", "");
+  const std::string a2 = RenderedFramesCache::ComputeKey("a", 2, "image/jpeg", "");
+  const std::string b1 = RenderedFramesCache::ComputeKey("b", 1, "image/jpeg", "");
+
+  ASSERT_EQ(etag, cache.Store(a1, "hello"));  // Not stored, as the cache is disabled
+  ASSERT_EQ(0u, cache.GetSize());
+
+  cache.SetMaxSize(10);
+  ASSERT_TRUE(cache.IsEnabled());
+
+  std::string content, e;
+  ASSERT_FALSE(cache.Lookup(content, e, a1));
+
+  cache.Store(a1, "hello");
+  cache.Store(a2, "abc");
+  ASSERT_TRUE(cache.Lookup(content, e, a1));  // "a1" becomes the most recently used
+  ASSERT_EQ("hello", content);
+  ASSERT_EQ(etag, e);
+  ASSERT_EQ(8u, cache.GetMemoryUsage());
+
+  cache.Store(b1, "xyz");  // Evicts "a2"
+  ASSERT_EQ(2u, cache.GetSize());
+  ASSERT_EQ(8u, cache.GetMemoryUsage());
+  ASSERT_FALSE(cache.Lookup(content, e, a2));
+
+  cache.Store(b1, "0123456789a");  // Too large, not stored
+  ASSERT_EQ(2u, cache.GetSize());
+
+  cache.Invalidate("a");
+  ASSERT_EQ(1u, cache.GetSize());
+  ASSERT_FALSE(cache.Lookup(content, e, a1));
+  ASSERT_TRUE(cache.Lookup(content, e, b1));
+  ASSERT_EQ("xyz", content);
+
+  cache.CountNotModified();
+
+  uint64_t hits, misses, notModified;
+  cache.GetStatistics(hits, misses, notModified);
+  ASSERT_EQ(2u, hits);
+  ASSERT_EQ(3u, misses);
+  ASSERT_EQ(1u, notModified);
+
+  cache.Clear();
+  ASSERT_EQ(0u, cache.GetSize());
+  ASSERT_EQ(0u, cache.GetMemoryUsage());
+}
+
+
+static void FillTestImage(Orthanc::ImageAccessor& image,
+                          int minValue,
+                          int maxValue)
+{
+  // Deterministic pseudo-random content in the range [minValue, maxValue]
+  uint32_t seed = 42;
+
+  for (unsigned int y = 0; y < image.GetHeight(); y++)
+  {
+    for (unsigned int x = 0; x < image.GetWidth(); x++)
+    {
+      seed = seed * 1103515245u + 12345u;
+      const int value = minValue + static_cast<int>((seed >> 8) % static_cast<uint32_t>(maxValue - minValue + 1));
+
+      void* pixel = reinterpret_cast<uint8_t*>(image.GetRow(y)) + x * image.GetBytesPerPixel();
+
+      switch (image.GetFormat())
+      {
+        case Orthanc::PixelFormat_Grayscale8:
+          *reinterpret_cast<uint8_t*>(pixel) = static_cast<uint8_t>(value);
+          break;
+
+        case Orthanc::PixelFormat_Grayscale16:
+          *reinterpret_cast<uint16_t*>(pixel) = static_cast<uint16_t>(value);
+          break;
+
+        case Orthanc::PixelFormat_SignedGrayscale16:
+          *reinterpret_cast<int16_t*>(pixel) = static_cast<int16_t>(value);
+          break;
+
+        case Orthanc::PixelFormat_Float32:
+          *reinterpret_cast<float*>(pixel) = static_cast<float>(value);
+          break;
+
+        default:
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_NotImplemented);
+      }
+    }
+  }
+}
+
+
+static bool IsSameImage(const Orthanc::ImageAccessor& a,
+                        const Orthanc::ImageAccessor& b)
+{
+  for (unsigned int y = 0; y < a.GetHeight(); y++)
+  {
+    if (memcmp(a.GetConstRow(y), b.GetConstRow(y), a.GetWidth() * a.GetBytesPerPixel()) != 0)
+    {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+
+TEST(RenderingKernels, LookupTable)
+{
+  const WindowingMode modes[] = {
+    WindowingMode_WholeDynamics,
+    WindowingMode_Linear,
+    WindowingMode_LinearExact,
+    WindowingMode_Sigmoid
+  };
+
+  struct Source
+  {
+    Orthanc::PixelFormat  format_;
+    int                   minValue_;
+    int                   maxValue_;
+  };
+
+  const Source sources[] = {
+    { Orthanc::PixelFormat_Grayscale8, 0, 255 },
+    { Orthanc::PixelFormat_Grayscale8, 10, 20 },
+    { Orthanc::PixelFormat_Grayscale16, 0, 4095 },
+    { Orthanc::PixelFormat_Grayscale16, 0, 65535 },   // Larger than the image, no lookup table
+    { Orthanc::PixelFormat_SignedGrayscale16, -1024, 3071 },
+    { Orthanc::PixelFormat_SignedGrayscale16, -32768, 32767 },
+    { Orthanc::PixelFormat_Float32, -1024, 3071 }
+  };
+
+  for (size_t i = 0; i < sizeof(sources) / sizeof(Source); i++)
+  {
+    Orthanc::Image source(sources[i].format_, 97, 61, false);
+    FillTestImage(source, sources[i].minValue_, sources[i].maxValue_);
+
+    for (size_t j = 0; j < sizeof(modes) / sizeof(WindowingMode); j++)
+    {
+      Orthanc::Image expected(Orthanc::PixelFormat_Grayscale8, 97, 61, false);
+      Orthanc::Image actual(Orthanc::PixelFormat_Grayscale8, 97, 61, false);
+
+      RenderingKernels::ApplyWindowing(expected, source, 40, 400, modes[j], 1.5f, -1024, false);
+      RenderingKernels::ApplyWindowing(actual, source, 40, 400, modes[j], 1.5f, -1024, true);
+      ASSERT_TRUE(IsSameImage(expected, actual));
+    }
+  }
+
+  {
+    Orthanc::Image source(Orthanc::PixelFormat_Grayscale16, 2, 1, false);
+    reinterpret_cast<uint16_t*>(source.GetRow(0))[0] = 100;
+    reinterpret_cast<uint16_t*>(source.GetRow(0))[1] = 300;
+
+    Orthanc::Image target(Orthanc::PixelFormat_Grayscale8, 2, 1, false);
+    RenderingKernels::ApplyWindowing(target, source, 200, 100, WindowingMode_Linear, 1, 0);
+    ASSERT_EQ(0, reinterpret_cast<const uint8_t*>(target.GetConstRow(0))[0]);
+    ASSERT_EQ(255, reinterpret_cast<const uint8_t*>(target.GetConstRow(0))[1]);
+
+    RenderingKernels::ApplyWindowing(target, source, 200, 100, WindowingMode_WholeDynamics, 1, 0);
+    ASSERT_EQ(0, reinterpret_cast<const uint8_t*>(target.GetConstRow(0))[0]);
+    ASSERT_EQ(255, reinterpret_cast<const uint8_t*>(target.GetConstRow(0))[1]);
+
+    Orthanc::Image tooSmall(Orthanc::PixelFormat_Grayscale8, 1, 1, false);
+    ASSERT_THROW(RenderingKernels::ApplyWindowing(tooSmall, source, 200, 100, WindowingMode_Linear, 1, 0),
+                 Orthanc::OrthancException);
+  }
+}
+
+
+namespace
+{
+  class PartsCollector : public StreamingMultipartParser::IHandler
+  {
+  private:
+    std::vector<StreamingMultipartParser::HttpHeaders>  headers_;
+    std::vector<std::string>                            contents_;
+    bool                                                inPart_;
+
+  public:
+    PartsCollector() :
+      inPart_(false)
+    {
+    }
+
+    virtual void StartPart(const StreamingMultipartParser::HttpHeaders& headers) ORTHANC_OVERRIDE
+    {
+      ASSERT_FALSE(inPart_);
+      inPart_ = true;
+      headers_.push_back(headers);
+      contents_.push_back("");
+    }
+
+    virtual void AddPartContent(const void* data,
+                                size_t size) ORTHANC_OVERRIDE
+    {
+      ASSERT_TRUE(inPart_);
+      ASSERT_GT(size, 0u);
+      contents_.back().append(reinterpret_cast<const char*>(data), size);
+    }
+
+    virtual void EndPart() ORTHANC_OVERRIDE
+    {
+      ASSERT_TRUE(inPart_);
+      inPart_ = false;
+    }
+
+    size_t GetCount() const
+    {
+      return contents_.size();
+    }
+
+    const StreamingMultipartParser::HttpHeaders& GetHeaders(size_t i) const
+    {
+      return headers_[i];
+    }
+
+    const std::string& GetContent(size_t i) const
+    {
+      return contents_[i];
+    }
+  };
+}
+
+
+TEST(StreamingMultipartParser, Basic)
+{
+  const std::string body = ("This is a preamble\r\n"
+                            "--BOUNDARY  \r\n"
+                            "Content-Type: Application/DICOM\r\n"
+                            "X-Test:  value \r\n"
+                            "\r\n"
+                            "hello\r\n--BOUND\r\nworld\r\n"
+                            "--BOUNDARY\r\n"
+                            "\r\n"
+                            "\r\n"
+                            "--BOUNDARY\r\n"
+                            "Content-Type: text/plain\r\n"
+                            "\r\n"
+                            "--BOUNDARYX--BOUNDARY"
+                            "\r\n--BOUNDARY--\r\n"
+                            "This is an epilogue\r\n--BOUNDARY\r\n");
+
+  // Feed the body using all the possible sizes of chunks
+  for (size_t chunk = 1; chunk <= body.size(); chunk++)
+  {
+    PartsCollector collector;
+
+    {
+      StreamingMultipartParser parser(collector, "BOUNDARY");
+
+      for (size_t pos = 0; pos < body.size(); pos += chunk)
+      {
+        parser.AddChunk(body.c_str() + pos, std::min(chunk, body.size() - pos));
+      }
+
+      ASSERT_TRUE(parser.IsDone());
+      parser.CloseStream();
+    }
+
+    ASSERT_EQ(3u, collector.GetCount());
+
+    ASSERT_EQ(2u, collector.GetHeaders(0).size());
+    ASSERT_EQ("Application/DICOM", collector.GetHeaders(0).find("content-type")->second);
+    ASSERT_EQ("value", collector.GetHeaders(0).find("x-test")->second);
+    ASSERT_EQ("hello\r\n--BOUND\r\nworld", collector.GetContent(0));
+
+    ASSERT_TRUE(collector.GetHeaders(1).empty());
+    ASSERT_TRUE(collector.GetContent(1).empty());
+
+    ASSERT_EQ(1u, collector.GetHeaders(2).size());
+    ASSERT_EQ("--BOUNDARYX--BOUNDARY", collector.GetContent(2));
+  }
+}
+
+
+TEST(StreamingMultipartParser, NoPreamble)
+{
+  const std::string body = "--b\r\n\r\nab\r\n--b--";
+
+  PartsCollector collector;
+  StreamingMultipartParser parser(collector, "b");
+  parser.AddChunk(body.c_str(), body.size());
+  ASSERT_TRUE(parser.IsDone());
+
+  ASSERT_EQ(1u, collector.GetCount());
+  ASSERT_EQ("ab", collector.GetContent(0));
+}
+
+
+TEST(SpillableBuffer, Basic)
+{
+  {
+    SpillableBuffer buffer(0);
+    buffer.Append("hello", 5);
+    buffer.Append(NULL, 0);
+    buffer.Append(" world", 6);
+    ASSERT_FALSE(buffer.IsSpilled());
+    ASSERT_EQ(11u, buffer.GetSize());
+    ASSERT_EQ("hello world", std::string(reinterpret_cast<const char*>(buffer.GetData()), buffer.GetSize()));
+  }
+
+  {
+    SpillableBuffer buffer(8);
+    ASSERT_EQ(NULL, buffer.GetData());
+    buffer.Append("hello", 5);
+    ASSERT_FALSE(buffer.IsSpilled());
+    buffer.Append(" world", 6);
+    ASSERT_TRUE(buffer.IsSpilled());
+    buffer.Append("!", 1);
+    ASSERT_EQ(12u, buffer.GetSize());
+    ASSERT_EQ("hello world!", std::string(reinterpret_cast<const char*>(buffer.GetData()), buffer.GetSize()));
+  }
+}
+
+
+namespace
+{
+  class ZipStringOutput : public ZipStreamWriter::IOutput
+  {
+  private:
+    std::string  content_;
+
+  public:
+    virtual void Write(const void* data,
+                       size_t size) ORTHANC_OVERRIDE
+    {
+      content_.append(reinterpret_cast<const char*>(data), size);
+    }
+
+    const std::string& GetContent() const
+    {
+      return content_;
+    }
+  };
+}
+
+static uint32_t ReadZipUInt32(const std::string& s,
+                              size_t offset)
+{
+  return (static_cast<uint32_t>(static_cast<uint8_t>(s[offset])) |
+          (static_cast<uint32_t>(static_cast<uint8_t>(s[offset + 1])) << 8) |
+          (static_cast<uint32_t>(static_cast<uint8_t>(s[offset + 2])) << 16) |
+          (static_cast<uint32_t>(static_cast<uint8_t>(s[offset + 3])) << 24));
+}
+
+static uint16_t ReadZipUInt16(const std::string& s,
+                              size_t offset)
+{
+  return static_cast<uint16_t>(static_cast<uint8_t>(s[offset]) |
+                               (static_cast<uint8_t>(s[offset + 1]) << 8));
+}
+
+TEST(ZipStreamWriter, Stored)
+{
+  ZipStringOutput output;
+
+  {
+    ZipStreamWriter writer(output, false);
+    writer.AddEntry("1.2.3/4.5/6.dcm", "hello", 5);
+    writer.AddEntry("empty", "");
+    ASSERT_THROW(writer.AddEntry("", "nope"), Orthanc::OrthancException);
+    writer.Close();
+    ASSERT_THROW(writer.AddEntry("late", "nope"), Orthanc::OrthancException);
+    ASSERT_EQ(2u, writer.GetEntriesCount());
+    ASSERT_EQ(output.GetContent().size(), writer.GetArchiveSize());
+  }
+
+  const std::string& zip = output.GetContent();
+
+  // Local file header of the first entry
+  ASSERT_EQ(0x04034b50u, ReadZipUInt32(zip, 0));
+  ASSERT_EQ(0u, ReadZipUInt16(zip, 8));  // Stored
+  ASSERT_EQ(static_cast<uint32_t>(crc32(0, reinterpret_cast<const Bytef*>("hello"), 5)), ReadZipUInt32(zip, 14));
+  ASSERT_EQ(5u, ReadZipUInt32(zip, 18));
+  ASSERT_EQ(5u, ReadZipUInt32(zip, 22));
+  ASSERT_EQ(15u, ReadZipUInt16(zip, 26));
+  ASSERT_EQ("1.2.3/4.5/6.dcm", zip.substr(30, 15));
+  ASSERT_EQ("hello", zip.substr(45, 5));
+
+  // End of central directory record, without ZIP64
+  ASSERT_GT(zip.size(), 22u);
+  const size_t end = zip.size() - 22;
+  ASSERT_EQ(0x06054b50u, ReadZipUInt32(zip, end));
+  ASSERT_EQ(2u, ReadZipUInt16(zip, end + 10));
+  const uint32_t directorySize = ReadZipUInt32(zip, end + 12);
+  const uint32_t directoryOffset = ReadZipUInt32(zip, end + 16);
+  ASSERT_EQ(end, directoryOffset + directorySize);
+  ASSERT_EQ(0x02014b50u, ReadZipUInt32(zip, directoryOffset));
+  ASSERT_EQ(0u, ReadZipUInt32(zip, directoryOffset + 42));  // Offset of the first entry
+}
+
+TEST(ZipStreamWriter, Deflate)
+{
+  const std::string source(100000, 'a');
+
+  ZipStringOutput output;
+
+  {
+    ZipStreamWriter writer(output, true);
+    writer.AddEntry("a", source);
+    writer.AddEntry("b", "x");  // Not compressible
+    writer.Close();
+  }
+
+  const std::string& zip = output.GetContent();
+
+  ASSERT_EQ(8u, ReadZipUInt16(zip, 8));  // Deflate
+  const uint32_t compressedSize = ReadZipUInt32(zip, 18);
+  ASSERT_LT(compressedSize, 1000u);
+  ASSERT_EQ(source.size(), ReadZipUInt32(zip, 22));
+
+  std::string uncompressed(source.size(), '\0');
+
+  z_stream stream;
+  memset(&stream, 0, sizeof(stream));
+  ASSERT_EQ(Z_OK, inflateInit2(&stream, -MAX_WBITS));
+  stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(zip.c_str() + 31));
+  stream.avail_in = compressedSize;
+  stream.next_out = reinterpret_cast<Bytef*>(&uncompressed[0]);
+  stream.avail_out = static_cast<uInt>(uncompressed.size());
+  ASSERT_EQ(Z_STREAM_END, inflate(&stream, Z_FINISH));
+  inflateEnd(&stream);
+  ASSERT_EQ(source, uncompressed);
+
+  const size_t second = 31 + compressedSize;
+  ASSERT_EQ(0x04034b50u, ReadZipUInt32(zip, second));
+  ASSERT_EQ(0u, ReadZipUInt16(zip, second + 8));  // Stored
+}
+
+TEST(ZipStreamWriter, Zip64)
+{
+  ZipStringOutput output;
+
+  {
+    ZipStreamWriter writer(output, false);
+    for (unsigned int i = 0; i < 70000; i++)
+    {
+      writer.AddEntry(boost::lexical_cast<std::string>(i), "x");
+    }
+    writer.Close();
+  }
+
+  const std::string& zip = output.GetContent();
+
+  const size_t end = zip.size() - 22;
+  ASSERT_EQ(0x06054b50u, ReadZipUInt32(zip, end));
+  ASSERT_EQ(0xffffu, ReadZipUInt16(zip, end + 10));
+
+  // ZIP64 end of central directory locator, then record
+  ASSERT_EQ(0x07064b50u, ReadZipUInt32(zip, end - 20));
+  const size_t zip64End = ReadZipUInt32(zip, end - 12);
+  ASSERT_EQ(end - 20 - 56, zip64End);
+  ASSERT_EQ(0x06064b50u, ReadZipUInt32(zip, zip64End));
+  ASSERT_EQ(70000u, ReadZipUInt32(zip, zip64End + 32));
+}
+
+
+TEST(HttpByteRange, Parse)
+{
+  uint64_t first, last;
+
+  ASSERT_EQ(HttpByteRange::Result_Satisfiable, HttpByteRange::Parse(first, last, "bytes=0-99", 1000));
+  ASSERT_EQ(0u, first);
+  ASSERT_EQ(99u, last);
+
+  ASSERT_EQ(HttpByteRange::Result_Satisfiable, HttpByteRange::Parse(first, last, " Bytes = 900- ", 1000));
+  ASSERT_EQ(900u, first);
+  ASSERT_EQ(999u, last);
+
+  ASSERT_EQ(HttpByteRange::Result_Satisfiable, HttpByteRange::Parse(first, last, "bytes=500-5000", 1000));
+  ASSERT_EQ(500u, first);
+  ASSERT_EQ(999u, last);
+
+  ASSERT_EQ(HttpByteRange::Result_Satisfiable, HttpByteRange::Parse(first, last, "bytes=-10", 1000));
+  ASSERT_EQ(990u, first);
+  ASSERT_EQ(999u, last);
+
+  ASSERT_EQ(HttpByteRange::Result_Satisfiable, HttpByteRange::Parse(first, last, "bytes=-5000", 1000));
+  ASSERT_EQ(0u, first);
+  ASSERT_EQ(999u, last);
+
+  ASSERT_EQ(HttpByteRange::Result_Unsatisfiable, HttpByteRange::Parse(first, last, "bytes=1000-", 1000));
+  ASSERT_EQ(HttpByteRange::Result_Unsatisfiable, HttpByteRange::Parse(first, last, "bytes=-0", 1000));
+  ASSERT_EQ(HttpByteRange::Result_Unsatisfiable, HttpByteRange::Parse(first, last, "bytes=0-", 0));
+
+  ASSERT_EQ(HttpByteRange::Result_Ignored, HttpByteRange::Parse(first, last, "", 1000));
+  ASSERT_EQ(HttpByteRange::Result_Ignored, HttpByteRange::Parse(first, last, "items=0-10", 1000));
+  ASSERT_EQ(HttpByteRange::Result_Ignored, HttpByteRange::Parse(first, last, "bytes=10-5", 1000));
+  ASSERT_EQ(HttpByteRange::Result_Ignored, HttpByteRange::Parse(first, last, "bytes=0-10,20-30", 1000));
+  ASSERT_EQ(HttpByteRange::Result_Ignored, HttpByteRange::Parse(first, last, "bytes=a-10", 1000));
+  ASSERT_EQ(HttpByteRange::Result_Ignored, HttpByteRange::Parse(first, last, "bytes=-", 1000));
+  ASSERT_EQ(HttpByteRange::Result_Ignored, HttpByteRange::Parse(first, last, "bytes=99999999999999999999-", 1000));
+
+  ASSERT_EQ("bytes 0-99/1000", HttpByteRange::FormatContentRange(0, 99, 1000));
+  ASSERT_EQ("bytes */1000", HttpByteRange::FormatUnsatisfiedRange(1000));
+}
+
+
+TEST(BulkDataCache, Basic)
+{
+  BulkDataCache cache;
+
+  BulkDataCache::FilePtr a(new std::string(10, 'a'));
+  BulkDataCache::FilePtr b(new std::string(10, 'b'));
+
+  DicomHeaderScanner::ElementLocation location;
+  location.offset_ = 4;
+  location.length_ = 2;
+
+  // Disabled cache: The locations are still indexed
+  cache.StoreFile("a", a);
+  ASSERT_EQ(NULL, cache.LookupFile("a").get());
+  cache.StoreLocation("big", "7FE00010", location);
+  ASSERT_TRUE(cache.LookupLocation(location, "big", "7FE00010"));
+  ASSERT_GT(cache.GetIndexMemoryUsage(), 0u);
+
+  cache.SetMaxSize(25);
+  cache.StoreFile("a", a);
+  cache.StoreFile("b", b);
+  cache.StoreFile("big", BulkDataCache::FilePtr(new std::string(30, 'c')));
+  ASSERT_EQ(2u, cache.GetSize());
+  ASSERT_EQ(20u, cache.GetMemoryUsage());
+  ASSERT_EQ(a.get(), cache.LookupFile("a").get());
+  ASSERT_EQ(NULL, cache.LookupFile("big").get());
+  ASSERT_TRUE(cache.LookupLocation(location, "big", "7FE00010"));
+
+  cache.StoreLocation("a", "7FE00010", location);
+
+  DicomHeaderScanner::ElementLocation found;
+  ASSERT_TRUE(cache.LookupLocation(found, "a", "7FE00010"));
+  ASSERT_EQ(4u, found.offset_);
+  ASSERT_EQ(2u, found.length_);
+  ASSERT_FALSE(cache.LookupLocation(found, "a", "00691010"));
+  ASSERT_FALSE(cache.LookupLocation(found, "b", "7FE00010"));
+
+  // "b" is the least recently used
+  cache.StoreFile("c", BulkDataCache::FilePtr(new std::string(10, 'c')));
+  ASSERT_EQ(NULL, cache.LookupFile("b").get());
+  ASSERT_TRUE(cache.LookupFile("a").get() != NULL);
+  ASSERT_TRUE(cache.LookupFile("c").get() != NULL);
+
+  // The index is kept when the file is evicted, but not when the instance is invalidated
+  cache.StoreLocation("b", "7FE00010", location);
+  ASSERT_TRUE(cache.LookupLocation(found, "b", "7FE00010"));
+  cache.Invalidate("a");
+  ASSERT_EQ(NULL, cache.LookupFile("a").get());
+  ASSERT_FALSE(cache.LookupLocation(found, "a", "7FE00010"));
+  ASSERT_EQ(1u, cache.GetSize());
+
+  uint64_t hits, misses;
+  cache.GetStatistics(hits, misses);
+  ASSERT_EQ(3u, hits);
+  ASSERT_EQ(4u, misses);
+
+  // The index has its own budget, evicting the least recently used instances
+  const size_t indexSize = cache.GetIndexMemoryUsage();
+  ASSERT_GT(indexSize, 0u);
+  cache.SetMaxIndexSize(indexSize / 2);  // Two equally-sized instances are indexed: "big" and "b"
+  ASSERT_TRUE(cache.LookupLocation(found, "b", "7FE00010"));
+  ASSERT_FALSE(cache.LookupLocation(found, "big", "7FE00010"));
+  ASSERT_EQ(indexSize / 2, cache.GetIndexMemoryUsage());
+
+  // A location that is larger than the index is ignored
+  location.isEncapsulated_ = true;
+  location.fragments_.resize(indexSize);
+  cache.StoreLocation("d", "7FE00010", location);
+  ASSERT_FALSE(cache.LookupLocation(found, "d", "7FE00010"));
+
+  cache.Clear();
+  ASSERT_EQ(0u, cache.GetSize());
+  ASSERT_EQ(0u, cache.GetMemoryUsage());
+  ASSERT_EQ(0u, cache.GetIndexMemoryUsage());
+}
+
+
 int main(int argc, char **argv)
 {
   ::testing::InitGoogleTest(&argc, argv);